@@ -63,8 +63,8 @@ char *lighting_file[NUM_LIGHTING_TYPES] = {0};
 // Note that these are all the default values when no config variable is specified.
 bool combined_gu(0), underwater(0), kbd_text_mode(0), univ_stencil_shadows(1), use_waypoint_app_spots(0), enable_tiled_mesh_ao(0), tiled_terrain_only(0);
 bool show_lightning(0), disable_shader_effects(0), use_waypoints(0), group_back_face_cull(0), start_maximized(0), claim_planet(0), skip_light_vis_test(0);
-bool no_smoke_over_mesh(0), enable_model3d_tex_comp(0), global_lighting_update(0), lighting_update_offline(0), mesh_difuse_tex_comp(1), smoke_dlights(0), keep_keycards_on_death(0);
-bool texture_alpha_in_red_comp(0), use_model2d_tex_mipmaps(1), mt_cobj_tree_build(0), two_sided_lighting(0), inf_terrain_scenery(1), invert_model_nmap_bscale(0);
+bool no_smoke_over_mesh(0), enable_model3d_tex_comp(0), global_lighting_update(0), lighting_update_offline(0), deterministic_lighting(0), lighting_file_half_float(0), mesh_difuse_tex_comp(1), smoke_dlights(0), keep_keycards_on_death(0);
+bool texture_alpha_in_red_comp(0), use_model2d_tex_mipmaps(1), mt_cobj_tree_build(0), sah_cobj_tree_build(1), mt_obj_file_load(1), noise_benchmark(0), two_sided_lighting(0), inf_terrain_scenery(1), invert_model_nmap_bscale(0);
 bool gen_tree_roots(1), fast_water_reflect(0), vsync_enabled(0), use_voxel_cobjs(0), disable_sound(0), enable_depth_clamp(0), volume_lighting(0), no_subdiv_model(0);
 bool detail_normal_map(0), init_core_context(0), use_core_context(0), enable_multisample(1), dynamic_smap_bias(0), model3d_wn_normal(0), snow_shadows(0), user_action_key(0);
 bool enable_dlight_shadows(1), tree_indir_lighting(0), ctrl_key_pressed(0), only_pine_palm_trees(0), enable_gamma_correct(0), use_z_prepass(0), reflect_dodgeballs(0);
@@ -72,9 +72,9 @@ bool store_cobj_accum_lighting_as_blocked(0), all_model3d_ref_update(0), begin_m
 bool enable_model3d_bump_maps(1), use_obj_file_bump_grayscale(1), invert_bump_maps(0), use_interior_cube_map_refl(0), enable_cube_map_bump_maps(1), no_store_model_textures_in_memory(0);
 bool enable_model3d_custom_mipmaps(1), flatten_tt_mesh_under_models(0), show_map_view_mandelbrot(0), smileys_chase_player(0), disable_fire_delay(0), disable_recoil(0);
 bool enable_dpart_shadows(0), enable_tt_model_reflect(1), enable_tt_model_indir(0), auto_calc_tt_model_zvals(0), use_model_lod_blocks(0), enable_translocator(0), enable_grass_fire(0);
-bool disable_model_textures(0), start_in_inf_terrain(0), allow_shader_invariants(1), config_unlimited_weapons(0), disable_tt_water_reflect(0), allow_model3d_quads(1);
+bool disable_model_textures(0), start_in_inf_terrain(0), allow_shader_invariants(1), config_unlimited_weapons(0), disable_tt_water_reflect(0), allow_model3d_quads(1), model3d_file_compress(0);
 bool enable_timing_profiler(0), fast_transparent_spheres(0), force_ref_cmap_update(0), use_instanced_pine_trees(0), enable_postproc_recolor(0), draw_building_interiors(0);
-bool toggle_room_light(0), teleport_to_screenshot(0), merge_model_objects(0), display_frame_time(0), reverse_3ds_vert_winding_order(1), disable_dlights(0);
+bool toggle_room_light(0), teleport_to_screenshot(0), merge_model_objects(0), display_frame_time(0), reverse_3ds_vert_winding_order(1), disable_dlights(0), deterministic_erosion(0), tile_gen_force_cpu_noise(0);
 int xoff(0), yoff(0), xoff2(0), yoff2(0), rand_gen_index(0), mesh_rgen_index(0), camera_change(1), camera_in_air(0), auto_time_adv(0);
 int animate(1), animate2(1), draw_model(0), init_x(STARTING_INIT_X), fire_key(0), do_run(0), init_num_balls(-1), change_wmode_frame(0);
 int game_mode(0), map_mode(0), load_hmv(0), load_coll_objs(1), read_landscape(0), screen_reset(0), mesh_seed(0), rgen_seed(1);
@@ -92,7 +92,7 @@ int enable_fsource(0), run_forward(0), advanced(0), dynamic_mesh_scroll(0);
 int read_snow_file(0), write_snow_file(0), mesh_detail_tex(NOISE_TEX);
 int read_light_files[NUM_LIGHTING_TYPES] = {0}, write_light_files[NUM_LIGHTING_TYPES] = {0};
 unsigned num_snowflakes(0), create_voxel_landscape(0), hmap_filter_width(0), num_dynam_parts(100), snow_coverage_resolution(2), num_birds_per_tile(2), num_fish_per_tile(15);
-unsigned erosion_iters(0), erosion_iters_tt(0), video_framerate(60), num_video_threads(0), skybox_tid(0);
+unsigned erosion_iters(0), erosion_iters_tt(0), video_framerate(60), num_video_threads(0), num_tile_gen_threads(2), num_planet_gen_threads(1), planet_surface_cache_mb(64), building_light_cache_mb(64), building_light_prefetch_count(4), skybox_tid(0);
 float NEAR_CLIP(DEF_NEAR_CLIP), FAR_CLIP(DEF_FAR_CLIP), system_max_orbit(1.0), sky_occlude_scale(0.0), tree_slope_thresh(5.0), mouse_sensitivity(1.0), tt_grass_scale_factor(1.0);
 float water_plane_z(0.0), base_gravity(1.0), crater_depth(1.0), crater_radius(1.0), disabled_mesh_z(FAR_CLIP), vegetation(1.0), atmosphere(1.0), biome_x_offset(0.0);
 float mesh_file_scale(1.0), mesh_file_tz(0.0), speed_mult(1.0), mesh_z_cutoff(-FAR_CLIP), relh_adj_tex(0.0), dodgeball_metalness(1.0), ray_step_size_mult(1.0);
@@ -106,7 +106,7 @@ float model_hemi_lighting_scale(0.5), pine_tree_radius_scale(1.0), sunlight_brig
 float light_int_scale[NUM_LIGHTING_TYPES] = {1.0, 1.0, 1.0, 1.0, 1.0}, first_ray_weight[NUM_LIGHTING_TYPES] = {1.0, 1.0, 1.0, 1.0, 1.0};
 double camera_zh(0.0);
 point mesh_origin(all_zeros), camera_pos(all_zeros), cube_map_center(all_zeros);
-string user_text, cobjs_out_fn, sphere_materials_fn, hmap_out_fn, skybox_cube_map_name, coll_damage_name;
+string user_text, cobjs_out_fn, sphere_materials_fn, hmap_out_fn, skybox_cube_map_name, coll_damage_name, planet_surface_cache_dir, building_light_cache_dir;
 colorRGB ambient_lighting_scale(1,1,1), mesh_color_scale(1,1,1);
 colorRGBA bkg_color, flower_color(ALPHA0);
 set<unsigned char> keys, keyset;
@@ -170,6 +170,7 @@ void setup_linear_fog(colorRGBA const &color, float fog_end);
 void write_map_mode_heightmap_image();
 void apply_grass_scale();
 void take_screenshot_texture();
+void run_noise_benchmark();
 
 
 // all OpenGL error handling goes through these functions
@@ -237,6 +238,7 @@ void quit_3dworld() { // called once at the end for proper cleanup
 	cout << "quitting" << endl;
 	kill_current_raytrace_threads();
 	end_building_rt_job();
+	end_building_indir_light_prefetch();
 	clear_context();
 	exit_openal();
 
@@ -885,6 +887,8 @@ void keyboard_proc(unsigned char key, int x, int y) {
 	case 'f': // print framerate and stats
 		show_framerate = 1;
 		timing_profiler_stats();
+		show_cobj_tree_stats();
+		if (world_mode == WMODE_INF_TERRAIN && have_cities()) {show_ped_path_finder_stats();}
 		break;
 	case 'g': // pause/resume playback of eventlist
 		pause_frame = !pause_frame;
@@ -1630,8 +1634,13 @@ int load_config(string const &config_file) {
 	kwmb.add("use_dense_voxels", use_dense_voxels);
 	kwmb.add("use_voxel_cobjs", use_voxel_cobjs);
 	kwmb.add("mt_cobj_tree_build", mt_cobj_tree_build);
+	kwmb.add("sah_cobj_tree_build", sah_cobj_tree_build);
+	kwmb.add("mt_obj_file_load", mt_obj_file_load);
+	kwmb.add("noise_benchmark", noise_benchmark);
 	kwmb.add("global_lighting_update", global_lighting_update);
 	kwmb.add("lighting_update_offline", lighting_update_offline);
+	kwmb.add("deterministic_lighting", deterministic_lighting);
+	kwmb.add("lighting_file_half_float", lighting_file_half_float);
 	kwmb.add("two_sided_lighting", two_sided_lighting);
 	kwmb.add("disable_sound", disable_sound);
 	kwmb.add("start_maximized", start_maximized);
@@ -1690,12 +1699,15 @@ int load_config(string const &config_file) {
 	kwmb.add("allow_shader_invariants", allow_shader_invariants);
 	kwmb.add("unlimited_weapons", config_unlimited_weapons);
 	kwmb.add("allow_model3d_quads", allow_model3d_quads);
+	kwmb.add("model3d_file_compress", model3d_file_compress);
 	kwmb.add("keep_keycards_on_death", keep_keycards_on_death);
 	kwmb.add("enable_timing_profiler", enable_timing_profiler);
 	kwmb.add("fast_transparent_spheres", fast_transparent_spheres);
 	kwmb.add("draw_building_interiors", draw_building_interiors);
 	kwmb.add("reverse_3ds_vert_winding_order", reverse_3ds_vert_winding_order);
 	kwmb.add("disable_dlights", disable_dlights);
+	kwmb.add("deterministic_erosion", deterministic_erosion);
+	kwmb.add("tile_gen_force_cpu_noise", tile_gen_force_cpu_noise); // use the tile gen pool with GPU noise modes by evaluating all tiles with CPU noise
 
 	kw_to_val_map_t<int> kwmi(error);
 	kwmi.add("verbose", verbose_mode);
@@ -1748,6 +1760,11 @@ int load_config(string const &config_file) {
 	kwmu.add("dlight_grid_bitshift", DL_GRID_BS);
 	kwmu.add("video_framerate", video_framerate);
 	kwmu.add("num_video_threads", num_video_threads);
+	kwmu.add("num_tile_gen_threads", num_tile_gen_threads); // 0 = generate tiled terrain tiles on the main thread
+	kwmu.add("num_planet_gen_threads", num_planet_gen_threads); // 0 = generate planet and moon surfaces on the main thread
+	kwmu.add("planet_surface_cache_mb", planet_surface_cache_mb); // memory cap for generated planet and moon surfaces
+	kwmu.add("building_light_cache_mb", building_light_cache_mb); // memory cap for cached building indirect lighting volumes
+	kwmu.add("building_light_prefetch_count", building_light_prefetch_count); // number of nearby buildings to precompute indirect lighting for; 0 = disabled
 
 	kw_to_val_map_t<float> kwmf(error);
 	kwmf.add("gravity", base_gravity);
@@ -1853,6 +1870,8 @@ int load_config(string const &config_file) {
 	kwms.add("font_texture_atlas_fn", font_texture_atlas_fn);
 	kwms.add("sphere_materials_fn", sphere_materials_fn);
 	kwms.add("write_heightmap_png", hmap_out_fn);
+	kwms.add("planet_surface_cache_dir", planet_surface_cache_dir); // empty = no disk cache of generated planet and moon surfaces
+	kwms.add("building_light_cache_dir", building_light_cache_dir); // empty = no disk cache of building indirect lighting
 	kwms.add("skybox_cube_map", skybox_cube_map_name);
 
 	while (read_str(fp, strc)) { // slow but should be OK: these ones require special handling
@@ -2208,6 +2227,7 @@ int main(int argc, char** argv) {
 	load_texture_names(); // needs to be before config file load
 	load_top_level_config(defaults_file);
 	gen_gauss_rand_arr(); // after reading seed from config file
+	if (noise_benchmark) {run_noise_benchmark();} // after reading mesh params from config file
 	cout << "Loading."; cout.flush();
 	
  	// Initialize GLUT
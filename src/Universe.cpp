@@ -47,6 +47,7 @@ float const ROT_RATE_CONST   = 0.5*ROTREV_TIMESCALE;
 float const REV_RATE_CONST   = 1.0*ROTREV_TIMESCALE;
 float const STAR_BRIGHTNESS  = 1.4;
 float const MIN_TEX_OBJ_SZ   = 4.0;
+float const SURF_PREFETCH_T  = 2.0; // in seconds; planet/moon surfaces are generated in the background this far ahead of the player's motion
 float const MAX_WATER        = 0.75;
 float const GLOBAL_AMBIENT   = 0.25;
 float const GAS_GIANT_MIN_REL_SZ = 0.34;
@@ -837,6 +838,7 @@ void ucell::draw_systems(ushader_group &usg, s_object const &clobj, unsigned pas
 	bool const p_system(clobj.has_valid_system());
 	// use lower detail when the player is moving quickly in hyperspeed since objects zoom by so quickly
 	float const velocity_mag(get_player_velocity().mag()), sscale_val(1.0/max(1.0f, 2.0f*velocity_mag)); // up to 5x lower
+	point const pred_camera(camera + (SURF_PREFETCH_T*TICKS_PER_SECOND)*get_player_velocity()); // predicted camera pos for surface prefetch
 
 	// draw galaxies
 	for (unsigned i = 0; i < galaxies->size(); ++i) { // remember, galaxies can overlap
@@ -937,6 +939,7 @@ void ucell::draw_systems(ushader_group &usg, s_object const &clobj, unsigned pas
 						if (sel_s && (p2p_dist_sq(camera, ppos) < p2p_dist_sq(camera, spos)) != (sol_draw_pass != 0)) continue; // don't draw planet in this pass
 						float const pradius(PLANET_ATM_RSCALE*planet.radius), sizep(sscale_val*calc_sphere_size(ppos, camera, pradius));
 						bool skip_draw(!planets_visible);
+						if (!gen_only) {planet.prefetch_texture(sscale_val*calc_sphere_size(ppos, pred_camera, pradius));} // even if not visible
 
 						if (sclip && sizep < (planet.ring_data.empty() ? 0.6 : 0.3)) {
 							if (gen_all_bodies) {planet.process();} // process anyway to ensure moons are generated for ship colonization
@@ -981,6 +984,7 @@ void ucell::draw_systems(ushader_group &usg, s_object const &clobj, unsigned pas
 								if (!moon.is_ok()) continue;
 								point_d const mpos(pos + moon.pos);
 								float const sizem(sscale_val*calc_sphere_size(mpos, camera, moon.radius));
+								moon.prefetch_texture(sscale_val*calc_sphere_size(mpos, pred_camera, moon.radius));
 								if ((sizem < 0.2 && sclip) || !univ_sphere_vis(mpos, moon.radius)) continue;
 								current.moon = l;
 								//planet.bind_rings_texture(2); // use the planet's rings texture for shadows
@@ -2067,26 +2071,31 @@ void urev_body::check_gen_texture(unsigned size) {
 		return;
 	}
 	unsigned const tsize0(get_texture_size(size));
+	bool const has_texture(glIsTexture(tid) != 0);
+	if (has_texture && tsize0 == tsize) return; // nothing to do
+	vector<unsigned char> data;
+	// if there's already a texture, keep drawing with it until the new size has been generated in the background;
+	// otherwise wait only if background generation is disabled, and draw untextured until the surface is ready
+	if (!get_rocky_surface(rocky_surface_gen_t(*this, tsize0), size, 0, surface, data)) return; // not yet generated
+	if (has_texture) {::free_texture(tid);} // delete old texture
+	create_rocky_texture(tsize0, data); // new texture
+}
 
-	if (!glIsTexture(tid)) { // texture has not been generated
-		gen_surface();
-	}
-	else if (tsize0 != tsize) { // new texture size
-		::free_texture(tid); // delete old texture
-	}
-	else {
-		return; // nothing to do
-	}
-	create_rocky_texture(tsize0); // new texture
+
+void urev_body::prefetch_texture(float size) const { // size is the expected screen size at some point in the near future
+
+	if (!gen || gas_giant || use_procedural_shader() || size <= MIN_TEX_OBJ_SZ) return;
+	unsigned const tsize0(get_texture_size(size));
+	if (tid > 0 && tsize0 <= tsize) return; // already have a texture at least this large
+	prefetch_rocky_surface(rocky_surface_gen_t(*this, tsize0), size);
 }
 
 
-void urev_body::create_rocky_texture(unsigned size) {
+void urev_body::create_rocky_texture(unsigned size, vector<unsigned char> const &data) {
 
 	tsize = size;
 	assert(tsize <= MAX_TEXTURE_SIZE);
-	vector<unsigned char> data(3*tsize*tsize);
-	gen_texture_data_and_heightmap(&data.front(), tsize);
+	assert(data.size() == 3*tsize*tsize);
 	setup_texture(tid, 0, 1, 0);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, tsize, tsize, 0, GL_RGB, GL_UNSIGNED_BYTE, &data.front());
 }
@@ -2136,7 +2145,7 @@ void urev_body::upload_colors_to_shader(shader_t &s) const {
 }
 
 
-void urev_body::get_surface_color(unsigned char *data, float val, float phi) const { // val in [0,1]
+void rocky_surface_gen_t::get_surface_color(unsigned char *data, float val, float phi) const { // val in [0,1]
 
 	bool const frozen(temp < FREEZE_TEMP);
 	unsigned char const white[3] = {255, 255, 255};
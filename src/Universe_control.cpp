@@ -8,6 +8,7 @@
 #include "asteroid.h"
 #include "timetest.h"
 #include "openal_wrap.h"
+#include "parallel_jobs.h"
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -63,8 +64,12 @@ void add_player_ship_engine_light();
 
 #ifdef _OPENMP
 int omp_get_thread_num_3dw() {return omp_get_thread_num();} // where does this belong?
+int omp_get_max_threads_3dw() {return omp_get_max_threads();}
+void omp_set_num_threads_3dw(int num) {omp_set_num_threads(num);} // only affects the calling thread's parallel regions
 #else
 int omp_get_thread_num_3dw() {return 0;}
+int omp_get_max_threads_3dw() {return 1;}
+void omp_set_num_threads_3dw(int num) {}
 #endif
 
 void init_universe_display() {
@@ -334,173 +339,268 @@ void proc_collision(free_obj *const uobj, upos_point_type const &cpos, point con
 }
 
 
-void process_univ_objects() {
+// per-frame index of point sources (temp_sources, hyper_inhibits) sorted by x, searched in the same way as find_close_objects()
+class point_source_index_t {
+	vector<pair<float, unsigned>> by_x; // {x, index}
+	float rmax;
+public:
+	point_source_index_t() : rmax(0.0) {}
 
-	vector<free_obj const*> stat_obj_query_res;
+	template<typename T> void build(vector<T> const &sources) {
+		by_x.clear();
+		rmax = 0.0;
 
-	for (unsigned i = 0; i < uobjs.size(); ++i) { // can we use cached_objs?
-		free_obj *const uobj(uobjs[i]);
-		bool const no_coll(uobj->no_coll()), particle(uobj->is_particle()), projectile(uobj->is_proj());
-		if (no_coll && particle)   continue; // no collisions, gravity, or temperature on this object
-		if (uobj->is_stationary()) continue;
-		bool const is_ship(uobj->is_ship()), orbiting(uobj->is_orbiting());
-		bool const calc_gravity(((uobj->get_time() + unsigned(size_t(uobj)>>8)) & (GRAV_CHECK_MOD-1)) == 0);
-		bool const lod_coll(PLAYER_SLOW_PLANET_APPROACH && is_ship && uobj->is_player_ship()); // enable if we want to do close planet flyby
-		float const radius(uobj->get_c_radius()*(no_coll ? 0.5 : 1.0));
-		upos_point_type const &obj_pos(uobj->get_pos());
-		vector3d gravity(zero_vector); // sum of gravity from sun, planets, possibly some moons, and possibly asteroids
-		point sun_pos(all_zeros);
-
-		// skip orbiting objects (no collisions or gravity effects, temperature is mostly constant)
-		s_object clobj; // closest object
-		bool const include_asteroids(!particle); // disable particle-asteroid collisions because they're too slow
-		int const found_close(orbiting ? 0 : universe.get_object_closest_to_pos(clobj, obj_pos, include_asteroids, 1.0, (no_coll ? 0.0 : radius)));
-		bool temp_known(0), has_rings(0);
-		float limit_speed_dist(clobj.dist);
-
-		if (found_close) {
-			if (clobj.type == UTYPE_ASTEROID) {
-				uasteroid const &asteroid(clobj.get_asteroid());
-				float const dist_to_cobj(clobj.dist - (asteroid.radius + radius));
-				uobj->set_sobj_dist(dist_to_cobj);
-
-				if (dist_to_cobj < 0.0) { // possible collision
-					upos_point_type norm(obj_pos, asteroid.pos);
-					vector3d const &ascale(asteroid.get_scale());
-					double const dist(norm.mag());
-					if (dist > TOLERANCE) {norm /= dist;} else {norm = plus_z;} // normalize
-					double const a_radius(asteroid.radius*(norm*upos_point_type(ascale)).mag()), rsum(a_radius + radius);
-					
-					if (dist < rsum) {
-						// FIXME: detailed collision?
-						if (projectile) {} // projectile explosions damage the asteroid (reduce its radius? what if it's instanced?)
-						float const elastic((lod_coll ? 0.1 : 1.0)*SBODY_COLL_ELASTIC);
-						upos_point_type const cpos(asteroid.pos + norm*min(rsum, 1.1*dist)); // move away from the asteroid, but limit the distance to smooth the response
-						proc_collision(uobj, cpos, asteroid.pos, asteroid.radius, asteroid.get_velocity(), 1.0, elastic, asteroid.get_fragment_tid(obj_pos));
-
-						if (is_ship && clobj.asteroid_field == AST_BELT_ID) { // ship collision with asteroid belt
-							//clobj.get_asteroid_belt().detach_asteroid(clobj.asteroid); // incomplete
-						}
-					}
-				}
-			}
-			else {
-				assert(clobj.object != NULL);
-				float const clobj_radius(clobj.object->get_radius());
-				point const clobj_pos(clobj.object->get_pos());
-				float const temperature(universe.get_point_temperature(clobj, obj_pos, sun_pos)*(FOBJ_TEMP_SCALE - uobj->get_shadow_val())); // shadow_val = 0-3
-				uobj->set_temp(temperature, sun_pos);
-				temp_known = 1;
-				float hmap_scale(0.0);
-				if (clobj.type == UTYPE_MOON  ) {hmap_scale = MOON_HMAP_SCALE;  }
-				if (clobj.type == UTYPE_PLANET) {hmap_scale = PLANET_HMAP_SCALE;}
-				float dist_to_cobj(clobj.dist - (hmap_scale*clobj_radius + radius)); // (1.0 + hmap_scale)*radius?
-				
-				if (dist_to_cobj > 0.0 && is_ship && clobj.has_valid_system()) {
-					ussystem const &system(clobj.get_system());
+		for (unsigned i = 0; i < sources.size(); ++i) {
+			by_x.emplace_back(float(sources[i].pos.x), i);
+			max_eq(rmax, float(sources[i].radius));
+		}
+		sort(by_x.begin(), by_x.end());
+	}
+	template<typename F> void query(float x, float radius, F const &func) const { // calls func(ix) for each source that may be within radius of x
+		float const dmax(radius + rmax);
+		auto i(std::lower_bound(by_x.begin(), by_x.end(), make_pair((x - dmax), 0U)));
+		for (; i != by_x.end() && i->first <= (x + dmax); ++i) {func(i->second);}
+	}
+};
+
+struct uobj_phys_state_t { // results of the parallel query phase of process_univ_objects(), applied to each object serially afterward
+	bool skip, has_sobj_dist, temp_known, near_sobj, calc_gravity, near_b_hole, set_speed;
+	int sobj_coll, src_ix; // sobj_coll is passed to near_sobj(); src_ix is the hottest temp source, if any
+	float sobj_dist, temp, src_temp, speed_factor;
+	point sun_pos;
+	vector3d gravity, swp_accel;
+	s_object clobj; // closest object
 
-					if (system.asteroid_belt) {
-						// check distance to system asteroid fields (planet asteroid fields should be close enough to the planet already)
-						dist_to_cobj = min(dist_to_cobj, system.asteroid_belt->get_dist_to_boundary(obj_pos));
+	uobj_phys_state_t() : skip(1), has_sobj_dist(0), temp_known(0), near_sobj(0), calc_gravity(0), near_b_hole(0), set_speed(0),
+		sobj_coll(0), src_ix(-1), sobj_dist(0.0), temp(0.0), src_temp(0.0), speed_factor(1.0), sun_pos(all_zeros), gravity(zero_vector), swp_accel(zero_vector) {}
+};
+
+struct uobj_coll_t { // deferred proc_collision() call
+	unsigned obj_ix;
+	int coll_tid;
+	float radius, mass, elastic;
+	upos_point_type cpos;
+	point coll_pos;
+	vector3d velocity;
+
+	uobj_coll_t(unsigned obj_ix_, upos_point_type const &cpos_, point const &coll_pos_, float radius_, vector3d const &velocity_, float mass_, float elastic_, int coll_tid_)
+		: obj_ix(obj_ix_), coll_tid(coll_tid_), radius(radius_), mass(mass_), elastic(elastic_), cpos(cpos_), coll_pos(coll_pos_), velocity(velocity_) {}
+	bool operator<(uobj_coll_t const &c) const {return (obj_ix < c.obj_ix);}
+};
+
+point_source_index_t temp_source_index, hyper_inhibit_index;
+
+
+// read-only part of the update: finds the closest object and computes collisions, temperature, gravity, and speed limits for uobjs[i];
+// uobj state is not modified here, so this can be run in parallel; collisions are added to colls and applied later
+void query_univ_object(unsigned i, uobj_phys_state_t &st, vector<uobj_coll_t> &colls, vector<free_obj const*> &stat_obj_query_res) {
+
+	free_obj const *const uobj(uobjs[i]);
+	bool const no_coll(uobj->no_coll()), particle(uobj->is_particle()), projectile(uobj->is_proj());
+	if (no_coll && particle)   return; // no collisions, gravity, or temperature on this object
+	if (uobj->is_stationary()) return;
+	st.skip = 0;
+	bool const is_ship(uobj->is_ship()), orbiting(uobj->is_orbiting());
+	bool const calc_gravity(((uobj->get_time() + unsigned(size_t(uobj)>>8)) & (GRAV_CHECK_MOD-1)) == 0);
+	bool const lod_coll(PLAYER_SLOW_PLANET_APPROACH && is_ship && uobj->is_player_ship()); // enable if we want to do close planet flyby
+	float const radius(uobj->get_c_radius()*(no_coll ? 0.5 : 1.0));
+	upos_point_type const &obj_pos(uobj->get_pos());
+	vector3d &gravity(st.gravity); // sum of gravity from sun, planets, possibly some moons, and possibly asteroids
+	point &sun_pos(st.sun_pos);
+
+	// skip orbiting objects (no collisions or gravity effects, temperature is mostly constant)
+	s_object &clobj(st.clobj); // closest object
+	bool const include_asteroids(!particle); // disable particle-asteroid collisions because they're too slow
+	int const found_close(orbiting ? 0 : universe.get_object_closest_to_pos(clobj, obj_pos, include_asteroids, 1.0, (no_coll ? 0.0 : radius)));
+	bool has_rings(0);
+	float limit_speed_dist(clobj.dist);
+	st.calc_gravity = calc_gravity;
+
+	if (found_close) {
+		if (clobj.type == UTYPE_ASTEROID) {
+			uasteroid const &asteroid(clobj.get_asteroid());
+			float const dist_to_cobj(clobj.dist - (asteroid.radius + radius));
+			st.has_sobj_dist = 1;
+			st.sobj_dist     = dist_to_cobj;
+
+			if (dist_to_cobj < 0.0) { // possible collision
+				upos_point_type norm(obj_pos, asteroid.pos);
+				vector3d const &ascale(asteroid.get_scale());
+				double const dist(norm.mag());
+				if (dist > TOLERANCE) {norm /= dist;} else {norm = plus_z;} // normalize
+				double const a_radius(asteroid.radius*(norm*upos_point_type(ascale)).mag()), rsum(a_radius + radius);
+				
+				if (dist < rsum) {
+					// FIXME: detailed collision?
+					if (projectile) {} // projectile explosions damage the asteroid (reduce its radius? what if it's instanced?)
+					float const elastic((lod_coll ? 0.1 : 1.0)*SBODY_COLL_ELASTIC);
+					upos_point_type const cpos(asteroid.pos + norm*min(rsum, 1.1*dist)); // move away from the asteroid, but limit the distance to smooth the response
+					colls.emplace_back(i, cpos, asteroid.pos, asteroid.radius, asteroid.get_velocity(), 1.0, elastic, asteroid.get_fragment_tid(obj_pos));
+
+					if (is_ship && clobj.asteroid_field == AST_BELT_ID) { // ship collision with asteroid belt
+						//clobj.get_asteroid_belt().detach_asteroid(clobj.asteroid); // incomplete
 					}
 				}
-				uobj->set_sobj_dist(dist_to_cobj);
-
-				if (clobj.type == UTYPE_PLANET || clobj.type == UTYPE_MOON) {
-					int coll(0);
-
-					if (dist_to_cobj < 0.0) { // collision (except for stars)
-						float coll_r;
-						upos_point_type cpos;
-						coll = 1;
-
-						// player_ship and possibly other ships need the more stable but less accurate algorithm
-						bool const simple_coll(!is_ship && !projectile);
-						float const radius_coll(lod_coll ? 1.25*NEAR_CLIP_SCALED : radius);
-						float const elastic((lod_coll ? 0.1 : 1.0)*SBODY_COLL_ELASTIC);
-
-						if (clobj.object->collision(obj_pos, radius_coll, uobj->get_velocity(), cpos, coll_r, simple_coll)) {
-							proc_collision(uobj, cpos, clobj_pos, coll_r, zero_vector, clobj.object->mass, elastic, clobj.object->get_fragment_tid(obj_pos));
-							coll = 2;
-						}
-					} // collision
-					if (is_ship) {uobj->near_sobj(clobj, coll);}
-				} // planet or moon
-				if (calc_gravity) {get_gravity(clobj, obj_pos, gravity, 1);}
-
-				if (clobj.type == UTYPE_PLANET) {
-					// when near a planet with rings, use the dist to the outer rings to limit speed so that we don't fly through the rings too quickly
-					uplanet const &planet(clobj.get_planet());
-					has_rings = (planet.ring_ro > 0.0);
-					if (has_rings) {limit_speed_dist = clobj.dist - (planet.ring_ro - planet.radius);} // can be negative
-				}
 			}
-		} // found_close
-		if (!temp_known) {
-			float temperature(0.0);
-			if (!particle && !projectile) {temperature = universe.get_point_temperature(clobj, obj_pos, sun_pos)*FOBJ_TEMP_SCALE;}
-			uobj->set_temp(temperature, sun_pos);
 		}
-		if (calc_gravity) {
-			bool near_b_hole(0);
-			vector3d swp_accel(zero_vector);
-
-			if (!stat_objs.empty()) {
-				all_query_data qdata(&stat_objs, obj_pos, 10.0, urm_static, uobj, stat_obj_query_res);
-				get_all_close_objects(qdata);
-				
-				for (unsigned j = 0; j < stat_obj_query_res.size(); ++j) { // asteroid/black hole gravity
-					near_b_hole |= (stat_obj_query_res[j]->get_gravity(gravity, obj_pos) == 2);
+		else {
+			assert(clobj.object != NULL);
+			float const clobj_radius(clobj.object->get_radius());
+			point const clobj_pos(clobj.object->get_pos());
+			st.temp = universe.get_point_temperature(clobj, obj_pos, sun_pos)*(FOBJ_TEMP_SCALE - uobj->get_shadow_val()); // shadow_val = 0-3
+			st.temp_known = 1;
+			float hmap_scale(0.0);
+			if (clobj.type == UTYPE_MOON  ) {hmap_scale = MOON_HMAP_SCALE;  }
+			if (clobj.type == UTYPE_PLANET) {hmap_scale = PLANET_HMAP_SCALE;}
+			float dist_to_cobj(clobj.dist - (hmap_scale*clobj_radius + radius)); // (1.0 + hmap_scale)*radius?
+			
+			if (dist_to_cobj > 0.0 && is_ship && clobj.has_valid_system()) {
+				ussystem const &system(clobj.get_system());
+
+				if (system.asteroid_belt) {
+					// check distance to system asteroid fields (planet asteroid fields should be close enough to the planet already)
+					dist_to_cobj = min(dist_to_cobj, system.asteroid_belt->get_dist_to_boundary(obj_pos));
 				}
 			}
-			if (clobj.has_valid_system()) {
-				swp_accel = clobj.get_star().get_solar_wind_accel(obj_pos, uobj->get_mass(), uobj->get_surf_area());
+			st.has_sobj_dist = 1;
+			st.sobj_dist     = dist_to_cobj;
+
+			if (clobj.type == UTYPE_PLANET || clobj.type == UTYPE_MOON) {
+				int coll(0);
+
+				if (dist_to_cobj < 0.0) { // collision (except for stars)
+					float coll_r;
+					upos_point_type cpos;
+					coll = 1;
+
+					// player_ship and possibly other ships need the more stable but less accurate algorithm
+					bool const simple_coll(!is_ship && !projectile);
+					float const radius_coll(lod_coll ? 1.25*NEAR_CLIP_SCALED : radius);
+					float const elastic((lod_coll ? 0.1 : 1.0)*SBODY_COLL_ELASTIC);
+
+					if (clobj.object->collision(obj_pos, radius_coll, uobj->get_velocity(), cpos, coll_r, simple_coll)) {
+						colls.emplace_back(i, cpos, clobj_pos, coll_r, zero_vector, clobj.object->mass, elastic, clobj.object->get_fragment_tid(obj_pos));
+						coll = 2;
+					}
+				} // collision
+				st.near_sobj = is_ship;
+				st.sobj_coll = coll;
+			} // planet or moon
+			if (calc_gravity) {get_gravity(clobj, obj_pos, gravity, 1);}
+
+			if (clobj.type == UTYPE_PLANET) {
+				// when near a planet with rings, use the dist to the outer rings to limit speed so that we don't fly through the rings too quickly
+				uplanet const &planet(clobj.get_planet());
+				has_rings = (planet.ring_ro > 0.0);
+				if (has_rings) {limit_speed_dist = clobj.dist - (planet.ring_ro - planet.radius);} // can be negative
+			}
+		}
+	} // found_close
+	if (!st.temp_known) {
+		if (!particle && !projectile) {st.temp = universe.get_point_temperature(clobj, obj_pos, sun_pos)*FOBJ_TEMP_SCALE;}
+	}
+	if (calc_gravity) {
+		if (!stat_objs.empty()) {
+			all_query_data qdata(&stat_objs, obj_pos, 10.0, urm_static, uobj, stat_obj_query_res);
+			get_all_close_objects(qdata);
+			
+			for (unsigned j = 0; j < stat_obj_query_res.size(); ++j) { // asteroid/black hole gravity
+				st.near_b_hole |= (stat_obj_query_res[j]->get_gravity(gravity, obj_pos) == 2);
 			}
-			uobj->add_gravity_swp(gravity, swp_accel, float(GRAV_CHECK_MOD), near_b_hole);
 		}
-		if (is_ship) {
-			for (unsigned t = 0; t < temp_sources.size(); ++t) { // check for temperature of weapons - inefficient
-				temp_source const &ts(temp_sources[t]);
-				if (ts.source == uobj) continue; // no self damage
-				float const dist_sq(p2p_dist_sq(obj_pos, ts.pos)), rval(ts.radius + radius);
-				if (dist_sq > rval*rval) continue;
-				assert(ts.radius > TOLERANCE);
-				float const temp(ts.temp*min(1.0f, (rval - sqrt(dist_sq))/ts.radius)*min(1.0, 0.5*max(1.0f, ts.radius/radius)));
-				
-				if (temp > uobj->get_temp()) {
-					uobj->set_temp(temp, ts.pos, ts.source); // source should be valid (and should register as an attacker)
-				}
-			} // for t
-			if (!orbiting) {
-				float const speed_factor(uobj->get_max_sf()); // SLOW_SPEED_FACTOR = 0.04, FAST_SPEED_FACTOR = 1.0
-				float speed_factor2(1.0);
+		if (clobj.has_valid_system()) {
+			st.swp_accel = clobj.get_star().get_solar_wind_accel(obj_pos, uobj->get_mass(), uobj->get_surf_area());
+		}
+	}
+	if (is_ship) {
+		temp_source_index.query(obj_pos.x, radius, [&](unsigned t) { // check for temperature of weapons
+			temp_source const &ts(temp_sources[t]);
+			if (ts.source == uobj) return; // no self damage
+			float const dist_sq(p2p_dist_sq(obj_pos, ts.pos)), rval(ts.radius + radius);
+			if (dist_sq > rval*rval) return;
+			assert(ts.radius > TOLERANCE);
+			float const temp(ts.temp*min(1.0f, (rval - sqrt(dist_sq))/ts.radius)*min(1.0, 0.5*max(1.0f, ts.radius/radius)));
+			if (temp > st.src_temp) {st.src_temp = temp; st.src_ix = t;} // only the hottest source is applied
+		});
+		if (!orbiting) {
+			float const speed_factor(uobj->get_max_sf()); // SLOW_SPEED_FACTOR = 0.04, FAST_SPEED_FACTOR = 1.0
+			float speed_factor2(1.0);
+			
+			if (clobj.val > 0) {
+				float min_sf(0.25*SLOW_SPEED_FACTOR);
 				
-				if (clobj.val > 0) {
-					float min_sf(0.25*SLOW_SPEED_FACTOR);
-					
-					if (lod_coll && (clobj.type == UTYPE_PLANET || clobj.type == UTYPE_MOON)) {
-						assert(clobj.object != nullptr);
-						if (dot_product_ptv(upos_point_type(uobj->get_velocity()), obj_pos, clobj.object->get_pos()) < 0.0) {min_sf = (has_rings ? 0.0025 : 0.001);} // only on approach
-					}
-					speed_factor2 = max(min_sf, min(1.0f, 0.7f*limit_speed_dist)); // clip to [0.01, 1.0]
-				}
-				if (min(speed_factor, speed_factor2) > SLOW_SPEED_FACTOR) { // faster than slow speed
-					for (auto h = hyper_inhibits.begin(); h != hyper_inhibits.end(); ++h) {
-						float const dist_sq(p2p_dist_sq(obj_pos, h->pos));
-						if (dist_sq > h->radius*h->radius) continue; // too far away to take effect
-						if (uobj == h->parent) continue; // don't inhibit self
-						if (h->parent->is_related(uobj)) continue; // don't inhibit our own fighters or parent
-						//if (h->parent->is_enemy(uobj)) continue; // should we only inhibit enemies?
-						//uobj->register_attacker(h->parent); // no attacker registration (yet)
-						float const val(sqrt(dist_sq)/h->radius), val2(val*val); // 0.0 - 1.0
-						min_eq(speed_factor2, ((1.0f - val2)*SLOW_SPEED_FACTOR + val2*speed_factor));
-						// WRITE
-					} // for h
+				if (lod_coll && (clobj.type == UTYPE_PLANET || clobj.type == UTYPE_MOON)) {
+					assert(clobj.object != nullptr);
+					if (dot_product_ptv(upos_point_type(uobj->get_velocity()), obj_pos, clobj.object->get_pos()) < 0.0) {min_sf = (has_rings ? 0.0025 : 0.001);} // only on approach
 				}
-				uobj->set_speed_factor(min(speed_factor, speed_factor2));
+				speed_factor2 = max(min_sf, min(1.0f, 0.7f*limit_speed_dist)); // clip to [0.01, 1.0]
+			}
+			if (min(speed_factor, speed_factor2) > SLOW_SPEED_FACTOR) { // faster than slow speed
+				hyper_inhibit_index.query(obj_pos.x, 0.0, [&](unsigned hix) {
+					hyper_inhibit_t const &h(hyper_inhibits[hix]);
+					float const dist_sq(p2p_dist_sq(obj_pos, h.pos));
+					if (dist_sq > h.radius*h.radius) return; // too far away to take effect
+					if (uobj == h.parent) return; // don't inhibit self
+					if (h.parent->is_related(uobj)) return; // don't inhibit our own fighters or parent
+					//if (h.parent->is_enemy(uobj)) return; // should we only inhibit enemies?
+					//uobj->register_attacker(h.parent); // no attacker registration (yet)
+					float const val(sqrt(dist_sq)/h.radius), val2(val*val); // 0.0 - 1.0
+					min_eq(speed_factor2, ((1.0f - val2)*SLOW_SPEED_FACTOR + val2*speed_factor));
+				});
 			}
+			st.set_speed    = 1;
+			st.speed_factor = min(speed_factor, speed_factor2);
+		}
+	}
+}
+
+
+void process_univ_objects() {
+
+	unsigned const num_objs(uobjs.size()), objs_per_job = 128;
+	unsigned const num_jobs((num_objs + objs_per_job - 1)/objs_per_job), num_threads(max(1U, min(num_jobs, ((NUM_THREADS > 2) ? NUM_THREADS-1 : 1U)))); // one thread may be drawing
+	static vector<uobj_phys_state_t> state;
+	static vector<vector<uobj_coll_t>> colls; // per-thread
+	static vector<vector<free_obj const*>> stat_obj_query_res; // per-thread
+	state.clear();
+	state.resize(num_objs);
+	colls.resize(num_threads);
+	stat_obj_query_res.resize(num_threads);
+	for (auto &c : colls) {c.clear();}
+	temp_source_index.build(temp_sources);
+	hyper_inhibit_index.build(hyper_inhibits);
+
+	run_jobs_parallel(num_jobs, num_threads, [&](unsigned job, unsigned thread_ix) { // can we use cached_objs?
+		unsigned const start(job*objs_per_job), end(min(num_objs, (start + objs_per_job)));
+		for (unsigned i = start; i < end; ++i) {query_univ_object(i, state[i], colls[thread_ix], stat_obj_query_res[thread_ix]);}
+	});
+	// merge the per-thread collision queues and apply all updates in uobjs order so that the results don't depend on thread scheduling
+	vector<uobj_coll_t> &all_colls(colls[0]);
+	for (unsigned t = 1; t < colls.size(); ++t) {vector_add_to(colls[t], all_colls);}
+	std::stable_sort(all_colls.begin(), all_colls.end()); // each object has at most one collision
+	auto coll(all_colls.begin());
+
+	for (unsigned i = 0; i < num_objs; ++i) {
+		uobj_phys_state_t &st(state[i]);
+		if (st.skip) continue;
+		free_obj *const uobj(uobjs[i]);
+		if (st.has_sobj_dist) {uobj->set_sobj_dist(st.sobj_dist);}
+		if (st.temp_known   ) {uobj->set_temp(st.temp, st.sun_pos);}
+
+		for (; coll != all_colls.end() && coll->obj_ix == i; ++coll) {
+			proc_collision(uobj, coll->cpos, coll->coll_pos, coll->radius, coll->velocity, coll->mass, coll->elastic, coll->coll_tid);
+		}
+		if (st.near_sobj     ) {uobj->near_sobj(st.clobj, st.sobj_coll);}
+		if (!st.temp_known   ) {uobj->set_temp(st.temp, st.sun_pos);}
+		if (st.calc_gravity  ) {uobj->add_gravity_swp(st.gravity, st.swp_accel, float(GRAV_CHECK_MOD), st.near_b_hole);}
+
+		if (st.src_ix >= 0 && st.src_temp > uobj->get_temp()) {
+			temp_source const &ts(temp_sources[st.src_ix]);
+			uobj->set_temp(st.src_temp, ts.pos, ts.source); // source should be valid (and should register as an attacker)
 		}
+		if (st.set_speed) {uobj->set_speed_factor(st.speed_factor);}
 	} // for i
+	assert(coll == all_colls.end());
 	claim_planet = 0; // unset the flag - should have been used by this point
 }
 
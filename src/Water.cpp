@@ -8,6 +8,7 @@
 #include "openal_wrap.h"
 #include "shaders.h"
 #include "gl_ext_arb.h"
+#include "vfloat8.h"
 
 
 float    const RIPPLE_DAMP1        = 0.95;
@@ -692,6 +693,215 @@ inline void update_water_edges(int i, int j) {
 }
 
 
+void ripple_grid_t::alloc() {
+	rval.resize(XY_MULT_SIZE, 0.0);
+	acc .resize(XY_MULT_SIZE, 0.0);
+	active.clear();
+}
+void ripple_grid_t::free_data() {
+	clear_cont(rval);
+	clear_cont(acc);
+	active.clear();
+}
+void ripple_grid_t::clear_all() {
+	std::fill(rval.begin(), rval.end(), 0.0f);
+	std::fill(acc .begin(), acc .end(), 0.0f);
+	active.clear();
+}
+void ripple_grid_t::clear() {
+	for (auto r = active.begin(); r != active.end(); ++r) {
+		for (int y = r->y1; y < r->y2; ++y) {
+			unsigned const ix(y*MESH_X_SIZE + r->x1), n(r->x2 - r->x1);
+			std::fill(rval.begin()+ix, rval.begin()+ix+n, 0.0f);
+			std::fill(acc .begin()+ix, acc .begin()+ix+n, 0.0f);
+		}
+	}
+	active.clear();
+}
+void ripple_grid_t::add_active_rect(int x1, int y1, int x2, int y2) {
+	ripple_rect_t const r(max(x1, 0), max(y1, 0), min(x2+1, MESH_X_SIZE), min(y2+1, MESH_Y_SIZE));
+	if (!r.is_empty()) {active.push_back(r);}
+}
+void ripple_grid_t::merge_active_rects() { // merge rects that are within one cell of each other so that their update regions don't overlap
+
+	for (bool merged = 1; merged;) {
+		merged = 0;
+
+		for (unsigned i = 0; i < active.size(); ++i) {
+			for (unsigned j = i+1; j < active.size(); ++j) {
+				if (!active[i].expand_by(1).intersects(active[j].expand_by(1))) continue;
+				active[i].union_with(active[j]);
+				active[j] = active.back();
+				active.pop_back();
+				merged = 1;
+				--j;
+			}
+		}
+	}
+}
+
+
+// per-step ripple scratch data: ripple_act is 1.0 for cells that push ripples to their neighbors,
+// and ripple_i8f is the watershed inside8 neighbor mask of each cell as a float so that it can be tested in SIMD
+vector<float> ripple_act, ripple_i8f;
+
+// neighbor cells that push into the center cell: offset, the bit in the neighbor's inside8 mask for this direction, weight,
+// and whether the neighbor was visited before the center cell in the original row-major scatter order
+struct ripple_nbor_t {
+	int dx, dy;
+	unsigned bit;
+	float w;
+	bool earlier;
+};
+ripple_nbor_t const ripple_nbors[8] = {
+	{-1, 0, 0x08, 1.0, 1}, {-1,-1, 0x80, SQRTOFTWOINV, 1}, {0,-1, 0x10, 1.0, 1}, {1,-1, 0x40,  SQRTOFTWOINV, 1},
+	{ 1, 0, 0x02, 1.0, 0}, {-1, 1, 0x100,SQRTOFTWOINV, 0}, {0, 1, 0x04, 1.0, 0}, {1, 1, 0x20,  SQRTOFTWOINV, 0}};
+
+
+void calc_ripple_act_row(ripple_rect_t const &r, int y) {
+
+	for (int x = r.x1; x < r.x2; ++x) {
+		unsigned const ix(y*MESH_X_SIZE + x);
+		bool const act(wminside[y][x] && water_matrix[y][x] >= z_min_matrix[y][x]);
+		ripple_act[ix] = (act ? 1.0 : 0.0);
+		ripple_i8f[ix] = watershed_matrix[y][x].inside8;
+		if (act) {fix_fp_mag(ripples.rval[ix]);}
+	}
+}
+
+// gather form of the ripple propagation: each cell sums the pushes from its active neighbors rather than scattering its own pushes;
+// contributions from earlier neighbors are added before attenuation, and later ones after, to match the serial scatter result
+float calc_ripple_acc(int x, int y, float rm_atten, bool &start) {
+
+	unsigned const ix(y*MESH_X_SIZE + x);
+	float const rc(ripples.rval[ix]);
+	float early(0.0), late(0.0), self(0.0);
+
+	for (unsigned n = 0; n < 8; ++n) {
+		ripple_nbor_t const &nb(ripple_nbors[n]);
+		int const nx(x + nb.dx), ny(y + nb.dy);
+		if (point_outside_mesh(nx, ny)) continue;
+		unsigned const nix(ny*MESH_X_SIZE + nx);
+		float const d((rc - ripples.rval[nix])*nb.w);
+		self += d;
+		if (ripple_act[nix] == 0.0 || !(unsigned(ripple_i8f[nix]) & nb.bit)) continue;
+		(nb.earlier ? early : late) -= d;
+	}
+	float acc(ripples.acc[ix] + early);
+	if (ripple_act[ix] == 0.0) return (acc + late);
+	fix_fp_mag(acc);
+	acc *= rm_atten;
+	if (fabs(acc) > 1.0E-6) {start = 1;}
+	acc -= self;
+	fix_fp_mag(acc);
+	return (acc + late);
+}
+
+VFLOAT8_INLINE vfloat8 fix_fp_mag(vfloat8 const &v) {return select(cmp_lt(vabs(v), vfloat8(TOLERANCE)), vfloat8(0.0f), v);}
+
+VFLOAT8_INLINE vfloat8 get_mask_bit(vfloat8 const &m, float bit) { // m holds small integers, bit is a power of two; returns 0.0 or 1.0
+	vfloat8 const q(vfloor(m*vfloat8(1.0f/bit)));
+	return q - vfloat8(2.0f)*vfloor(q*vfloat8(0.5f));
+}
+
+// SIMD version of calc_ripple_acc() for 8 interior cells starting at x
+bool calc_ripple_acc_x8(int x, int y, float rm_atten) {
+
+	unsigned const ix(y*MESH_X_SIZE + x);
+	vfloat8 const rc(vfloat8::load(&ripples.rval[ix]));
+	vfloat8 early(0.0f), late(0.0f), self(0.0f);
+
+	for (unsigned n = 0; n < 8; ++n) {
+		ripple_nbor_t const &nb(ripple_nbors[n]);
+		unsigned const nix(ix + nb.dy*MESH_X_SIZE + nb.dx);
+		vfloat8 const d((rc - vfloat8::load(&ripples.rval[nix]))*vfloat8(nb.w));
+		self += d;
+		vfloat8 const push(vfloat8::load(&ripple_act[nix])*get_mask_bit(vfloat8::load(&ripple_i8f[nix]), nb.bit)*d);
+		if (nb.earlier) {early -= push;} else {late -= push;}
+	}
+	vfloat8 const acc0(vfloat8::load(&ripples.acc[ix]) + early);
+	vfloat8 const acc1(vfloat8(rm_atten)*fix_fp_mag(acc0));
+	vfloat8 const is_act(cmp_gt(vfloat8::load(&ripple_act[ix]), vfloat8(0.5f)));
+	(select(is_act, fix_fp_mag(acc1 - self), acc0) + late).store(&ripples.acc[ix]);
+	return (movemask(mask_and(is_act, cmp_gt(vabs(acc1), vfloat8(1.0E-6f)))) != 0);
+}
+
+bool calc_ripple_acc_row(ripple_rect_t const &r, int y, float rm_atten) {
+
+	bool start(0);
+	int x(r.x1);
+
+	if (y > 0 && y < MESH_Y_SIZE-1) {
+		if (x == 0) {ripples.acc[y*MESH_X_SIZE] = calc_ripple_acc(0, y, rm_atten, start); ++x;}
+		int const xe(min(r.x2, MESH_X_SIZE-1));
+		for (; x+8 <= xe; x += 8) {start |= calc_ripple_acc_x8(x, y, rm_atten);}
+	}
+	for (; x < r.x2; ++x) {ripples.acc[y*MESH_X_SIZE + x] = calc_ripple_acc(x, y, rm_atten, start);}
+	return start;
+}
+
+inline void update_ripple_water(int i, int j, float rm_atten, float rdamp1, float rdamp2, bool update_iter) {
+
+	unsigned const ix(i*MESH_X_SIZE + j);
+	float &rval(ripples.rval[ix]);
+	float const racc(ripples.acc[ix]);
+	float ripple_zval(0.0);
+
+	if (wminside[i][j]) {
+		float const zval(rdamp1*(rval + rdamp2*racc)); // ripple wave height
+		ripple_zval = ((fabs(zval) < TOLERANCE) ? 0.0 : zval); // prevent small floating point numbers
+	}
+	if (wminside[i][j] == 1) { // dynamic water
+		int const wsi(watershed_matrix[i][j].wsi);
+		assert(size_t(wsi) < valleys.size());
+
+		if (water_matrix[i][j] < z_min_matrix[i][j] && fabs(rval) < 1.0E-4 && fabs(racc) < 1.0E-4) { // under ground - no ripple
+			if (update_iter) water_matrix[i][j] = valleys[wsi].zval;
+			return;
+		}
+		float const depth(valleys[wsi].depth);
+
+		if (depth < 0) {
+			rval *= rm_atten;
+			if (update_iter) water_matrix[i][j] = valleys[wsi].zval;
+			return;
+		}
+		float const zval(max(min(ripple_zval, depth), -depth)); // max ripple height equals water depth
+		rval = rm_atten*zval;
+		water_matrix[i][j] = valleys[wsi].zval + zval;
+	}
+	else if (wminside[i][j] == 2) { // fixed water
+		rval = rm_atten*ripple_zval;
+		water_matrix[i][j] = water_plane_z + min(MAX_RIPPLE_HEIGHT, ripple_zval);
+		water_matrix[i][j] = max(water_matrix[i][j], zbottom);
+	}
+	else if (update_iter) {
+		if (get_water_enabled(j, i)) {
+			update_water_edges(i, j);
+		}
+		else {
+			rval = 0.0; // not sure if this is correct, or if there is something else that should be done here
+		}
+	}
+}
+
+ripple_rect_t shrink_ripple_rect(ripple_rect_t const &r) { // returns the tight bounds of nonzero ripple values, zeroing out denormal-sized values
+
+	ripple_rect_t bounds(r.x2, r.y2, r.x1, r.y1); // starts empty
+
+	for (int y = r.y1; y < r.y2; ++y) {
+		for (int x = r.x1; x < r.x2; ++x) {
+			unsigned const ix(y*MESH_X_SIZE + x);
+			fix_fp_mag(ripples.rval[ix]);
+			fix_fp_mag(ripples.acc [ix]);
+			if (ripples.rval[ix] == 0.0 && ripples.acc[ix] == 0.0) continue;
+			bounds.union_with(ripple_rect_t(x, y, x+1, y+1));
+		}
+	}
+	return bounds;
+}
+
+
 void compute_ripples() {
 
 	if (DISABLE_WATER) return;
@@ -702,135 +912,46 @@ void compute_ripples() {
 	if (temperature > W_FREEZE_POINT && (start_ripple || first_water_run)) {
 		float const tstep(max(fticks, 0.25f)); // ensure some min amount of damping to prevent unstable ripples when the framerate is very high
 		float const rm_atten(pow(RIPPLE_MAT_ATTEN, tstep)), rdamp1(pow(RIPPLE_DAMP1, tstep)), rdamp2(RIPPLE_DAMP2*tstep);
-		start_ripple = 0;
-
-		for (int i = 0; i < MESH_Y_SIZE; ++i) {
-			for (int j = 0; j < MESH_X_SIZE; ++j) {
-				if (!wminside[i][j] || water_matrix[i][j] < z_min_matrix[i][j] /*|| !get_water_enabled(j, i)*/) continue;
-				short const i8(watershed_matrix[i][j].inside8);
-				fix_fp_mag(ripples[i][j].rval);
-				float const rmij(ripples[i][j].rval);
-				float &acc(ripples[i][j].acc);
-				fix_fp_mag(acc);
-				acc *= rm_atten;
-				if (!start_ripple && fabs(acc) > 1.0E-6) start_ripple = 1;
-
-				// 00 0- -0 0+ +0 -- +- ++ -+  22  11
-				// 01 02 04 08 10 20 40 80 100 200 400
-				if (point_interior_to_mesh(j, i)) { // fast mode
-					float const d0( rmij - ripples[i  ][j-1].rval);
-					if (i8 & 0x02)  ripples[i  ][j-1].acc += d0;
-					float const d2( rmij - ripples[i  ][j+1].rval);
-					if (i8 & 0x08)  ripples[i  ][j+1].acc += d2;
-					float const d4((rmij - ripples[i-1][j-1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x20)  ripples[i-1][j-1].acc += d4;
-					float const d1( rmij - ripples[i-1][j  ].rval);
-					if (i8 & 0x04)  ripples[i-1][j  ].acc += d1;
-					float const d7((rmij - ripples[i-1][j+1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x100) ripples[i-1][j+1].acc += d7;
-					float const d5((rmij - ripples[i+1][j-1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x40)  ripples[i+1][j-1].acc += d5;
-					float const d3( rmij - ripples[i+1][j  ].rval);
-					if (i8 & 0x10)  ripples[i+1][j  ].acc += d3;
-					float const d6((rmij - ripples[i+1][j+1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x80)  ripples[i+1][j+1].acc += d6;
-					acc -= d0 + d1 + d2 + d3 + d4 + d5 + d6 + d7;
-					fix_fp_mag(acc);
-					continue;
-				}
-				if (j > 0) {
-					float const dz(rmij - ripples[i][j-1].rval);
-					if (i8 & 0x02) ripples[i][j-1].acc += dz;
-					acc -= dz;
-
-					if (i > 0) {
-						float const dz((rmij - ripples[i-1][j-1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x20) ripples[i-1][j-1].acc += dz;
-						acc -= dz;
-					}
-					if (i < MESH_Y_SIZE-1) {
-						float const dz((rmij - ripples[i+1][j-1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x40) ripples[i+1][j-1].acc += dz;
-						acc -= dz;
-					}
-				}
-				if (i > 0) {
-					float const dz(rmij - ripples[i-1][j].rval);
-					if (i8 & 0x04) ripples[i-1][j].acc += dz;
-					acc -= dz;
-				}
-				if (j < MESH_X_SIZE-1) {
-					float const dz(rmij - ripples[i][j+1].rval);
-					if (i8 & 0x08) ripples[i][j+1].acc += dz;
-					acc -= dz;
-
-					if (i < MESH_Y_SIZE-1) {
-						float const dz((rmij - ripples[i+1][j+1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x80) ripples[i+1][j+1].acc += dz;
-						acc -= dz;
-					}
-					if (i > 0) {
-						float const dz((rmij - ripples[i-1][j+1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x100) ripples[i-1][j+1].acc += dz;
-						acc -= dz;
-					}
-				}
-				if (i < MESH_Y_SIZE-1) {
-					float const dz(rmij - ripples[i+1][j].rval);
-					if (i8 & 0x10) ripples[i+1][j].acc += dz;
-					acc -= dz;
-				}
-				fix_fp_mag(acc);
-			} // for j
-		} // for i
+		int start(0); // int rather than bool for the omp reduction
+		ripple_act.resize(XY_MULT_SIZE, 0.0);
+		ripple_i8f.resize(XY_MULT_SIZE, 0.0);
+		// only cells within one of a nonzero value can change, so each active rect is updated over its bounds expanded by one cell,
+		// which reads act/inside8 values from one more cell beyond that; rects are merged so that the update regions don't overlap
+		ripples.merge_active_rects();
+		vector<ripple_rect_t> &active(ripples.active);
+
+		for (auto r = active.begin(); r != active.end(); ++r) {
+			ripple_rect_t const ur(r->expand_by(1)), ar(r->expand_by(2));
+#pragma omp parallel for schedule(static,4)
+			for (int y = ar.y1; y < ar.y2; ++y) {calc_ripple_act_row(ar, y);}
+#pragma omp parallel for schedule(static,4) reduction(|:start)
+			for (int y = ur.y1; y < ur.y2; ++y) {start |= int(calc_ripple_acc_row(ur, y, rm_atten));}
+		}
+		start_ripple = (start != 0);
 		if (DEBUG_RIPPLE_TIME) dtime1 += GET_DELTA_TIME;
 		
-		for (int i = 0; i < MESH_Y_SIZE; ++i) {
-			for (int j = 0; j < MESH_X_SIZE; ++j) {
-				float ripple_zval(0.0);
-
-				if (wminside[i][j]) {
-					float const zval(rdamp1*(ripples[i][j].rval + rdamp2*ripples[i][j].acc)); // ripple wave height
-					ripple_zval = ((fabs(zval) < TOLERANCE) ? 0.0 : zval); // prevent small floating point numbers
-				}
-				if (wminside[i][j] == 1) { // dynamic water
-					int const wsi(watershed_matrix[i][j].wsi);
-					assert(size_t(wsi) < valleys.size());
-
-					if (water_matrix[i][j] < z_min_matrix[i][j] && fabs(ripples[i][j].rval) < 1.0E-4 && fabs(ripples[i][j].acc) < 1.0E-4) { // under ground - no ripple
-						if (update_iter) water_matrix[i][j] = valleys[wsi].zval;
-						continue;
-					}
-					float const depth(valleys[wsi].depth);
+		if (update_iter || first_water_run) { // full update to refresh the water level of cells without ripples
+#pragma omp parallel for schedule(static,4)
+			for (int i = 0; i < MESH_Y_SIZE; ++i) {
+				for (int j = 0; j < MESH_X_SIZE; ++j) {update_ripple_water(i, j, rm_atten, rdamp1, rdamp2, update_iter);}
+			}
+		}
+		for (auto r = active.begin(); r != active.end(); ++r) {
+			ripple_rect_t const ur(r->expand_by(1));
 
-					if (depth < 0) {
-						ripples[i][j].rval *= rm_atten;
-						if (update_iter) water_matrix[i][j] = valleys[wsi].zval;
-						continue;
-					}
-					float const zval(max(min(ripple_zval, depth), -depth)); // max ripple height equals water depth
-					ripples[i][j].rval = rm_atten*zval;
-					water_matrix[i][j] = valleys[wsi].zval + zval;
-				}
-				else if (wminside[i][j] == 2) { // fixed water
-					ripples[i][j].rval = rm_atten*ripple_zval;
-					water_matrix[i][j] = water_plane_z + min(MAX_RIPPLE_HEIGHT, ripple_zval);
-					water_matrix[i][j] = max(water_matrix[i][j], zbottom);
+			if (!(update_iter || first_water_run)) {
+#pragma omp parallel for schedule(static,4)
+				for (int i = ur.y1; i < ur.y2; ++i) {
+					for (int j = ur.x1; j < ur.x2; ++j) {update_ripple_water(i, j, rm_atten, rdamp1, rdamp2, update_iter);}
 				}
-				else if (update_iter) {
-					if (get_water_enabled(j, i)) {
-						update_water_edges(i, j);
-					}
-					else {
-						ripples[i][j].rval = 0.0; // not sure if this is correct, or if there is something else that should be done here
-					}
-				}
-			} // for j
-		} // for i
+			}
+			*r = shrink_ripple_rect(ur);
+		}
+		active.erase(std::remove_if(active.begin(), active.end(), [](ripple_rect_t const &r) {return r.is_empty();}), active.end());
 		if (DEBUG_RIPPLE_TIME) dtime2 += GET_DELTA_TIME;
 	}
 	else { // no ripple
-		matrix_clear_2d(ripples);
+		ripples.clear();
 
 		// must clear ripples at least once at the beginning
 		if (NO_ICE_RIPPLES || counter == 0 || temperature > W_FREEZE_POINT) {
@@ -917,9 +1038,10 @@ void add_splash(point const &pos, int xpos, int ypos, float energy, float radius
 
 	for (int i = y1; i <= y2; i++) {
 		for (int j = x1; j <= x2; j++) {
-			if (((i - ypos)*(i - ypos) + (j - xpos)*(j - ypos)) <= radsq && wminside[i][j]) {ripples[i][j].rval += splash_size;}
+			if (((i - ypos)*(i - ypos) + (j - xpos)*(j - ypos)) <= radsq && wminside[i][j]) {ripples.get_rval(j, i) += splash_size;}
 		}
 	}
+	ripples.add_active_rect(x1, y1, x2, y2);
 	start_ripple = 1;
 }
 
@@ -937,29 +1059,39 @@ void add_waves() { // add waves due to wind
 	static float wave_time(0.0);
 	wave_time += fticks_clamped;
 	if (wave_time > 4000.0) {wave_time = 0.0;} // reset at 4000 ticks (2 min. or so) to avoid FP error
+	int x1(MESH_X_SIZE), y1(MESH_Y_SIZE), x2(-1), y2(-1); // bounds of cells with added waves
 	
-#pragma omp parallel for schedule(static,8) num_threads(2)
-	for (int y = 0; y < MESH_Y_SIZE; ++y) {
-		for (int x = 0; x < MESH_X_SIZE; ++x) {
-			if (!wminside[y][x] || !get_water_enabled(x, y)) continue; // only in water
-			float const wh(water_matrix[y][x]), depth(wh - mesh_height[y][x]);
-			if (depth < SMALL_NUMBER) continue; // not deep enough for waves
-			vector3d const local_wind(get_local_wind(x, y, wh));
-			float const lwmag(local_wind.mag());
-			float const tx(min(0.2f, fabs(local_wind.y))*wind_freq*(x + xoff2)/lwmag - wxoff);
-			float const ty(min(0.2f, fabs(local_wind.x))*wind_freq*(y + yoff2)/lwmag - wyoff);
-			float const val(get_texture_component(WIND_TEX, tx, ty, 0));
-			float const wval(wind_amplitude*min(2.5f, sqrt(lwmag))*val*min(depth, 0.1f));
-			
-			if (wminside[y][x] == 2) { // outside water (oceans)
-				ripples[y][x].rval += wval + wave_amplitude*fticks_clamped*sin(wave_freq*wave_time + depth_scale*depth);
-			}
-			else if (fabs(ripples[y][x].rval) < 0.1*wval) { // don't add wind if already rippling to prevent instability
-				ripples[y][x].rval += wval;
+#pragma omp parallel num_threads(2)
+	{
+		int tx1(MESH_X_SIZE), ty1(MESH_Y_SIZE), tx2(-1), ty2(-1); // per-thread bounds, merged below (OpenMP 2.0 has no min/max reductions)
+
+#pragma omp for schedule(static,8)
+		for (int y = 0; y < MESH_Y_SIZE; ++y) {
+			for (int x = 0; x < MESH_X_SIZE; ++x) {
+				if (!wminside[y][x] || !get_water_enabled(x, y)) continue; // only in water
+				float const wh(water_matrix[y][x]), depth(wh - mesh_height[y][x]);
+				if (depth < SMALL_NUMBER) continue; // not deep enough for waves
+				vector3d const local_wind(get_local_wind(x, y, wh));
+				float const lwmag(local_wind.mag());
+				float const tx(min(0.2f, fabs(local_wind.y))*wind_freq*(x + xoff2)/lwmag - wxoff);
+				float const ty(min(0.2f, fabs(local_wind.x))*wind_freq*(y + yoff2)/lwmag - wyoff);
+				float const val(get_texture_component(WIND_TEX, tx, ty, 0));
+				float const wval(wind_amplitude*min(2.5f, sqrt(lwmag))*val*min(depth, 0.1f));
+				
+				if (wminside[y][x] == 2) { // outside water (oceans)
+					ripples.get_rval(x, y) += wval + wave_amplitude*fticks_clamped*sin(wave_freq*wave_time + depth_scale*depth);
+				}
+				else if (fabs(ripples.get_rval(x, y)) < 0.1*wval) { // don't add wind if already rippling to prevent instability
+					ripples.get_rval(x, y) += wval;
+				}
+				tx1 = min(tx1, x); ty1 = min(ty1, y); tx2 = max(tx2, x); ty2 = max(ty2, y);
+				start_ripple = 1;
 			}
-			start_ripple = 1;
 		}
-	}
+#pragma omp critical(add_waves_bounds)
+		{x1 = min(x1, tx1); y1 = min(y1, ty1); x2 = max(x2, tx2); y2 = max(y2, ty2);}
+	} // end omp parallel
+	ripples.add_active_rect(x1, y1, x2, y2);
 	//PRINT_TIME("Add Waves");
 }
 
@@ -1353,7 +1485,7 @@ void calc_watershed() {
 	}
 	calc_water_flow();
 	init_water_springs(NUM_WATER_SPRINGS);
-	matrix_clear_2d(ripples);
+	ripples.clear_all();
 	first_water_run = 1;
 
 	for (int i = 0; i < MESH_Y_SIZE; ++i) {
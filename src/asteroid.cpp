@@ -340,7 +340,9 @@ public:
 
 	virtual void apply_physics() {
 		uobj_asteroid_destroyable::apply_physics();
-		model.proc_pending_updates();
+		point camera(get_camera_pos());
+		xform_point(camera); // to model space
+		model.proc_pending_updates(0, &camera);
 
 		if (!model.has_triangles()) { // completely destroyed (center anchor point is gone)
 			explode(0.0, radius, ETYPE_NONE, zero_vector, 0, WCLASS_EXPLODE, ALIGN_NEUTRAL, 0, NULL);
@@ -0,0 +1,68 @@
+// 3D World - Binary File Utility Functions
+// by Frank Gennari
+// 10/17/26
+#include "function_registry.h" // for checked_fclose()
+#include "binary_file_io.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+#ifdef _WIN32
+
+mapped_file_reader::mapped_file_reader() : data(nullptr), size(0), file_handle(INVALID_HANDLE_VALUE), map_handle(nullptr) {}
+
+bool mapped_file_reader::open(string const &filename) {
+
+	close();
+	file_handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file_handle == INVALID_HANDLE_VALUE) return 0;
+	LARGE_INTEGER fsize;
+	if (!GetFileSizeEx(file_handle, &fsize) || fsize.QuadPart == 0) {close(); return 0;} // can't map an empty file
+	size = (size_t)fsize.QuadPart;
+	map_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (map_handle == nullptr) {close(); return 0;}
+	data = (unsigned char const *)MapViewOfFile(map_handle, FILE_MAP_READ, 0, 0, 0);
+	if (data == nullptr) {close(); return 0;}
+	return 1;
+}
+
+void mapped_file_reader::close() {
+
+	if (data       != nullptr) {UnmapViewOfFile(data);}
+	if (map_handle != nullptr) {CloseHandle(map_handle);}
+	if (file_handle != INVALID_HANDLE_VALUE) {CloseHandle(file_handle);}
+	data = nullptr; size = 0; map_handle = nullptr; file_handle = INVALID_HANDLE_VALUE;
+}
+
+#else // POSIX
+
+mapped_file_reader::mapped_file_reader() : data(nullptr), size(0), fd(-1) {}
+
+bool mapped_file_reader::open(string const &filename) {
+
+	close();
+	fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return 0;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {close(); return 0;} // can't map an empty file
+	size = (size_t)st.st_size;
+	void *const ptr(mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+	if (ptr == MAP_FAILED) {close(); return 0;}
+	data = (unsigned char const *)ptr;
+	madvise(ptr, size, MADV_SEQUENTIAL);
+	return 1;
+}
+
+void mapped_file_reader::close() {
+
+	if (data != nullptr) {munmap((void *)data, size);}
+	if (fd >= 0) {::close(fd);}
+	data = nullptr; size = 0; fd = -1;
+}
+
+#endif
@@ -63,3 +63,25 @@ struct binary_file_writer : public binary_file_io {
 	}
 };
 
+// read-only memory mapped file; pages are loaded by the OS on first access, so nothing is copied until it's used
+class mapped_file_reader {
+	unsigned char const *data;
+	size_t size;
+#ifdef _WIN32
+	void *file_handle, *map_handle;
+#else
+	int fd;
+#endif
+	mapped_file_reader(mapped_file_reader const &) = delete; // forbidden
+	void operator=(mapped_file_reader const &) = delete; // forbidden
+public:
+	mapped_file_reader();
+	~mapped_file_reader() {close();}
+	bool open(string const &filename);
+	void close();
+	bool is_open() const {return (data != nullptr);}
+	unsigned char const *get_data() const {return data;}
+	size_t get_size() const {return size;}
+	bool in_range(size_t offset, size_t len) const {return (offset <= size && len <= size - offset);}
+};
+
@@ -5,19 +5,27 @@
 #include "function_registry.h"
 #include "buildings.h"
 #include "lightmap.h" // for light_source
+#include "mesh.h" // for get_xpos_round_down()
 #include "cobj_bsp_tree.h"
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 bool const USE_BKG_THREAD = 1;
 
 extern int MESH_Z_SIZE, display_mode, display_framerate, camera_surf_collide, animate2;
 extern unsigned LOCAL_RAYS, MAX_RAY_BOUNCES, NUM_THREADS;
-extern float indir_light_exp;
+extern unsigned building_light_cache_mb, building_light_prefetch_count;
+extern float indir_light_exp, ray_step_size_mult, light_int_scale[];
+extern std::string building_light_cache_dir;
 extern std::string lighting_update_text;
 extern building_dest_t cur_player_building_loc;
 extern vector<light_source> dl_sources;
 
 bool enable_building_people_ai();
+float get_step_size();
 
 
 bool ray_cast_cube(point const &p1, point const &p2, cube_t const &c, vector3d &cnorm, float &t) {
@@ -35,6 +43,7 @@ class cube_bvh_t : public cobj_tree_simple_type_t<colored_cube_t> {
 	}
 public:
 	vect_colored_cube_t &get_objs() {return objects;}
+	vect_colored_cube_t const &get_objs() const {return objects;}
 
 	bool ray_cast(point const &p1, point const &p2, vector3d &cnorm, colorRGBA &ccolor, float &t) const {
 		if (nodes.empty()) return 0;
@@ -159,27 +168,593 @@ void building_t::gather_interior_cubes(vect_colored_cube_t &cc) const {
 }
 
 
+// sparse light volume with the same cell counts as the scene lightmap ({MESH_X_SIZE, MESH_Y_SIZE, MESH_SIZE[2]}, which the indir texture requires);
+// ray paths are scaled from b.bcube onto the scene bounds in cast_building_light_rays(), so the grid spans the building rather than the scene;
+// only the local light color is stored, in 8x8x8 bricks that are allocated on first touch, so empty space costs nothing and touched cells use 12 bytes rather than 52 for lmcell
+class building_light_volume_t {
+	static unsigned const BRICK_BITS = 3, BRICK_SIZE = (1 << BRICK_BITS), BRICK_CELLS = (BRICK_SIZE*BRICK_SIZE*BRICK_SIZE);
+	struct brick_t {float c[BRICK_CELLS][3];}; // size = 6KB
+
+	unsigned dims[3], bdims[3]; // {x,y,z} in cells and bricks
+	vector<std::unique_ptr<brick_t>> bricks;
+	unsigned num_used;
+
+	unsigned get_brick_ix(unsigned x, unsigned y, unsigned z) const {return (((z >> BRICK_BITS)*bdims[1] + (y >> BRICK_BITS))*bdims[0] + (x >> BRICK_BITS));}
+	static unsigned get_cell_ix(unsigned x, unsigned y, unsigned z) {
+		unsigned const m(BRICK_SIZE-1);
+		return ((((z & m) << BRICK_BITS) + (y & m)) << BRICK_BITS) + (x & m);
+	}
+public:
+	struct compact_t { // final 8-bit RGB texture colors of the nonempty bricks; this is what's cached
+		unsigned dims[3];
+		vector<unsigned> brick_ixs;
+		vector<unsigned char> colors; // 3*BRICK_CELLS per brick
+		compact_t() {dims[0] = dims[1] = dims[2] = 0;}
+		static unsigned get_brick_data_size() {return 3*BRICK_CELLS;}
+		size_t get_mem() const {return (sizeof(compact_t) + brick_ixs.size()*sizeof(unsigned) + colors.size());}
+	};
+
+	building_light_volume_t() : num_used(0) {UNROLL_3X(dims[i_] = bdims[i_] = 0;)}
+	unsigned get_num_bricks() const {return num_used;}
+	size_t get_mem_usage() const {return (num_used*sizeof(brick_t) + bricks.capacity()*sizeof(std::unique_ptr<brick_t>));}
+	size_t get_dense_lmap_mem() const {return size_t(dims[0])*dims[1]*dims[2]*sizeof(lmcell);} // for comparison with lmap_manager_t
+
+	void init(unsigned nx, unsigned ny, unsigned nz) {
+		clear();
+		dims[0] = nx; dims[1] = ny; dims[2] = nz;
+		UNROLL_3X(bdims[i_] = (dims[i_] + BRICK_SIZE - 1) >> BRICK_BITS;)
+		bricks.resize(bdims[0]*bdims[1]*bdims[2]);
+	}
+	void clear() {
+		for (auto &b : bricks) {b.reset();}
+		num_used = 0;
+	}
+	float *get_cell_color(unsigned x, unsigned y, unsigned z) {
+		std::unique_ptr<brick_t> &brick(bricks[get_brick_ix(x, y, z)]);
+		if (!brick) {brick.reset(new brick_t()); ++num_used;} // value initialized to zeros
+		return brick->c[get_cell_ix(x, y, z)];
+	}
+	// same as add_path_to_lmcs() for LIGHTING_LOCAL with first_pt=0; p1 and p2 are in global scene space
+	void add_path(point p1, point const &p2, float weight, colorRGBA const &color) {
+		if (fabs(weight) < TOLERANCE) return;
+		weight *= ray_step_size_mult;
+		colorRGBA const cw(color*weight);
+		unsigned const nsteps(1 + unsigned(p2p_dist(p1, p2)/get_step_size())); // round up (dist can be 0)
+		vector3d const step((p2 - p1)/nsteps);
+		p1 += step; // move past the first step so we don't double count
+
+		for (unsigned s = 0; s < nsteps; ++s, p1 += step) {
+			int const x(get_xpos_round_down(p1.x)), y(get_ypos_round_down(p1.y)), z(get_zpos(p1.z));
+			if (x < 0 || y < 0 || z < 0 || x >= (int)dims[0] || y >= (int)dims[1] || z >= (int)dims[2]) continue;
+			float *const c(get_cell_color(x, y, z));
+			ADD_LIGHT_CONTRIB(cw, c);
+		}
+	}
+	void merge_from(building_light_volume_t &src) { // adds src into this volume and clears src
+		assert(src.bricks.size() == bricks.size());
+
+		for (unsigned i = 0; i < bricks.size(); ++i) {
+			std::unique_ptr<brick_t> &s(src.bricks[i]), &d(bricks[i]);
+			if (!s) continue;
+			if (!d) {d = std::move(s); ++num_used; continue;} // move rather than copy
+			for (unsigned n = 0; n < BRICK_CELLS; ++n) {ADD_LIGHT_CONTRIB(s->c[n], d->c[n]);}
+			s.reset();
+		}
+		src.num_used = 0;
+	}
+	void get_compact(compact_t &cv, float lighting_exponent) const { // converts to texture colors, as in update_indir_light_tex_range() with local_only=1
+		bool const apply_sqrt(lighting_exponent > 0.49 && lighting_exponent < 0.51), apply_exp(!apply_sqrt && lighting_exponent != 1.0);
+		float const scale(light_int_scale[LIGHTING_LOCAL]);
+		UNROLL_3X(cv.dims[i_] = dims[i_];)
+		cv.brick_ixs.clear();
+		cv.colors.clear();
+
+		for (unsigned i = 0; i < bricks.size(); ++i) {
+			if (!bricks[i]) continue;
+			cv.brick_ixs.push_back(i);
+
+			for (unsigned n = 0; n < BRICK_CELLS; ++n) {
+				colorRGB color;
+				UNROLL_3X(color[i_] = min(1.0f, bricks[i]->c[n][i_]*scale);)
+				if      (apply_sqrt) {UNROLL_3X(color[i_] = sqrt(color[i_]););}
+				else if (apply_exp)  {UNROLL_3X(color[i_] = pow(color[i_], lighting_exponent););}
+				UNROLL_3X(cv.colors.push_back((unsigned char)(255*CLIP_TO_01(color[i_])));)
+			}
+		}
+	}
+	static void expand_compact(compact_t const &cv, vector<unsigned char> &tex_data) { // texture is stored {Z,X,Y}
+		unsigned const nx(cv.dims[0]), ny(cv.dims[1]), nz(cv.dims[2]), bx((nx + BRICK_SIZE - 1) >> BRICK_BITS), by((ny + BRICK_SIZE - 1) >> BRICK_BITS);
+		assert(cv.colors.size() == 3*BRICK_CELLS*cv.brick_ixs.size());
+		tex_data.resize(4*nx*ny*nz);
+		std::fill(tex_data.begin(), tex_data.end(), 0);
+
+		for (unsigned i = 0; i < cv.brick_ixs.size(); ++i) {
+			unsigned const bix(cv.brick_ixs[i]), x0((bix%bx) << BRICK_BITS), y0(((bix/bx)%by) << BRICK_BITS), z0((bix/(bx*by)) << BRICK_BITS);
+			unsigned char const *const colors(&cv.colors[3*BRICK_CELLS*i]);
+
+			for (unsigned z = z0; z < min(nz, z0+BRICK_SIZE); ++z) {
+				for (unsigned y = y0; y < min(ny, y0+BRICK_SIZE); ++y) {
+					for (unsigned x = x0; x < min(nx, x0+BRICK_SIZE); ++x) {
+						unsigned const off(4*(nz*(y*nx + x) + z)), cix(3*get_cell_ix(x, y, z));
+						UNROLL_3X(tex_data[off+i_] = colors[cix+i_];)
+					}
+				}
+			}
+		} // for i
+	}
+};
+
+
+// LRU cache of completed building light volumes across building visits, keyed by building geometry and light state; optionally stored on disk
+class building_light_cache_t {
+	typedef std::shared_ptr<building_light_volume_t::compact_t const> p_compact_t;
+
+	struct cache_entry_t {
+		p_compact_t vol;
+		unsigned last_used;
+		cache_entry_t(p_compact_t const &vol_, unsigned last_used_) : vol(vol_), last_used(last_used_) {}
+	};
+	map<uint64_t, cache_entry_t> cache;
+	size_t mem_used;
+	unsigned use_counter;
+
+	std::string get_filename(uint64_t key) const {
+		if (building_light_cache_dir.empty()) return std::string(); // disk cache disabled
+		std::ostringstream oss;
+		oss << building_light_cache_dir << "/blight_" << std::hex << key << ".bin";
+		return oss.str();
+	}
+	// file format: key, dims[3], num_bricks, brick_ixs, colors
+	p_compact_t read_from_disk(uint64_t key) const {
+		std::string const fn(get_filename(key));
+		if (fn.empty()) return nullptr;
+		FILE *fp(fopen(fn.c_str(), "rb"));
+		if (fp == nullptr) return nullptr; // not cached; this is not an error
+		std::shared_ptr<building_light_volume_t::compact_t> vol(new building_light_volume_t::compact_t);
+		uint64_t file_key(0);
+		unsigned num_bricks(0);
+		bool ok(fread(&file_key, sizeof(uint64_t), 1, fp) == 1 && file_key == key);
+		ok = ok && (fread(vol->dims, sizeof(unsigned), 3, fp) == 3) && (fread(&num_bricks, sizeof(unsigned), 1, fp) == 1);
+
+		if (ok) {
+			vol->brick_ixs.resize(num_bricks);
+			vol->colors.resize(num_bricks*building_light_volume_t::compact_t::get_brick_data_size());
+			ok = (fread(vol->brick_ixs.data(), sizeof(unsigned), num_bricks, fp) == num_bricks);
+			ok = ok && (fread(vol->colors.data(), sizeof(unsigned char), vol->colors.size(), fp) == vol->colors.size());
+		}
+		checked_fclose(fp);
+		if (!ok) {std::cerr << "Error reading building light cache file " << fn << "; lighting will be recomputed" << endl; return nullptr;}
+		return vol;
+	}
+public:
+	void write_to_disk(uint64_t key, building_light_volume_t::compact_t const &vol) const { // thread safe
+		std::string const fn(get_filename(key));
+		if (fn.empty()) return;
+		FILE *fp(fopen(fn.c_str(), "wb"));
+		if (fp == nullptr) {std::cerr << "Error opening building light cache file " << fn << " for write" << endl; return;}
+		unsigned const num_bricks(vol.brick_ixs.size());
+		bool ok(fwrite(&key, sizeof(uint64_t), 1, fp) == 1);
+		ok = ok && (fwrite(vol.dims, sizeof(unsigned), 3, fp) == 3) && (fwrite(&num_bricks, sizeof(unsigned), 1, fp) == 1);
+		ok = ok && (fwrite(vol.brick_ixs.data(), sizeof(unsigned), num_bricks, fp) == num_bricks);
+		ok = ok && (fwrite(vol.colors.data(), sizeof(unsigned char), vol.colors.size(), fp) == vol.colors.size());
+		checked_fclose(fp);
+		if (!ok) {std::cerr << "Error writing building light cache file " << fn << endl;}
+	}
+	building_light_cache_t() : mem_used(0), use_counter(0) {}
+
+	void insert(uint64_t key, p_compact_t const &vol) {
+		if (!cache.emplace(key, cache_entry_t(vol, ++use_counter)).second) return; // already cached
+		mem_used += vol->get_mem();
+		size_t const max_mem(size_t(building_light_cache_mb) << 20);
+
+		while (mem_used > max_mem && cache.size() > 1) { // evict least recently used entries
+			auto lru(cache.begin());
+
+			for (auto i = cache.begin(); i != cache.end(); ++i) {
+				if (i->second.last_used < lru->second.last_used) {lru = i;}
+			}
+			if (lru->first == key) break; // don't evict the entry we just added
+			assert(mem_used >= lru->second.vol->get_mem());
+			mem_used -= lru->second.vol->get_mem();
+			cache.erase(lru);
+		}
+	}
+
+	p_compact_t lookup(uint64_t key, bool &from_disk) {
+		from_disk = 0;
+		auto it(cache.find(key));
+		if (it != cache.end()) {it->second.last_used = ++use_counter; return it->second.vol;}
+		p_compact_t const vol(read_from_disk(key));
+		if (!vol) return nullptr;
+		from_disk = 1;
+		insert(key, vol);
+		return vol;
+	}
+	bool contains(uint64_t key) const {return (cache.find(key) != cache.end());} // memory cache only
+	void store(uint64_t key, p_compact_t const &vol) {
+		insert(key, vol);
+		write_to_disk(key, *vol);
+	}
+};
+
+building_light_cache_t building_light_cache;
+
+
+void add_bytes_to_fnv_hash(uint64_t &key, void const *ptr, size_t size) {
+	for (size_t i = 0; i < size; ++i) {key = (key ^ ((uint8_t const *)ptr)[i])*1099511628211ULL;}
+}
+
+// FNV-1a hash of the building's lighting geometry and lighting params; bvh must contain the building's interior cubes;
+// buildings don't store their generation seeds, but everything that affects lighting is derived from them
+uint64_t calc_building_geom_light_key(building_t const &b, cube_bvh_t const &bvh) {
+	uint64_t key(14695981039346656037ULL);
+	auto add_bytes([&key](void const *ptr, size_t size) {add_bytes_to_fnv_hash(key, ptr, size);});
+	unsigned const iparams[5] = {(unsigned)MESH_X_SIZE, (unsigned)MESH_Y_SIZE, (unsigned)MESH_SIZE[2], LOCAL_RAYS, MAX_RAY_BOUNCES};
+	float const fparams[3] = {indir_light_exp, light_int_scale[LIGHTING_LOCAL], ray_step_size_mult};
+	bool const bparams[2] = {b.is_house, b.has_pri_hall()};
+	add_bytes(iparams, sizeof(iparams));
+	add_bytes(fparams, sizeof(fparams));
+	add_bytes(bparams, sizeof(bparams));
+	add_bytes(&b.bcube, sizeof(cube_t));
+	vect_colored_cube_t const &cubes(bvh.get_objs());
+	if (!cubes.empty()) {add_bytes(cubes.data(), cubes.size()*sizeof(colored_cube_t));}
+	return key;
+}
+// continues the geometry hash with the light state; this is cheap to recompute when lights are toggled since the bvh isn't needed
+uint64_t calc_building_light_key(building_t const &b, uint64_t geom_key) {
+	uint64_t key(geom_key);
+	auto add_bytes([&key](void const *ptr, size_t size) {add_bytes_to_fnv_hash(key, ptr, size);});
+	vector<room_object_t> const &objs(b.interior->room_geom->objs);
+
+	for (auto i = objs.begin(); i != objs.end(); ++i) { // light state
+		if (i->type != TYPE_LIGHT || !i->is_lit()) continue;
+		unsigned const ix(i - objs.begin());
+		colorRGBA const color(i->get_color());
+		add_bytes(&ix, sizeof(unsigned));
+		add_bytes(static_cast<cube_t const *>(&(*i)), sizeof(cube_t));
+		add_bytes(&color, sizeof(colorRGBA));
+	}
+	return key;
+}
+uint64_t calc_building_light_key(building_t const &b, cube_bvh_t const &bvh) {return calc_building_light_key(b, calc_building_geom_light_key(b, bvh));}
+
+void calc_reflect_ray(point &pos, point const &cpos, vector3d &dir, vector3d const &cnorm, rand_gen_t &rgen, float tolerance) {
+	vector3d v_ref;
+	calc_reflection_angle(dir, v_ref, cnorm);
+	v_ref.normalize();
+	vector3d const rand_dir(rgen.signed_rand_vector().get_norm());
+	dir = (v_ref + rand_dir).get_norm(); // diffuse reflection: new dir is mix 50% specular with 50% random
+	if (dot_product(dir, cnorm) < 0.0) {dir.negate();} // make sure it points away from the surface (is this needed?)
+	pos = cpos + tolerance*dir; // move slightly away from the surface
+}
+
+// casts rays from light ro (object index light_ix) into thread_lvols, one omp thread per volume, then merges them into lvol in thread order;
+// should_stop() is polled per primary ray; if it returns true, the partial results are discarded, lvol is unchanged, and the return value is 0
+template<typename F> bool cast_building_light_rays(building_t const &b, cube_bvh_t const &bvh, room_object_t const &ro, unsigned light_ix,
+	building_light_volume_t &lvol, vector<building_light_volume_t> &thread_lvols, size_t &peak_mem, F const &should_stop)
+{
+	unsigned const num_rt_threads(thread_lvols.size());
+	colorRGBA const lcolor(ro.get_color());
+	cube_t const scene_bounds(get_scene_bounds_bcube()); // expected by lmap update code
+	point const ray_scale(scene_bounds.get_size()/b.bcube.get_size()), llc_shift(scene_bounds.get_llc() - b.bcube.get_llc()*ray_scale);
+	float const tolerance(1.0E-5*b.bcube.get_max_extent()), light_zval(ro.z1() - 0.01*ro.dz()); // set slightly below bottom of light
+	float const surface_area(ro.dx()*ro.dy() + 2.0f*(ro.dx() + ro.dy())*ro.dz()); // bottom + 4 sides (top is occluded), 0.0003 for houses
+	float weight(100.0f*(surface_area/0.0003f)/LOCAL_RAYS); // normalize to the number of rays
+	if (b.has_pri_hall()) {weight *= 0.8;} // floorplan is open and well lit, indir lighting value seems too high
+	if (b.is_house) {weight *= 2.0;} // houses have dimmer lights and seem to work better with more indir
+	unsigned const NUM_PRI_SPLITS = 16;
+	int const num_rays(LOCAL_RAYS/NUM_PRI_SPLITS);
+
+#pragma omp parallel for schedule(dynamic) num_threads(num_rt_threads)
+	for (int n = 0; n < num_rays; ++n) {
+		if (should_stop()) continue;
+		rand_gen_t rgen;
+		rgen.set_state(n+1, light_ix);
+		vector3d pri_dir(rgen.signed_rand_vector_spherical(1.0).get_norm());
+		pri_dir.z = -fabs(pri_dir.z); // make sure dir points down
+		point origin, init_cpos, cpos;
+		vector3d init_cnorm, cnorm;
+		colorRGBA ccolor(WHITE);
+		// select a random point on the light cube (close enough for (ro.shape == SHAPE_CYLIN))
+		for (unsigned d = 0; d < 2; ++d) {origin[d] = rgen.rand_uniform(ro.d[d][0], ro.d[d][1]);}
+		origin.z = light_zval;
+		init_cpos = origin; // init value
+		if (!b.ray_cast_interior(origin, pri_dir, bvh, init_cpos, init_cnorm, ccolor)) continue;
+		colorRGBA const init_color(lcolor.modulate_with(ccolor));
+		if (init_color.get_luminance() < 0.1) continue; // done
+		building_light_volume_t &tvol(thread_lvols[omp_get_thread_num_3dw()]);
+
+		for (unsigned splits = 0; splits < NUM_PRI_SPLITS; ++splits) {
+			point pos(origin);
+			vector3d dir(pri_dir);
+			colorRGBA cur_color(init_color);
+			calc_reflect_ray(pos, init_cpos, dir, init_cnorm, rgen, tolerance);
+
+			for (unsigned bounce = 1; bounce < MAX_RAY_BOUNCES; ++bounce) { // allow up to MAX_RAY_BOUNCES bounces
+				cpos = pos; // init value
+				bool const hit(b.ray_cast_interior(pos, dir, bvh, cpos, cnorm, ccolor));
+
+				if (cpos != pos) { // accumulate light along the ray from pos to cpos (which is always valid) with color cur_color
+					point const p1(pos*ray_scale + llc_shift), p2(cpos*ray_scale + llc_shift); // transform building space to global scene space
+					tvol.add_path(p1, p2, weight, cur_color);
+				}
+				if (!hit) break; // done
+				cur_color = cur_color.modulate_with(ccolor);
+				if (cur_color.get_luminance() < 0.1) break; // done
+				calc_reflect_ray(pos, cpos, dir, cnorm, rgen, tolerance);
+			} // for bounce
+		} // for splits
+	} // for n
+	size_t cur_mem(lvol.get_mem_usage());
+	for (auto const &v : thread_lvols) {cur_mem += v.get_mem_usage();}
+	peak_mem = max(peak_mem, cur_mem); // including per-thread volumes
+
+	if (should_stop()) { // incomplete
+		for (auto &v : thread_lvols) {v.clear();}
+		return 0;
+	}
+	for (auto &v : thread_lvols) {lvol.merge_from(v);} // merge in a fixed order
+	return 1;
+}
+
+unsigned get_num_building_rt_threads() {return max(1, (int)NUM_THREADS - (USE_BKG_THREAD ? 1 : 0));} // reserve a thread for the main thread if running in the background
+
+
+// background job queue that precomputes indirect lighting for the nearest buildings other than the one the player is in, ordered by
+// camera distance and heading; completed volumes go into building_light_cache, so entering a prefetched building only needs a texture upload;
+// one building is processed at a time using the same threads as the foreground job, and only while the foreground job is idle
+class building_light_prefetch_t {
+	struct job_t {
+		building_t b; // copy, since the original can be modified or regenerated by the main thread
+		cube_bvh_t bvh;
+		vector<pair<unsigned, room_object_t>> lights; // {object index, light} for lit lights
+		uint64_t key;
+		unsigned bix;
+		float priority;
+		std::atomic<bool> cancel;
+		job_t(building_t const &b_, unsigned bix_, float priority_) : b(b_), key(0), bix(bix_), priority(priority_), cancel(0) {}
+	};
+	struct result_t {
+		std::shared_ptr<building_light_volume_t::compact_t const> vol;
+		uint64_t key;
+		unsigned bix, num_lights, num_bricks;
+		double time_ms;
+		size_t peak_mem, dense_mem;
+	};
+	struct cand_t {
+		building_t const *b;
+		uint64_t key; // 0 if not yet known
+		unsigned bix;
+		float priority;
+		cand_t(building_t const *b_, unsigned bix_, float priority_) : b(b_), key(0), bix(bix_), priority(priority_) {}
+		bool operator<(cand_t const &c) const {return (priority < c.priority);}
+	};
+	typedef std::shared_ptr<job_t> p_job_t;
+
+	std::atomic<bool> const &fg_running;
+	std::atomic<bool> exiting;
+	vector<cand_t> cands; // collected by the main thread each frame
+	map<unsigned, pair<cube_t, uint64_t>> geom_keys; // bix => {bcube, geometry part of the cache key} for buildings in range; bcube is used to detect building regeneration
+	set<uint64_t> handled; // cache keys that are queued, running, or skipped (no lights or over the memory budget); removed when cached or out of range
+	vector<p_job_t> queue; // pending
+	p_job_t cur_job; // running
+	vector<result_t> results; // completed, not yet added to the cache
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable work_cv;
+
+	bool run_job(job_t &job, result_t &res) const;
+	void worker_loop();
+public:
+	building_light_prefetch_t(std::atomic<bool> const &fg_running_) : fg_running(fg_running_), exiting(0) {}
+	~building_light_prefetch_t() {stop();}
+	void stop();
+	void add_cand(building_t const &b, unsigned bix, point const &camera_bs);
+	void update(int cur_bix);
+};
+
+void building_light_prefetch_t::stop() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		exiting = 1;
+		if (cur_job) {cur_job->cancel = 1;}
+		queue.clear();
+	}
+	work_cv.notify_all();
+	if (worker.joinable()) {worker.join();}
+	cur_job.reset();
+	results.clear();
+	geom_keys.clear();
+	handled.clear();
+	exiting = 0; // allow restarting
+}
+
+void building_light_prefetch_t::add_cand(building_t const &b, unsigned bix, point const &camera_bs) {
+	if (building_light_prefetch_count == 0 || !b.has_room_geom() || b.is_rotated() || !b.is_simple_cube()) return; // ray_cast_interior() doesn't support these cases
+	vector3d const dir((b.bcube.get_cube_center() - camera_bs).get_norm());
+	float const dist(p2p_dist(camera_bs, b.bcube.closest_pt(camera_bs))), heading(dot_product(dir, cview_dir)); // heading is in [-1, 1]
+	cands.emplace_back(&b, bix, dist*(1.5f - 0.5f*heading)); // buildings behind the player have up to 2x the distance
+}
+
+void building_light_prefetch_t::update(int cur_bix) { // called by the main thread once per frame
+	vector<result_t> done;
+	std::sort(cands.begin(), cands.end());
+	if (!cands.empty() && (int)cands.front().bix == cur_bix) {cands.erase(cands.begin());} // handled by the foreground job
+	if (cands.size() > building_light_prefetch_count) {cands.erase((cands.begin() + building_light_prefetch_count), cands.end());}
+
+	for (auto i = geom_keys.begin(); i != geom_keys.end();) { // remove buildings that are no longer among the nearest
+		bool in_range(0);
+		for (cand_t const &c : cands) {if (c.bix == i->first) {in_range = 1; break;}}
+		if (in_range) {++i;} else {i = geom_keys.erase(i);}
+	}
+	set<uint64_t> keep;
+
+	for (cand_t &c : cands) { // the full key only needs to iterate over the lights, so light state changes are picked up each frame
+		auto it(geom_keys.find(c.bix));
+		if (it == geom_keys.end() || it->second.first != c.b->bcube) continue; // new or regenerated building; key computed below
+		c.key = calc_building_light_key(*c.b, it->second.second);
+		keep.insert(c.key);
+	}
+	for (auto i = handled.begin(); i != handled.end();) { // remove keys for buildings that left prefetch range or whose lights have changed
+		if (keep.find(*i) == keep.end()) {i = handled.erase(i);} else {++i;}
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		done.swap(results);
+
+		for (unsigned i = 0; i < queue.size(); ++i) { // remove jobs that are no longer needed
+			if (keep.find(queue[i]->key) != keep.end()) continue;
+			std::swap(queue[i], queue.back());
+			queue.pop_back();
+			--i;
+		}
+		if (cur_job && !cur_job->cancel && keep.find(cur_job->key) == keep.end()) {cur_job->cancel = 1;} // cooperative cancel of the running job
+
+		for (auto &q : queue) { // update priorities of pending jobs
+			for (cand_t const &c : cands) {if (c.key == q->key) {q->priority = c.priority; break;}}
+		}
+	}
+	for (result_t const &r : done) {
+		building_light_cache.insert(r.key, r.vol);
+		handled.erase(r.key); // the cache lookup is used from now on
+		cout << "Building " << r.bix << " indir lighting (prefetch): " << r.num_lights << " lights in " << r.time_ms << "ms, volume " << r.num_bricks
+			 << " bricks, peak " << (r.peak_mem >> 10) << "KB (dense lmap " << (r.dense_mem >> 10) << "KB), cached " << (r.vol->get_mem() >> 10) << "KB" << endl;
+	}
+	cand_t const *to_add(nullptr);
+
+	for (cand_t const &c : cands) { // at most one new building per frame, since gathering its cubes and building its bvh takes some time
+		if (c.key == 0 || (handled.find(c.key) == handled.end() && !building_light_cache.contains(c.key))) {to_add = &c; break;}
+	}
+	if (to_add != nullptr) {
+		building_t const &b(*to_add->b);
+		p_job_t job(new job_t(b, to_add->bix, to_add->priority));
+		b.gather_interior_cubes(job->bvh.get_objs());
+		job->bvh.build_tree_top(0); // verbose=0
+		uint64_t const geom_key(calc_building_geom_light_key(b, job->bvh));
+		geom_keys[job->bix] = make_pair(b.bcube, geom_key);
+		job->key = calc_building_light_key(b, geom_key);
+		vector<room_object_t> const &objs(b.interior->room_geom->objs);
+
+		for (auto i = objs.begin(); i != objs.end(); ++i) {
+			if (i->type == TYPE_LIGHT && i->is_lit()) {job->lights.emplace_back((i - objs.begin()), *i);}
+		}
+		bool from_disk(0);
+		bool const is_cached(building_light_cache.lookup(job->key, from_disk) != nullptr); // loads it from disk if needed
+
+		if (!is_cached) {
+			handled.insert(job->key);
+
+			if (!job->lights.empty()) {
+				std::lock_guard<std::mutex> lock(mutex);
+				queue.push_back(job);
+				if (!worker.joinable()) {worker = std::thread(&building_light_prefetch_t::worker_loop, this);}
+				work_cv.notify_one();
+			}
+		}
+	}
+	cands.clear();
+}
+
+void building_light_prefetch_t::worker_loop() {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (1) {
+		work_cv.wait(lock, [this] {return (exiting || !queue.empty());});
+		if (exiting) break;
+		auto best(queue.begin());
+		for (auto i = queue.begin(); i != queue.end(); ++i) {if ((*i)->priority < (*best)->priority) {best = i;}}
+		cur_job = *best;
+		queue.erase(best);
+		p_job_t const job(cur_job);
+		lock.unlock();
+		result_t res;
+		bool const done(run_job(*job, res));
+		lock.lock();
+		cur_job.reset();
+		if (done) {results.push_back(res);}
+	} // while
+}
+
+bool building_light_prefetch_t::run_job(job_t &job, result_t &res) const { // runs in the worker thread
+	typedef std::chrono::steady_clock clock_t; // Note: GET_TIME_MS() can't be called from this thread
+	auto const start_time(clock_t::now());
+	unsigned const xsize(MESH_X_SIZE), ysize(MESH_Y_SIZE), zsize(MESH_SIZE[2]);
+	size_t const max_mem(size_t(building_light_cache_mb) << 20);
+	size_t peak_mem(0);
+	building_light_volume_t lvol;
+	vector<building_light_volume_t> thread_lvols(get_num_building_rt_threads());
+	lvol.init(xsize, ysize, zsize);
+	for (auto &v : thread_lvols) {v.init(xsize, ysize, zsize);}
+	auto should_stop([&job, this]() {return (job.cancel || exiting || fg_running);}); // yield to the foreground job
+
+	for (auto const &light : job.lights) {
+		while (!cast_building_light_rays(job.b, job.bvh, light.second, light.first, lvol, thread_lvols, peak_mem, should_stop)) { // retry if preempted
+			if (job.cancel || exiting) return 0;
+			while (fg_running && !job.cancel && !exiting) {alut_sleep(0.01);}
+		}
+		if (peak_mem > max_mem) return 0; // over the memory budget; let the foreground job compute it if the player enters this building
+	}
+	std::shared_ptr<building_light_volume_t::compact_t> vol(new building_light_volume_t::compact_t);
+	lvol.get_compact(*vol, indir_light_exp);
+	building_light_cache.write_to_disk(job.key, *vol); // thread safe; the memory cache is updated later by the main thread
+	res.vol        = vol;
+	res.key        = job.key;
+	res.bix        = job.bix;
+	res.num_lights = job.lights.size();
+	res.num_bricks = lvol.get_num_bricks();
+	res.time_ms    = std::chrono::duration<double, std::milli>(clock_t::now() - start_time).count();
+	res.peak_mem   = peak_mem;
+	res.dense_mem  = lvol.get_dense_lmap_mem();
+	return 1;
+}
+
+
 class building_indir_light_mgr_t {
-	bool is_running, is_done, kill_thread, lighting_updated, needs_to_join;
+	bool is_done, lighting_updated, needs_to_join;
+	std::atomic<bool> is_running, kill_thread; // also read by the prefetch thread
 	int cur_bix, cur_light;
 	unsigned cur_tid;
+	int start_time;
+	uint64_t cur_key;
 	vector<unsigned char> tex_data;
 	vector<unsigned> light_ids;
 	set<unsigned> lights_complete;
 	cube_bvh_t bvh;
-	lmap_manager_t lmgr;
+	building_light_volume_t lvol;
+	vector<building_light_volume_t> thread_lvols; // per ray tracing thread, merged into lvol in thread order when each light completes
+	size_t peak_lvol_mem;
 	std::thread rt_thread;
+	building_light_prefetch_t prefetch;
 
-	void init_lmgr(bool clear_lighting) {
-		if (clear_lighting) {lmgr.reset_all();}
-		if (lmgr.is_allocated()) return; // already setup
-		unsigned const tot_sz(XY_MULT_SIZE*MESH_SIZE[2]); // Note: MESH_SIZE[2], not MESH_Z_SIZE; want clipped size that lmap uses rather than user-specified size
-		lmcell init_lmcell;
-		lmgr.alloc(tot_sz, MESH_X_SIZE, MESH_Y_SIZE, MESH_SIZE[2], (unsigned char **)nullptr, init_lmcell);
+	void init_lvol() {
+		lvol.init(MESH_X_SIZE, MESH_Y_SIZE, MESH_SIZE[2]); // Note: MESH_SIZE[2], not MESH_Z_SIZE; this must match the size used in indir_tex_mgr_t
+		thread_lvols.resize(get_num_building_rt_threads());
+		for (auto &v : thread_lvols) {v.init(MESH_X_SIZE, MESH_Y_SIZE, MESH_SIZE[2]);}
+		peak_lvol_mem = 0;
+	}
+	bool load_from_cache() {
+		bool from_disk(0);
+		int const t0(GET_TIME_MS());
+		auto const vol(building_light_cache.lookup(cur_key, from_disk));
+		if (!vol || vol->dims[0] != (unsigned)MESH_X_SIZE || vol->dims[1] != (unsigned)MESH_Y_SIZE || vol->dims[2] != (unsigned)MESH_SIZE[2]) return 0;
+		building_light_volume_t::expand_compact(*vol, tex_data);
+		upload_volume_light_texture();
+		is_done = 1;
+		cout << "Building " << cur_bix << " indir lighting: loaded from " << (from_disk ? "disk" : "memory") << " cache in " << (GET_TIME_MS() - t0)
+			 << "ms, " << vol->brick_ixs.size() << " bricks, " << (vol->get_mem() >> 10) << "KB" << endl;
+		return 1;
+	}
+	void store_to_cache() {
+		std::shared_ptr<building_light_volume_t::compact_t> vol(new building_light_volume_t::compact_t);
+		lvol.get_compact(*vol, indir_light_exp);
+		building_light_cache.store(cur_key, vol);
+		cout << "Building " << cur_bix << " indir lighting: " << lights_complete.size() << " lights in " << (GET_TIME_MS() - start_time) << "ms, volume "
+			 << lvol.get_num_bricks() << " bricks, peak " << (peak_lvol_mem >> 10) << "KB (dense lmap " << (lvol.get_dense_lmap_mem() >> 10) << "KB), cached "
+			 << (vol->get_mem() >> 10) << "KB" << endl;
+		lvol.clear(); // no longer needed, since the texture has been updated and the result is cached
 	}
 	void start_lighting_compute(building_t const &b) {
 		assert(cur_light >= 0);
-		init_lmgr(0); // clear_lighting=0
 		is_running = 1;
 		lighting_updated = 1;
 
@@ -192,71 +767,10 @@ class building_indir_light_mgr_t {
 			cast_light_ray(b);
 		}
 	}
-	void calc_reflect_ray(point &pos, point const &cpos, vector3d &dir, vector3d const &cnorm, rand_gen_t &rgen, float tolerance) const {
-		vector3d v_ref;
-		calc_reflection_angle(dir, v_ref, cnorm);
-		v_ref.normalize();
-		vector3d const rand_dir(rgen.signed_rand_vector().get_norm());
-		dir = (v_ref + rand_dir).get_norm(); // diffuse reflection: new dir is mix 50% specular with 50% random
-		if (dot_product(dir, cnorm) < 0.0) {dir.negate();} // make sure it points away from the surface (is this needed?)
-		pos = cpos + tolerance*dir; // move slightly away from the surface
-	}
-	void cast_light_ray(building_t const &b) {
-		// Note: modifies lmgr, but otherwise thread safe
-		unsigned const num_rt_threads(NUM_THREADS - (USE_BKG_THREAD ? 1 : 0)); // reserve a thread for the main thread if running in the background
+	void cast_light_ray(building_t const &b) { // Note: modifies lvol, but otherwise thread safe
 		vector<room_object_t> const &objs(b.interior->room_geom->objs);
 		assert((unsigned)cur_light < objs.size());
-		room_object_t const &ro(objs[cur_light]);
-		colorRGBA const lcolor(ro.get_color());
-		cube_t const scene_bounds(get_scene_bounds_bcube()); // expected by lmap update code
-		point const ray_scale(scene_bounds.get_size()/b.bcube.get_size()), llc_shift(scene_bounds.get_llc() - b.bcube.get_llc()*ray_scale);
-		float const tolerance(1.0E-5*b.bcube.get_max_extent()), light_zval(ro.z1() - 0.01*ro.dz()); // set slightly below bottom of light
-		float const surface_area(ro.dx()*ro.dy() + 2.0f*(ro.dx() + ro.dy())*ro.dz()); // bottom + 4 sides (top is occluded), 0.0003 for houses
-		float weight(100.0f*(surface_area/0.0003f)/LOCAL_RAYS); // normalize to the number of rays
-		if (b.has_pri_hall()) {weight *= 0.8;} // floorplan is open and well lit, indir lighting value seems too high
-		if (b.is_house) {weight *= 2.0;} // houses have dimmer lights and seem to work better with more indir
-		unsigned const NUM_PRI_SPLITS = 16;
-		int const num_rays(LOCAL_RAYS/NUM_PRI_SPLITS);
-
-#pragma omp parallel for schedule(dynamic) num_threads(num_rt_threads)
-		for (int n = 0; n < num_rays; ++n) {
-			if (kill_thread) continue;
-			rand_gen_t rgen;
-			rgen.set_state(n+1, cur_light);
-			vector3d pri_dir(rgen.signed_rand_vector_spherical(1.0).get_norm());
-			pri_dir.z = -fabs(pri_dir.z); // make sure dir points down
-			point origin, init_cpos, cpos;
-			vector3d init_cnorm, cnorm;
-			colorRGBA ccolor(WHITE);
-			// select a random point on the light cube (close enough for (ro.shape == SHAPE_CYLIN))
-			for (unsigned d = 0; d < 2; ++d) {origin[d] = rgen.rand_uniform(ro.d[d][0], ro.d[d][1]);}
-			origin.z = light_zval;
-			init_cpos = origin; // init value
-			if (!b.ray_cast_interior(origin, pri_dir, bvh, init_cpos, init_cnorm, ccolor)) continue;
-			colorRGBA const init_color(lcolor.modulate_with(ccolor));
-			if (init_color.get_luminance() < 0.1) continue; // done
-
-			for (unsigned splits = 0; splits < NUM_PRI_SPLITS; ++splits) {
-				point pos(origin);
-				vector3d dir(pri_dir);
-				colorRGBA cur_color(init_color);
-				calc_reflect_ray(pos, init_cpos, dir, init_cnorm, rgen, tolerance);
-
-				for (unsigned bounce = 1; bounce < MAX_RAY_BOUNCES; ++bounce) { // allow up to MAX_RAY_BOUNCES bounces
-					cpos = pos; // init value
-					bool const hit(b.ray_cast_interior(pos, dir, bvh, cpos, cnorm, ccolor));
-
-					if (cpos != pos) { // accumulate light along the ray from pos to cpos (which is always valid) with color cur_color
-						point const p1(pos*ray_scale + llc_shift), p2(cpos*ray_scale + llc_shift); // transform building space to global scene space
-						add_path_to_lmcs(&lmgr, nullptr, p1, p2, weight, cur_color, LIGHTING_LOCAL, 0); // local light, no bcube
-					}
-					if (!hit) break; // done
-					cur_color = cur_color.modulate_with(ccolor);
-					if (cur_color.get_luminance() < 0.1) break; // done
-					calc_reflect_ray(pos, cpos, dir, cnorm, rgen, tolerance);
-				} // for bounce
-			} // for splits
-		} // for n
+		cast_building_light_rays(b, bvh, objs[cur_light], cur_light, lvol, thread_lvols, peak_lvol_mem, [this]() {return bool(kill_thread);});
 		is_running = 0;
 	}
 	void wait_for_finish(bool force_kill) {
@@ -265,15 +779,25 @@ class building_indir_light_mgr_t {
 		while (is_running) {alut_sleep(0.01);}
 		kill_thread = 0;
 	}
-	void update_volume_light_texture() { // full update, 6.6ms for z=128
+	void upload_volume_light_texture() {
+		unsigned const xsize(MESH_X_SIZE), ysize(MESH_Y_SIZE), zsize(MESH_SIZE[2]);
+		assert(tex_data.size() == 4*xsize*ysize*zsize);
+		if (cur_tid == 0) {cur_tid = create_3d_texture(zsize, xsize, ysize, 4, tex_data, GL_LINEAR, GL_CLAMP_TO_EDGE);} // see indir_light_tex_from_lmap()
+		else {update_3d_texture(cur_tid, 0, 0, 0, zsize, xsize, ysize, 4, tex_data.data());} // stored {Z,X,Y}
+	}
+	void update_volume_light_texture() { // full update; only nonempty bricks are converted
 		//timer_t timer("Lighting Tex Create");
-		indir_light_tex_from_lmap(cur_tid, lmgr, tex_data, MESH_X_SIZE, MESH_Y_SIZE, MESH_SIZE[2], indir_light_exp, 1); // local_only=1
+		building_light_volume_t::compact_t cv;
+		lvol.get_compact(cv, indir_light_exp);
+		building_light_volume_t::expand_compact(cv, tex_data);
+		upload_volume_light_texture();
 	}
 	void maybe_join_thread() {
 		if (needs_to_join) {rt_thread.join(); needs_to_join = 0;}
 	}
 public:
-	building_indir_light_mgr_t() : is_running(0), is_done(0), kill_thread(0), lighting_updated(0), needs_to_join(0), cur_bix(-1), cur_light(-1), cur_tid(0) {}
+	building_indir_light_mgr_t() : is_done(0), lighting_updated(0), needs_to_join(0), is_running(0), kill_thread(0), cur_bix(-1), cur_light(-1), cur_tid(0),
+		start_time(0), cur_key(0), peak_lvol_mem(0), prefetch(is_running) {}
 
 	void clear() {
 		is_done = lighting_updated = 0;
@@ -282,7 +806,8 @@ public:
 		light_ids.clear();
 		lights_complete.clear();
 		end_rt_job();
-		lmgr.reset_all(); // clear lighting values back to 0
+		lvol.clear(); // free lighting values
+		for (auto &v : thread_lvols) {v.clear();}
 		bvh.clear();
 	}
 	void end_rt_job() {
@@ -297,8 +822,11 @@ public:
 			cur_bix = bix;
 			assert(!is_running);
 			build_bvh(b);
+			cur_key    = calc_building_light_key(b, bvh);
+			start_time = GET_TIME_MS();
+			if (!load_from_cache()) {init_lvol();} // revisited buildings don't need to be recomputed
 		}
-		if (cur_tid > 0 && is_done) return; // nothing else to do
+		if (cur_tid > 0 && is_done) {tid = cur_tid; return;} // nothing else to do
 
 		if (display_framerate && (is_running || lighting_updated)) { // show progress to the user
 			std::ostringstream oss;
@@ -320,7 +848,7 @@ public:
 			if (lights_complete.find(*i) == lights_complete.end()) {cur_light = *i; break;} // find an incomplete light
 		}
 		if (cur_light >= 0) {start_lighting_compute(b);} // this light is next
-		else {is_done = 1;} // no more lights to process
+		else {is_done = 1; store_to_cache();} // no more lights to process
 		//cout << "Process light " << lights_complete.size() << " of " << light_ids.size() << endl;
 		tid = cur_tid;
 	}
@@ -330,12 +858,19 @@ public:
 		bvh.build_tree_top(0); // verbose=0
 	}
 	cube_bvh_t const &get_bvh() const {return bvh;}
+	building_light_prefetch_t &get_prefetch() {return prefetch;}
 };
 
 building_indir_light_mgr_t building_indir_light_mgr;
 
 void free_building_indir_texture() {building_indir_light_mgr.free_indir_texture();}
 void end_building_rt_job() {building_indir_light_mgr.end_rt_job();}
+void update_building_indir_light_prefetch(int cur_bix) {building_indir_light_mgr.get_prefetch().update(cur_bix);}
+void end_building_indir_light_prefetch() {building_indir_light_mgr.get_prefetch().stop();}
+
+void building_t::add_indir_light_prefetch_cand(unsigned bix, point const &camera_bs) const {
+	building_indir_light_mgr.get_prefetch().add_cand(*this, bix, camera_bs);
+}
 
 void building_t::create_building_volume_light_texture(unsigned bix, point const &target, unsigned &tid) const {
 	if (!has_room_geom()) return; // error?
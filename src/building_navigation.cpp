@@ -6,6 +6,7 @@
 #include "buildings.h"
 #include "city.h" // for pedestrian_t
 #include <queue>
+#include <mutex>
 #pragma warning(disable : 26812) // prefer enum class over enum
 
 
@@ -37,16 +38,18 @@ class building_nav_graph_t {
 			conn_rooms.emplace_back(room, vector2d(cu.xc(), cu.yc()), vector2d(cd.xc(), cd.yc()));
 		}
 	};
-	struct a_star_node_state_t {
+	struct path_node_state_t {
 		int came_from_ix;
 		point path_pt;
-		float g_score, h_score, f_score;
-		a_star_node_state_t() : came_from_ix(-1), g_score(0), h_score(0), f_score(0) {}
+		path_node_state_t() : came_from_ix(-1) {}
 	};
 
 	unsigned num_rooms, num_stairs;
 	float stairs_extend;
 	vector<node_t> nodes;
+	// lazily filled routing tables indexed by {use_stairs, up_or_down}: next_hop[dest][n] is the next node on the shortest path from n to dest, or -1 if unreachable
+	mutable vector<vector<int>> next_hop[2][2];
+	mutable std::mutex route_mutex;
 	node_t       &get_node(unsigned room)       {assert(room < nodes.size()); return nodes[room];}
 	node_t const &get_node(unsigned room) const {assert(room < nodes.size()); return nodes[room];}
 
@@ -58,6 +61,55 @@ class building_nav_graph_t {
 		}
 		assert(0); // must be found - should not get here
 	}
+	pt_with_ix_t const &get_connection(unsigned from, unsigned to) const {
+		auto const &conn(get_node(from).conn_rooms);
+
+		for (auto i = conn.begin(); i != conn.end(); ++i) {
+			if (i->ix == to) return *i;
+		}
+		assert(0); // must be found - should not get here
+		return conn.front();
+	}
+	void clear_route_tables() {
+		for (unsigned d = 0; d < 4; ++d) {next_hop[d>>1][d&1].clear();}
+	}
+	// Dijkstra's algorithm run backwards from dest, giving the next hop toward dest for every node; costs are in XY only, so this is independent of zval
+	void calc_next_hops(unsigned dest, bool use_stairs, bool up_or_down, vector<int> &next) const {
+		vector<float> dist(nodes.size(), FLT_MAX);
+		std::priority_queue<pair<float, unsigned> > open_queue;
+		next.resize(nodes.size(), -1);
+		dist[dest] = 0.0;
+		open_queue.push(make_pair(0.0f, dest));
+
+		while (!open_queue.empty()) {
+			float const cur_dist(-open_queue.top().first);
+			unsigned const cur(open_queue.top().second);
+			open_queue.pop();
+			if (cur_dist > dist[cur]) continue; // stale queue entry
+			node_t const &cur_node(get_node(cur));
+			if (cur_node.is_stairs && !use_stairs && cur != dest) continue; // stairs can be a path endpoint, but not a path through node in this mode
+			point const center(cur_node.get_center(0.0));
+
+			for (auto i = cur_node.conn_rooms.begin(); i != cur_node.conn_rooms.end(); ++i) {
+				assert(i->ix < nodes.size());
+				vector2d const &pt(i->pt[up_or_down]); // connections are symmetric, so this is also the point used going from i->ix to cur
+				float const new_dist(cur_dist + p2p_dist_xy(center, pt) + p2p_dist_xy(pt, get_node(i->ix).get_center(0.0)));
+				if (new_dist >= dist[i->ix]) continue; // not better
+				dist[i->ix] = new_dist;
+				next[i->ix] = cur;
+				open_queue.push(make_pair(-new_dist, i->ix));
+			} // for i
+		} // end while()
+	}
+	vector<int> const &get_next_hops(unsigned dest, bool use_stairs, bool up_or_down) const {
+		std::lock_guard<std::mutex> lock(route_mutex);
+		vector<vector<int>> &table(next_hop[use_stairs][up_or_down]);
+		if (table.empty()) {table.resize(nodes.size());}
+		assert(dest < table.size());
+		vector<int> &next(table[dest]);
+		if (next.empty()) {calc_next_hops(dest, use_stairs, up_or_down, next);}
+		return next; // never modified once filled, so it can be read after the lock is released
+	}
 public:
 	building_nav_graph_t(float stairs_extend_) : num_rooms(0), num_stairs(0), stairs_extend(stairs_extend_) {}
 
@@ -66,6 +118,7 @@ public:
 		num_stairs = num_stairs_;
 		nodes.resize(num_rooms + num_stairs);
 		for (unsigned n = num_rooms; n < nodes.size(); ++n) {nodes[n].is_stairs = 1;}
+		clear_route_tables();
 	}
 	void set_room_bcube  (unsigned room,   cube_t const &c) {get_node(room).bcube = c;}
 	void set_stairs_bcube(unsigned stairs, cube_t const &c) {get_node(stairs + num_rooms).bcube = c;}
@@ -82,16 +135,19 @@ public:
 		entry_d.d[dim][!dir] = entry_d.d[dim][ dir] - extend; // shrink to zero area at the entrance to the stairs when going down
 		get_node(room).add_conn_room(node_ix2, entry_u, entry_d);
 		n2.add_conn_room(room, entry_u, entry_d);
+		clear_route_tables();
 	}
 	void connect_rooms(unsigned room1, unsigned room2, cube_t const &conn_bcube) { // graph is bidirectional
 		assert(room1 < num_rooms && room2 < num_rooms);
 		get_node(room1).add_conn_room(room2, conn_bcube, conn_bcube);
 		get_node(room2).add_conn_room(room1, conn_bcube, conn_bcube);
+		clear_route_tables();
 	}
 	void disconnect_room_pair(unsigned room1, unsigned room2) { // remove connections in both directions
 		assert(room1 != room2 && room1 < num_rooms && room2 < num_rooms);
 		remove_connection(room1, room2);
 		remove_connection(room2, room1);
+		clear_route_tables();
 	}
 	bool is_room_connected_to(unsigned room1, unsigned room2) const { // Note: likely faster than running full A* algorithm
 		assert(room1 < num_rooms && room2 < num_rooms);
@@ -260,12 +316,12 @@ public:
 	static point closest_room_pt(cube_t const &c, point const &pos) {
 		return point(max(c.x1(), min(c.x2(), pos.x)), max(c.y1(), min(c.y2(), pos.y)), pos.z);
 	}
-	bool reconstruct_path(vector<a_star_node_state_t> const &state, vect_cube_t const &avoid, point const &cur_pt,
+	bool reconstruct_path(vector<path_node_state_t> const &state, vect_cube_t const &avoid, point const &cur_pt,
 		float radius, float height, unsigned start_ix, unsigned end_ix, bool is_first_path, bool up_or_down, vector<point> &path) const
 	{
 		unsigned n(start_ix);
 		rand_gen_t rgen;
-		static unsigned call_ix(1);
+		static std::atomic<unsigned> call_ix(1); // may be called from multiple threads
 		rgen.set_state(start_ix, call_ix++);
 		vect_cube_t keepout;
 
@@ -332,54 +388,30 @@ public:
 		return 0; // never gets here
 	}
 	
-	// A* algorithm; Note: path is stored backwards
+	// uses the cached routing table for room2; Note: path is stored backwards
 	bool find_path_points(unsigned room1, unsigned room2, float radius, float height, bool use_stairs,
 		bool is_first_path, bool up_or_down, vect_cube_t const &avoid, point const &cur_pt, vector<point> &path) const
 	{
 		assert(room1 < nodes.size() && room2 < nodes.size());
 		assert(room1 != room2); // or just return an empty path?
 		path.clear();
-		vector<a_star_node_state_t> state(nodes.size());
-		vector<uint8_t> open(nodes.size(), 0), closed(nodes.size(), 0); // tentative/already evaluated nodes
-		std::priority_queue<pair<float, unsigned> > open_queue;
-		point const dest_pos(get_node(room2).get_center(cur_pt.z)); // Note: approximate, actual dest may be different
-		a_star_node_state_t &start(state[room1]);
-		start.g_score = 0.0;
-		start.h_score = start.f_score = p2p_dist_xy(get_node(room1).get_center(cur_pt.z), dest_pos); // estimated total cost from start to goal through current
-		open[room1]   = 1;
-		open_queue.push(make_pair(-start.f_score, room1));
-
-		while (!open_queue.empty()) {
-			unsigned const cur(open_queue.top().second);
-			open_queue.pop();
-			assert(!closed[cur]);
-			node_t const &cur_node(get_node(cur));
-			point const center(cur_node.get_center(cur_pt.z));
-			assert(!closed[cur]);
-			closed[cur] = 1;
-			open[cur]   = 0;
-
-			for (auto i = cur_node.conn_rooms.begin(); i != cur_node.conn_rooms.end(); ++i) {
-				assert(i->ix < nodes.size());
-				if (closed[i->ix]) continue; // already closed (duplicate)
-				node_t const &conn_node(get_node(i->ix));
-				if (conn_node.is_stairs && !use_stairs && i->ix != room2) continue; // skip stairs in this mode
-				point const conn_center(conn_node.get_center(cur_pt.z));
-				a_star_node_state_t &sn(state[i->ix]);
-				vector2d const &pt(i->pt[up_or_down]);
-				float const new_g_score(sn.g_score + p2p_dist_xy(center, pt) + p2p_dist_xy(pt, conn_center));
-				if (!open[i->ix]) {open[i->ix] = 1;}
-				else if (new_g_score >= sn.g_score) continue; // not better
-				sn.came_from_ix = cur;
-				sn.path_pt.assign(pt.x, pt.y, cur_pt.z);
-				if (i->ix == room2) {return reconstruct_path(state, avoid, cur_pt, radius, height, i->ix, room1, is_first_path, up_or_down, path);} // done, reconstruct path (in reverse)
-				sn.g_score = new_g_score;
-				sn.h_score = p2p_dist_xy(conn_center, dest_pos);
-				sn.f_score = sn.g_score + sn.h_score;
-				open_queue.push(make_pair(-sn.f_score, i->ix));
-			} // for i
-		} // end while()
-		return 0; // failed - no path from room1 to room2
+		vector<int> const &next(get_next_hops(room2, use_stairs, up_or_down));
+		if (next[room1] < 0) return 0; // failed - no path from room1 to room2
+		static thread_local vector<path_node_state_t> state; // per-thread scratch; only nodes along the path are written and read
+		state.resize(nodes.size());
+		state[room1].came_from_ix = -1;
+
+		for (unsigned cur = room1, num_steps = 0; cur != room2; ++num_steps) { // walk the next hops forward, recording came_from links for reconstruct_path()
+			assert(num_steps < nodes.size()); // can't have cycles
+			int const nhop(next[cur]);
+			assert(nhop >= 0 && (unsigned)nhop < nodes.size());
+			vector2d const &pt(get_connection(cur, nhop).pt[up_or_down]);
+			path_node_state_t &sn(state[nhop]);
+			sn.came_from_ix = cur;
+			sn.path_pt.assign(pt.x, pt.y, cur_pt.z);
+			cur = nhop;
+		}
+		return reconstruct_path(state, avoid, cur_pt, radius, height, room2, room1, is_first_path, up_or_down, path); // reconstruct path (in reverse)
 	}
 }; // end building_nav_graph_t
 
@@ -590,7 +622,7 @@ bool building_t::find_route_to_point(point const &from, point const &to, float r
 		if (parts[loc1.part_ix].z1() != parts[loc2.part_ix].z1()) {use_stairs = 1;} // stacked parts
 	}
 	float const floor_spacing(get_window_vspace()), height(0.7*floor_spacing), z2_add(height - radius); // approximate, since we're not tracking actual heights
-	static vect_cube_t avoid; // reuse across frames/people
+	static thread_local vect_cube_t avoid; // reuse across frames/people; per-thread since buildings are updated in parallel
 	interior->get_avoid_cubes(avoid, (from.z - radius), (from.z + z2_add));
 
 	if (use_stairs) { // find path from <from> to nearest stairs, then find path from stairs to <to>
@@ -604,7 +636,7 @@ bool building_t::find_route_to_point(point const &from, point const &to, float r
 			unsigned const stairs_room_ix(*s + interior->rooms.size()); // map to graph space
 			path.clear();
 			vector<point> from_path;
-			// Note: passing use_stairs=0 here because it's unclear if we want to go through stairs nodes in our A* algorithm
+			// Note: passing use_stairs=0 here because it's unclear if we want to go through stairs nodes in our routing
 			if (!interior->nav_graph->find_path_points(loc1.room_ix, stairs_room_ix, radius, height, 0, is_first_path, up_or_down, avoid, from, from_path)) continue; // from => stairs
 			point const seg2_start(interior->nav_graph->get_stairs_entrance_pt(to.z, stairs_room_ix, !up_or_down)); // other end
 			interior->get_avoid_cubes(avoid, (seg2_start.z - radius), (seg2_start.z + z2_add)); // new floor, new zval, new avoid cubes
@@ -817,15 +849,29 @@ void vect_building_t::ai_room_update(vector<building_ai_state_t> &ai_state, vect
 	//timer_t timer("Building People Update"); // ~3.7ms for 50K people, 0.55ms with distance check
 	point const camera_bs(get_camera_building_space());
 	float const dmax(1.5f*(X_SCENE_SIZE + Y_SCENE_SIZE));
-	unsigned const num_people(people.size());
+	unsigned const num_people(people.size()), people_per_job = 256;
 	ai_state.resize(num_people);
+	// people are sorted by building and only interact with others in the same building, so buildings can be updated in parallel;
+	// split into jobs of at least people_per_job people, breaking only at building boundaries
+	vector<unsigned> job_starts;
 
-	for (unsigned i = 0; i < num_people; ++i) {
-		if (!dist_less_than(people[i].pos, camera_bs, dmax)) continue; // too far away, no updates
-		unsigned const bix(people[i].dest_bldg);
-		assert(bix < size());
-		operator[](bix).ai_room_update(ai_state[i], rgen, people, delta_dir, i, STAY_ON_ONE_FLOOR); // dispatch to the correct building
+	for (unsigned i = 0, job_size = 0; i < num_people; ++i, ++job_size) {
+		if (i == 0 || (job_size >= people_per_job && people[i].dest_bldg != people[i-1].dest_bldg)) {job_starts.push_back(i); job_size = 0;}
 	}
+	unsigned const num_jobs(job_starts.size()), rseed(rgen.rand()); // rgen can't be shared across threads, so use it to seed per-building rgens
+	job_starts.push_back(num_people); // add terminator
+
+	run_jobs_parallel(num_jobs, get_city_update_num_threads(), [&](unsigned job, unsigned thread_ix) {
+		rand_gen_t bldg_rgen;
+
+		for (unsigned i = job_starts[job]; i < job_starts[job+1]; ++i) {
+			unsigned const bix(people[i].dest_bldg);
+			assert(bix < size());
+			if (i == job_starts[job] || bix != people[i-1].dest_bldg) {bldg_rgen.set_state(rseed, bix+1);} // new building
+			if (!dist_less_than(people[i].pos, camera_bs, dmax)) continue; // too far away, no updates
+			operator[](bix).ai_room_update(ai_state[i], bldg_rgen, people, delta_dir, i, STAY_ON_ONE_FLOOR); // dispatch to the correct building
+		}
+	});
 }
 
 unsigned room_t::get_floor_containing_zval(float zval, float floor_spacing) const {
@@ -541,6 +541,7 @@ struct colored_cube_t;
 typedef vector<colored_cube_t> vect_colored_cube_t;
 class cube_bvh_t;
 class building_indir_light_mgr_t;
+class building_light_prefetch_t;
 
 struct building_t : public building_geom_t {
 
@@ -558,6 +559,7 @@ struct building_t : public building_geom_t {
 	float ao_bcz2;
 
 	friend class building_indir_light_mgr_t;
+	friend class building_light_prefetch_t;
 
 	building_t(unsigned mat_ix_=0) : mat_ix(mat_ix_), hallway_dim(2), real_num_parts(0), roof_type(ROOF_TYPE_FLAT), is_house(0), has_chimney(0), has_garage(0),
 		has_shed(0), has_courtyard(0), has_complex_floorplan(0), has_helipad(0), side_color(WHITE), roof_color(WHITE), detail_color(BLACK), door_color(WHITE), ao_bcz2(0.0) {}
@@ -599,6 +601,7 @@ struct building_t : public building_geom_t {
 	bool check_point_or_cylin_contained(point const &pos, float xy_radius, vector<point> &points) const;
 	bool ray_cast_interior(point const &pos, vector3d const &dir, cube_bvh_t const &bvh, point &cpos, vector3d &cnorm, colorRGBA &ccolor) const;
 	void create_building_volume_light_texture(unsigned bix, point const &target, unsigned &tid) const;
+	void add_indir_light_prefetch_cand(unsigned bix, point const &camera_bs) const;
 	bool ray_cast_camera_dir(point const &camera_bs, point &cpos, colorRGBA &ccolor) const;
 	void calc_bcube_from_parts();
 	void adjust_part_zvals_for_floor_spacing(cube_t &c) const;
@@ -7,11 +7,13 @@
 #include "explosion.h" // for add_blastr()
 #include "lightmap.h" // for light_source
 #include <cfloat> // for FLT_MAX
+#include <mutex>
 
 float const MIN_CAR_STOP_SEP = 0.25; // in units of car lengths
 
 extern bool tt_fire_button_down;
 extern int display_mode, game_mode, map_mode, animate2;
+extern unsigned NUM_THREADS;
 extern float FAR_CLIP;
 extern point pre_smap_player_pos;
 extern vector<light_source> dl_sources;
@@ -113,7 +115,10 @@ bool car_t::front_intersects_car(car_t const &c) const {
 
 void car_t::honk_horn_if_close() const {
 	point const pos(get_center());
-	if (dist_less_than((pos + get_tiled_terrain_model_xlate()), get_camera_pos(), 1.0)) {gen_sound(SOUND_HORN, pos);}
+	if (!dist_less_than((pos + get_tiled_terrain_model_xlate()), get_camera_pos(), 1.0)) return;
+	static std::mutex sound_mutex; // car update may be run on multiple threads
+	std::lock_guard<std::mutex> lock(sound_mutex);
+	gen_sound(SOUND_HORN, pos);
 }
 
 void car_t::honk_horn_if_close_and_fast() const {
@@ -701,7 +706,7 @@ bool car_manager_t::check_car_for_ped_colls(car_t &car) const {
 	coll_area.d[car.dim][car.dir] += (car.dir ? 1.25 : -1.25)*car.get_length(); // extend the front
 	coll_area.d[!car.dim][0] -= 0.5*car.get_width();
 	coll_area.d[!car.dim][1] += 0.5*car.get_width();
-	static rand_gen_t rgen;
+	static thread_local rand_gen_t rgen;
 
 	for (auto i = peds.begin(); i != peds.end(); ++i) {
 		if (coll_area.contains_pt_xy_exp(i->pos, i->radius)) {
@@ -730,23 +735,43 @@ bool car_manager_t::choose_dest_parked_car(unsigned city_id, unsigned &plot_id,
 	return 0;
 }
 
-void car_manager_t::next_frame(ped_manager_t const &ped_manager, float car_speed) {
-	if (cars.empty() || !animate2) return;
-	// Warning: not really thread safe, but should be okay; the ped state should valid at all points (thought maybe inconsistent) and we don't need it to be exact every frame
-	ped_manager.get_peds_crossing_roads(peds_crossing_roads);
-	//timer_t timer("Update Cars"); // 4K cars = 0.7ms / 2.1ms with destinations + navigation
-#pragma omp critical(modify_car_data)
-	{
-		if (car_destroyed) {remove_destroyed_cars();} // at least one car was destroyed in the previous frame - remove it/them
-		sort(cars.begin(), cars.end(), comp_car_road_then_pos(camera_pdu.pos - dstate.xlate)); // sort by city/road/position for intersection tests and tile shadow map binds
+unsigned const MIN_CARS_PARALLEL_UPDATE = 2000; // below this, thread startup costs more than the update itself
+
+// cars and peds are updated concurrently on their own threads while another thread draws, so each gets half of the remaining threads
+unsigned get_city_update_num_threads() {return max(1U, ((NUM_THREADS > 3) ? (NUM_THREADS - 1)/2 : 1U));}
+
+// runs func(block_ix) for each car block in block_order
+template<typename F> void run_car_blocks_parallel(vector<unsigned> const &block_order, F const &func) {
+	run_jobs_parallel(block_order.size(), get_city_update_num_threads(), [&](unsigned job, unsigned thread_ix) {func(block_order[job]);});
+}
+
+void car_manager_t::sort_cars() { // incremental sort: most cars stay in order from frame to frame, so only re-insert the ones that moved
+	comp_car_road_then_pos const comp(camera_pdu.pos - dstate.xlate);
+	if (std::is_sorted(cars.begin(), cars.end(), comp)) return; // common case for static scenes
+	vector<car_t> moved;
+	unsigned num_kept(0);
+
+	for (unsigned i = 0; i < cars.size(); ++i) { // stable compaction of cars that are still in order with respect to their neighbors
+		bool const in_order((num_kept == 0 || !comp(cars[i], cars[num_kept-1])) && (i+1 == cars.size() || !comp(cars[i+1], cars[i])));
+		if (!in_order) {moved.push_back(cars[i]); continue;}
+		if (num_kept != i) {cars[num_kept] = cars[i];}
+		++num_kept;
 	}
-	entering_city.clear();
+	if (4*moved.size() > cars.size()) { // too many out of order, do a full sort
+		copy(moved.begin(), moved.end(), cars.begin()+num_kept);
+		sort(cars.begin(), cars.end(), comp);
+		return;
+	}
+	sort(moved.begin(), moved.end(), comp);
+	copy(moved.begin(), moved.end(), cars.begin()+num_kept);
+	std::inplace_merge(cars.begin(), cars.begin()+num_kept, cars.end(), comp);
+}
+
+void car_manager_t::build_car_blocks() {
 	car_blocks.clear();
-	float const speed(CAR_SPEED_SCALE*car_speed*fticks);
 	bool saw_parked(0);
-	//unsigned num_on_conn_road(0);
 
-	for (auto i = cars.begin(); i != cars.end(); ++i) { // move cars
+	for (auto i = cars.begin(); i != cars.end(); ++i) {
 		unsigned const cix(i - cars.begin());
 		i->car_in_front = nullptr; // reset for this frame
 
@@ -755,43 +780,110 @@ void car_manager_t::next_frame(ped_manager_t const &ped_manager, float car_speed
 			saw_parked = 0; // reset for next city
 			car_blocks.emplace_back(cix, i->cur_city);
 		}
-		if (i->is_parked()) {
-			if (!saw_parked) {car_blocks.back().first_parked = cix; saw_parked = 1;}
-			continue; // no update for parked cars
-		}
-		i->move(speed);
-		if (i->entering_city) {entering_city.push_back(cix);} // record for use in collision detection
-		if (!i->stopped_at_light && i->is_almost_stopped() && i->in_isect()) {get_car_isec(*i).stoplight.mark_blocked(i->dim, i->dir);} // blocking intersection
-		register_car_at_city(*i);
+		if (i->is_parked() && !saw_parked) {car_blocks.back().first_parked = cix; saw_parked = 1;}
 	} // for i
 	if (!saw_parked && !car_blocks.empty()) {car_blocks.back().first_parked = cars.size();} // no parked cars in final city
 	car_blocks.emplace_back(cars.size(), 0); // add terminator
+}
 
-	for (auto i = cars.begin(); i != cars.end(); ++i) { // collision detection
-		if (i->is_parked()) continue; // no collisions for parked cars
-		bool const on_conn_road(i->cur_city == CONN_CITY_IX);
-		float const length(i->get_length()), max_check_dist(max(3.0f*length, (length + i->get_max_lookahead_dist()))); // max of collision dist and car-in-front dist
-
-		for (auto j = i+1; j != cars.end(); ++j) { // check for collisions with cars on the same road (can't test seg because they can be on diff segs but still collide)
-			if (i->cur_city != j->cur_city || i->cur_road != j->cur_road) break; // different cities or roads
-			if (!on_conn_road && i->cur_road_type == j->cur_road_type && abs((int)i->cur_seg - (int)j->cur_seg) > (on_conn_road ? 1 : 0)) break; // diff road segs or diff isects
-			check_collision(*i, *j);
-			i->register_adj_car(*j);
-			j->register_adj_car(*i);
-			if (!dist_xy_less_than(i->get_center(), j->get_center(), max_check_dist)) break;
+// Note: intersections, stoplights, and city car counts are per-city, and each city is in exactly one block, so blocks can be moved in parallel
+void car_manager_t::move_car_block(unsigned cb_ix, float speed) {
+	assert(cb_ix+1 < car_blocks.size());
+
+	for (unsigned c = car_blocks[cb_ix].start; c < car_blocks[cb_ix].first_parked; ++c) { // parked cars aren't updated
+		car_t &car(cars[c]);
+		car.move(speed);
+		if (!car.stopped_at_light && car.is_almost_stopped() && car.in_isect()) {get_car_isec(car).stoplight.mark_blocked(car.dim, car.dir);} // blocking intersection
+		register_car_at_city(car);
+	}
+}
+
+unsigned car_manager_t::get_turn_dest_city(car_t const &car) const { // city of the road the car will be on after its current intersection
+	road_isec_t const &isec(get_car_isec(car));
+	if (car.turn_dir == TURN_NONE && !isec.is_global_conn_int()) return car.cur_city;
+	return ((isec.rix_xy[isec.get_dest_orient_for_car_in_isec(car, 0)] < 0) ? CONN_CITY_IX : car.cur_city);
+}
+
+// handles all interactions between cars in the same block; interactions that cross into another block are deferred to the serial hand-off phase
+void car_manager_t::collide_car_block(unsigned cb_ix) {
+	assert(cb_ix+1 < car_blocks.size());
+	unsigned const end(car_blocks[cb_ix].first_parked), block_end(car_blocks[cb_ix+1].start);
+	vector<unsigned> &deferred(deferred_turns[cb_ix]);
+	deferred.clear();
+
+	for (unsigned c = car_blocks[cb_ix].start; c < end; ++c) {
+		car_t &car(cars[c]);
+		bool const on_conn_road(car.cur_city == CONN_CITY_IX);
+		float const length(car.get_length()), max_check_dist(max(3.0f*length, (length + car.get_max_lookahead_dist()))); // max of collision dist and car-in-front dist
+
+		for (unsigned c2 = c+1; c2 < block_end; ++c2) { // check for collisions with cars on the same road (can't test seg because they can be on diff segs but still collide)
+			car_t &car2(cars[c2]);
+			if (car.cur_road != car2.cur_road) break; // different roads
+			if (!on_conn_road && car.cur_road_type == car2.cur_road_type && abs((int)car.cur_seg - (int)car2.cur_seg) > 0) break; // diff road segs or diff isects
+			check_collision(car, car2);
+			car .register_adj_car(car2);
+			car2.register_adj_car(car );
+			if (!dist_xy_less_than(car.get_center(), car2.get_center(), max_check_dist)) break;
+		}
+		if (car.in_isect()) {
+			if (get_turn_dest_city(car) == car.cur_city) {
+				int const next_car(find_next_car_after_turn(car)); // Note: calculates in car.car_in_front
+				if (next_car >= 0) {check_collision(car, cars[next_car]);} // make sure we collide with the correct car
+			}
+			else {deferred.push_back(c);} // turning onto a connector road, which is in another block
 		}
-		if (on_conn_road) { // on connector road, check before entering intersection to a city
-			for (auto ix = entering_city.begin(); ix != entering_city.end(); ++ix) {
-				if (*ix != unsigned(i - cars.begin())) {check_collision(*i, cars[*ix]);}
+		if (!peds_crossing_roads.peds.empty()) {check_car_for_ped_colls(car);}
+	} // for c
+}
+
+void car_manager_t::next_frame(ped_manager_t const &ped_manager, float car_speed) {
+	if (cars.empty() || !animate2) return;
+	// Warning: not really thread safe, but should be okay; the ped state should valid at all points (thought maybe inconsistent) and we don't need it to be exact every frame
+	ped_manager.get_peds_crossing_roads(peds_crossing_roads);
+	//timer_t timer("Update Cars"); // 4K cars = 0.7ms / 2.1ms with destinations + navigation
+#pragma omp critical(modify_car_data)
+	{
+		if (car_destroyed) {remove_destroyed_cars();} // at least one car was destroyed in the previous frame - remove it/them
+		sort_cars(); // sort by city/road/position for intersection tests and tile shadow map binds
+	}
+	build_car_blocks();
+	float const speed(CAR_SPEED_SCALE*car_speed*fticks);
+	unsigned const num_blocks(car_blocks.size() - 1); // excludes terminator
+	vector<unsigned> block_order;
+	deferred_turns.resize(num_blocks);
+
+	if (cars.size() >= MIN_CARS_PARALLEL_UPDATE) { // process the largest blocks first for better load balancing
+		for (unsigned b = 0; b < num_blocks; ++b) {block_order.push_back(b);}
+		auto const block_sz([this](unsigned b) {return (car_blocks[b].first_parked - car_blocks[b].start);});
+		sort(block_order.begin(), block_order.end(), [&](unsigned a, unsigned b) {return (block_sz(a) > block_sz(b));});
+	}
+	if (block_order.empty()) { // serial update
+		for (unsigned b = 0; b < num_blocks; ++b) {move_car_block(b, speed);}
+	}
+	else {run_car_blocks_parallel(block_order, [&](unsigned b) {move_car_block(b, speed);});}
+	entering_city.clear();
+
+	for (unsigned c = 0; c < cars.size(); ++c) {
+		if (cars[c].entering_city && !cars[c].is_parked()) {entering_city.push_back(c);} // record for use in collision detection
+	}
+	if (block_order.empty()) {
+		for (unsigned b = 0; b < num_blocks; ++b) {collide_car_block(b);}
+	}
+	else {run_car_blocks_parallel(block_order, [&](unsigned b) {collide_car_block(b);});}
+	// serial hand-off phase for interactions between cars in different blocks (connector roads vs. cities)
+	for (unsigned b = 0; b < num_blocks; ++b) {
+		if (car_blocks[b].cur_city == CONN_CITY_IX) { // on connector road, check before entering intersection to a city
+			for (unsigned c = car_blocks[b].start; c < car_blocks[b].first_parked; ++c) {
+				for (unsigned ix : entering_city) {
+					if (ix != c) {check_collision(cars[c], cars[ix]);}
+				}
 			}
-			//++num_on_conn_road;
 		}
-		if (i->in_isect()) {
-			int const next_car(find_next_car_after_turn(*i)); // Note: calculates in i->car_in_front
-			if (next_car >= 0) {check_collision(*i, cars[next_car]);} // make sure we collide with the correct car
+		for (unsigned c : deferred_turns[b]) {
+			int const next_car(find_next_car_after_turn(cars[c])); // Note: calculates in car_in_front
+			if (next_car >= 0) {check_collision(cars[c], cars[next_car]);}
 		}
-		if (!peds_crossing_roads.peds.empty()) {check_car_for_ped_colls(*i);}
-	} // for i
+	} // for b
 	update_cars(); // run update logic
 
 	if (map_mode) { // create cars_by_road
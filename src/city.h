@@ -11,6 +11,9 @@
 #include "draw_utils.h"
 #include "buildings.h" // for building_occlusion_state_t and obj models
 #include "city_model.h"
+#include "parallel_jobs.h"
+#include <unordered_map>
+#include <cfloat> // for FLT_MAX
 
 using std::string;
 
@@ -567,6 +570,9 @@ public:
 class city_road_gen_t;
 struct pedestrian_t;
 class ped_manager_t;
+class path_finder_t;
+
+unsigned get_city_update_num_threads();
 
 struct ped_city_vect_t {
 	vector<vector<vector<sphere_t>>> peds; // per city per road
@@ -591,6 +597,7 @@ class car_manager_t {
 	car_draw_state_t dstate;
 	rand_gen_t rgen;
 	vector<unsigned> entering_city;
+	vector<vector<unsigned>> deferred_turns; // per car block: cars turning into a different city, handled serially after the parallel update
 	cube_t garages_bcube;
 	unsigned first_parked_car, first_garage_car;
 	bool car_destroyed;
@@ -603,6 +610,11 @@ class car_manager_t {
 	void get_car_ix_range_for_cube(vector<car_block_t>::const_iterator cb, cube_t const &bc, unsigned &start, unsigned &end) const;
 	void remove_destroyed_cars();
 	void update_cars();
+	void sort_cars();
+	void build_car_blocks();
+	void move_car_block(unsigned cb_ix, float speed);
+	void collide_car_block(unsigned cb_ix);
+	unsigned get_turn_dest_city(car_t const &car) const;
 	int find_next_car_after_turn(car_t &car);
 public:
 	car_manager_t(city_road_gen_t const &road_gen_) : road_gen(road_gen_), dstate(car_model_loader), first_parked_car(0), first_garage_car(0), car_destroyed(0) {}
@@ -654,9 +666,7 @@ struct pedestrian_t : public waiting_obj_t {
 	void stop();
 	void go();
 	bool check_for_safe_road_crossing(ped_manager_t const &ped_mgr, cube_t const &plot_bcube, cube_t const &next_plot_bcube, vect_cube_t *dbg_cubes=nullptr) const;
-	bool check_ped_ped_coll_range(vector<pedestrian_t> &peds, unsigned pid, unsigned ped_start, unsigned target_plot, float prox_radius, vector3d &force);
-	bool check_ped_ped_coll(ped_manager_t const &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, float delta_dir);
-	bool check_ped_ped_coll_stopped(vector<pedestrian_t> &peds, unsigned pid);
+	bool check_ped_ped_coll(ped_manager_t const &ped_mgr, unsigned pid, float delta_dir);
 	bool check_inside_plot(ped_manager_t &ped_mgr, point const &prev_pos, cube_t const &plot_bcube, cube_t const &next_plot_bcube);
 	bool check_road_coll(ped_manager_t const &ped_mgr, cube_t const &plot_bcube, cube_t const &next_plot_bcube) const;
 	bool is_valid_pos(vect_cube_t const &colliders, bool &ped_at_dest, ped_manager_t const *const ped_mgr) const;
@@ -664,46 +674,133 @@ struct pedestrian_t : public waiting_obj_t {
 	point get_dest_pos(cube_t const &plot_bcube, cube_t const &next_plot_bcube, ped_manager_t const &ped_mgr) const;
 	bool choose_alt_next_plot(ped_manager_t const &ped_mgr);
 	void get_avoid_cubes(ped_manager_t const &ped_mgr, vect_cube_t const &colliders, point const &dest_pos, vect_cube_t &avoid) const;
-	void next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, rand_gen_t &rgen, float delta_dir);
+	void next_frame(ped_manager_t &ped_mgr, path_finder_t &path_finder, unsigned pid, float delta_dir);
 	void register_at_dest();
 	void destroy() {destroyed = 1;} // that's it, no other effects
 	bool is_close_to_player() const;
 	void debug_draw(ped_manager_t &ped_mgr) const;
 };
 
-unsigned const MAX_PATH_DEPTH = 32;
+unsigned const MAX_PATH_EXPANSIONS  = 256;  // upper bound on A* node expansions per path, which bounds the worst case path finding time
+unsigned const MAX_PATH_CACHE_SIZE  = 4096; // the shared path cache is cleared when it reaches this size
+
+struct path_finder_stats_t {
+	unsigned num_runs, num_cache_hits, num_expanded, max_expanded;
+	path_finder_stats_t() : num_runs(0), num_cache_hits(0), num_expanded(0), max_expanded(0) {}
+	void add(path_finder_stats_t const &s) {num_runs += s.num_runs; num_cache_hits += s.num_cache_hits; num_expanded += s.num_expanded; max_eq(max_expanded, s.max_expanded);}
+};
+
+// complete paths, keyed by {plot, start cell, dest cell}; shared by all path finders and read-only during the parallel ped update;
+// new paths are added serially afterward so that cache hits don't depend on which thread updated which ped
+class path_cache_t {
+public:
+	struct entry_t {
+		uint64_t key;
+		unsigned avoid_hash; // cached paths are only valid for the same set of avoid cubes
+		float length;
+		vector<point> path;
+		entry_t(uint64_t key_, unsigned avoid_hash_, float length_, vector<point> const &path_) : key(key_), avoid_hash(avoid_hash_), length(length_), path(path_) {}
+		bool operator<(entry_t const &e) const; // total order, used to pick one path when several peds add the same key in a frame
+	};
+private:
+	std::unordered_map<uint64_t, entry_t> cache;
+public:
+	entry_t const *find(uint64_t key) const {auto it(cache.find(key)); return ((it == cache.end()) ? nullptr : &it->second);}
+	void add_entries(vector<entry_t> &entries); // sorts and clears entries
+	void clear() {cache.clear();}
+};
 
-class path_finder_t {
+class path_finder_t { // A* over a visibility graph of the expanded corners of the avoid cubes
 	struct path_t : public vector<point> {
 		float length;
 		path_t() : length(0.0) {}
-		path_t(point const &a, point const &b) {init(a, b);} // line constructor
-		void init(point const &a, point const &b) {length = p2p_dist(a, b); push_back(a); push_back(b);}
 		float calc_length_up_to(const_iterator i) const;
 		void calc_length() {length = calc_length_up_to(end());}
-		cube_t calc_bcube() const;
+	};
+	struct node_t {
+		point p;
+		float g, f; // cost from start, estimated total cost through this node
+		int parent;
+		bool closed;
+		node_t(point const &p_) : p(p_), g(FLT_MAX), f(FLT_MAX), parent(-1), closed(0) {}
 	};
 	vect_cube_t avoid;
-	vector<uint8_t> used;
-	path_t path_stack[MAX_PATH_DEPTH];
+	vector<node_t> nodes; // arena of graph nodes, reused across runs
+	vector<pair<float, unsigned>> open_set; // min heap of {f, node_ix}, reused across runs
+	path_cache_t const *path_cache; // may be null
+	vector<path_cache_t::entry_t> new_cache_entries; // paths found since the last call to add_entries()
+	path_finder_stats_t stats;
 	float gap;
 	point pos, dest;
 	cube_t plot_bcube;
-	path_t cur_path, best_path, partial_path;
+	path_t best_path, partial_path;
 	bool debug;
 
-	bool add_pt_to_path(point const &p, path_t &path) const;
-	bool add_pts_around_cube_xy(path_t &path, path_t const &cur_path, path_t::const_iterator p, cube_t const &c, bool dir);
-	void find_best_path_recur(path_t const &cur_path, unsigned depth);
+	void build_path_to_node(unsigned node_ix, path_t &path) const;
 	bool shorten_path(path_t &path) const;
+	unsigned get_avoid_hash() const;
+	uint64_t get_cache_key(unsigned plot_id) const;
+	bool check_cached_path(uint64_t key, unsigned avoid_hash);
 public:
-	path_finder_t(bool debug_=0) : gap(0.0f), debug(debug_) {}
+	path_finder_t(bool debug_=0) : path_cache(nullptr), gap(0.0f), debug(debug_) {}
 	vect_cube_t &get_avoid_vector() {return avoid;}
 	vector<point> const &get_best_path() const {return (found_complete_path() ? best_path : partial_path);}
 	bool found_complete_path() const {return (!best_path.empty());}
 	bool found_path() const {return (found_complete_path() || !partial_path.empty());}
 	bool find_best_path();
-	unsigned run(point const &pos_, point const &dest_, cube_t const &plot_bcube_, float gap_, point &new_dest);
+	unsigned run(point const &pos_, point const &dest_, cube_t const &plot_bcube_, float gap_, point &new_dest, int plot_id=-1);
+	path_finder_stats_t const &get_stats() const {return stats;}
+	void clear_stats() {stats = path_finder_stats_t();}
+	void set_path_cache(path_cache_t const *cache) {path_cache = cache;}
+	vector<path_cache_t::entry_t> &get_new_cache_entries() {return new_cache_entries;}
+};
+
+// start-of-frame copy of the ped state that's read by other peds, so that peds can be updated in parallel without depending on update order
+struct ped_state_t {
+	point pos;
+	vector3d vel;
+	float radius;
+	unsigned plot;
+	ped_state_t(pedestrian_t const &p) : pos(p.pos), vel(p.vel), radius(p.radius), plot(p.plot) {}
+};
+
+class ped_state_grid_t { // uniform grid spatial hash over ped_state_t
+	vector<ped_state_t> state;
+	vector<unsigned> cell_start, ped_ixs; // ped_ixs is sorted by cell, then ped index
+	float cell_sz, inv_cell_sz;
+	unsigned hash_mask;
+
+	int get_cell_coord(float v) const {return int(floor(v*inv_cell_sz));}
+	unsigned get_hash(int x, int y) const {return ((unsigned(x)*73856093U) ^ (unsigned(y)*19349663U)) & hash_mask;}
+public:
+	ped_state_grid_t() : cell_sz(1.0), inv_cell_sz(1.0), hash_mask(0) {}
+	void build(vector<pedestrian_t> const &peds);
+	ped_state_t const &get(unsigned ix) const {assert(ix < state.size()); return state[ix];}
+
+	// calls func(ped_ix) for each ped that may be within search_radius of pos, in a deterministic order; stops early if func returns true
+	template<typename F> bool for_each_near(point const &pos, float search_radius, F const &func) const {
+		if (state.empty()) return 0;
+		int const x1(get_cell_coord(pos.x - search_radius)), x2(get_cell_coord(pos.x + search_radius));
+		int const y1(get_cell_coord(pos.y - search_radius)), y2(get_cell_coord(pos.y + search_radius));
+		unsigned visited[9], num_visited(0);
+		bool const can_dedup((x2 - x1 + 1)*(y2 - y1 + 1) <= 9); // search radius is expected to be no larger than the cell size
+
+		for (int y = y1; y <= y2; ++y) {
+			for (int x = x1; x <= x2; ++x) {
+				unsigned const h(get_hash(x, y));
+
+				if (can_dedup) { // skip hash buckets we've already visited so that no ped is reported twice
+					if (std::find(visited, visited+num_visited, h) != visited+num_visited) continue;
+					visited[num_visited++] = h;
+				}
+				for (unsigned i = cell_start[h]; i < cell_start[h+1]; ++i) {
+					if (func(ped_ixs[i])) return 1;
+				}
+			} // for x
+		} // for y
+		return 0;
+	}
+	float get_cell_size() const {return cell_sz;}
 };
 
 class ped_manager_t { // pedestrians
@@ -722,6 +819,11 @@ class ped_manager_t { // pedestrians
 	vector<unsigned char> need_to_sort_city;
 	vector<car_city_vect_t> cars_by_city;
 	vector<point> bldg_ppl_pos;
+	vector<path_finder_t> path_finders; // one per update thread
+	vector<path_cache_t::entry_t> new_cache_entries; // merged from path_finders
+	path_cache_t path_cache;
+	path_finder_stats_t path_stats; // accumulated across frames until shown
+	ped_state_grid_t ped_grid;
 	rand_gen_t rgen;
 	ao_draw_state_t dstate;
 	int selected_ped_ssn;
@@ -740,13 +842,14 @@ class ped_manager_t { // pedestrians
 		bool &in_sphere_draw, bool shadow_only, bool is_dlight_shadows, bool enable_animations);
 public:
 	// for use in pedestrian_t, mostly for collisions and path finding
-	path_finder_t path_finder;
+	ped_state_grid_t const &get_ped_grid() const {return ped_grid;}
 	vect_cube_t const &get_colliders_for_plot(unsigned city_ix, unsigned plot_ix) const;
 	cube_t const &get_city_plot_bcube_for_peds(unsigned city_ix, unsigned plot_ix) const;
 	cube_t get_expanded_city_bcube_for_peds(unsigned city_ix) const;
 	cube_t get_expanded_city_plot_bcube_for_peds(unsigned city_ix, unsigned plot_ix) const;
 	car_manager_t const &get_car_manager() const {return car_manager;}
 	void choose_new_ped_plot_pos(pedestrian_t &ped);
+	void show_path_finder_stats();
 	bool check_isec_sphere_coll(pedestrian_t const &ped) const;
 	bool check_streetlight_sphere_coll(pedestrian_t const &ped) const;
 	bool mark_crosswalk_in_use(pedestrian_t const &ped);
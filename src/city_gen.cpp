@@ -3112,6 +3112,7 @@ public:
 	}
 	virtual bool enable_lights() const {return (is_night(max(STREETLIGHT_ON_RAND, HEADLIGHT_ON_RAND)) || road_gen.has_tunnels() || flashlight_on);} // only have lights at night
 	void next_ped_animation() {ped_manager.next_animation();}
+	void show_ped_path_finder_stats() {ped_manager.show_path_finder_stats();}
 	void free_context() {car_manager.free_context(); ped_manager.free_context();}
 	unsigned get_model_gpu_mem() const {return (ped_manager.get_model_gpu_mem() + car_manager.get_model_gpu_mem());}
 }; // city_gen_t
@@ -3191,6 +3192,7 @@ bool get_city_color_at_xy(float x, float y, colorRGBA &color) {return city_gen.g
 cube_t get_city_lights_bcube() {return city_gen.get_lights_bcube();}
 unsigned get_city_model_gpu_mem() {return city_gen.get_model_gpu_mem();}
 void next_pedestrian_animation() {city_gen.next_ped_animation();}
+void show_ped_path_finder_stats() {city_gen.show_ped_path_finder_stats();}
 void free_city_context() {city_gen.free_context();}
 bool has_city_trees() {return (city_params.max_trees_per_plot > 0);}
 vector3d get_nom_car_size() {return city_params.get_nom_car_size();}
@@ -4,15 +4,57 @@
 
 #include "3DWorld.h"
 #include "cobj_bsp_tree.h"
+#include "vfloat8.h"
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <cfloat>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH4_USE_SSE
+#include <emmintrin.h>
+#endif
+
+
+unsigned const MAX_LEAF_SIZE      = 2;
+unsigned const SAH_NUM_BINS       = 16;
+unsigned const SAH_MAX_LEAF_SIZE  = 8; // leaves up to this size are created when splitting isn't expected to help
+unsigned const SAH_PARALLEL_DEPTH = 4; // SAH subtrees at this depth are built in parallel
+unsigned const SAH_MIN_PARALLEL   = 1000; // min cobjs for a subtree to be built in parallel
+float const SAH_TRAVERSAL_COST    = 1.0; // relative to the cost of one cobj intersection test
+float const REFIT_REBUILD_COST_RATIO = 1.5; // refit subtrees are rebuilt when their SAH cost grows by this factor
+float const POLY_TOLER            = 1.0E-6;
+float const OVERLAP_AMT           = 0.02;
+
+
+extern bool mt_cobj_tree_build, sah_cobj_tree_build, begin_motion;
+extern int display_mode, frame_counter, cobj_counter, verbose_mode;
+
+
+// query stats per builder type {midpoint, SAH}; only collected in verbose mode
+struct cobj_tree_stats_t {
+	std::atomic<unsigned long long> num_queries, num_node_visits;
+	std::atomic<unsigned> num_builds, build_time_ms, num_refits, num_subtree_rebuilds, refit_time_ms;
+	cobj_tree_stats_t() : num_queries(0), num_node_visits(0), num_builds(0), build_time_ms(0), num_refits(0), num_subtree_rebuilds(0), refit_time_ms(0) {}
+};
+cobj_tree_stats_t cobj_tree_stats[2];
+
+void register_cobj_tree_query(bool sah, unsigned num_visits) {
+	if (!verbose_mode) return;
+	++cobj_tree_stats[sah].num_queries;
+	cobj_tree_stats[sah].num_node_visits += num_visits;
+}
 
-
-unsigned const MAX_LEAF_SIZE = 2;
-float const POLY_TOLER       = 1.0E-6;
-float const OVERLAP_AMT      = 0.02;
-
-
-extern bool mt_cobj_tree_build, begin_motion;
-extern int display_mode, frame_counter, cobj_counter;
+void show_cobj_tree_stats() {
+	for (unsigned sah = 0; sah < 2; ++sah) {
+		cobj_tree_stats_t &s(cobj_tree_stats[sah]);
+		if (s.num_builds == 0 && s.num_queries == 0) continue;
+		cout << (sah ? "SAH" : "Midpoint") << " cobj trees: builds: " << s.num_builds << ", build time: " << s.build_time_ms << "ms, queries: " << s.num_queries
+			 << ", node visits: " << s.num_node_visits << ", per query: " << (s.num_queries ? float(s.num_node_visits)/float(s.num_queries) : 0.0f)
+			 << ", refits: " << s.num_refits << ", subtree rebuilds: " << s.num_subtree_rebuilds << ", refit time: " << s.refit_time_ms << "ms" << endl;
+		s.num_queries = s.num_node_visits = 0; // build stats are kept
+	}
+}
 extern coll_obj_group coll_objects;
 extern vector<unsigned> falling_cobjs;
 extern set<unsigned> moving_cobjs;
@@ -145,6 +187,59 @@ bool cobj_tree_base::node_ix_mgr::check_node(unsigned &nix) const {
 }
 
 
+// SoA line segments for packet traversal, processed as two groups of 8 lanes; the per-lane tmax is the parametric end of the
+// segment, which is reduced as closer hits are found so that farther nodes are culled without recomputing the inverse direction
+struct line_packet_t {
+	float ox[MAX_LINE_PACKET_SIZE], oy[MAX_LINE_PACKET_SIZE], oz[MAX_LINE_PACKET_SIZE];
+	float dx[MAX_LINE_PACKET_SIZE], dy[MAX_LINE_PACKET_SIZE], dz[MAX_LINE_PACKET_SIZE]; // inverse direction
+	float tmax[MAX_LINE_PACKET_SIZE];
+	unsigned active; // lanes that still need to be traversed
+
+	line_packet_t(unsigned num, point const *p1, point const *p2, unsigned active_mask) : active(active_mask & ((1U << num) - 1)) {
+		assert(num > 0 && num <= MAX_LINE_PACKET_SIZE);
+
+		for (unsigned i = 0; i < MAX_LINE_PACKET_SIZE; ++i) {
+			if (i < num) {
+				vector3d dinv(p2[i] - p1[i]);
+				dinv.invert();
+				ox[i] = p1[i].x; oy[i] = p1[i].y; oz[i] = p1[i].z;
+				dx[i] = dinv.x;  dy[i] = dinv.y;  dz[i] = dinv.z;
+				tmax[i] = 1.0;
+			}
+			else { // unused lane; a negative tmax never passes the clip test
+				ox[i] = oy[i] = oz[i] = 0.0;
+				dx[i] = dy[i] = dz[i] = 1.0;
+				tmax[i] = -1.0;
+			}
+		}
+	}
+	static VFLOAT8_INLINE void clip_dim(float const *o, float const *dinv, float lo, float hi, vfloat8 &tmin, vfloat8 &tmax) {
+		vfloat8 const ov(vfloat8::load(o)), dv(vfloat8::load(dinv));
+		vfloat8 const t1((vfloat8(lo) - ov)*dv), t2((vfloat8(hi) - ov)*dv);
+		tmin = vmax(tmin, vmin(t1, t2));
+		tmax = vmin(tmax, vmax(t1, t2));
+	}
+	// returns the lanes in mask with a segment that intersects the cube {lo, hi}
+	unsigned clip_cube(float const lo[3], float const hi[3], unsigned mask) const {
+		unsigned ret(0);
+
+		for (unsigned g = 0; g < MAX_LINE_PACKET_SIZE; g += 8) {
+			if (!((mask >> g) & 0xFF)) continue; // no lanes in this group
+			vfloat8 tmin(0.0f), tmx(vfloat8::load(tmax + g));
+			clip_dim(ox+g, dx+g, lo[0], hi[0], tmin, tmx);
+			clip_dim(oy+g, dy+g, lo[1], hi[1], tmin, tmx);
+			clip_dim(oz+g, dz+g, lo[2], hi[2], tmin, tmx);
+			ret |= (movemask(cmp_lt(tmin, tmx)) << g);
+		}
+		return (ret & mask);
+	}
+	unsigned clip_cube(cube_t const &c, unsigned mask) const {
+		float const lo[3] = {c.x1(), c.y1(), c.z1()}, hi[3] = {c.x2(), c.y2(), c.z2()};
+		return clip_cube(lo, hi, mask);
+	}
+};
+
+
 // *** cobj_tree_simple_type_t ***
 
 
@@ -318,6 +413,60 @@ bool cobj_tree_tquads_t::check_coll_line(point const &p1, point const &p2, point
 }
 
 
+unsigned cobj_tree_tquads_t::check_coll_lines(unsigned num, point const *p1, point const *p2, point *cpos, vector3d *cnorm, colorRGBA *color, int *cindex,
+	int ignore_cobj, bool exact, unsigned active_mask) const
+{
+	if (nodes.empty()) return 0;
+	line_packet_t pk(num, p1, p2, active_mask);
+	unsigned const num_nodes((unsigned)nodes.size());
+	unsigned hits(0), mask(pk.active);
+	static thread_local vector<pair<unsigned, unsigned>> stack; // {subtree end node, parent lane mask}
+	stack.clear();
+
+	for (unsigned nix = 0; nix < num_nodes;) {
+		while (!stack.empty() && nix >= stack.back().first) {mask = stack.back().second; stack.pop_back();} // leaving a subtree
+		mask &= pk.active;
+
+		if (!mask) { // no lanes left in this subtree
+			if (stack.empty()) break; // done
+			nix = stack.back().first;
+			continue;
+		}
+		tree_node const &n(nodes[nix]);
+		unsigned const node_mask(pk.clip_cube(n, mask));
+
+		if (!node_mask) {
+			assert(n.next_node_id > nix);
+			nix = n.next_node_id; // failed the bbox test for all lanes
+			continue;
+		}
+		for (unsigned l = 0; l < num; ++l) {
+			if (!(node_mask & pk.active & (1U << l))) continue;
+
+			for (unsigned i = n.start; i < n.end; ++i) { // check leaves
+				if (ignore_cobj >= 0 && (int)objects[i].cid == ignore_cobj) continue;
+				float t(0.0);
+				vector3d cn;
+				if (!objects[i].line_int_exact(p1[l], p2[l], t, cn, 0.0, pk.tmax[l])) continue;
+				if (cindex) {cindex[l] = objects[i].cid;}
+				if (color ) {color [l] = objects[i].color.get_c4();}
+				cpos [l] = p1[l] + (p2[l] - p1[l])*t;
+				cnorm[l] = cn;
+				hits    |= (1U << l);
+				if (!exact) {pk.active &= ~(1U << l); break;} // first hit is enough for this lane
+				pk.tmax[l] = t;
+			}
+		}
+		if (n.next_node_id > nix+1) { // descend into the subtree with only the lanes that hit this node
+			stack.emplace_back(n.next_node_id, mask);
+			mask = node_mask;
+		}
+		++nix;
+	}
+	return hits;
+}
+
+
 // *** cobj_tree_sphere_t ***
 
 
@@ -396,6 +545,12 @@ void cobj_bvh_tree::clear() {
 
 	cobj_tree_base::clear();
 	cixs.resize(0);
+	nodes4.clear();
+	refit_cids.clear();
+	refit_bcubes.clear();
+	node_parents.clear();
+	subtree_cost.clear();
+	build_cost.clear();
 }
 
 
@@ -404,11 +559,11 @@ void cobj_bvh_tree::add_cobjs(bool verbose) {
 	RESET_TIME;
 	clear();
 	if (!create_cixs()) return; // nothing to be done
-	bool const do_mt_build(mt_cobj_tree_build && cixs.size() > 10000);
+	bool const do_mt_build((mt_cobj_tree_build || sah_cobj_tree_build) && cixs.size() > 10000); // SAH parallel build produces the same tree as the serial build
 	build_tree_from_cixs(do_mt_build);
 
 	if (verbose) {
-		PRINT_TIME(" Cobj Tree Create");
+		PRINT_TIME(sah_cobj_tree_build ? " Cobj Tree Create (SAH)" : " Cobj Tree Create (Midpoint)");
 		cout << "cobjs: " << cobjs->size() << ", leaves: " << cixs.size() << ", nodes: " << nodes.size()
 				<< ", depth: " << max_depth << ", max_leaves: " << max_leaf_count << ", leaf_nodes: " << num_leaf_nodes << endl;
 	}
@@ -418,22 +573,483 @@ void cobj_bvh_tree::add_cobjs(bool verbose) {
 // to be called from within add_cobjs() or after a call to add_cobj_ids()
 void cobj_bvh_tree::build_tree_from_cixs(bool do_mt_build) {
 
+	RESET_TIME;
 	max_depth = max_leaf_count = num_leaf_nodes = 0;
-	nodes.resize(get_conservative_num_nodes(cixs.size()) + 64*do_mt_build); // add 8 extra nodes for each of 8 top level splits
-	unsigned const root(0);
-	nodes[root] = tree_node(0, (unsigned)cixs.size());
+	built_with_sah = sah_cobj_tree_build;
 
-	if (do_mt_build) { // 2x faster build time, 10% slower traversal
-		build_tree_top_level_omp();
+	if (built_with_sah) {
+		build_tree_sah_top(do_mt_build);
 	}
 	else {
-		per_thread_data ptd(1, nodes.size(), 1);
-		build_tree(root, 0, 0, ptd);
-		nodes.resize(ptd.get_next_node_ix());
+		nodes.resize(get_conservative_num_nodes(cixs.size()) + 64*do_mt_build); // add 8 extra nodes for each of 8 top level splits
+		unsigned const root(0);
+		nodes[root] = tree_node(0, (unsigned)cixs.size());
+
+		if (do_mt_build) { // 2x faster build time, 10% slower traversal
+			build_tree_top_level_omp();
+		}
+		else {
+			per_thread_data ptd(1, nodes.size(), 1);
+			build_tree(root, 0, 0, ptd);
+			nodes.resize(ptd.get_next_node_ix());
+		}
+		nodes[root].next_node_id = (unsigned)nodes.size();
+	}
+	build_bvh4_nodes();
+	++cobj_tree_stats[built_with_sah].num_builds;
+	cobj_tree_stats[built_with_sah].build_time_ms += GET_DELTA_TIME;
+}
+
+
+// *** SAH builder ***
+
+inline float get_half_area(cube_t const &c) {
+	vector3d const sz(c.get_size());
+	return (sz.x*sz.y + sz.y*sz.z + sz.z*sz.x);
+}
+inline unsigned get_sah_bin(float v, float lo, float scale) {return min(SAH_NUM_BINS-1, unsigned(max(0.0f, (v - lo)*scale)));}
+
+void cobj_bvh_tree::set_unused_node(unsigned nix, unsigned next_nix) {
+
+	tree_node &n(nodes[nix]);
+	n = tree_node(0, 0);
+	UNROLL_3X(n.d[i_][0] = FLT_MAX; n.d[i_][1] = -FLT_MAX;) // inverted bcube fails all intersection tests
+	n.next_node_id = next_nix;
+}
+
+// every subtree is given a fixed range of 2*num-1 nodes, the max for a binary tree with num leaves;
+// this allows subtrees to be built independently, and the unused nodes are removed afterward
+void cobj_bvh_tree::build_tree_sah_top(bool do_mt_build) {
+
+	unsigned const num(cixs.size());
+	assert(num > 0);
+	nodes.resize(2*num - 1);
+	for (unsigned i = 0; i < nodes.size(); ++i) {set_unused_node(i, i+1);}
+	nodes[0] = tree_node(0, num);
+	vector<unsigned> parallel_jobs;
+	build_tree_sah(0, 0, (do_mt_build ? &parallel_jobs : nullptr));
+
+	#pragma omp parallel for schedule(dynamic,1)
+	for (int i = 0; i < (int)parallel_jobs.size(); ++i) {build_tree_sah(parallel_jobs[i], SAH_PARALLEL_DEPTH, nullptr);}
+	compact_nodes_and_calc_stats();
+}
+
+// binary BVH split using the surface area heuristic with binned cobj centers
+void cobj_bvh_tree::build_tree_sah(unsigned nix, unsigned depth, vector<unsigned> *parallel_jobs) {
+
+	assert(nix < nodes.size());
+	tree_node &n(nodes[nix]);
+	unsigned const num(n.end - n.start), range_end(nix + 2*num - 1);
+	assert(num > 0 && range_end <= nodes.size());
+	if (parallel_jobs && depth == SAH_PARALLEL_DEPTH && num >= SAH_MIN_PARALLEL) {parallel_jobs->push_back(nix); return;} // build later
+	calc_node_bbox(n);
+	n.next_node_id = range_end;
+	if (num <= MAX_LEAF_SIZE) return; // leaf
+	cube_t cbounds; // bounds of cobj centers
+
+	for (unsigned i = n.start; i < n.end; ++i) {
+		point const center(get_cobj(i).get_cube_center());
+		if (i == n.start) {cbounds.set_from_point(center);} else {cbounds.union_with_pt(center);}
+	}
+	struct bin_t {
+		cube_t bc;
+		unsigned count;
+		bin_t() : count(0) {}
+		void add(cube_t const &c) {if (count++ == 0) {bc = c;} else {bc.union_with_cube(c);}}
+	};
+	float const parent_area(max(get_half_area(n), TOLERANCE));
+	float best_cost(FLT_MAX);
+	unsigned best_dim(0), best_bin(0);
+
+	for (unsigned dim = 0; dim < 3; ++dim) {
+		float const lo(cbounds.d[dim][0]), extent(cbounds.get_sz_dim(dim));
+		if (extent <= 0.0) continue; // all centers are the same in this dim
+		float const scale(SAH_NUM_BINS/extent);
+		bin_t bins[SAH_NUM_BINS];
+
+		for (unsigned i = n.start; i < n.end; ++i) {
+			coll_obj const &c(get_cobj(i));
+			bins[get_sah_bin(c.get_cube_center()[dim], lo, scale)].add(c);
+		}
+		float right_cost[SAH_NUM_BINS] = {0}; // count*area for everything right of each bin split
+		bin_t acc;
+
+		for (unsigned b = SAH_NUM_BINS-1; b > 0; --b) {
+			if (bins[b].count > 0) {acc.add(bins[b].bc); acc.count += bins[b].count - 1;}
+			right_cost[b] = (acc.count ? acc.count*get_half_area(acc.bc) : 0.0f);
+		}
+		acc = bin_t();
+
+		for (unsigned b = 0; b+1 < SAH_NUM_BINS; ++b) { // split between bins b and b+1
+			if (bins[b].count > 0) {acc.add(bins[b].bc); acc.count += bins[b].count - 1;}
+			if (acc.count == 0 || acc.count == num) continue; // everything on one side
+			float const cost(SAH_TRAVERSAL_COST + (acc.count*get_half_area(acc.bc) + right_cost[b+1])/parent_area);
+			if (cost < best_cost) {best_cost = cost; best_dim = dim; best_bin = b;}
+		}
+	} // for dim
+	if (best_cost >= num && num <= SAH_MAX_LEAF_SIZE) return; // leaf is cheaper than splitting
+	unsigned num_lo(0);
+
+	if (best_cost < FLT_MAX) {
+		float const lo(cbounds.d[best_dim][0]), scale(SAH_NUM_BINS/cbounds.get_sz_dim(best_dim));
+		auto const mid(std::partition((cixs.begin() + n.start), (cixs.begin() + n.end),
+			[&](unsigned cix) {return (get_sah_bin((*cobjs)[cix].get_cube_center()[best_dim], lo, scale) <= best_bin);}));
+		num_lo = (mid - (cixs.begin() + n.start));
+	}
+	if (num_lo == 0 || num_lo == num) {num_lo = num/2;} // no valid split (centers are all the same); split in half to bound the leaf size
+	unsigned const start(n.start), end(n.end), left(nix + 1), right(nix + 2*num_lo);
+	n.start = n.end = 0; // branch node has no leaves
+	nodes[left ] = tree_node(start, start+num_lo);
+	nodes[right] = tree_node(start+num_lo, end);
+	build_tree_sah(left,  depth+1, parallel_jobs);
+	build_tree_sah(right, depth+1, parallel_jobs);
+}
+
+void cobj_bvh_tree::compact_nodes_and_calc_stats() {
+
+	vector<unsigned> new_ix(nodes.size()+1), range_ends;
+	unsigned num_used(0);
+
+	for (unsigned i = 0; i < nodes.size(); ++i) {
+		new_ix[i] = num_used;
+		if (!is_unused_node(i)) {++num_used;}
+	}
+	new_ix[nodes.size()] = num_used;
+
+	for (unsigned i = 0; i < nodes.size(); ++i) { // Note: new_ix[i] <= i, so this can be done in place
+		if (is_unused_node(i)) continue;
+		assert(nodes[i].next_node_id <= nodes.size());
+		tree_node n(nodes[i]);
+		n.next_node_id = new_ix[n.next_node_id]; // first used node after the skipped range
+		nodes[new_ix[i]] = n;
+	}
+	nodes.resize(num_used);
+
+	for (unsigned i = 0; i < nodes.size(); ++i) { // depth and leaf stats weren't tracked during the (possibly parallel) build
+		while (!range_ends.empty() && i >= range_ends.back()) {range_ends.pop_back();}
+		max_depth = max(max_depth, (unsigned)range_ends.size());
+		range_ends.push_back(nodes[i].next_node_id);
+		if (nodes[i].end > nodes[i].start) {register_leaf(nodes[i].end - nodes[i].start);}
+	}
+}
+
+
+// *** 4-wide node layout ***
+
+cobj_bvh_tree::bvh4_node_t::bvh4_node_t() {
+	for (unsigned s = 0; s < 4; ++s) {
+		UNROLL_3X(bmin[i_][s] = 1.0; bmax[i_][s] = -1.0;)
+		child[s] = 0;
+		num  [s] = 0;
+	}
+}
+
+void cobj_bvh_tree::get_child_nodes(unsigned nix, vector<unsigned> &kids) const {
+
+	kids.clear();
+
+	for (unsigned c = nix+1; c < nodes[nix].next_node_id; c = nodes[c].next_node_id) {
+		assert(nodes[c].next_node_id > c);
+		if (!is_unused_node(c)) {kids.push_back(c);}
+	}
+}
+
+// kids are indices into nodes
+unsigned cobj_bvh_tree::build_bvh4_node(vector<unsigned> &kids) {
+
+	vector<unsigned> sub;
+
+	while (kids.size() < 4) { // fill the node by replacing the largest inner kid with its own kids
+		int best(-1);
+		float best_area(-1.0);
+
+		for (unsigned k = 0; k < kids.size(); ++k) {
+			tree_node const &n(nodes[kids[k]]);
+			if (n.end > n.start) continue; // leaf
+			get_child_nodes(kids[k], sub);
+			if (kids.size() - 1 + sub.size() > 4) continue; // doesn't fit
+			float const area(get_half_area(n));
+			if (area > best_area) {best = k; best_area = area;}
+		}
+		if (best < 0) break; // can't expand any further
+		get_child_nodes(kids[best], sub);
+		kids.erase(kids.begin() + best);
+		kids.insert(kids.end(), sub.begin(), sub.end());
+	} // while
+	unsigned const ix(nodes4.size()), num_slots(min(4U, (unsigned)kids.size()));
+	nodes4.emplace_back();
+
+	for (unsigned s = 0; s < num_slots; ++s) { // more than 4 kids only happens for the 8-way root of the parallel midpoint build; these are grouped
+		unsigned const k1(s*kids.size()/num_slots), k2((s+1)*kids.size()/num_slots);
+		cube_t bc(nodes[kids[k1]]);
+		for (unsigned k = k1+1; k < k2; ++k) {bc.union_with_cube(nodes[kids[k]]);}
+		tree_node const &n(nodes[kids[k1]]);
+		int child(0);
+		unsigned num(0);
+
+		if (k2 - k1 == 1 && n.end > n.start) { // leaf
+			child = ~int(n.start);
+			num   = n.end - n.start;
+		}
+		else {
+			if (k2 - k1 > 1) {sub.assign((kids.begin() + k1), (kids.begin() + k2));} else {get_child_nodes(kids[k1], sub);}
+			child = build_bvh4_node(sub);
+		}
+		bvh4_node_t &node(nodes4[ix]); // Note: must be after the recursive call, which may reallocate nodes4
+		node.set_bounds(s, bc);
+		node.child[s] = child;
+		node.num  [s] = num;
+	} // for s
+	return ix;
+}
+
+void cobj_bvh_tree::build_bvh4_nodes() {
+
+	nodes4.clear();
+	if (nodes.empty()) return;
+	vector<unsigned> kids;
+	if (nodes[0].end > nodes[0].start) {kids.push_back(0);} // root is a leaf
+	else {get_child_nodes(0, kids);}
+	build_bvh4_node(kids);
+}
+
+// returns a 4-bit mask of the child bcubes of n that intersect the line p1 + t*(1/dinv) for t in [0,1], and the entry t for each
+inline unsigned get_line_clip4(float const bmin[3][4], float const bmax[3][4], point const &p1, vector3d const &dinv, float tmin_out[4]) {
+#ifdef BVH4_USE_SSE
+	__m128 tmin(_mm_setzero_ps()), tmax(_mm_set1_ps(1.0f));
+
+	for (unsigned d = 0; d < 3; ++d) {
+		__m128 const p(_mm_set1_ps(p1[d])), di(_mm_set1_ps(dinv[d]));
+		__m128 const t1(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(bmin[d]), p), di)), t2(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(bmax[d]), p), di));
+		tmin = _mm_max_ps(tmin, _mm_min_ps(t1, t2));
+		tmax = _mm_min_ps(tmax, _mm_max_ps(t1, t2));
+	}
+	_mm_storeu_ps(tmin_out, tmin);
+	return _mm_movemask_ps(_mm_cmplt_ps(tmin, tmax));
+#else
+	unsigned mask(0);
+
+	for (unsigned s = 0; s < 4; ++s) {
+		float tmin(0.0), tmax(1.0);
+
+		for (unsigned d = 0; d < 3; ++d) {
+			float const t1((bmin[d][s] - p1[d])*dinv[d]), t2((bmax[d][s] - p1[d])*dinv[d]);
+			tmin = max(tmin, min(t1, t2));
+			tmax = min(tmax, max(t1, t2));
+		}
+		tmin_out[s] = tmin;
+		if (tmin < tmax) {mask |= (1 << s);}
 	}
-	nodes[root].next_node_id = (unsigned)nodes.size();
+	return mask;
+#endif
 }
 
+// returns a 4-bit mask of the child bcubes that intersect cube, with the same toler semantics as cube_t::intersects()
+inline unsigned get_cube_overlap4(float const bmin[3][4], float const bmax[3][4], cube_t const &cube, float toler) {
+#ifdef BVH4_USE_SSE
+	__m128 outside(_mm_setzero_ps());
+
+	for (unsigned d = 0; d < 3; ++d) {
+		outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_load_ps(bmax[d]), _mm_set1_ps(cube.d[d][0] + toler)));
+		outside = _mm_or_ps(outside, _mm_cmpgt_ps(_mm_load_ps(bmin[d]), _mm_set1_ps(cube.d[d][1] - toler)));
+	}
+	return (~_mm_movemask_ps(outside) & 15);
+#else
+	unsigned mask(0);
+
+	for (unsigned s = 0; s < 4; ++s) {
+		bool outside(0);
+		for (unsigned d = 0; d < 3; ++d) {outside |= (bmax[d][s] < (cube.d[d][0] + toler) || bmin[d][s] > (cube.d[d][1] - toler));}
+		if (!outside) {mask |= (1 << s);}
+	}
+	return mask;
+#endif
+}
+
+
+// *** refit ***
+
+// for trees that are updated every frame: refits the tree if cids is the same set of cobjs it was built from, otherwise rebuilds it
+void cobj_bvh_tree::refit_or_rebuild(vector<unsigned> &cids) {
+
+	sort(cids.begin(), cids.end());
+	cids.erase(unique(cids.begin(), cids.end()), cids.end());
+	if (!nodes.empty() && cids == refit_cids) {refit(); return;}
+	clear();
+	if (cids.empty()) return;
+	refit_cids = cids;
+	cixs       = cids;
+	build_tree_from_cixs((mt_cobj_tree_build || sah_cobj_tree_build) && cixs.size() > 10000);
+	calc_refit_data();
+	build_cost = subtree_cost;
+}
+
+// refit version of add_cobjs()
+void cobj_bvh_tree::add_or_refit_cobjs() {
+
+	vector<unsigned> cids;
+	cixs.swap(cids);
+	create_cixs(); // gather the current cobjs
+	cixs.swap(cids);
+	refit_or_rebuild(cids);
+}
+
+float cobj_bvh_tree::get_node_sah_cost(unsigned nix) const { // Note: kid costs must be valid
+
+	tree_node const &n(nodes[nix]);
+	float const area(get_half_area(n));
+	if (n.end > n.start) {return area*(n.end - n.start);} // leaf
+	float cost(area*SAH_TRAVERSAL_COST);
+
+	for (unsigned c = nix+1; c < n.next_node_id; c = nodes[c].next_node_id) {
+		if (!is_unused_node(c)) {cost += subtree_cost[c];}
+	}
+	return cost;
+}
+
+void cobj_bvh_tree::calc_refit_data() {
+
+	node_parents.assign(nodes.size(), -1);
+	subtree_cost.assign(nodes.size(), 0.0);
+	refit_bcubes.resize(cixs.size());
+	for (unsigned i = 0; i < cixs.size(); ++i) {refit_bcubes[i] = get_cobj(i);}
+
+	for (unsigned nix = 0; nix < nodes.size(); ++nix) {
+		if (is_unused_node(nix)) continue;
+		for (unsigned c = nix+1; c < nodes[nix].next_node_id; c = nodes[c].next_node_id) {node_parents[c] = nix;}
+	}
+	for (unsigned nix = nodes.size(); nix-- > 0;) { // bottom-up
+		if (!is_unused_node(nix)) {subtree_cost[nix] = get_node_sah_cost(nix);}
+	}
+}
+
+void cobj_bvh_tree::get_subtree_cix_range(unsigned nix, unsigned &start, unsigned &end) const {
+
+	start = cixs.size(); end = 0;
+
+	for (unsigned c = nix; c < nodes[nix].next_node_id; ++c) { // Note: all nodes in the range are either in the subtree or marked unused
+		if (is_unused_node(c) || nodes[c].end == nodes[c].start) continue;
+		start = min(start, nodes[c].start);
+		end   = max(end,   nodes[c].end);
+	}
+	assert(start < end);
+}
+
+// rebuilds the subtree at nix with the SAH builder in place; returns false if the new subtree needs more nodes than the old one
+bool cobj_bvh_tree::rebuild_subtree(unsigned nix) {
+
+	unsigned const range_end(nodes[nix].next_node_id);
+	unsigned start(0), end(0);
+	get_subtree_cix_range(nix, start, end);
+	unsigned const num(end - start), saved_stats[3] = {max_depth, max_leaf_count, num_leaf_nodes};
+	vector<tree_node> saved_nodes;
+	saved_nodes.swap(nodes);
+	nodes.resize(2*num - 1);
+	for (unsigned i = 0; i < nodes.size(); ++i) {set_unused_node(i, i+1);}
+	nodes[0] = tree_node(start, end);
+	build_tree_sah(0, 0, nullptr); // Note: reorders cixs within [start, end)
+	compact_nodes_and_calc_stats();
+	max_depth = saved_stats[0]; max_leaf_count = saved_stats[1]; num_leaf_nodes = saved_stats[2]; // overwritten by the subtree build
+	saved_nodes.swap(nodes); // saved_nodes is now the new subtree
+	unsigned const num_new(saved_nodes.size());
+	for (unsigned i = start; i < end; ++i) {refit_bcubes[i] = get_cobj(i);}
+	if (nix + num_new > range_end) return 0; // doesn't fit; caller must rebuild the whole tree
+
+	for (unsigned i = 0; i < num_new; ++i) {
+		nodes[nix + i] = saved_nodes[i];
+		nodes[nix + i].next_node_id += nix;
+	}
+	for (unsigned i = nix + num_new; i < range_end; ++i) {set_unused_node(i, range_end);} // fill the unused part of the range
+	nodes[nix].next_node_id = range_end;
+	return 1;
+}
+
+// updates node bounds bottom-up for cobjs that have moved since the last build or refit,
+// then rebuilds subtrees with an SAH cost that has degraded past REFIT_REBUILD_COST_RATIO relative to when they were built
+void cobj_bvh_tree::refit() {
+
+	if (nodes.empty()) return;
+	RESET_TIME;
+	assert(refit_bcubes.size() == cixs.size() && subtree_cost.size() == nodes.size());
+	vector<unsigned char> dirty(nodes.size(), 0);
+	bool any_changed(0);
+
+	for (unsigned nix = 0; nix < nodes.size(); ++nix) { // find leaves with cobjs that have moved
+		tree_node const &n(nodes[nix]);
+		if (n.end == n.start || is_unused_node(nix)) continue;
+
+		for (unsigned i = n.start; i < n.end; ++i) {
+			cube_t const &bc(get_cobj(i));
+			if (bc == refit_bcubes[i]) continue;
+			refit_bcubes[i] = bc;
+			dirty[nix]  = 1;
+			any_changed = 1;
+		}
+	}
+	if (!any_changed) return; // nothing moved
+
+	for (unsigned nix = nodes.size(); nix-- > 0;) { // bottom-up; kids are always after their parent
+		if (!dirty[nix]) continue;
+		tree_node &n(nodes[nix]);
+
+		if (n.end > n.start) {calc_node_bbox(n);} // leaf
+		else { // inner node: union of kids
+			bool first(1);
+
+			for (unsigned c = nix+1; c < n.next_node_id; c = nodes[c].next_node_id) {
+				if (is_unused_node(c)) continue;
+				if (first) {n.copy_from(nodes[c]); first = 0;} else {n.union_with_cube(nodes[c]);}
+			}
+		}
+		subtree_cost[nix] = get_node_sah_cost(nix);
+		if (node_parents[nix] >= 0) {dirty[node_parents[nix]] = 1;}
+	} // for nix
+	vector<pair<unsigned, unsigned>> rebuilt; // node ranges
+	bool full_rebuild(0);
+
+	for (unsigned nix = 0; nix < nodes.size();) { // rebuild the topmost degraded subtrees
+		tree_node const &n(nodes[nix]);
+
+		if (!dirty[nix] || n.end > n.start || is_unused_node(nix) || subtree_cost[nix] <= REFIT_REBUILD_COST_RATIO*build_cost[nix]) {++nix; continue;}
+		if (nix == 0 || !rebuild_subtree(nix)) {full_rebuild = 1; break;}
+		rebuilt.emplace_back(nix, nodes[nix].next_node_id);
+		nix = nodes[nix].next_node_id; // skip the rest of this subtree
+	}
+	if (full_rebuild) { // cixs has the same set of cobjs in a different order
+		build_tree_from_cixs(0);
+		calc_refit_data();
+		build_cost = subtree_cost;
+	}
+	else {
+		if (!rebuilt.empty()) { // update parent links and costs; rebuilt subtrees get new baseline costs
+			calc_refit_data();
+
+			for (auto const &r : rebuilt) {
+				for (unsigned nix = r.first; nix < r.second; ++nix) {build_cost[nix] = subtree_cost[nix];}
+			}
+		}
+		build_bvh4_nodes();
+	}
+	++cobj_tree_stats[built_with_sah].num_refits;
+	cobj_tree_stats[built_with_sah].num_subtree_rebuilds += rebuilt.size();
+	cobj_tree_stats[built_with_sah].refit_time_ms += GET_DELTA_TIME;
+}
+
+
+bool cobj_bvh_tree::skip_cobj_for_line(unsigned i, point const &p1, int ignore_cobj, int test_alpha, float max_alpha,
+	bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const
+{
+	if ((int)cixs[i] == ignore_cobj) return 1;
+	coll_obj const &c(get_cobj(i));
+	if (!obj_ok(c))                  return 1;
+	if (skip_non_drawn  && !c.cp.might_be_drawn())                    return 1;
+	if (skip_movable    && c.is_movable())                            return 1;
+	if (test_alpha == 1 && c.is_semi_trans())                         return 1; // semi-transparent, can see through
+	if (test_alpha == 2 && c.cp.color.alpha <= max_alpha)             return 1; // lower alpha than an earlier object
+	if (test_alpha == 3 && c.cp.color.alpha < MIN_SHADOW_ALPHA)       return 1; // less than min alpha
+	if (skip_init_colls && c.contains_pt(p1) && c.contains_point(p1)) return 1;
+	return 0;
+}
 
 // test_alpha: 0 = allow any alpha value, 1 = require alpha = 1.0, 2 = get intersected cobj with max alpha, 3 = require alpha >= MIN_SHADOW_ALPHA
 bool cobj_bvh_tree::check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex,
@@ -443,25 +1059,15 @@ bool cobj_bvh_tree::check_coll_line(point const &p1, point const &p2, point &cpo
 	bool ret(0);
 	float t(0.0), tmin(0.0), tmax(1.0), max_alpha(0.0);
 	node_ix_mgr nixm(nodes, p1, p2);
-	unsigned const num_nodes((unsigned)nodes.size());
+	unsigned num_visits(0);
 
-	for (unsigned nix = 0; nix < num_nodes;) {
-		tree_node const &n(nodes[nix]);
-		if (!nixm.check_node(nix)) continue; // Note: modifies nix
-
-		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
+	auto check_leaves([&](unsigned start, unsigned end) { // returns true if the query is done
+		for (unsigned i = start; i < end; ++i) {
 			// Note: we test cobj against the original (unclipped) p1 and p2 so that t is correct
 			// Note: we probably don't need to return cnorm and cpos in inexact mode, but it shouldn't be too expensive to do so
-			if ((int)cixs[i] == ignore_cobj) continue;
+			if (skip_cobj_for_line(i, p1, ignore_cobj, test_alpha, max_alpha, skip_non_drawn, skip_init_colls, skip_movable)) continue;
 			coll_obj const &c(get_cobj(i));
-			if (!obj_ok(c))                  continue;
-			if (skip_non_drawn  && !c.cp.might_be_drawn())                    continue;
-			if (skip_movable    && c.is_movable())                            continue;
-			if (test_alpha == 1 && c.is_semi_trans())                         continue; // semi-transparent, can see through
-			if (test_alpha == 2 && c.cp.color.alpha <= max_alpha)             continue; // lower alpha than an earlier object
-			if (test_alpha == 3 && c.cp.color.alpha < MIN_SHADOW_ALPHA)       continue; // less than min alpha
-			if (skip_init_colls && c.contains_pt(p1) && c.contains_point(p1)) continue;
-			if (!c.line_int_exact(p1, p2, t, cnorm, tmin, tmax))              continue;
+			if (!c.line_int_exact(p1, p2, t, cnorm, tmin, tmax)) continue;
 			cindex = cixs[i];
 			cpos   = p1 + (p2 - p1)*t;
 			//if (c.type == COLL_POLYGON && dot_product((p2 - p1), c.norm) < 0.0) {} // back-facing polygon test
@@ -472,11 +1078,98 @@ bool cobj_bvh_tree::check_coll_line(point const &p1, point const &p2, point &cpo
 			tmax = t;
 			ret  = 1;
 		}
+		return 0;
+	});
+	if (!nodes4.empty()) { // 4-wide SIMD traversal
+		static thread_local vector<unsigned> stack;
+		stack.clear();
+		stack.push_back(0);
+
+		while (!stack.empty()) {
+			bvh4_node_t const &n(nodes4[stack.back()]);
+			stack.pop_back();
+			++num_visits;
+			float tnear[4];
+			unsigned const mask(get_line_clip4(n.bmin, n.bmax, p1, nixm.dinv, tnear));
+			unsigned order[4], num_inner(0);
+
+			for (unsigned s = 0; s < 4; ++s) {
+				if (!(mask & (1 << s)) || n.is_empty_slot(s)) continue;
+				if (n.num[s] == 0) {order[num_inner++] = s; continue;} // inner node
+				unsigned const start(~n.child[s]);
+				if (check_leaves(start, start+n.num[s])) {register_cobj_tree_query(built_with_sah, num_visits); return 1;}
+			}
+			// push far children first so that near children are visited first, which shortens the line sooner for exact queries
+			std::sort(order, order+num_inner, [&](unsigned a, unsigned b) {return (tnear[a] > tnear[b]);});
+			for (unsigned i = 0; i < num_inner; ++i) {stack.push_back(n.child[order[i]]);}
+		} // while
 	}
+	else {
+		unsigned const num_nodes((unsigned)nodes.size());
+
+		for (unsigned nix = 0; nix < num_nodes;) {
+			tree_node const &n(nodes[nix]);
+			++num_visits;
+			if (!nixm.check_node(nix)) continue; // Note: modifies nix
+			if (check_leaves(n.start, n.end)) {register_cobj_tree_query(built_with_sah, num_visits); return 1;}
+		}
+	}
+	register_cobj_tree_query(built_with_sah, num_visits);
 	return ret;
 }
 
 
+unsigned cobj_bvh_tree::check_coll_lines(unsigned num, point const *p1, point const *p2, point *cpos, vector3d *cnorm, int *cindex, int ignore_cobj,
+	bool exact, int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable, unsigned active_mask) const
+{
+	if (nodes4.empty()) return 0;
+	line_packet_t pk(num, p1, p2, active_mask);
+	float max_alpha[MAX_LINE_PACKET_SIZE] = {0.0};
+	unsigned hits(0), num_visits(0);
+	static thread_local vector<pair<unsigned, unsigned>> stack; // {node, lane mask}
+	stack.clear();
+	stack.emplace_back(0, pk.active);
+
+	while (!stack.empty() && pk.active) {
+		bvh4_node_t const &n(nodes4[stack.back().first]);
+		unsigned const node_mask(stack.back().second & pk.active); // lanes may have finished since this node was pushed
+		stack.pop_back();
+		if (!node_mask) continue;
+		++num_visits;
+
+		for (unsigned s = 0; s < 4; ++s) {
+			if (n.is_empty_slot(s)) continue;
+			float const lo[3] = {n.bmin[0][s], n.bmin[1][s], n.bmin[2][s]}, hi[3] = {n.bmax[0][s], n.bmax[1][s], n.bmax[2][s]};
+			unsigned const mask(pk.clip_cube(lo, hi, (node_mask & pk.active)));
+			if (!mask) continue;
+			if (n.num[s] == 0) {stack.emplace_back(n.child[s], mask); continue;} // inner node
+			unsigned const start(~n.child[s]), end(start + n.num[s]);
+
+			for (unsigned l = 0; l < num; ++l) {
+				if (!(mask & pk.active & (1U << l))) continue;
+
+				for (unsigned i = start; i < end; ++i) { // check leaves
+					if (skip_cobj_for_line(i, p1[l], ignore_cobj, test_alpha, max_alpha[l], skip_non_drawn, skip_init_colls, skip_movable)) continue;
+					coll_obj const &c(get_cobj(i));
+					float t(0.0);
+					vector3d cn;
+					if (!c.line_int_exact(p1[l], p2[l], t, cn, 0.0, pk.tmax[l])) continue;
+					cindex[l] = cixs[i];
+					cpos  [l] = p1[l] + (p2[l] - p1[l])*t;
+					cnorm [l] = cn;
+					hits     |= (1U << l);
+					if (!exact && test_alpha != 2) {pk.active &= ~(1U << l); break;} // first hit is enough for this lane
+					max_alpha[l] = c.cp.color.alpha;
+					pk.tmax  [l] = t;
+				}
+			} // for l
+		} // for s
+	} // while
+	register_cobj_tree_query(built_with_sah, num_visits);
+	return hits;
+}
+
+
 bool cobj_bvh_tree::check_point_contained(point const &p, int &cindex) const {
 
 	unsigned const num_nodes((unsigned)nodes.size());
@@ -502,18 +1195,10 @@ bool cobj_bvh_tree::check_point_contained(point const &p, int &cindex) const {
 void cobj_bvh_tree::get_intersecting_cobjs(cube_t const &cube, vector<unsigned> &cobjs,
 	int ignore_cobj, float toler, bool check_ccounter, int id_for_cobj_int) const
 {
-	unsigned const num_nodes((unsigned)nodes.size());
-
-	for (unsigned nix = 0; nix < num_nodes;) {
-		tree_node const &n(nodes[nix]);
-		assert(n.start <= n.end);
+	unsigned num_visits(0);
 
-		if (!cube.intersects(n, toler)) {
-			assert(n.next_node_id > nix);
-			nix = n.next_node_id; // failed the bbox test
-			continue;
-		}
-		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
+	auto check_leaves([&](unsigned start, unsigned end) {
+		for (unsigned i = start; i < end; ++i) {
 			if ((int)cixs[i] == ignore_cobj) continue;
 			coll_obj const &c(get_cobj(i));
 			if (check_ccounter && c.counter == cobj_counter) continue;
@@ -521,8 +1206,43 @@ void cobj_bvh_tree::get_intersecting_cobjs(cube_t const &cube, vector<unsigned>
 			if (id_for_cobj_int >= 0 && coll_objects[id_for_cobj_int].intersects_cobj(c, toler) != 1) continue;
 			cobjs.push_back(cixs[i]);
 		}
-		++nix;
+	});
+	if (!nodes4.empty()) { // 4-wide SIMD traversal
+		static thread_local vector<unsigned> stack;
+		stack.clear();
+		stack.push_back(0);
+
+		while (!stack.empty()) {
+			bvh4_node_t const &n(nodes4[stack.back()]);
+			stack.pop_back();
+			++num_visits;
+			unsigned const mask(get_cube_overlap4(n.bmin, n.bmax, cube, toler));
+
+			for (unsigned s = 0; s < 4; ++s) {
+				if (!(mask & (1 << s)) || n.is_empty_slot(s)) continue;
+				if (n.num[s] == 0) {stack.push_back(n.child[s]);} // inner node
+				else {check_leaves(~n.child[s], (~n.child[s] + n.num[s]));}
+			}
+		}
+	}
+	else {
+		unsigned const num_nodes((unsigned)nodes.size());
+
+		for (unsigned nix = 0; nix < num_nodes;) {
+			tree_node const &n(nodes[nix]);
+			assert(n.start <= n.end);
+			++num_visits;
+
+			if (!cube.intersects(n, toler)) {
+				assert(n.next_node_id > nix);
+				nix = n.next_node_id; // failed the bbox test
+				continue;
+			}
+			check_leaves(n.start, n.end);
+			++nix;
+		}
 	}
+	register_cobj_tree_query(built_with_sah, num_visits);
 }
 
 
@@ -665,7 +1385,7 @@ void cobj_bvh_tree::build_tree_top_level_omp() { // single octtree level
 		build_tree(kid, ((count == num) ? 7 : 0), 1, ptd); // if all in one bin, make that bin a leaf
 		unsigned const next_kid(ptd.get_next_node_ix());
 		assert(next_kid <= end_nix);
-		if (next_kid < end_nix) {nodes[next_kid].next_node_id = end_nix;} // close the gap of unused nodes
+		for (unsigned i = next_kid; i < end_nix; ++i) {set_unused_node(i, end_nix);} // close the gap of unused nodes
 		nodes[kid].next_node_id = end_nix;
 	}
 	nodes.resize(cur_nix);
@@ -754,17 +1474,51 @@ void cobj_bvh_tree::build_tree(unsigned nix, unsigned skip_dims, unsigned depth,
 cobj_bvh_tree cobj_tree_static (&coll_objects, 1, 0, 0, 0, 0); // does not include voxels
 cobj_bvh_tree cobj_tree_dynamic(&coll_objects, 0, 1, 0, 0, 0);
 cobj_bvh_tree cobj_tree_occlude(&coll_objects, 1, 0, 1, 0, 0);
-cobj_bvh_tree cobj_tree_static_moving(&coll_objects, 1, 0, 0, 0, 0);
 //cobj_tree_tquads_t cobj_tree_triangles;
 
 
+// The static moving tree is updated every frame by the main thread and is also read by ray trace lighting threads, so it's double buffered:
+// the back tree is refit or rebuilt and then published as the front tree, and readers pin the front tree for the duration of each query
+class static_moving_cobj_tree_t {
+	cobj_bvh_tree trees[2];
+	std::atomic<unsigned> front_ix, num_readers[2];
+
+public:
+	static_moving_cobj_tree_t() : trees{cobj_bvh_tree(&coll_objects, 1, 0, 0, 0, 0), cobj_bvh_tree(&coll_objects, 1, 0, 0, 0, 0)}, front_ix(0) {
+		num_readers[0] = num_readers[1] = 0;
+	}
+	class reader_t {
+		static_moving_cobj_tree_t &smt;
+		unsigned ix;
+	public:
+		reader_t(static_moving_cobj_tree_t &smt_) : smt(smt_) {
+			while (1) {
+				ix = smt.front_ix;
+				++smt.num_readers[ix];
+				if (smt.front_ix == ix) break; // still the front tree, so the writer won't modify it until we're done
+				--smt.num_readers[ix]; // swapped after we read front_ix; try again
+			}
+		}
+		~reader_t() {--smt.num_readers[ix];}
+		cobj_bvh_tree const &get() const {return smt.trees[ix];}
+	};
+	void update(vector<unsigned> &cids) { // main thread only
+		unsigned const back_ix(1 - front_ix);
+		while (num_readers[back_ix] > 0) {std::this_thread::yield();} // wait for queries that started before the last swap
+		trees[back_ix].refit_or_rebuild(cids);
+		front_ix = back_ix; // publish
+	}
+};
+
+static_moving_cobj_tree_t cobj_tree_static_moving;
+
+
 cobj_bvh_tree &get_tree(bool dynamic) {
 	return (dynamic ? cobj_tree_dynamic : cobj_tree_static);
 }
 
 void build_static_moving_cobj_tree() {
 
-	cobj_tree_static_moving.clear();
 	vector<unsigned> moving_cids(falling_cobjs);
 		
 	for (auto i = moving_cobjs.begin(); i != moving_cobjs.end(); ++i) {
@@ -773,10 +1527,7 @@ void build_static_moving_cobj_tree() {
 	for (platform_cont::const_iterator i = platforms.begin(); i != platforms.end(); ++i) {
 		copy(i->cobjs.begin(), i->cobjs.end(), back_inserter(moving_cids));
 	}
-	if (!moving_cids.empty()) {
-		cobj_tree_static_moving.add_cobj_ids(moving_cids);
-		cobj_tree_static_moving.build_tree_from_cixs(0);
-	}
+	cobj_tree_static_moving.update(moving_cids); // refits if the set of moving cobjs is unchanged
 }
 
 void build_cobj_tree(bool dynamic, bool verbose) {
@@ -788,7 +1539,7 @@ void build_cobj_tree(bool dynamic, bool verbose) {
 		//cobj_tree_triangles.add_cobjs(coll_objects, verbose);
 	}
 	else { // dynamic
-		if (begin_motion) {get_tree(1).add_cobjs(verbose);}
+		if (begin_motion) {get_tree(1).add_or_refit_cobjs();}
 		//build_static_moving_cobj_tree();
 	}
 }
@@ -800,11 +1551,37 @@ bool check_coll_line_exact_tree(point const &p1, point const &p2, point &cpos, v
 	cindex = -1;
 	//return cobj_tree_triangles.check_coll_line(p1, p2, cpos, cnorm, cindex, ignore_cobj, 1);
 	bool ret(get_tree(dynamic).check_coll_line(p1, p2, cpos, cnorm, cindex, ignore_cobj, 1, test_alpha, skip_non_drawn, skip_init_colls, skip_movable));
-	if (!dynamic && !no_stat_moving) {ret |= cobj_tree_static_moving.check_coll_line(p1, (ret ? cpos : p2), cpos, cnorm, cindex, ignore_cobj, 1, test_alpha, skip_non_drawn, skip_init_colls, skip_movable);}
+	if (!dynamic && !no_stat_moving) {
+		static_moving_cobj_tree_t::reader_t const smt(cobj_tree_static_moving);
+		ret |= smt.get().check_coll_line(p1, (ret ? cpos : p2), cpos, cnorm, cindex, ignore_cobj, 1, test_alpha, skip_non_drawn, skip_init_colls, skip_movable);
+	}
 	if (!dynamic && include_voxels) {ret |= check_voxel_coll_line(p1, (ret ? cpos : p2), cpos, cnorm, cindex, ignore_cobj, 1);}
 	return ret;
 }
 
+// packet version of check_coll_line_exact_tree() for static cobjs; returns a bit mask of the lines that hit something
+unsigned check_coll_lines_exact_tree(unsigned num, point const *p1, point const *p2, point *cpos, vector3d *cnorm, int *cindex, int ignore_cobj,
+	int test_alpha, bool include_voxels, bool skip_init_colls, bool no_stat_moving)
+{
+	assert(num > 0 && num <= MAX_LINE_PACKET_SIZE);
+	unsigned const all_lanes((1U << num) - 1);
+	for (unsigned i = 0; i < num; ++i) {cindex[i] = -1;}
+	unsigned hits(get_tree(0).check_coll_lines(num, p1, p2, cpos, cnorm, cindex, ignore_cobj, 1, test_alpha, 0, skip_init_colls, 0, all_lanes));
+
+	if (!no_stat_moving) {
+		point end_pts[MAX_LINE_PACKET_SIZE];
+		for (unsigned i = 0; i < num; ++i) {end_pts[i] = ((hits & (1U << i)) ? cpos[i] : p2[i]);} // shorten to the closest hit
+		static_moving_cobj_tree_t::reader_t const smt(cobj_tree_static_moving);
+		hits |= smt.get().check_coll_lines(num, p1, end_pts, cpos, cnorm, cindex, ignore_cobj, 1, test_alpha, 0, skip_init_colls, 0, all_lanes);
+	}
+	if (include_voxels) { // voxels have their own structure, so these are tested one line at a time
+		for (unsigned i = 0; i < num; ++i) {
+			if (check_voxel_coll_line(p1[i], ((hits & (1U << i)) ? cpos[i] : p2[i]), cpos[i], cnorm[i], cindex[i], ignore_cobj, 1)) {hits |= (1U << i);}
+		}
+	}
+	return hits;
+}
+
 // can use with snow shadows, grass shadows, tree leaf shadows
 bool check_coll_line_tree(point const &p1, point const &p2, int &cindex, int ignore_cobj, bool dynamic,
 	int test_alpha, bool skip_non_drawn, bool include_voxels, bool skip_init_colls, bool skip_movable)
@@ -813,7 +1590,10 @@ bool check_coll_line_tree(point const &p1, point const &p2, int &cindex, int ign
 	point cpos; // unused
 	cindex = -1;
 	if (get_tree(dynamic).check_coll_line(p1, p2, cpos, cnorm, cindex, ignore_cobj, 0, test_alpha, skip_non_drawn, skip_init_colls, skip_movable)) return 1;
-	if (!dynamic && cobj_tree_static_moving.check_coll_line(p1, p2, cpos, cnorm, cindex, ignore_cobj, 0, test_alpha, skip_non_drawn, skip_init_colls, skip_movable)) return 1;
+	if (!dynamic) {
+		static_moving_cobj_tree_t::reader_t const smt(cobj_tree_static_moving);
+		if (smt.get().check_coll_line(p1, p2, cpos, cnorm, cindex, ignore_cobj, 0, test_alpha, skip_non_drawn, skip_init_colls, skip_movable)) return 1;
+	}
 	if (!dynamic && include_voxels && check_voxel_coll_line(p1, p2, cpos, cnorm, cindex, ignore_cobj, 0)) return 1;
 	return 0;
 }
@@ -823,7 +1603,7 @@ void get_intersecting_cobjs_tree(cube_t const &cube, vector<unsigned> &cobjs, in
 	bool dynamic, bool check_ccounter, int id_for_cobj_int)
 {
 	get_tree(dynamic).get_intersecting_cobjs(cube, cobjs, ignore_cobj, toler, check_ccounter, id_for_cobj_int);
-	if (!dynamic) {cobj_tree_static_moving.get_intersecting_cobjs(cube, cobjs, ignore_cobj, toler, check_ccounter, id_for_cobj_int);}
+	if (!dynamic) {static_moving_cobj_tree_t::reader_t const smt(cobj_tree_static_moving); smt.get().get_intersecting_cobjs(cube, cobjs, ignore_cobj, toler, check_ccounter, id_for_cobj_int);}
 }
 
 // used in cobj_contained_ref() for grass occlusion
@@ -836,19 +1616,22 @@ void get_coll_line_cobjs_tree(point const &pos1, point const &pos2, int ignore_c
 	vector<int> *cobjs, cobj_query_callback *cqc, bool dynamic, bool occlude, bool do_expand)
 {
 	(occlude ? cobj_tree_occlude : get_tree(dynamic)) .get_coll_line_cobjs(pos1, pos2, ignore_cobj, cobjs, cqc, do_expand);
-	if (!dynamic && !occlude) {cobj_tree_static_moving.get_coll_line_cobjs(pos1, pos2, ignore_cobj, cobjs, cqc, do_expand);}
+	if (!dynamic && !occlude) {static_moving_cobj_tree_t::reader_t const smt(cobj_tree_static_moving); smt.get().get_coll_line_cobjs(pos1, pos2, ignore_cobj, cobjs, cqc, do_expand);}
 }
 
 // used in vert_coll_detector for object collision detection
 void get_coll_sphere_cobjs_tree(point const &center, float radius, int cobj, vert_coll_detector &vcd, bool dynamic) {
 	get_tree(dynamic).get_coll_sphere_cobjs(center, radius, cobj, vcd);
-	if (!dynamic) {cobj_tree_static_moving.get_coll_sphere_cobjs(center, radius, cobj, vcd);}
+	if (!dynamic) {static_moving_cobj_tree_t::reader_t const smt(cobj_tree_static_moving); smt.get().get_coll_sphere_cobjs(center, radius, cobj, vcd);}
 	if (!dynamic) {get_voxel_coll_sphere_cobjs(center, radius, cobj, vcd);}
 }
 
 bool check_point_contained_tree(point const &p, int &cindex, bool dynamic) { // Note: doesn't test voxels
 	if (get_tree(dynamic).check_point_contained(p, cindex)) return 1;
-	if (!dynamic && cobj_tree_static_moving.check_point_contained(p, cindex)) return 1;
+	if (!dynamic) {
+		static_moving_cobj_tree_t::reader_t const smt(cobj_tree_static_moving);
+		if (smt.get().check_point_contained(p, cindex)) return 1;
+	}
 	return 0;
 }
 
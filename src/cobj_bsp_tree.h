@@ -5,6 +5,10 @@
 
 #include "physics_objects.h"
 
+unsigned const MAX_LINE_PACKET_SIZE = 16; // max lines per check_coll_lines() call; hit results are returned as a bit mask
+
+struct line_packet_t;
+
 
 class cobj_tree_base {
 
@@ -75,6 +79,9 @@ public:
 	void add_cobjs(coll_obj_group const &cobjs, bool verbose);
 	void add_polygons(vector<polygon_t> const &polygons, bool verbose);
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, colorRGBA *color, int *cindex, int ignore_cobj, bool exact) const;
+	// packet version for coherent lines; only lanes set in active_mask are tested, and only hit lanes are written
+	unsigned check_coll_lines(unsigned num, point const *p1, point const *p2, point *cpos, vector3d *cnorm, colorRGBA *color, int *cindex,
+		int ignore_cobj, bool exact, unsigned active_mask) const;
 
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj, bool exact) const {
 		cindex = -1;
@@ -108,7 +115,22 @@ class cobj_bvh_tree : public cobj_tree_base {
 
 	coll_obj_group const *cobjs;
 	vector<unsigned> cixs;
-	bool is_static, is_dynamic, occluders_only, cubes_only, inc_voxel_cobjs;
+	bool is_static, is_dynamic, occluders_only, cubes_only, inc_voxel_cobjs, built_with_sah;
+
+	struct alignas(64) bvh4_node_t { // flattened 4-wide node for SIMD traversal; size = 128
+		float bmin[3][4], bmax[3][4]; // child bounds, one array of 4 per dim
+		int child[4];   // >= 0: index of inner child node; < 0: leaf with cixs start index ~child
+		unsigned num[4]; // number of leaf objects; 0 for inner children
+		bvh4_node_t();
+		bool is_empty_slot(unsigned s) const {return (child[s] == 0 && num[s] == 0);} // the root can't be a child
+		void set_bounds(unsigned s, cube_t const &c) {UNROLL_3X(bmin[i_][s] = c.d[i_][0]; bmax[i_][s] = c.d[i_][1];)}
+	};
+	vector<bvh4_node_t> nodes4; // used by check_coll_line() and get_intersecting_cobjs(); built from nodes
+	// refit data, for trees updated with refit_or_rebuild()
+	vector<unsigned> refit_cids; // sorted cobj IDs the tree was built from
+	vector<cube_t> refit_bcubes; // cobj bcubes at the last build or refit, per cixs entry
+	vector<int> node_parents;
+	vector<float> subtree_cost, build_cost; // SAH cost of each subtree: current and at build time
 
 	struct per_thread_data {
 		vector<unsigned> temp_bins[3];
@@ -128,6 +150,20 @@ class cobj_bvh_tree : public cobj_tree_base {
 	void calc_node_bbox(tree_node &n) const;
 	void build_tree_top_level_omp();
 	void build_tree(unsigned nix, unsigned skip_dims, unsigned depth, per_thread_data &ptd);
+	void build_tree_sah_top(bool do_mt_build);
+	void build_tree_sah(unsigned nix, unsigned depth, vector<unsigned> *parallel_jobs);
+	void set_unused_node(unsigned nix, unsigned next_nix);
+	bool is_unused_node(unsigned nix) const {return (nodes[nix].x1() > nodes[nix].x2());}
+	void compact_nodes_and_calc_stats();
+	void get_child_nodes(unsigned nix, vector<unsigned> &kids) const;
+	unsigned build_bvh4_node(vector<unsigned> &kids);
+	void build_bvh4_nodes();
+	float get_node_sah_cost(unsigned nix) const;
+	void calc_refit_data();
+	void get_subtree_cix_range(unsigned nix, unsigned &start, unsigned &end) const;
+	bool rebuild_subtree(unsigned nix);
+	void refit();
+	bool skip_cobj_for_line(unsigned i, point const &p1, int ignore_cobj, int test_alpha, float max_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const;
 
 	bool obj_ok(coll_obj const &c) const {
 		return (((is_static && c.status == COLL_STATIC) || (is_dynamic && c.status == COLL_DYNAMIC) || (!is_static && !is_dynamic)) &&
@@ -137,15 +173,20 @@ class cobj_bvh_tree : public cobj_tree_base {
 
 public:
 	cobj_bvh_tree(coll_obj_group const *cobjs_, bool s, bool d, bool o, bool c, bool v)
-		: cobjs(cobjs_), is_static(s), is_dynamic(d), occluders_only(o), cubes_only(c), inc_voxel_cobjs(v) {assert(cobjs);}
+		: cobjs(cobjs_), is_static(s), is_dynamic(d), occluders_only(o), cubes_only(c), inc_voxel_cobjs(v), built_with_sah(0) {assert(cobjs);}
 
 	unsigned get_num_objs() const {return cixs.size();}
 	void clear();
 	void add_cobj_ids(vector<unsigned> const &cids) {assert(cixs.empty() && !cids.empty()); cixs = cids;}
 	void add_cobjs(bool verbose);
 	void build_tree_from_cixs(bool do_mt_build);
+	void refit_or_rebuild(vector<unsigned> &cids);
+	void add_or_refit_cobjs();
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
 		bool exact, int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const;
+	// packet version for coherent lines such as those sharing an origin; returns a bit mask of lanes that hit
+	unsigned check_coll_lines(unsigned num, point const *p1, point const *p2, point *cpos, vector3d *cnorm, int *cindex, int ignore_cobj,
+		bool exact, int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable, unsigned active_mask) const;
 	bool check_point_contained(point const &p, int &cindex) const;
 	void get_intersecting_cobjs(cube_t const &cube, vector<unsigned> &cobjs, int ignore_cobj, float toler, bool check_ccounter, int id_for_cobj_int) const;
 	bool is_cobj_contained(point const &viewer, point const *const pts, unsigned npts, int ignore_cobj, int &cobj) const;
@@ -5,16 +5,23 @@
 #include "3DWorld.h"
 #include "mesh.h"
 #include <cfloat> // for FLT_EPSILON
+#include <climits> // for INT_MAX
 
 
+extern bool deterministic_erosion;
 extern float erode_amount, water_plane_z;
 
+// tile and halo sizes for deterministic erosion; each droplet is confined to its start tile expanded by the halo;
+// tile size must be at least twice the halo size so that tiles of the same color in a 2x2 phase pattern never overlap
+int const EROSION_TILE_SZ(64), EROSION_HALO(32); // for full heightmaps
+int const TT_EROSION_TILE_SZ(16), TT_EROSION_HALO(8); // for tiled terrain, smaller to limit the context size
+
 
 // see http://ranmantaru.com/blog/2011/10/08/water-erosion-on-heightmap-terrain/
-void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters) {
+// droplet positions are limited to the range [bx1, bx2]x[by1, by2], which is the region it can modify minus the erosion kernel radius;
+// returns true if the path length limit was reached
+bool run_erosion_droplet(float *mh_padded, vector2d *erosion, int NX, int NY, int bx1, int by1, int bx2, int by2, int xi, int zi, rand_gen_t &rgen, unsigned max_path_len) {
 
-	if (num_iters == 0 || erode_amount <= 0.0) return; // erosion disabled
-	RESET_TIME;
 	// Kq and minSlope are for soil carry capacity.
 	// Kw is water evaporation speed.
 	// Kr is erosion speed (how fast the soil is removed).
@@ -22,19 +29,6 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 	// Ki is direction inertia. Higher values make channel turns smoother.
 	// g is gravity that accelerates the flows.
 	float const Kq=10, Kw=0.001f, Kr=0.9f, Kd=0.02f, Ki=0.1f, minSlope=0.05f, g=20, Kg=g*2;
-	int const PAD(4), NX(xsize+2*PAD), NY(ysize+2*PAD);
-	unsigned const MAX_PATH_LEN(4*NX*NY);
-	vector<vector2d> erosion(NX*NY, vector2d(0.0, 0.0));
-	vector<float> mh_padded(NX*NY);
-
-	// pad mesh by 1 unit on each side to create a buffer of trash around the edges that can be discarded
-	for (int y = 0; y < NY; ++y) {
-		int const offset(max(min(y-PAD, ysize-1), 0)*xsize);
-
-		for (int x = 0; x < NX; ++x) {
-			mh_padded[y*NX + x] = heightmap[max(min(x-PAD, xsize-1), 0) + offset];
-		}
-	}
 
 #define HMAP_INDEX(x, y) (NX*max(min(y, NY-1), 0) + max(min(x, NX-1), 0))
 #define HMAP(x, y) mh_padded[HMAP_INDEX(x, y)]
@@ -63,97 +57,179 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 	e.x=r; e.y=d; \
 }
 
-#pragma omp parallel for schedule(dynamic,1)
-	for (int iter=0; iter < (int)num_iters; ++iter) {
-		rand_gen_t rgen;
-		rgen.set_state(iter+11, 79*iter+121);
-		int xi = PAD + (rgen.rand()%xsize);
-		int zi = PAD + (rgen.rand()%ysize);
-		float xp=xi, zp=zi, xf=0, zf=0, s=0, v=0, w=1, dx=0, dz=0;
-		float h=HMAP(xi, zi), h00=h, h10=HMAP(xi+1, zi), h01=HMAP(xi, zi+1), h11=HMAP(xi+1, zi+1);
-
-		unsigned numMoves=0;
-		for (; numMoves<MAX_PATH_LEN; ++numMoves) {
-			// calc gradient
-			float gx=h00+h01-h10-h11, gz=h00+h10-h01-h11;
-			// calc next pos
-			dx=(dx-gx)*Ki+gx;
-			dz=(dz-gz)*Ki+gz;
-
-			float dl=sqrtf(dx*dx+dz*dz);
-			if (dl<=FLT_EPSILON) { // pick random dir
-				float a=rgen.rand_float()*TWO_PI;
-				dx=cosf(a); dz=sinf(a);
-			}
-			else {
-				dx/=dl; dz/=dl;
+	float xp=xi, zp=zi, xf=0, zf=0, s=0, v=0, w=1, dx=0, dz=0;
+	float h=HMAP(xi, zi), h00=h, h10=HMAP(xi+1, zi), h01=HMAP(xi, zi+1), h11=HMAP(xi+1, zi+1);
+
+	unsigned numMoves=0;
+	for (; numMoves<max_path_len; ++numMoves) {
+		// calc gradient
+		float gx=h00+h01-h10-h11, gz=h00+h10-h01-h11;
+		// calc next pos
+		dx=(dx-gx)*Ki+gx;
+		dz=(dz-gz)*Ki+gz;
+
+		float dl=sqrtf(dx*dx+dz*dz);
+		if (dl<=FLT_EPSILON) { // pick random dir
+			float a=rgen.rand_float()*TWO_PI;
+			dx=cosf(a); dz=sinf(a);
+		}
+		else {
+			dx/=dl; dz/=dl;
+		}
+		float nxp=xp+dx, nzp=zp+dz;
+		// sample next height
+		int nxi=floor(nxp), nzi=floor(nzp);
+		float nxf=nxp-nxi, nzf=nzp-nzi;
+		float nh00=HMAP(nxi, nzi), nh10=HMAP(nxi+1, nzi), nh01=HMAP(nxi, nzi+1), nh11=HMAP(nxi+1, nzi+1);
+		float nh=(nh00*(1-nxf)+nh10*nxf)*(1-nzf)+(nh01*(1-nxf)+nh11*nxf)*nzf;
+		// adjust by HALF_DXY = average mesh texel size - this is river depth
+		if (max(max(nh00, nh10), max(nh01, nh11)) < water_plane_z - HALF_DXY) break; // reached ocean water, stop and ignore sediment
+
+		// if higher than current, try to deposit sediment up to neighbour height;
+		// a droplet leaving its tile region is treated the same as one leaving the mesh
+		bool const outside(xi < 0 || zi < 0 || xi >= NX || zi >= NY || nxi < bx1 || nzi < by1 || nxi > bx2 || nzi > by2);
+		if (nh>=h || outside) {
+			float ds=(nh-h)+0.001f;
+
+			if (ds>=s || outside) {
+				ds=s;
+				DEPOSIT(h) // deposit all sediment
+				s=0;
+				break; // stop
 			}
-			float nxp=xp+dx, nzp=zp+dz;
-			// sample next height
-			int nxi=floor(nxp), nzi=floor(nzp);
-			float nxf=nxp-nxi, nzf=nzp-nzi;
-			float nh00=HMAP(nxi, nzi), nh10=HMAP(nxi+1, nzi), nh01=HMAP(nxi, nzi+1), nh11=HMAP(nxi+1, nzi+1);
-			float nh=(nh00*(1-nxf)+nh10*nxf)*(1-nzf)+(nh01*(1-nxf)+nh11*nxf)*nzf;
-			// adjust by HALF_DXY = average mesh texel size - this is river depth
-			if (max(max(nh00, nh10), max(nh01, nh11)) < water_plane_z - HALF_DXY) break; // reached ocean water, stop and ignore sediment
-
-			// if higher than current, try to deposit sediment up to neighbour height
-			bool const outside(xi < 0 || zi < 0 || xi >= NX || zi >= NY);
-			if (nh>=h || outside) {
-				float ds=(nh-h)+0.001f;
-
-				if (ds>=s || outside) {
-					ds=s;
-					DEPOSIT(h) // deposit all sediment
-					s=0;
-					break; // stop
+			DEPOSIT(h)
+			s-=ds;
+			v=0;
+		}
+		// compute transport capacity
+		float dh=h-nh;
+		float slope=dh;
+		//float slope=dh/sqrtf(dh*dh+1);
+		float q=max(slope, minSlope)*v*w*Kq;
+
+		// deposit/erode (don't erode more than dh)
+		float ds=s-q;
+		if (ds>=0) { // deposit
+			ds*=Kd;
+			//ds=minval(ds, 1.0f);
+			DEPOSIT(dh)
+			s-=ds;
+		}
+		else { // erode
+			ds*=-Kr;
+			ds=min(ds, dh*0.99f);
+			ds*=((get_bare_ls_tid(nh) == ROCK_TEX) ? 0.5 : 2.0); // rock erodes slower than dirt/sand
+
+			for (int z=zi-1; z<=zi+2; ++z) {
+				float zo=z-zp, zo2=zo*zo;
+
+				for (int x=xi-1; x<=xi+2; ++x) {
+					float xo=x-xp;
+					float w=1-(xo*xo+zo2)*0.25f;
+					if (w<=0) continue;
+					w*=0.1591549430918953f;
+					ERODE(x, z, w)
 				}
-				DEPOSIT(h)
-				s-=ds;
-				v=0;
 			}
-			// compute transport capacity
-			float dh=h-nh;
-			float slope=dh;
-			//float slope=dh/sqrtf(dh*dh+1);
-			float q=max(slope, minSlope)*v*w*Kq;
-
-			// deposit/erode (don't erode more than dh)
-			float ds=s-q;
-			if (ds>=0) { // deposit
-				ds*=Kd;
-				//ds=minval(ds, 1.0f);
-				DEPOSIT(dh)
-				s-=ds;
+			dh-=ds;
+			s+=ds;
+		}
+		// move to the neighbor
+		v=sqrtf(v*v+Kg*dh);
+		w*=1-Kw;
+		xp=nxp; zp=nzp; xi=nxi; zi=nzi; xf=nxf; zf=nzf;
+		h=nh; h00=nh00; h10=nh10; h01=nh01; h11=nh11;
+	} // for numMoves
+	return (numMoves >= max_path_len);
+#undef HMAP_INDEX
+#undef HMAP
+#undef DEPOSIT_AT
+#undef DEPOSIT
+#undef ERODE
+}
+
+void init_erosion_droplet(rand_gen_t &rgen, int iter, int xsize, int ysize, int &xi, int &zi) {
+	rgen.set_state(iter+11, 79*iter+121);
+	xi = rgen.rand()%xsize;
+	zi = rgen.rand()%ysize;
+}
+
+// Deterministic version: droplets are binned into tiles by their start position, and tiles are processed in four phases by 2x2 color;
+// each droplet may only modify its tile plus a halo, and the regions of same colored tiles are disjoint, so there are no write conflicts;
+// the tiles of each phase are processed in parallel, and the droplets within a tile are processed in a fixed order, so the result is independent of thread count
+void apply_erosion_deterministic(vector<float> &mh_padded, vector<vector2d> &erosion, int NX, int NY, int PAD, int xsize, int ysize, unsigned num_iters) {
+
+	int const T(EROSION_TILE_SZ), H(EROSION_HALO), ntx((NX + T - 1)/T), nty((NY + T - 1)/T);
+	assert(T >= 2*H && H >= 4);
+	vector<vector<unsigned>> tile_iters(ntx*nty);
+
+	for (unsigned iter = 0; iter < num_iters; ++iter) { // bin droplets by start tile, using the same start positions as the non-deterministic version
+		rand_gen_t rgen;
+		int xi(0), zi(0);
+		init_erosion_droplet(rgen, iter, xsize, ysize, xi, zi);
+		tile_iters[((zi + PAD)/T)*ntx + (xi + PAD)/T].push_back(iter);
+	}
+	for (unsigned color = 0; color < 4; ++color) {
+		vector<unsigned> tiles;
+
+		for (int ty = (color >> 1); ty < nty; ty += 2) {
+			for (int tx = (color & 1); tx < ntx; tx += 2) {
+				unsigned const tix(ty*ntx + tx);
+				if (!tile_iters[tix].empty()) {tiles.push_back(tix);}
 			}
-			else { // erode
-				ds*=-Kr;
-				ds=min(ds, dh*0.99f);
-				ds*=((get_bare_ls_tid(nh) == ROCK_TEX) ? 0.5 : 2.0); // rock erodes slower than dirt/sand
-
-				for (int z=zi-1; z<=zi+2; ++z) {
-					float zo=z-zp, zo2=zo*zo;
-
-					for (int x=xi-1; x<=xi+2; ++x) {
-						float xo=x-xp;
-						float w=1-(xo*xo+zo2)*0.25f;
-						if (w<=0) continue;
-						w*=0.1591549430918953f;
-						ERODE(x, z, w)
-					}
+		}
+#pragma omp parallel for schedule(dynamic,1)
+		for (int i = 0; i < (int)tiles.size(); ++i) {
+			unsigned const tix(tiles[i]);
+			int const tx(tix%ntx), ty(tix/ntx);
+			// region the droplet can modify, clamped to the mesh; the erosion kernel extends from -1 to +2 around the droplet
+			int const rx1(max(tx*T - H, 0)), ry1(max(ty*T - H, 0)), rx2(min((tx+1)*T + H, NX)), ry2(min((ty+1)*T + H, NY));
+			unsigned const max_path_len(4*(rx2 - rx1)*(ry2 - ry1));
+
+			for (unsigned iter : tile_iters[tix]) {
+				rand_gen_t rgen;
+				int xi(0), zi(0);
+				init_erosion_droplet(rgen, iter, xsize, ysize, xi, zi);
+
+				if (run_erosion_droplet(&mh_padded.front(), &erosion.front(), NX, NY, rx1+1, ry1+1, rx2-3, ry2-3, xi+PAD, zi+PAD, rgen, max_path_len)) {
+					cout << "droplet path is too long: " << iter << endl;
 				}
-				dh-=ds;
-				s+=ds;
 			}
-			// move to the neighbor
-			v=sqrtf(v*v+Kg*dh);
-			w*=1-Kw;
-			xp=nxp; zp=nzp; xi=nxi; zi=nzi; xf=nxf; zf=nzf;
-			h=nh; h00=nh00; h10=nh10; h01=nh01; h11=nh11;
-		} // for numMoves
-		if (numMoves>=MAX_PATH_LEN) {cout << "droplet path is too long: " << iter << endl;}
-	} // for iter
+		} // for i
+	} // for color
+}
 
+void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters) {
+
+	if (num_iters == 0 || erode_amount <= 0.0) return; // erosion disabled
+	RESET_TIME;
+	int const PAD(4), NX(xsize+2*PAD), NY(ysize+2*PAD);
+	unsigned const MAX_PATH_LEN(4*NX*NY);
+	vector<vector2d> erosion(NX*NY, vector2d(0.0, 0.0));
+	vector<float> mh_padded(NX*NY);
+
+	// pad mesh by 1 unit on each side to create a buffer of trash around the edges that can be discarded
+	for (int y = 0; y < NY; ++y) {
+		int const offset(max(min(y-PAD, ysize-1), 0)*xsize);
+
+		for (int x = 0; x < NX; ++x) {
+			mh_padded[y*NX + x] = heightmap[max(min(x-PAD, xsize-1), 0) + offset];
+		}
+	}
+	if (deterministic_erosion) {apply_erosion_deterministic(mh_padded, erosion, NX, NY, PAD, xsize, ysize, num_iters);}
+	else {
+		// Note: droplets may update the same heightmap values concurrently, so results can vary from run to run
+#pragma omp parallel for schedule(dynamic,1)
+		for (int iter=0; iter < (int)num_iters; ++iter) {
+			rand_gen_t rgen;
+			int xi(0), zi(0);
+			init_erosion_droplet(rgen, iter, xsize, ysize, xi, zi);
+
+			if (run_erosion_droplet(&mh_padded.front(), &erosion.front(), NX, NY, -INT_MAX, -INT_MAX, INT_MAX, INT_MAX, xi+PAD, zi+PAD, rgen, MAX_PATH_LEN)) {
+				cout << "droplet path is too long: " << iter << endl;
+			}
+		} // for iter
+	}
 	// remove padding and clamp to min_zval
 	for (int y = 0; y < ysize; ++y) {
 		for (int x = 0; x < xsize; ++x) {
@@ -163,3 +239,57 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 	PRINT_TIME("Erosion");
 }
 
+
+int floor_div(int v, int d) {return ((v >= 0) ? v/d : -((d - 1 - v)/d));}
+
+// context border required around a tiled terrain tile so that every erosion tile that can modify it is fully contained
+unsigned get_tiled_erosion_margin() {return (TT_EROSION_TILE_SZ + 2*TT_EROSION_HALO);}
+
+// Erodes a region of tiled terrain with heightmap origin at mesh grid position (gx0, gy0) using erosion tiles aligned to the global grid;
+// each erosion tile runs its droplets on the uneroded heights and the height deltas of all tiles are summed in a fixed order, so the eroded
+// height of a grid point only depends on the uneroded heights within get_tiled_erosion_margin() of it; this means that adjacent terrain tiles
+// that include this margin compute identical values along their shared edges and can be generated incrementally in any order
+void apply_erosion_tiled(float *heightmap, int xsize, int ysize, int gx0, int gy0, float min_zval, float droplet_density) {
+
+	if (droplet_density <= 0.0 || erode_amount <= 0.0) return; // erosion disabled
+	int const T(TT_EROSION_TILE_SZ), H(TT_EROSION_HALO), R(T + 2*H), num_droplets(round_fp(droplet_density*T*T));
+	if (num_droplets == 0) return;
+	// only process erosion tiles where the tile plus halo is contained in the heightmap
+	int const tx1(floor_div(gx0 + H + T - 1, T)), ty1(floor_div(gy0 + H + T - 1, T)), tx2(floor_div(gx0 + xsize - H, T)), ty2(floor_div(gy0 + ysize - H, T));
+	if (tx2 <= tx1 || ty2 <= ty1) return; // heightmap is too small
+	int const ntx(tx2 - tx1), nty(ty2 - ty1);
+	unsigned const max_path_len(4*R*R);
+	vector<vector<float>> deltas(ntx*nty);
+
+#pragma omp parallel for schedule(dynamic,1)
+	for (int i = 0; i < ntx*nty; ++i) {
+		int const tx(tx1 + i%ntx), ty(ty1 + i/ntx), rx(tx*T - H - gx0), ry(ty*T - H - gy0); // rx/ry = region start within heightmap
+		assert(rx >= 0 && ry >= 0 && rx + R <= xsize && ry + R <= ysize);
+		vector<float> &mh(deltas[i]);
+		vector<vector2d> erosion(R*R, vector2d(0.0, 0.0));
+		mh.resize(R*R);
+
+		for (int y = 0; y < R; ++y) {
+			for (int x = 0; x < R; ++x) {mh[y*R + x] = heightmap[(y + ry)*xsize + x + rx];}
+		}
+		vector<float> const orig(mh); // deep copy
+		rand_gen_t rgen;
+		rgen.set_state(((123457U*tx + 7919U*ty + 11U) & 0x7FFFFFFF), ((65537U*ty + 31U*tx + 121U) & 0x7FFFFFFF)); // seed is a function of global tile position
+		rgen.rand_mix();
+
+		for (int n = 0; n < num_droplets; ++n) {
+			int const xi(H + rgen.rand()%T), zi(H + rgen.rand()%T);
+			run_erosion_droplet(&mh.front(), &erosion.front(), R, R, 1, 1, R-3, R-3, xi, zi, rgen, max_path_len);
+		}
+		for (unsigned j = 0; j < mh.size(); ++j) {mh[j] -= orig[j];} // convert to deltas
+	} // for i
+	for (int i = 0; i < ntx*nty; ++i) { // merge deltas serially in tile order so that the sum is deterministic
+		int const rx((tx1 + i%ntx)*T - H - gx0), ry((ty1 + i/ntx)*T - H - gy0);
+		vector<float> const &delta(deltas[i]);
+
+		for (int y = 0; y < R; ++y) {
+			for (int x = 0; x < R; ++x) {heightmap[(y + ry)*xsize + x + rx] += delta[y*R + x];}
+		}
+	}
+	for (int i = 0; i < xsize*ysize; ++i) {max_eq(heightmap[i], min_zval);}
+}
@@ -9,6 +9,7 @@ struct xform_matrix;
 struct cube_with_zval_t;
 
 int omp_get_thread_num_3dw();
+int omp_get_max_threads_3dw();
 
 // function prototypes - main (3DWorld.cpp, etc.)
 bool get_gl_error(unsigned loc_id=0);
@@ -337,6 +338,8 @@ bool save_state(const char *filename);
 
 // function prototypes - erosion
 void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters);
+unsigned get_tiled_erosion_margin();
+void apply_erosion_tiled(float *heightmap, int xsize, int ysize, int gx0, int gy0, float min_zval, float droplet_density);
 
 // function prototypes - city_gen
 template<typename T> bool check_bcubes_sphere_coll(vector<T> const &bcubes, point const &sc, float radius, bool xy_only);
@@ -368,6 +371,7 @@ void set_city_lighting_shader_opts(shader_t &s, cube_t const &lights_bcube, bool
 unsigned get_city_model_gpu_mem();
 cube_t get_city_lights_bcube();
 void next_pedestrian_animation();
+void show_ped_path_finder_stats();
 void free_city_context();
 bool has_city_trees();
 
@@ -446,8 +450,11 @@ void free_cobj_draw_group_vbos();
 // function prototypes - coll_cell_search
 void build_static_moving_cobj_tree();
 void build_cobj_tree(bool dynamic=0, bool verbose=1);
+void show_cobj_tree_stats();
 bool check_coll_line_exact_tree(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
 	bool dynamic=0, int test_alpha=0, bool skip_non_drawn=0, bool include_voxels=1, bool skip_init_colls=0, bool skip_movable=0, bool no_stat_moving=0);
+unsigned check_coll_lines_exact_tree(unsigned num, point const *p1, point const *p2, point *cpos, vector3d *cnorm, int *cindex, int ignore_cobj,
+	int test_alpha=0, bool include_voxels=1, bool skip_init_colls=0, bool no_stat_moving=0);
 bool check_coll_line_tree(point const &p1, point const &p2, int &cindex, int ignore_cobj, bool dynamic=0, int test_alpha=0,
 	bool skip_non_drawn=0, bool include_voxels=1, bool skip_init_colls=0, bool skip_movable=0);
 bool cobj_contained_tree(point const &viewer, point const *const pts, unsigned npts, int ignore_cobj, int &cobj);
@@ -821,6 +828,8 @@ bool is_any_dlight_visible(point const &p);
 void add_smoke(point const &pos, float val);
 void distribute_smoke();
 float get_smoke_at_pos(point const &pos);
+void reset_smoke_grid();
+void update_smoke_grid_flow(int x1, int y1, int x2, int y2);
 void update_smoke_indir_tex_range(unsigned x_start, unsigned x_end, unsigned y_start, unsigned y_end, unsigned z_start=0, unsigned z_end=0, bool update_lighting=1);
 bool upload_smoke_indir_texture();
 void init_ground_fire();
@@ -1021,6 +1030,8 @@ int create_buildings_tile(int x, int y, bool allow_flatten);
 bool remove_buildings_tile(int x, int y);
 void free_building_indir_texture();
 void end_building_rt_job();
+void update_building_indir_light_prefetch(int cur_bix);
+void end_building_indir_light_prefetch();
 
 // function prototypes - csg
 void expand_cubes_by_xy(vect_cube_t &cubes, float val);
@@ -2158,6 +2158,7 @@ public:
 						bool const inc_small(b.bcube.closest_dist_less_than(camera_xlated, ddist_scale*room_geom_sm_draw_dist));
 						b.gen_and_draw_room_geom(s, oc, xlate, ped_bcubes, bi->ix, ped_ix, 0, reflection_pass, inc_small, b.bcube.contains_pt_xy(camera_xlated)); // shadow_only=0
 						g->has_room_geom = 1;
+						if (!reflection_pass && (display_mode & 0x10)) {b.add_indir_light_prefetch_cand(bi->ix, camera_xlated);} // only called for buildings with room geom
 						if (!draw_interior) continue;
 						if (ped_ix >= 0) {draw_peds_in_building(ped_ix, bi->ix, s, xlate, shadow_only);} // draw people in this building
 						// check the bcube rather than check_point_or_cylin_contained() so that it works with roof doors that are outside any part?
@@ -2205,6 +2206,7 @@ public:
 			// update indir lighting using ray casting
 			if (indir_bcs_ix >= 0 && indir_bix >= 0) {indir_tex_mgr.create_for_building(bcs[indir_bcs_ix]->get_building(indir_bix), indir_bix, camera_xlated);}
 			else if (!reflection_pass) {end_building_rt_job();}
+			if (!reflection_pass && (display_mode & 0x10)) {update_building_indir_light_prefetch(indir_bix);} // after the current building has been registered
 			
 			if (draw_interior && have_windows && reflection_pass != 2) { // write to stencil buffer, use stencil test for back facing building walls
 				shader_t holes_shader;
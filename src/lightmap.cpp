@@ -280,10 +280,32 @@ void lmap_manager_t::copy_data(lmap_manager_t const &src, float blend_weight) {
 }
 
 
+// adds the tiles that were touched; callers add buffers in a fixed order, so the result doesn't depend on thread scheduling
+void lmap_accum_buffer_t::add_to(lmap_manager_t &lmgr, int ltype) const {
+
+	if (empty()) return; // nothing to do
+	assert(num_cells == lmgr.size());
+	unsigned const dsz(lmcell::get_dsz(ltype));
+
+	for (unsigned t = 0; t < tiles.size(); ++t) {
+		tile_t const *const tile(tiles[t].get());
+		if (tile == nullptr) continue; // never touched by this job
+		unsigned const start(t << TILE_BITS), end(min(start+TILE_SIZE, num_cells));
+
+		for (unsigned i = start; i < end; ++i) {
+			float *color(lmgr.get_cell(i).get_offset(ltype));
+			float const *const v(tile->v[i - start]);
+			for (unsigned n = 0; n < dsz; ++n) {color[n] += v[n];}
+		}
+	}
+	lmgr.was_updated = 1;
+}
+
+
 // *this = val*lmc + (1.0 - val)*(*this)
 void lmcell::mix_lighting_with(lmcell const &lmc, float val) {
 
-	float const omv(1.0 - val); // Note: we ignore the flow values and smoke for now
+	float const omv(1.0 - val); // Note: we ignore the flow values for now
 	sv = val*lmc.sv + omv*sv;
 	gv = val*lmc.gv + omv*gv;
 	UNROLL_3X(sc[i_] = val*lmc.sc[i_] + omv*sc[i_];)
@@ -527,6 +549,7 @@ void clear_lightmap() {
 	if (!lmap_manager.is_allocated()) return;
 	kill_current_raytrace_threads(); // kill raytrace threads and wait for them to finish since they are using the current lightmap
 	lmap_manager.clear_cells();
+	reset_smoke_grid(); // smoke is only valid within the lmap
 	using_lightmap = 0;
 	lm_alloc       = 0;
 	czmin0         = czmin;
@@ -809,6 +832,7 @@ void update_flow_for_voxels(vector<cube_t> const &cubes) {
 			} // for x
 		} //for y
 	}
+	update_smoke_grid_flow(bcx1, bcy1, bcx2, bcy2);
 	//PRINT_TIME("Update Flow");
 }
 
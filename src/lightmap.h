@@ -28,12 +28,12 @@ protected:
 
 unsigned const lmcell_ltype_off[NUM_LIGHTING_TYPES] = {0, 4, 8, 0}; // sky, global, local, sky cobj accum, dynamic
 
-struct lmcell { // size = 52
+struct lmcell { // size = 48
 
-	float sc[3], sv, gc[3], gv, lc[3], smoke; // *c[3]: RGB sky, global, local colors
+	float sc[3], sv, gc[3], gv, lc[3]; // *c[3]: RGB sky, global, local colors; smoke is stored separately in smoke.cpp
 	unsigned char pflow[3]; // flow: x, y, z
 	
-	lmcell() : sv(0.0), gv(0.0), smoke(0.0) {UNROLL_3X(sc[i_] = gc[i_] = lc[i_] = 0.0; pflow[i_] = 255;)}
+	lmcell() : sv(0.0), gv(0.0) {UNROLL_3X(sc[i_] = gc[i_] = lc[i_] = 0.0; pflow[i_] = 255;)}
 	float       *get_offset(int ltype)       {return (sc + lmcell_ltype_off[ltype]);}
 	float const *get_offset(int ltype) const {return (sc + lmcell_ltype_off[ltype]);}
 	static unsigned get_dsz(int ltype)       {return ((ltype == LIGHTING_LOCAL) ? 3 : 4);}
@@ -44,6 +44,10 @@ struct lmcell { // size = 52
 };
 
 
+struct lmap_file_header_t;
+struct binary_file_reader;
+class mapped_file_reader;
+
 class lmap_manager_t {
 
 	vector<lmcell> vldata_alloc;
@@ -52,6 +56,10 @@ class lmap_manager_t {
 
 	lmap_manager_t(lmap_manager_t const &) = delete; // forbidden
 	void operator=(lmap_manager_t const &) = delete; // forbidden
+	bool check_file_header(lmap_file_header_t const &header, char const *const fn, int ltype) const;
+	bool read_data_from_mapped_file(mapped_file_reader const &mfr, char const *const fn, int ltype);
+	bool read_legacy_data_from_stream(binary_file_reader &reader, unsigned data_size, char const *const fn, int ltype);
+	void set_component(int ltype, unsigned comp, void const *src, unsigned stride, bool is_half, float scale);
 
 public:
 	bool was_updated;
@@ -61,8 +69,10 @@ public:
 	void clear_cells() {vldata_alloc.clear();} // vlmap matrix headers are not cleared
 	bool is_allocated() const {return (vlmap != NULL && !vldata_alloc.empty());}
 	size_t size() const {return vldata_alloc.size();}
+	unsigned get_cell_ix(lmcell const *lmc) const {return unsigned(lmc - vldata_alloc.data());}
+	lmcell &get_cell(unsigned ix) {return vldata_alloc[ix];} // Note: no bounds checking
 	bool read_data_from_file(char const *const fn, int ltype);
-	bool write_data_to_file(char const *const fn, int ltype) const;
+	bool write_data_to_file(char const *const fn, int ltype, bool half_float=0) const;
 	void clear_lighting_values(int ltype);
 	bool is_valid_cell(int x, int y, int z) const;
 	lmcell const *get_column(int x, int y) const {return vlmap[y][x];} // Note: no bounds checking
@@ -77,6 +87,33 @@ public:
 };
 
 
+// per-job sparse lighting accumulation buffer, indexed by lmap_manager_t cell index;
+// cells are grouped into fixed size tiles that are allocated on first touch and added to the lmap in job order as jobs finish
+class lmap_accum_buffer_t {
+
+	static unsigned const TILE_BITS = 8, TILE_SIZE = (1 << TILE_BITS); // 256 cells per tile
+	struct tile_t {float v[TILE_SIZE][4];}; // RGB + weight; size = 4KB
+
+	vector<std::unique_ptr<tile_t>> tiles;
+	unsigned num_cells, num_used;
+
+public:
+	lmap_accum_buffer_t() : num_cells(0), num_used(0) {}
+	void init(lmap_manager_t const &lmgr) {clear(); num_cells = lmgr.size(); tiles.resize((num_cells + TILE_SIZE - 1) >> TILE_BITS);}
+	void clear() {tiles.clear(); num_cells = num_used = 0;}
+	bool is_enabled() const {return !tiles.empty();}
+	bool empty() const {return (num_used == 0);}
+
+	float *get_cell_vals(unsigned cell_ix) {
+		assert(cell_ix < num_cells);
+		std::unique_ptr<tile_t> &tile(tiles[cell_ix >> TILE_BITS]);
+		if (!tile) {tile.reset(new tile_t()); ++num_used;} // value initialized to zeros
+		return tile->v[cell_ix & (TILE_SIZE-1)];
+	}
+	void add_to(lmap_manager_t &lmgr, int ltype) const;
+};
+
+
 struct lmcell_local { // size = 12 (must be packed)
 	float lc[3];
 	lmcell_local() {lc[0] = lc[1] = lc[2] = 0.0;}
@@ -330,7 +367,7 @@ public:
 // from ray_trace.cpp
 void check_for_lighting_finished();
 void compute_ray_trace_lighting(unsigned ltype, bool verbose);
-unsigned add_path_to_lmcs(lmap_manager_t *lmgr, cube_t *bcube, point p1, point const &p2, float weight, colorRGBA const &color, int ltype, bool first_pt);
+unsigned add_path_to_lmcs(lmap_manager_t *lmgr, cube_t *bcube, point p1, point const &p2, float weight, colorRGBA const &color, int ltype, bool first_pt, lmap_accum_buffer_t *abuf=nullptr);
 // from lightmap.cpp
 void update_indir_light_tex_range(lmap_manager_t const &lmap, vector<unsigned char> &tex_data,
 	unsigned xsize, unsigned y1, unsigned y2, unsigned zsize, float lighting_exponent=1.0, bool local_only=0, bool mt=0);
@@ -11,8 +11,28 @@ float const MESH_MIN_Z = -1.0E6; // special mesh height that is guaranteed to be
 extern float sthresh[2][2];
 
 
-struct ripple_state {
-	float rval, acc;
+struct ripple_rect_t { // {x1,y1} inclusive, {x2,y2} exclusive
+	int x1, y1, x2, y2;
+	ripple_rect_t(int x1_=0, int y1_=0, int x2_=0, int y2_=0) : x1(x1_), y1(y1_), x2(x2_), y2(y2_) {}
+	bool is_empty() const {return (x1 >= x2 || y1 >= y2);}
+	ripple_rect_t expand_by(int v) const {return ripple_rect_t(max(x1-v, 0), max(y1-v, 0), min(x2+v, MESH_X_SIZE), min(y2+v, MESH_Y_SIZE));}
+	bool intersects(ripple_rect_t const &r) const {return (x1 < r.x2 && r.x1 < x2 && y1 < r.y2 && r.y1 < y2);}
+	void union_with(ripple_rect_t const &r) {x1 = min(x1, r.x1); y1 = min(y1, r.y1); x2 = max(x2, r.x2); y2 = max(y2, r.y2);}
+};
+
+// ripple state as SoA arrays indexed by y*MESH_X_SIZE+x; all nonzero values are contained in the active rects
+struct ripple_grid_t {
+	vector<float> rval, acc;
+	vector<ripple_rect_t> active;
+
+	void alloc();
+	void free_data();
+	void clear_all();
+	void clear(); // only clears active rects
+	void add_active_rect(int x1, int y1, int x2, int y2); // inclusive, clipped to the mesh
+	void merge_active_rects();
+	float &get_rval(int x, int y) {return rval[y*MESH_X_SIZE + x];}
+	float  get_rval(int x, int y) const {return rval[y*MESH_X_SIZE + x];}
 };
 
 
@@ -122,7 +142,7 @@ extern vector3d  **surface_normals;
 extern vector3d  **vertex_normals;
 extern float     **charge_dist;
 extern float     **surface_damage;
-extern ripple_state **ripples;
+extern ripple_grid_t ripples;
 extern unsigned char **mesh_draw;
 extern unsigned char **water_enabled;
 extern unsigned char **flower_weight;
@@ -9,6 +9,7 @@
 #include "heightmap.h"
 #include "shaders.h"
 #include "gl_ext_arb.h"
+#include "simd_noise.h"
 #include <glm/gtc/noise.hpp>
 
 
@@ -37,6 +38,7 @@ int cache_counter(1), start_eval_sin(0), GLACIATE(DEF_GLACIATE), mesh_gen_mode(M
 float zmax, zmin, zmax_est, zcenter(0.0), zbottom(0.0), ztop(0.0), h_sum(0.0), alt_temp(DEF_TEMPERATURE);
 float mesh_scale(1.0), tree_scale(1.0), mesh_scale_z(1.0), mesh_scale_z_inv(1.0), glaciate_exp(1.0), glaciate_exp_inv(1.0);
 float mesh_height_scale(1.0), zmax_est2(1.0), zmax_est2_inv(1.0);
+thread_local bool mesh_gen_force_cpu(0); // evaluate GPU noise modes on the CPU, including domain warp; per-thread so that tile gen workers can set it
 vector<float> sin_table;
 float sinTable[F_TABLE_SIZE][5];
 
@@ -65,6 +67,7 @@ void estimate_zminmax(bool using_eq);
 void set_zvals();
 void update_temperature(bool verbose);
 void compute_scale();
+void get_noise_zvals_batch(float const *xvals, float const *yvals, float *zvals, unsigned num, int mode, int shape);
 
 bool using_hmap_with_detail();
 
@@ -592,13 +595,24 @@ bool mesh_xy_grid_cache_t::build_arrays(float x0, float y0, float dx, float dy,
 	do_glaciate = 0; // must set enable_glaciate() after this call if needed
 	cached_vals.clear();
 
-	if (gen_mode >= MGEN_SIMPLEX_GPU) { // GPU simplex noise - always cache values
+	if (gen_mode >= MGEN_SIMPLEX_GPU && !mesh_gen_force_cpu) { // GPU simplex noise - always cache values
 		bool const is_running(cshader && cshader->get_is_running());
 		if (!is_running) {run_gpu_simplex();} // launch the job
 		if (no_wait && !is_running) return 0; // just started, results not yet available
 		cache_gpu_simplex_vals();
 		return 1; // results are available
 	}
+	if (gen_mode != MGEN_SINE) { // CPU simplex/perlin noise - always cache values, evaluated one row at a time with the SIMD kernel
+		cached_vals.resize(cur_nx*cur_ny);
+
+#pragma omp parallel for schedule(static,1)
+		for (int y = 0; y < (int)cur_ny; ++y) {
+			vector<float> xvals(cur_nx), yvals(cur_nx, (y*mdy + my0)*DY_VAL_INV);
+			for (unsigned x = 0; x < cur_nx; ++x) {xvals[x] = (x*mdx + mx0)*DX_VAL_INV;}
+			get_noise_zvals_batch(&xvals.front(), &yvals.front(), &cached_vals[y*cur_nx], cur_nx, gen_mode, gen_shape);
+		}
+		return 1; // results are available
+	}
 	yterms_start = nx*F_TABLE_SIZE;
 	xyterms.resize((nx + ny)*F_TABLE_SIZE, 0.0);
 	float const msx(mesh_scale*DX_VAL_INV), msy(mesh_scale*DY_VAL_INV), ms2(0.5*mesh_scale);
@@ -746,13 +760,33 @@ float get_noise_zval(float xval, float yval, int mode, int shape) {
 	return zval*get_hmap_scale(mode);
 }
 
+// batched version of get_noise_zval() using the SIMD kernel
+void get_noise_zvals_batch(float const *xvals, float const *yvals, float *zvals, unsigned num, int mode, int shape) {
+
+	assert(mode != MGEN_SINE); // mode 0 not supported by this function
+	float const xy_scale(MESH_SCALE_FACTOR*mesh_scale), zscale(get_hmap_scale(mode));
+	unsigned const end_octave(NUM_FREQ_COMP - start_eval_sin/N_RAND_SIN2);
+	bool const use_simplex(mode == MGEN_SIMPLEX || mode == MGEN_SIMPLEX_GPU || mode == MGEN_DWARP_GPU);
+	float rx, ry;
+	gen_rx_ry(rx, ry);
+	vector<float> xv(num), yv(num);
+	for (unsigned i = 0; i < num; ++i) {xv[i] = xy_scale*xvals[i]; yv[i] = xy_scale*yvals[i];}
+	gen_noise_2d_batch(&xv.front(), &yv.front(), zvals, num, end_octave, rx, ry, shape, use_simplex, (mode == MGEN_DWARP_GPU));
+	bool const need_postproc(hmap_params.need_postproc());
+
+	for (unsigned i = 0; i < num; ++i) {
+		if (need_postproc) {postproc_noise_zval(zvals[i]);}
+		zvals[i] *= zscale;
+	}
+}
+
 
 float mesh_xy_grid_cache_t::eval_index(unsigned x, unsigned y, int min_start_sin, bool use_cache) const {
 
 	assert(x < cur_nx && y < cur_ny);
 	float zval(0.0);
 
-	if ((use_cache || gen_mode >= MGEN_SIMPLEX_GPU) && !cached_vals.empty()) {
+	if ((use_cache || gen_mode != MGEN_SINE) && !cached_vals.empty()) { // noise modes always cache
 		zval += cached_vals[y*cur_nx + x];
 	}
 	else if (gen_mode != MGEN_SINE) { // perlin/simplex
@@ -10,6 +10,7 @@
 #include "voxels.h" // for get_cur_model_edges_as_cubes
 #include "csg.h" // for clip_polygon_to_cube
 #include "lightmap.h" // for lmap_manager_t
+#include "binary_file_io.h" // for mapped_file_reader and zlib
 #include <fstream>
 #include <queue>
 #include "meshoptimizer.h"
@@ -18,6 +19,9 @@ bool const ENABLE_BUMP_MAPS  = 1;
 bool const ENABLE_SPEC_MAPS  = 1;
 bool const ENABLE_INTER_REFLECTIONS = 1;
 unsigned const MAGIC_NUMBER  = 42987143; // arbitrary file signature
+unsigned const MAGIC_NUMBER_V2 = 42987144; // chunked file format with a table of contents and per-material geometry blocks
+unsigned const MODEL3D_FILE_VERSION = 2;
+unsigned const MODEL3D_BLOCK_ALIGN  = 64; // geometry blocks start on cache line boundaries
 unsigned const BLOCK_SIZE    = 32768; // in vertex indices
 
 bool model_calc_tan_vect(1); // slower and more memory but sometimes better quality/smoother transitions
@@ -168,6 +172,86 @@ template<typename V> void read_vector(istream &in, V &v) {
 	in.read((char *)&v.front(), (std::streamsize)v.size()*sizeof(typename V::value_type));
 }
 
+struct mem_read_buf_t : public std::streambuf { // read-only stream buffer over existing memory, used to parse mapped file data without copying it
+	mem_read_buf_t(void const *data, size_t size) {char *const p((char *)data); setg(p, p, p+size);}
+};
+
+bool deflate_raw(string const &in, string &out) { // raw deflate stream, no zlib header or checksum
+
+	if (in.size() > UINT_MAX) return 0; // too large for a single deflate call
+	z_stream strm = {};
+	if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return 0;
+	out.resize(deflateBound(&strm, (uLong)in.size()));
+	strm.next_in   = (Bytef *)in.data();
+	strm.avail_in  = (uInt)in.size();
+	strm.next_out  = (Bytef *)&out[0];
+	strm.avail_out = (uInt)out.size();
+	int const ret(deflate(&strm, Z_FINISH));
+	out.resize(strm.total_out);
+	deflateEnd(&strm);
+	return (ret == Z_STREAM_END);
+}
+
+bool inflate_raw(unsigned char const *in, size_t in_sz, string &out) { // out must be sized to the uncompressed size
+
+	if (in_sz > UINT_MAX || out.size() > UINT_MAX) return 0;
+	z_stream strm = {};
+	if (inflateInit2(&strm, -15) != Z_OK) return 0;
+	strm.next_in   = (Bytef *)in;
+	strm.avail_in  = (uInt)in_sz;
+	strm.next_out  = (Bytef *)&out[0];
+	strm.avail_out = (uInt)out.size();
+	int const ret(inflate(&strm, Z_FINISH));
+	inflateEnd(&strm);
+	return (ret == Z_STREAM_END && strm.total_out == out.size());
+}
+
+
+// ************ model3d file blocks ************
+
+unsigned const BLOCK_COMPRESSED = 1, BLOCK_HAS_GEOM = 2, BLOCK_HAS_GEOM_TAN = 4; // block flags
+
+struct model3d_file_block_t { // table of contents entry; written as POD
+
+	uint64_t offset, stored_size, raw_size;
+	unsigned flags, verts, quads, tris, blocks;
+	float avg_area_per_tri; // 0.0 if not computed
+
+	model3d_file_block_t() : offset(0), stored_size(0), raw_size(0), flags(0), verts(0), quads(0), tris(0), blocks(0), avg_area_per_tri(0.0) {}
+	void set_stats(model3d_stats_t const &stats) {verts = stats.verts; quads = stats.quads; tris = stats.tris; blocks = stats.blocks;}
+
+	void add_stats(model3d_stats_t &stats) const {
+		stats.verts += verts; stats.quads += quads; stats.tris += tris; stats.blocks += blocks;
+	}
+};
+
+struct model3d_file_t {
+
+	mapped_file_reader mfr;
+	vector<model3d_file_block_t> blocks;
+	unsigned num_pending; // materials that still need to be loaded
+
+	model3d_file_t() : num_pending(0) {}
+
+	// returns a pointer to the block's uncompressed data, which is either in the mapped file or in decomp_buf
+	char const *get_block_data(unsigned ix, string &decomp_buf) const {
+		assert(ix < blocks.size());
+		model3d_file_block_t const &b(blocks[ix]);
+		unsigned char const *const data(mfr.get_data() + b.offset);
+		if (!(b.flags & BLOCK_COMPRESSED)) return (char const *)data;
+		decomp_buf.resize(b.raw_size);
+		return (inflate_raw(data, b.stored_size, decomp_buf) ? decomp_buf.data() : nullptr);
+	}
+	template<typename F> bool read_block(unsigned ix, F const &read_func) const { // thread safe
+		string decomp_buf;
+		char const *const data(get_block_data(ix, decomp_buf));
+		if (data == nullptr) return 0;
+		mem_read_buf_t buf(data, blocks[ix].raw_size);
+		istream in(&buf);
+		return (read_func(in) && !in.fail());
+	}
+};
+
 
 // ************ vntc_vect_t/indexed_vntc_vect_t ************
 
@@ -1086,7 +1170,7 @@ void material_t::init_textures(texture_manager &tmgr) {
 
 void material_t::check_for_tc_invert_y(texture_manager &tmgr) {
 
-	if (tcs_checked) return; // already done
+	if (tcs_checked || !is_geom_loaded()) return; // already done, or will be done when the geometry is loaded
 	int const tid(get_render_texture());
 	if (tid < 0) return; // no texture
 	texture_t &texture(tmgr.get_texture(tid));
@@ -1221,21 +1305,21 @@ bool material_t::add_poly(polygon_t const &poly, vntc_map_t vmap[2], vntct_map_t
 }
 
 
-bool material_t::write(ostream &out) const {
+bool material_t::write_params(ostream &out) const {
 
 	out.write((char const *)this, sizeof(material_params_t));
 	write_vector(out, name);
 	write_vector(out, filename);
-	return (geom.write(out) && geom_tan.write(out));
+	return out.good();
 }
 
 
-bool material_t::read(istream &in) {
+bool material_t::read_params(istream &in) {
 
 	in.read((char *)this, sizeof(material_params_t));
 	read_vector(in, name);
 	read_vector(in, filename);
-	return (geom.read(in) && geom_tan.read(in));
+	return in.good();
 }
 
 
@@ -1558,6 +1642,7 @@ void model3d::mark_mat_as_used(int mat_id) {
 
 void model3d::finalize() {
 
+	ensure_all_geom_loaded();
 #pragma omp parallel for schedule(dynamic)
 	for (int i = 0; i < (int)materials.size(); ++i) {materials[i].finalize();}
 	unbound_geom.finalize();
@@ -1573,6 +1658,7 @@ void model3d::clear() {
 	mat_map.clear();
 	coll_tree.clear();
 	smap_data.clear(); // unnecessary
+	geom_file.reset();
 	textures_loaded = 0;
 }
 
@@ -1618,7 +1704,7 @@ void model3d::bind_all_used_tids() {
 		tmgr.ensure_tid_bound(m->get_render_texture()); // only one tid for now
 		
 		if (m->use_bump_map()) {
-			if (model_calc_tan_vect && !m->geom.empty()) {
+			if (model_calc_tan_vect && mat_has_geom_no_tan(*m)) {
 				cerr << "Error loading model3d material " << m->name << ": Geometry is missing tangent vectors, so bump map cannot be enabled." << endl;
 				m->bump_tid = -1; // disable bump map
 			}
@@ -1641,12 +1727,13 @@ void model3d::bind_all_used_tids() {
 void model3d::calc_tangent_vectors() {
 
 	for (deque<material_t>::iterator m = materials.begin(); m != materials.end(); ++m) {
-		if (!m->mat_is_used() || !m->use_bump_map()) continue;
+		if (!m->mat_is_used() || !m->use_bump_map() || !m->is_geom_loaded()) continue; // tangents are stored in the file for unloaded geometry
 		m->geom_tan.calc_tangents();
 	}
 }
 
 void model3d::simplify_indices(float reduce_target) {
+	ensure_all_geom_loaded();
 	for (deque<material_t>::iterator m = materials.begin(); m != materials.end(); ++m) {m->simplify_indices(reduce_target);}
 	unbound_geom.simplify_indices(reduce_target);
 }
@@ -1711,6 +1798,13 @@ void model3d::render_materials(shader_t &shader, bool is_shadow_pass, int reflec
 		}
 		sort(to_draw.begin(), to_draw.end());
 
+		if (geom_file) { // load geometry of visible materials on first use
+			for (auto const &d : to_draw) {
+				if (!materials[d.second].is_geom_loaded()) {to_load.push_back(d.second);}
+			}
+			load_materials_geom(to_load);
+			to_load.clear();
+		}
 		for (unsigned i = 0; i < to_draw.size(); ++i) {
 			materials[to_draw[i].second].render(shader, tmgr, unbound_mat.tid, is_shadow_pass, is_z_prepass, enable_alpha_mask, is_bmap_pass, xlate);
 		}
@@ -1726,7 +1820,10 @@ void model3d::render_material(shader_t &shader, unsigned mat_id, bool is_shadow_
 	int enable_alpha_mask, bool is_bmap_pass, point const *const xlate)
 {
 	if (mat_id == materials.size()) {unbound_geom.render(shader, is_shadow_pass, xlate);} // unbound geom is material ID materials.size() (one past the end)
-	else {get_material(mat_id).render(shader, tmgr, unbound_mat.tid, is_shadow_pass, is_z_prepass, enable_alpha_mask, is_bmap_pass, xlate);}
+	else {
+		if (!get_material(mat_id).is_geom_loaded()) {load_materials_geom(vector<unsigned>(1, mat_id));}
+		get_material(mat_id).render(shader, tmgr, unbound_mat.tid, is_shadow_pass, is_z_prepass, enable_alpha_mask, is_bmap_pass, xlate);
+	}
 }
 
 material_t *model3d::get_material_by_name(string const &name) {
@@ -2087,6 +2184,7 @@ void model3d::build_cobj_tree(bool verbose) {
 
 	if (!coll_tree.is_empty() || has_cobjs) return; // already built or not needed because cobjs will be used instead
 	RESET_TIME;
+	ensure_all_geom_loaded();
 	get_polygons(coll_tree.get_tquads_ref());
 	PRINT_TIME(" Get Model3d Polygons");
 	coll_tree.build_tree_top(verbose);
@@ -2125,14 +2223,71 @@ bool model3d::check_coll_line(point const &p1, point const &p2, point &cpos, vec
 	return coll;
 }
 
+// packet version for coherent lines; only uses an existing BVH; p2 is shortened to each hit so that only closer hits are found later;
+// returns a bit mask of lines that hit
+unsigned model3d::check_coll_lines(unsigned num, point const *p1, point *p2, point *cpos, vector3d *cnorm, colorRGBA *color, bool exact) {
+
+	if (coll_tree.is_empty()) return 0;
+	unsigned hits(0);
+
+	if (transforms.empty()) {
+		unsigned active(0);
+		for (unsigned i = 0; i < num; ++i) {if (check_line_clip(p1[i], p2[i], bcube.d)) {active |= (1U << i);}}
+		if (active) {hits = coll_tree.check_coll_lines(num, p1, p2, cpos, cnorm, color, nullptr, -1, exact, active);}
+		for (unsigned i = 0; i < num; ++i) {if (hits & (1U << i)) {p2[i] = cpos[i];}}
+		return hits;
+	}
+	point p1x[MAX_LINE_PACKET_SIZE], p2x[MAX_LINE_PACKET_SIZE];
+	assert(num <= MAX_LINE_PACKET_SIZE);
+
+	for (auto xf = transforms.begin(); xf != transforms.end(); ++xf) {
+		cube_t const xf_bcube(xf->get_xformed_bcube(bcube));
+		unsigned active(0);
+
+		for (unsigned i = 0; i < num; ++i) {
+			p1x[i] = p1[i];
+			p2x[i] = p2[i];
+			if (!check_line_clip(p1[i], p2[i], xf_bcube.d)) continue;
+			xf->inv_xform_pos(p1x[i]);
+			xf->inv_xform_pos(p2x[i]);
+			active |= (1U << i);
+		}
+		if (!active) continue;
+		unsigned const xf_hits(coll_tree.check_coll_lines(num, p1x, p2x, cpos, cnorm, color, nullptr, -1, exact, active));
+
+		for (unsigned i = 0; i < num; ++i) {
+			if (!(xf_hits & (1U << i))) continue;
+			xf->xform_pos(cpos[i]);
+			xf->xform_pos_rm(cnorm[i]);
+			p2[i] = cpos[i]; // closer intersection point - shorten the segment
+		}
+		hits |= xf_hits;
+	} // for xf
+	return hits;
+}
+
 
 void model3d::get_all_mat_lib_fns(set<string> &mat_lib_fns) const {
 	for (deque<material_t>::const_iterator m = materials.begin(); m != materials.end(); ++m) {mat_lib_fns.insert(m->filename);}
 }
 
 void model3d::compute_area_per_tri() {
+
+	if (geom_file) { // area may be stored in the file; only load materials where it wasn't computed
+		vector<unsigned> mat_ids;
+
+		for (unsigned i = 0; i < materials.size(); ++i) {
+			material_t &mat(materials[i]);
+			if (mat.is_geom_loaded() || mat.avg_area_per_tri > 0.0) continue;
+			mat.avg_area_per_tri = geom_file->blocks[mat.file_block_ix].avg_area_per_tri;
+			if (mat.avg_area_per_tri == 0.0) {mat_ids.push_back(i);}
+		}
+		load_materials_geom(mat_ids);
+	}
 #pragma omp parallel for schedule(dynamic)
-	for (int i = 0; i < (int)materials.size(); ++i) {materials[i].compute_area_per_tri();}
+	for (int i = 0; i < (int)materials.size(); ++i) {
+		if (materials[i].is_geom_loaded()) {materials[i].compute_area_per_tri();}
+	}
 }
 
 void model3d::get_stats(model3d_stats_t &stats) const {
@@ -2141,8 +2296,11 @@ void model3d::get_stats(model3d_stats_t &stats) const {
 	unbound_geom.get_stats(stats);
 	
 	for (deque<material_t>::const_iterator m = materials.begin(); m != materials.end(); ++m) {
-		m->geom.get_stats(stats);
-		m->geom_tan.get_stats(stats);
+		if (m->is_geom_loaded()) {
+			m->geom.get_stats(stats);
+			m->geom_tan.get_stats(stats);
+		}
+		else {geom_file->blocks[m->file_block_ix].add_stats(stats);}
 		++stats.mats;
 	}
 }
@@ -2158,8 +2316,10 @@ void model3d::show_stats() const {
 }
 
 
-bool model3d::write_to_disk(string const &fn) const { // Note: transforms not written
+// file layout: header, material params, table of contents, then one aligned geometry block per material (block 0 is the unbound geometry)
+bool model3d::write_to_disk(string const &fn, bool compress) const { // Note: transforms not written
 
+	assert(!geom_file); // must call ensure_all_geom_loaded() first
 	ofstream out(fn, ios::out | ios::binary);
 	
 	if (!out.good()) {
@@ -2167,17 +2327,76 @@ bool model3d::write_to_disk(string const &fn) const { // Note: transforms not wr
 		return 0;
 	}
 	cout << "Writing model3d file " << fn << endl;
-	write_uint(out, MAGIC_NUMBER);
+	unsigned const num_blocks(materials.size() + 1);
+	vector<model3d_file_block_t> blocks(num_blocks);
+	vector<string> block_data(num_blocks);
+	vector<unsigned char> block_valid(num_blocks, 0);
+
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < (int)num_blocks; ++i) { // serialize and compress blocks in parallel
+		ostringstream oss(ios::out | ios::binary);
+		model3d_file_block_t &b(blocks[i]);
+		model3d_stats_t stats;
+
+		if (i == 0) {
+			block_valid[i] = unbound_geom.write(oss);
+			unbound_geom.get_stats(stats);
+			if (!unbound_geom.empty()) {b.flags |= BLOCK_HAS_GEOM;}
+		}
+		else {
+			material_t const &m(materials[i-1]);
+			block_valid[i] = m.write_geom(oss);
+			m.geom.get_stats(stats);
+			m.geom_tan.get_stats(stats);
+			if (!m.geom.empty()    ) {b.flags |= BLOCK_HAS_GEOM;}
+			if (!m.geom_tan.empty()) {b.flags |= BLOCK_HAS_GEOM_TAN;}
+			b.avg_area_per_tri = m.avg_area_per_tri;
+		}
+		b.set_stats(stats);
+		string &data(block_data[i]);
+		data = oss.str();
+		b.raw_size = data.size();
+		string comp_data;
+
+		if (compress && deflate_raw(data, comp_data) && comp_data.size() < data.size()) { // only use compression if it makes the block smaller
+			data.swap(comp_data);
+			b.flags |= BLOCK_COMPRESSED;
+		}
+		b.stored_size = data.size();
+	} // for i
+	for (unsigned i = 0; i < num_blocks; ++i) {
+		if (!block_valid[i]) {
+			cerr << "Error writing material" << endl;
+			return 0;
+		}
+	}
+	write_uint(out, MAGIC_NUMBER_V2);
+	write_uint(out, MODEL3D_FILE_VERSION);
+	write_uint(out, num_blocks);
 	out.write((char const *)&bcube, sizeof(cube_t));
-	if (!unbound_geom.write(out)) return 0;
-	write_uint(out, (unsigned)materials.size());
-	
+
 	for (deque<material_t>::const_iterator m = materials.begin(); m != materials.end(); ++m) {
-		if (!m->write(out)) {
+		if (!m->write_params(out)) {
 			cerr << "Error writing material" << endl;
 			return 0;
 		}
 	}
+	uint64_t offset(uint64_t(out.tellp()) + num_blocks*sizeof(model3d_file_block_t)); // end of the table of contents
+
+	for (auto b = blocks.begin(); b != blocks.end(); ++b) {
+		offset = (offset + MODEL3D_BLOCK_ALIGN - 1) & ~uint64_t(MODEL3D_BLOCK_ALIGN - 1);
+		b->offset = offset;
+		offset   += b->stored_size;
+	}
+	out.write((char const *)blocks.data(), num_blocks*sizeof(model3d_file_block_t));
+	char const zeros[MODEL3D_BLOCK_ALIGN] = {0};
+
+	for (unsigned i = 0; i < num_blocks; ++i) {
+		uint64_t const pos(out.tellp());
+		assert(pos <= blocks[i].offset && blocks[i].offset - pos < MODEL3D_BLOCK_ALIGN);
+		out.write(zeros, (std::streamsize)(blocks[i].offset - pos)); // padding
+		out.write(block_data[i].data(), (std::streamsize)block_data[i].size());
+	}
 	return out.good();
 }
 
@@ -2193,6 +2412,10 @@ bool model3d::read_from_disk(string const &fn) { // Note: transforms not read
 	clear(); // ???
 	unsigned const magic_number_comp(read_uint(in));
 
+	if (magic_number_comp == MAGIC_NUMBER_V2) {
+		in.close();
+		return read_from_disk_v2(fn);
+	}
 	if (magic_number_comp != MAGIC_NUMBER) {
 		cerr << "Error reading model3d file " << fn << ": Invalid file format (magic number check failed)." << endl;
 		return 0;
@@ -2214,6 +2437,111 @@ bool model3d::read_from_disk(string const &fn) { // Note: transforms not read
 	return in.good();
 }
 
+bool model3d::read_from_disk_v2(string const &fn) { // only reads the header and table of contents; material geometry is loaded on demand
+
+	std::shared_ptr<model3d_file_t> file(new model3d_file_t);
+
+	if (!file->mfr.open(fn)) {
+		cerr << "Error mapping model3d file for read: " << fn << endl;
+		return 0;
+	}
+	mem_read_buf_t buf(file->mfr.get_data(), file->mfr.get_size());
+	istream in(&buf);
+	read_uint(in); // skip magic number, which was already checked
+	unsigned const version(read_uint(in));
+
+	if (version != MODEL3D_FILE_VERSION) {
+		cerr << "Error reading model3d file " << fn << ": Unsupported file version " << version << "." << endl;
+		return 0;
+	}
+	cout << "Reading model3d file " << fn << endl;
+	from_model3d_file = 1;
+	unsigned const num_blocks(read_uint(in));
+	in.read((char *)&bcube, sizeof(cube_t));
+
+	if (num_blocks == 0 || in.fail()) {
+		cerr << "Error reading model3d file " << fn << ": Invalid header." << endl;
+		return 0;
+	}
+	materials.resize(num_blocks - 1);
+
+	for (deque<material_t>::iterator m = materials.begin(); m != materials.end(); ++m) {
+		if (!m->read_params(in)) {
+			cerr << "Error reading material" << endl;
+			return 0;
+		}
+		mat_map[m->name] = (m - materials.begin());
+	}
+	file->blocks.resize(num_blocks);
+	in.read((char *)file->blocks.data(), num_blocks*sizeof(model3d_file_block_t));
+
+	if (in.fail()) {
+		cerr << "Error reading model3d file " << fn << ": Truncated table of contents." << endl;
+		return 0;
+	}
+	for (unsigned i = 0; i < num_blocks; ++i) {
+		if (!file->mfr.in_range(file->blocks[i].offset, file->blocks[i].stored_size)) {
+			cerr << "Error reading model3d file " << fn << ": Block " << i << " is out of range." << endl;
+			return 0;
+		}
+	}
+	if (!file->read_block(0, [this](istream &bin) {return unbound_geom.read(bin);})) { // unbound geometry is always loaded
+		cerr << "Error reading model3d file " << fn << ": Invalid unbound geometry block." << endl;
+		return 0;
+	}
+	for (unsigned i = 0; i < materials.size(); ++i) {
+		if (!(file->blocks[i+1].flags & (BLOCK_HAS_GEOM | BLOCK_HAS_GEOM_TAN))) continue; // no geometry, nothing to load
+		materials[i].file_block_ix = i+1;
+		++file->num_pending;
+	}
+	if (file->num_pending > 0) {geom_file = file;} // else the file is unmapped here
+	return 1;
+}
+
+bool model3d::load_material_geom(material_t &mat) { // thread safe for different materials
+
+	assert(geom_file && !mat.is_geom_loaded());
+	bool const ret(geom_file->read_block(mat.file_block_ix, [&mat](istream &in) {return mat.read_geom(in);}));
+	if (!ret) {cerr << "Error reading geometry for material " << mat.name << " from model3d file " << filename << endl;}
+	mat.file_block_ix = -1; // don't try again, even on failure
+	return ret;
+}
+
+void model3d::load_materials_geom(vector<unsigned> const &mat_ids) { // Note: mat_ids must be unique and not yet loaded
+
+	if (mat_ids.empty()) return;
+	assert(geom_file && geom_file->num_pending >= mat_ids.size());
+#pragma omp parallel for schedule(dynamic) if (mat_ids.size() > 1)
+	for (int i = 0; i < (int)mat_ids.size(); ++i) {load_material_geom(get_material(mat_ids[i]));}
+
+	if (textures_loaded) { // bind_all_used_tids() skipped these materials because they had no geometry
+		for (unsigned i : mat_ids) {
+			if (materials[i].mat_is_used()) {materials[i].check_for_tc_invert_y(tmgr);}
+		}
+	}
+	geom_file->num_pending -= mat_ids.size();
+	if (geom_file->num_pending == 0) {geom_file.reset();} // everything has been loaded, unmap the file
+}
+
+void model3d::ensure_all_geom_loaded() { // for operations that need all of the geometry, such as building the cobj tree
+
+	if (!geom_file) return; // nothing to load
+	RESET_TIME;
+	vector<unsigned> mat_ids;
+
+	for (unsigned i = 0; i < materials.size(); ++i) {
+		if (!materials[i].is_geom_loaded()) {mat_ids.push_back(i);}
+	}
+	load_materials_geom(mat_ids);
+	assert(!geom_file);
+	PRINT_TIME("Model3d Material Geometry Load");
+}
+
+bool model3d::mat_has_geom_no_tan(material_t const &mat) const {
+	if (mat.is_geom_loaded()) {return !mat.geom.empty();}
+	return ((geom_file->blocks[mat.file_block_ix].flags & BLOCK_HAS_GEOM) != 0);
+}
+
 
 void model3d::proc_model_normals(vector<counted_normal> &cn, int recalc_normals, float nmag_thresh) {
 
@@ -2411,6 +2739,14 @@ bool model3ds::check_coll_line(point const &p1, point const &p2, point &cpos, ve
 	return ret;
 }
 
+// Note: p2 is modified
+unsigned model3ds::check_coll_lines(unsigned num, point const *p1, point *p2, point *cpos, vector3d *cnorm, colorRGBA *color, bool exact) {
+
+	unsigned hits(0);
+	for (iterator m = begin(); m != end(); ++m) {hits |= m->check_coll_lines(num, p1, p2, cpos, cnorm, color, exact);}
+	return hits;
+}
+
 
 void model3ds::write_to_cobj_file(ostream &out) const {
 	for (const_iterator m = begin(); m != end(); ++m) {m->write_to_cobj_file(out);}
@@ -2452,6 +2788,7 @@ void get_cur_model_polygons(vector<coll_tquad> &ppts, model3d_xform_t const &xf,
 	RESET_TIME;
 	unsigned const start_ix(ppts.size());
 	model3d &cur_model(get_cur_model("extract polygons from"));
+	cur_model.ensure_all_geom_loaded();
 	cur_model.get_polygons(ppts, 0, 0, lod_level);
 	cur_model.set_has_cobjs();
 	xform_polygons(ppts, xf, start_ix);
@@ -2532,6 +2869,7 @@ void get_cur_model_edges_as_cubes(vector<cube_t> &cubes, model3d_xform_t const &
 void get_cur_model_as_cubes(vector<cube_t> &cubes, model3d_xform_t const &xf) { // Note: only xf.scale is used
 	RESET_TIME;
 	model3d &cur_model(get_cur_model("extract cubes from"));
+	cur_model.ensure_all_geom_loaded();
 	cur_model.get_cubes(cubes, xf);
 	//cur_model.set_has_cobjs(); // billboard cobjs are not added, and the colors/textures are missing
 	PRINT_TIME("Create Model3d Cubes");
@@ -415,6 +415,7 @@ struct material_t : public material_params_t {
 
 	bool might_have_alpha_comp, tcs_checked;
 	int a_tid, d_tid, s_tid, ns_tid, alpha_tid, bump_tid, refl_tid;
+	int file_block_ix; // geometry block in the model3d file if not yet loaded, -1 if loaded
 	float draw_order_score, avg_area_per_tri;
 	float metalness; // < 0 disables; should go into material_params_t, but that would invalidate the model3d file format
 	string name, filename;
@@ -423,11 +424,12 @@ struct material_t : public material_params_t {
 	geometry_t<vert_norm_tc_tan> geom_tan;
 
 	material_t(string const &name_=string(), string const &fn=string())
-		: might_have_alpha_comp(0), tcs_checked(0), a_tid(-1), d_tid(-1), s_tid(-1), ns_tid(-1), alpha_tid(-1), bump_tid(-1), refl_tid(-1),
+		: might_have_alpha_comp(0), tcs_checked(0), a_tid(-1), d_tid(-1), s_tid(-1), ns_tid(-1), alpha_tid(-1), bump_tid(-1), refl_tid(-1), file_block_ix(-1),
 		draw_order_score(0.0), avg_area_per_tri(0.0), metalness(-1.0), name(name_), filename(fn) {}
 	bool add_poly(polygon_t const &poly, vntc_map_t vmap[2], vntct_map_t vmap_tan[2], unsigned obj_id=0);
 	void mark_as_used() {is_used = 1;}
 	bool mat_is_used () const {return is_used;}
+	bool is_geom_loaded() const {return (file_block_ix < 0);}
 	bool use_bump_map() const;
 	bool use_spec_map() const;
 	unsigned get_gpu_mem() const {return (geom.get_gpu_mem() + geom_tan.get_gpu_mem());}
@@ -444,13 +446,18 @@ struct material_t : public material_params_t {
 		int enable_alpha_mask, bool is_bmap_pass, point const *const xlate);
 	colorRGBA get_ad_color() const;
 	colorRGBA get_avg_color(texture_manager const &tmgr, int default_tid=-1) const;
-	bool write(ostream &out) const;
-	bool read(istream &in);
+	bool write(ostream &out) const {return (write_params(out) && write_geom(out));}
+	bool read(istream &in) {return (read_params(in) && read_geom(in));}
+	bool write_params(ostream &out) const;
+	bool read_params(istream &in);
+	bool write_geom(ostream &out) const {return (geom.write(out) && geom_tan.write(out));}
+	bool read_geom(istream &in) {return (geom.read(in) && geom_tan.read(in));}
 };
 
 
 struct voxel_params_t; // forward declaration
 class voxel_manager; // forward declaration
+struct model3d_file_t; // forward declaration
 
 class model3d {
 
@@ -475,6 +482,7 @@ class model3d {
 	set<string> undef_materials; // to reduce warning messages
 	cobj_tree_tquads_t coll_tree;
 	bool textures_loaded;
+	std::shared_ptr<model3d_file_t> geom_file; // mapped model3d file that material geometry is lazily loaded from
 
 	// transforms
 	vector<model3d_xform_t> transforms;
@@ -498,9 +506,14 @@ class model3d {
 
 	// temporaries to be reused
 	vector<pair<float, unsigned> > to_draw, to_draw_xf;
+	vector<unsigned> to_load;
 
 	void update_bbox(polygon_t const &poly);
 	void create_indir_texture();
+	bool load_material_geom(material_t &mat);
+	void load_materials_geom(vector<unsigned> const &mat_ids);
+	bool mat_has_geom_no_tan(material_t const &mat) const;
+	bool read_from_disk_v2(string const &fn);
 
 public:
 	texture_manager &tmgr; // stores all textures
@@ -544,6 +557,7 @@ public:
 	void bind_all_used_tids();
 	void calc_tangent_vectors();
 	void simplify_indices(float reduce_target);
+	void ensure_all_geom_loaded();
 	static void bind_default_flat_normal_map() {select_multitex(FLAT_NMAP_TEX, 5);}
 	void set_sky_lighting_file(string const &fn, float weight, unsigned sz[3]);
 	void set_occlusion_cube(cube_t const &cube) {occlusion_cube = cube;}
@@ -573,6 +587,7 @@ public:
 	void build_cobj_tree(bool verbose);
 	bool check_coll_line_cur_xf(point const &p1, point const &p2, point &cpos, vector3d &cnorm, colorRGBA &color, bool exact);
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, colorRGBA &color, bool exact, bool build_bvh_if_needed=0);
+	unsigned check_coll_lines(unsigned num, point const *p1, point *p2, point *cpos, vector3d *cnorm, colorRGBA *color, bool exact);
 	bool get_needs_alpha_test() const {return needs_alpha_test;}
 	bool get_needs_bump_maps () const {return needs_bump_maps;}
 	bool uses_spec_map()        const {return has_spec_maps;}
@@ -584,7 +599,7 @@ public:
 	void get_stats(model3d_stats_t &stats) const;
 	void show_stats() const;
 	void get_all_mat_lib_fns(set<std::string> &mat_lib_fns) const;
-	bool write_to_disk (string const &fn) const;
+	bool write_to_disk (string const &fn, bool compress=0) const;
 	bool read_from_disk(string const &fn);
 	static void proc_model_normals(vector<counted_normal> &cn, int recalc_normals, float nmag_thresh=0.7);
 	static void proc_model_normals(vector<weighted_normal> &wn, int recalc_normals, float nmag_thresh=0.7);
@@ -607,6 +622,7 @@ struct model3ds : public deque<model3d> {
 	unsigned get_gpu_mem() const;
 	void build_cobj_trees(bool verbose);
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, colorRGBA &color, bool exact, bool build_bvh_if_needed=0);
+	unsigned check_coll_lines(unsigned num, point const *p1, point *p2, point *cpos, vector3d *cnorm, colorRGBA *color, bool exact);
 	void write_to_cobj_file(std::ostream &out) const;
 };
 
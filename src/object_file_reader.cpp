@@ -10,9 +10,10 @@
 #include <algorithm> // for transform()
 #include <cctype> // for tolower()
 #include "fast_atof.h"
+#include "binary_file_io.h" // for mapped_file_reader
 
 
-extern bool use_obj_file_bump_grayscale;
+extern bool use_obj_file_bump_grayscale, model3d_file_compress, mt_obj_file_load;
 extern float model_auto_tc_scale, model_mat_lod_thresh;
 extern model3ds all_models;
 
@@ -225,6 +226,222 @@ public:
 };
 
 
+// ************ parallel object file parser ************
+
+unsigned const MIN_PARALLEL_OBJ_FILE_SZ = (1 << 20); // 1MB; smaller files use the serial parser
+unsigned const OBJ_CHUNK_SZ             = (1 << 21); // 2MB per parallel work item
+int      const OBJ_IX_NONE              = INT_MIN; // index not specified
+
+struct obj_face_t {
+	unsigned ix_start, npts, line; // first index into obj_chunk_t::ixs, number of vertices, line number within the chunk
+	unsigned nv, nt, nn; // number of vertices, tex coords, and normals in the chunk before this face, for resolving relative indices
+	obj_face_t(unsigned ix_start_, unsigned line_, unsigned nv_, unsigned nt_, unsigned nn_) : ix_start(ix_start_), npts(0), line(line_), nv(nv_), nt(nt_), nn(nn_) {}
+};
+
+struct obj_event_t { // a record that changes the parser state rather than adding geometry; applied in file order
+	enum {USEMTL=0, MTLLIB, OBJECT, GROUP, SMOOTH, UNDEF};
+	unsigned type, face_pos, line, val; // face_pos = number of faces in the chunk before this record
+	string str;
+	obj_event_t(unsigned type_, unsigned face_pos_, unsigned line_, string const &str_, unsigned val_=0) : type(type_), face_pos(face_pos_), line(line_), val(val_), str(str_) {}
+};
+
+struct obj_chunk_t { // data parsed from a range of whole lines of an object file
+	char const *begin, *end;
+	vector<point> v;
+	vector<colorRGB> colors; // empty if no vertex colors were read
+	vector<vector3d> n;
+	vector<point2d<float> > tc;
+	vector<int> ixs; // {vix, tix, nix} as written in the file for each face vertex
+	vector<obj_face_t> faces;
+	vector<obj_event_t> events;
+	unsigned num_lines, error_line;
+	string error;
+
+	obj_chunk_t() : begin(nullptr), end(nullptr), num_lines(0), error_line(0) {}
+	void free_vert_data() {clear_cont(v); clear_cont(colors); clear_cont(n); clear_cont(tc);}
+};
+
+inline bool obj_is_space(char c) {return (c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f');} // no newlines; lines are already split
+inline bool obj_is_digit(char c) {return (c >= '0' && c <= '9');}
+
+inline bool is_eight_digits(uint64_t val) { // SWAR test that all 8 bytes are ASCII digits
+	return (((val & 0xF0F0F0F0F0F0F0F0ULL) | (((val + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL);
+}
+inline unsigned parse_eight_digits(uint64_t val) { // SWAR conversion of 8 ASCII digits; little endian, so the first digit is in the low byte
+	uint64_t const mask(0x000000FF000000FFULL), mul1(0x000F424000000064ULL), mul2(0x0000271000000001ULL); // 100 + (1000000 << 32), 1 + (10000 << 32)
+	val -= 0x3030303030303030ULL;
+	val  = (val * 10) + (val >> 8);
+	return unsigned((((val & mask) * mul1) + (((val >> 16) & mask) * mul2)) >> 32);
+}
+
+// same result as Assimp::strtoul10_64(), but converts 8 digits at a time when possible; reads at most max_digits digits
+uint64_t parse_obj_digits(char const *&c, char const *end, unsigned &num_digits, unsigned max_digits) {
+
+	uint64_t value(0);
+	num_digits = 0;
+
+	while (num_digits + 8 <= max_digits && end - c >= 8 && value < 100000000000ULL) { // can't overflow
+		uint64_t val;
+		memcpy(&val, c, 8);
+		if (!is_eight_digits(val)) break;
+		value = 100000000ULL*value + parse_eight_digits(val);
+		c += 8;
+		num_digits += 8;
+	}
+	for (; num_digits < max_digits && c < end && obj_is_digit(*c); ++c, ++num_digits) {
+		uint64_t const new_value(10*value + uint64_t(*c - '0'));
+		if (new_value < value) break; // numeric overflow
+		value = new_value;
+	}
+	return value;
+}
+
+// parses a number the same way as Assimp::fast_atof() so that results match the serial parser exactly, without requiring a null terminated string
+char const *parse_obj_float(char const *c, char const *end, float &out) {
+
+	bool const inv(c < end && *c == '-');
+	if (inv || (c < end && *c == '+')) {++c;}
+	unsigned nd(0);
+	float f(static_cast<float>(parse_obj_digits(c, end, nd, UINT_MAX)));
+
+	if (c < end && (*c == '.' || (*c == ',' && c+1 < end && obj_is_digit(c[1])))) {
+		++c;
+		double pl(static_cast<double>(parse_obj_digits(c, end, nd, AI_FAST_ATOF_RELAVANT_DECIMALS)));
+		while (c < end && obj_is_digit(*c)) {++c;} // skip digits past the relevant decimals
+		pl *= Assimp::fast_atof_table[nd];
+		f  += static_cast<float>(pl);
+	}
+	if (c < end && (*c == 'e' || *c == 'E')) {
+		++c;
+		bool const einv(c < end && *c == '-');
+		if (einv || (c < end && *c == '+')) {++c;}
+		float exp(static_cast<float>(parse_obj_digits(c, end, nd, UINT_MAX)));
+		if (einv) {exp = -exp;}
+		f *= pow(10.0f, exp);
+	}
+	out = (inv ? -f : f);
+	return c;
+}
+
+void skip_obj_space(char const *&c, char const *end) {
+	while (c < end && obj_is_space(*c)) {++c;}
+}
+
+unsigned read_obj_floats(char const *&c, char const *end, float *vals, unsigned max_vals) { // returns the number of values read
+	for (unsigned i = 0; i < max_vals; ++i) {
+		skip_obj_space(c, end);
+		if (c == end || (!obj_is_digit(*c) && *c != '.' && *c != '-')) return i; // not a fp number
+		c = parse_obj_float(c, end, vals[i]);
+		while (c < end && !obj_is_space(*c)) {++c;} // ignore anything else up to the next whitespace, as the serial parser does
+	}
+	return max_vals;
+}
+
+bool read_obj_int(char const *&c, char const *end, int &v) {
+
+	skip_obj_space(c, end);
+	if (c == end || (!obj_is_digit(*c) && *c != '-')) return 0;
+	bool const is_neg(*c == '-');
+	if (is_neg) {++c;}
+	unsigned nd(0);
+	v = (int)parse_obj_digits(c, end, nd, UINT_MAX);
+	if (is_neg) {v = -v;}
+	return 1;
+}
+
+string get_obj_line_str(char const *c, char const *end) { // remainder of the line with leading and trailing whitespace removed
+	skip_obj_space(c, end);
+	while (end > c && obj_is_space(end[-1])) {--end;}
+	return string(c, end);
+}
+
+bool parse_obj_line(obj_chunk_t &chunk, char const *c, char const *const le, geom_xform_t const &xf, bool recalc_normals) {
+
+	skip_obj_space(c, le);
+	if (c == le) return 1; // empty line; not counted by the serial parser either
+	unsigned const line(++chunk.num_lines);
+	char const *const kw(c);
+	while (c < le && !obj_is_space(*c)) {++c;}
+	string const keyword(kw, c);
+	unsigned const face_pos(chunk.faces.size());
+
+	if (keyword[0] == '#') {} // comment
+	else if (keyword == "f") { // face
+		chunk.faces.emplace_back(chunk.ixs.size(), line, chunk.v.size(), chunk.tc.size(), chunk.n.size());
+		int vix(0);
+
+		while (read_obj_int(c, le, vix)) { // read vertex index
+			int tix(OBJ_IX_NONE), nix(OBJ_IX_NONE);
+
+			if (c < le && *c == '/') {
+				++c;
+				if (!read_obj_int(c, le, tix)) {tix = OBJ_IX_NONE;} // tex coord index is optional
+				if (c < le && *c == '/') {++c; if (!read_obj_int(c, le, nix)) {nix = OBJ_IX_NONE;}}
+			}
+			chunk.ixs.push_back(vix);
+			chunk.ixs.push_back(tix);
+			chunk.ixs.push_back(nix);
+			++chunk.faces.back().npts;
+		}
+	}
+	else if (keyword == "v") { // vertex
+		float vals[6];
+		unsigned const num(read_obj_floats(c, le, vals, 6));
+		if (num < 3) {chunk.error = "Error reading vertex"; chunk.error_line = line; return 0;}
+		if (num > 3 && num < 6) {chunk.error = "Error reading vertex color"; chunk.error_line = line; return 0;}
+		chunk.v.push_back(point(vals[0], vals[1], vals[2]));
+		xf.xform_pos(chunk.v.back());
+
+		if (num == 6) {
+			if (chunk.colors.empty()) {chunk.colors.resize(chunk.v.size()-1, WHITE);} // pad colors up to this point with white
+			chunk.colors.push_back(colorRGB(vals[3], vals[4], vals[5]));
+		}
+		else if (!chunk.colors.empty()) {chunk.colors.push_back(WHITE);} // color not specified, and in colors mode, pad with white
+	}
+	else if (keyword == "vt") { // tex coord
+		float vals[3];
+		if (read_obj_floats(c, le, vals, 3) < 2) {chunk.error = "Error reading texture coord"; chunk.error_line = line; return 0;}
+		chunk.tc.push_back(point2d<float>(vals[0], vals[1])); // discard z
+	}
+	else if (keyword == "vn") { // normal
+		float vals[3];
+		if (read_obj_floats(c, le, vals, 3) < 3) {chunk.error = "Error reading normal"; chunk.error_line = line; return 0;}
+
+		if (!recalc_normals) {
+			vector3d normal(vals[0], vals[1], vals[2]);
+			xf.xform_pos_rm(normal);
+			chunk.n.push_back(normal);
+		}
+	}
+	else if (keyword == "l") {} // line, ignored
+	else if (keyword == "o"     ) {chunk.events.emplace_back(obj_event_t::OBJECT, face_pos, line, get_obj_line_str(c, le));}
+	else if (keyword == "g"     ) {chunk.events.emplace_back(obj_event_t::GROUP,  face_pos, line, get_obj_line_str(c, le));}
+	else if (keyword == "usemtl") {chunk.events.emplace_back(obj_event_t::USEMTL, face_pos, line, get_obj_line_str(c, le));}
+	else if (keyword == "mtllib") {chunk.events.emplace_back(obj_event_t::MTLLIB, face_pos, line, get_obj_line_str(c, le));}
+	else if (keyword == "s") { // smoothing/shading (off/on or 0/1)
+		int val(0);
+
+		if (!read_obj_int(c, le, val) || val < 0) {
+			if (get_obj_line_str(c, le) != "off") {chunk.error = "Error reading smoothing group"; chunk.error_line = line; return 0;}
+			val = 0;
+		}
+		chunk.events.emplace_back(obj_event_t::SMOOTH, face_pos, line, string(), val);
+	}
+	else {chunk.events.emplace_back(obj_event_t::UNDEF, face_pos, line, keyword);}
+	return 1;
+}
+
+void parse_obj_chunk(obj_chunk_t &chunk, geom_xform_t const &xf, bool recalc_normals) {
+
+	for (char const *c = chunk.begin; c < chunk.end;) {
+		char const *line_end((char const *)memchr(c, '\n', chunk.end - c));
+		if (line_end == nullptr) {line_end = chunk.end;} // last line with no newline
+		if (!parse_obj_line(chunk, c, line_end, xf, recalc_normals)) return; // error
+		c = line_end + (line_end < chunk.end); // skip the newline
+	}
+}
+
+
 // ************************************************
 
 
@@ -281,7 +498,18 @@ bool endswith(string const &value, string const &ending) {
 
 class object_file_reader_model : public object_file_reader, public model_from_file_t {
 
-	bool had_empty_mat_error;
+	bool had_empty_mat_error, is_textured, had_npts_error;
+	int cur_mat_id, recalc_normals;
+	unsigned smoothing_group, prev_smoothing_group, num_faces, num_objects, num_groups, obj_group_id;
+	geom_xform_t xf;
+	vector<point> v; // vertices
+	vector<vector3d> n; // normals
+	// weighted_normal can also be used, but doesn't work well; see face_weight_avg mode selected by recalc_normals==2
+	vector<counted_normal> vn; // vertex normals
+	vector<point2d<float> > tc; // texture coords
+	vector<colorRGB> colors; // vertex colors
+	deque<poly_data_block> pblocks;
+	set<string> loaded_mat_libs;
 
 	bool read_map_name(ifstream &in, string &name, float *scale=nullptr) {
 		if (!(in >> name)) {return 0;} // no name read (EOF?)
@@ -317,7 +545,8 @@ class object_file_reader_model : public object_file_reader, public model_from_fi
 	}
 
 public:
-	object_file_reader_model(string const &fn, model3d &model_) : object_file_reader(fn), model_from_file_t(fn, model_), had_empty_mat_error(0) {}
+	object_file_reader_model(string const &fn, model3d &model_) : object_file_reader(fn), model_from_file_t(fn, model_), had_empty_mat_error(0), is_textured(0),
+		had_npts_error(0), cur_mat_id(-1), recalc_normals(0), smoothing_group(0), prev_smoothing_group(0), num_faces(0), num_objects(0), num_groups(0), obj_group_id(0) {}
 
 	bool load_mat_lib(string const &fn) { // Note: could cache filename, but seems to never be included more than once
 		ifstream mat_in;
@@ -529,27 +758,96 @@ public:
 		return 1;
 	}
 
-	bool read(geom_xform_t const &xf, int recalc_normals, bool verbose) {
-		RESET_TIME;
+	poly_data_block &start_face() {
+		unsigned const block_size = (1 << 18); // 256K
+		model.mark_mat_as_used(cur_mat_id);
+
+		if (pblocks.empty() || pblocks.back().pts.size() >= block_size || smoothing_group != prev_smoothing_group) { // create a new block
+			if (!pblocks.empty()) {
+				remove_excess_cap(pblocks.back().polys);
+				remove_excess_cap(pblocks.back().pts);
+			}
+			pblocks.push_back(poly_data_block());
+			prev_smoothing_group = smoothing_group;
+		}
+		poly_data_block &pb(pblocks.back());
+		pb.polys.push_back(poly_header_t(cur_mat_id, obj_group_id));
+		return pb;
+	}
+
+	void end_face(poly_data_block &pb, unsigned pix, unsigned approx_line) {
+		unsigned const npts(pb.polys.back().npts);
+
+		if (npts < 3) {
+			if (!had_npts_error) {cerr << "Error near line " << approx_line << ": face has only " << npts << " vertices." << endl; had_npts_error = 1;}
+			pb.pts.resize(pix);
+			pb.polys.pop_back(); // remove pts and polygon
+			return; // skip it
+		}
+		vector3d &normal(pb.polys.back().n);
+				
+		for (unsigned i = pix; i < pix+npts-2; ++i) { // find a nonzero normal
+			normal = cross_product((v[pb.pts[i+1].vix] - v[pb.pts[i].vix]), (v[pb.pts[i+2].vix] - v[pb.pts[i].vix])); // backwards?
+			// if we disable this normalize() we will weight normal contributions by polygon area,
+			// but we have to change the code below and it causes problems with vertex uniquing
+			normal.normalize();
+			if (normal != zero_vector) break; // got a good normal
+		}
+		if (recalc_normals) {
+			bool const face_weight_avg(recalc_normals == 2 && (npts == 3 || npts == 4)); // only works for quads and triangles
+			float face_area(0.0);
+
+			if (face_weight_avg) {
+				point face_pts[4];
+				for (unsigned i = 0; i < npts; ++i) {face_pts[i] = v[pb.pts[i+pix].vix];}
+				face_area = polygon_area(face_pts, npts);
+			}
+			for (unsigned i = pix; i < pix+npts; ++i) {
+				unsigned const vix(pb.pts[i].vix);
+				assert((unsigned)vix < vn.size());
+				bool const using_texgen(is_textured && model_auto_tc_scale > 0.0 && pb.pts[i].tix == 0);
+
+				if (vn[vix].is_valid() && (using_texgen || dot_product(normal, vn[vix].get_norm()) < 0.25)) { // normals in disagreement (or using texgen)
+					vn[vix] = zero_vector; // zero it out so that it becomes invalid later
+				}
+				else if (face_weight_avg) {vn[vix].add_normal(face_area*normal);} // face weighted average
+				else {vn[vix].add_normal(normal);} // unweighted average of normals
+			}
+		}
+	}
+
+	bool use_material(string const &material_name, unsigned approx_line) {
+		if (material_name.empty()) {
+			if (!had_empty_mat_error) {cerr << "Error reading material from object file " << filename << " near line " << approx_line << endl;}
+			had_empty_mat_error = 1;
+			return 0;
+		}
+		cur_mat_id = model.find_material(material_name);
+				
+		if (cur_mat_id >= 0) { // material was valid
+			int const tid(model.get_material(cur_mat_id).d_tid);
+			is_textured = (tid >= 0 && model.tmgr.get_tex_avg_color(tid) != WHITE); // no texture, or all white texture
+		}
+		return 1;
+	}
+
+	bool add_mat_lib(string const &mat_lib, unsigned approx_line) {
+		if (mat_lib.empty()) {
+			cerr << "Error reading material library from object file " << filename << " near line " << approx_line << endl;
+			return 0;
+		}
+		if (!try_load_mat_lib(mat_lib, loaded_mat_libs, approx_line)) {
+			//return 0; // nonfatal
+		}
+		return 1;
+	}
+
+	bool read_serial() {
 		if (!open_file()) return 0;
 		cout << "Reading object file " << filename << endl;
-		unsigned const block_size = (1 << 18); // 256K
-		int cur_mat_id(-1);
-		unsigned smoothing_group(0), prev_smoothing_group(0), num_faces(0), num_objects(0), num_groups(0), obj_group_id(0);
-		vector<point> v; // vertices
-		vector<vector3d> n; // normals
-		// weighted_normal can also be used, but doesn't work well; see face_weight_avg mode selected by recalc_normals==2
-		vector<counted_normal> vn; // vertex normals
-		vector<point2d<float> > tc; // texture coords
-		vector<colorRGB> colors; // vertex colors
-		deque<poly_data_block> pblocks;
-		set<string> loaded_mat_libs;
 		char s[MAX_CHARS];
 		string material_name, mat_lib, group_name, object_name;
-		tc.push_back(point2d<float>(0.0, 0.0)); // default tex coords
-		n.push_back(zero_vector); // default normal
 		unsigned approx_line(0);
-		bool is_textured(0), had_npts_error(0);
 
 		while (read_string(s, MAX_CHARS)) {
 			++approx_line;
@@ -562,20 +860,9 @@ public:
 				read_to_newline(fp); // ignore
 			}
 			else if (strcmp(s, "f") == 0) { // face
-				model.mark_mat_as_used(cur_mat_id);
-
-				if (pblocks.empty() || pblocks.back().pts.size() >= block_size || smoothing_group != prev_smoothing_group) { // create a new block
-					if (!pblocks.empty()) {
-						remove_excess_cap(pblocks.back().polys);
-						remove_excess_cap(pblocks.back().pts);
-					}
-					pblocks.push_back(poly_data_block());
-					prev_smoothing_group = smoothing_group;
-				}
-				poly_data_block &pb(pblocks.back());
-				pb.polys.push_back(poly_header_t(cur_mat_id, obj_group_id));
+				poly_data_block &pb(start_face());
 				unsigned &npts(pb.polys.back().npts);
-				unsigned const pix((unsigned)pb.pts.size()), pts_start(pb.pts.size());
+				unsigned const pix((unsigned)pb.pts.size());
 				int vix(0), tix(0), nix(0);
 
 				while (read_int(vix)) { // read vertex index
@@ -602,42 +889,7 @@ public:
 					pb.pts.push_back(vntc_ix);
 					++npts;
 				} // end while vertex
-				if (npts < 3) {
-					if (!had_npts_error) {cerr << "Error near line " << approx_line << ": face has only " << npts << " vertices." << endl; had_npts_error = 1;}
-					pb.pts.resize(pts_start);
-					pb.polys.pop_back(); // remove pts and polygon
-					continue; // skip it
-				}
-				vector3d &normal(pb.polys.back().n);
-				
-				for (unsigned i = pix; i < pix+npts-2; ++i) { // find a nonzero normal
-					normal = cross_product((v[pb.pts[i+1].vix] - v[pb.pts[i].vix]), (v[pb.pts[i+2].vix] - v[pb.pts[i].vix])); // backwards?
-					// if we disable this normalize() we will weight normal contributions by polygon area,
-					// but we have to change the code below and it causes problems with vertex uniquing
-					normal.normalize();
-					if (normal != zero_vector) break; // got a good normal
-				}
-				if (recalc_normals) {
-					bool const face_weight_avg(recalc_normals == 2 && (npts == 3 || npts == 4)); // only works for quads and triangles
-					float face_area(0.0);
-
-					if (face_weight_avg) {
-						point face_pts[4];
-						for (unsigned i = 0; i < npts; ++i) {face_pts[i] = v[pb.pts[i+pix].vix];}
-						face_area = polygon_area(face_pts, npts);
-					}
-					for (unsigned i = pix; i < pix+npts; ++i) {
-						unsigned const vix(pb.pts[i].vix);
-						assert((unsigned)vix < vn.size());
-						bool const using_texgen(is_textured && model_auto_tc_scale > 0.0 && pb.pts[i].tix == 0);
-
-						if (vn[vix].is_valid() && (using_texgen || dot_product(normal, vn[vix].get_norm()) < 0.25)) { // normals in disagreement (or using texgen)
-							vn[vix] = zero_vector; // zero it out so that it becomes invalid later
-						}
-						else if (face_weight_avg) {vn[vix].add_normal(face_area*normal);} // face weighted average
-						else {vn[vix].add_normal(normal);} // unweighted average of normals
-					}
-				}
+				end_face(pb, pix, approx_line);
 			}
 			else if (strcmp(s, "v") == 0) { // vertex
 				v.push_back(point());
@@ -702,29 +954,11 @@ public:
 			}
 			else if (strcmp(s, "usemtl") == 0) { // use material
 				read_str_to_newline(fp, material_name);
-
-				if (material_name.empty()) {
-					if (!had_empty_mat_error) {cerr << "Error reading material from object file " << filename << " near line " << approx_line << endl;}
-					had_empty_mat_error = 1;
-					return 0;
-				}
-				cur_mat_id = model.find_material(material_name);
-				
-				if (cur_mat_id >= 0) { // material was valid
-					int const tid(model.get_material(cur_mat_id).d_tid);
-					is_textured = (tid >= 0 && model.tmgr.get_tex_avg_color(tid) != WHITE); // no texture, or all white texture
-				}
+				if (!use_material(material_name, approx_line)) return 0;
 			}
 			else if (strcmp(s, "mtllib") == 0) { // material library
 				read_str_to_newline(fp, mat_lib);
-
-				if (mat_lib.empty()) {
-					cerr << "Error reading material library from object file " << filename << " near line " << approx_line << endl;
-					return 0;
-				}
-				if (!try_load_mat_lib(mat_lib, loaded_mat_libs, approx_line)) {
-					//return 0; // nonfatal
-				}
+				if (!add_mat_lib(mat_lib, approx_line)) return 0;
 			}
 			else {
 				cerr << "Error: Undefined entry '" << s << "' in object file " << filename << " near line " << approx_line << endl;
@@ -732,6 +966,122 @@ public:
 				//return 0;
 			}
 		} // while
+		return 1;
+	}
+
+	// parses chunks of lines of a memory mapped file in parallel, then applies faces and state changes in file order;
+	// the result is the same as read_serial(); returns 0=error, 1=success, 2=not used (file too small or can't be mapped)
+	int read_parallel() {
+		mapped_file_reader mfr;
+		if (!mfr.open(filename)) return 2; // the serial parser will report the error
+		size_t const fsize(mfr.get_size());
+		if (fsize < MIN_PARALLEL_OBJ_FILE_SZ) return 2;
+		cout << "Reading object file " << filename << " in parallel" << endl;
+		int const start_time(GET_TIME_MS());
+		char const *const data((char const *)mfr.get_data()), *const data_end(data + fsize);
+		unsigned const num_chunks(min(size_t(1024), (fsize + OBJ_CHUNK_SZ - 1)/OBJ_CHUNK_SZ));
+		vector<obj_chunk_t> chunks(num_chunks);
+		char const *pos(data);
+
+		for (unsigned i = 0; i < num_chunks; ++i) { // split at line boundaries
+			obj_chunk_t &chunk(chunks[i]);
+			chunk.begin = pos;
+
+			if (i+1 < num_chunks) {
+				pos = max(pos, data + (fsize*(i+1))/num_chunks);
+				char const *const nl((char const *)memchr(pos, '\n', data_end - pos));
+				pos = (nl ? nl+1 : data_end);
+			}
+			else {pos = data_end;}
+			chunk.end = pos;
+		}
+#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < (int)num_chunks; ++i) {parse_obj_chunk(chunks[i], xf, (recalc_normals != 0));}
+		int const parse_time(max(1, GET_TIME_MS() - start_time));
+		cout << "Parsed " << fsize/1048576 << " MB in " << num_chunks << " chunks: " << parse_time << " ms, " << (fsize/1048.576)/parse_time << " MB/s" << endl;
+		// find vertex/tc/normal offsets of each chunk in the global arrays, and check for errors in file order
+		vector<unsigned> vbase(num_chunks+1, 0), tbase(num_chunks+1, 0), nbase(num_chunks+1, 0), line_base(num_chunks+1, 0);
+		bool has_colors(0);
+
+		for (unsigned i = 0; i < num_chunks; ++i) {
+			obj_chunk_t const &chunk(chunks[i]);
+
+			if (!chunk.error.empty()) {
+				cerr << chunk.error << " from object file " << filename << " near line " << (line_base[i] + chunk.error_line) << endl;
+				return 0;
+			}
+			vbase[i+1] = vbase[i] + chunk.v.size();
+			tbase[i+1] = tbase[i] + chunk.tc.size();
+			nbase[i+1] = nbase[i] + chunk.n.size();
+			line_base[i+1] = line_base[i] + chunk.num_lines;
+			has_colors |= !chunk.colors.empty();
+		}
+		v.resize(vbase.back());
+		tc.resize(tbase.back() + 1); // account for tc[0]
+		n .resize(nbase.back() + 1); // account for n[0]
+		if (recalc_normals) {vn.resize(v.size());}
+		if (has_colors) {colors.resize(v.size(), WHITE);} // vertices without colors are white
+
+#pragma omp parallel for schedule(static)
+		for (int i = 0; i < (int)num_chunks; ++i) { // merge vertex data
+			obj_chunk_t &chunk(chunks[i]);
+			std::copy(chunk.v .begin(), chunk.v .end(), v .begin() + vbase[i]);
+			std::copy(chunk.tc.begin(), chunk.tc.end(), tc.begin() + tbase[i] + 1);
+			std::copy(chunk.n .begin(), chunk.n .end(), n .begin() + nbase[i] + 1);
+			std::copy(chunk.colors.begin(), chunk.colors.end(), colors.begin() + vbase[i]); // Note: chunk colors are either empty or the same size as chunk verts
+			chunk.free_vert_data();
+		}
+		for (unsigned i = 0; i < num_chunks; ++i) { // add faces and apply state changes in order
+			obj_chunk_t const &chunk(chunks[i]);
+			auto ev(chunk.events.begin());
+
+			for (unsigned f = 0; f <= chunk.faces.size(); ++f) {
+				for (; ev != chunk.events.end() && ev->face_pos == f; ++ev) {
+					unsigned const approx_line(line_base[i] + ev->line);
+
+					switch (ev->type) {
+					case obj_event_t::USEMTL: if (!use_material(ev->str, approx_line)) return 0; break;
+					case obj_event_t::MTLLIB: if (!add_mat_lib (ev->str, approx_line)) return 0; break;
+					case obj_event_t::OBJECT: ++num_objects; ++obj_group_id; break;
+					case obj_event_t::GROUP : ++num_groups;  ++obj_group_id; break;
+					case obj_event_t::SMOOTH: smoothing_group = ev->val; break;
+					case obj_event_t::UNDEF : cerr << "Error: Undefined entry '" << ev->str << "' in object file " << filename << " near line " << approx_line << endl; break;
+					default: assert(0);
+					}
+				} // for ev
+				if (f == chunk.faces.size()) break; // events after the last face were applied
+				obj_face_t const &face(chunk.faces[f]);
+				poly_data_block &pb(start_face());
+				unsigned const pix((unsigned)pb.pts.size());
+				unsigned const nv(vbase[i] + face.nv), nt(tbase[i] + face.nt), nn(nbase[i] + face.nn);
+
+				for (unsigned p = 0; p < face.npts; ++p) {
+					int const *const ix(&chunk.ixs[face.ix_start + 3*p]);
+					int vix(ix[0]), tix(ix[1]), nix(ix[2]);
+					normalize_index(vix, nv);
+					vntc_ix_t vntc_ix(vix, 0, 0);
+					if (tix != OBJ_IX_NONE) {normalize_index(tix, nt); vntc_ix.tix = tix+1;} // account for tc[0]
+					if (nix != OBJ_IX_NONE && !recalc_normals) {normalize_index(nix, nn); vntc_ix.nix = nix+1;} // account for n[0]
+					pb.pts.push_back(vntc_ix);
+				}
+				pb.polys.back().npts = face.npts;
+				end_face(pb, pix, line_base[i] + face.line);
+			} // for f
+		} // for i
+		int const total_time(max(1, GET_TIME_MS() - start_time));
+		cout << "Object file parse and merge: " << total_time << " ms, " << (fsize/1048.576)/total_time << " MB/s" << endl;
+		return 1;
+	}
+
+	bool read(geom_xform_t const &xf_, int recalc_normals_, bool verbose) {
+		RESET_TIME;
+		xf = xf_;
+		recalc_normals = recalc_normals_;
+		tc.push_back(point2d<float>(0.0, 0.0)); // default tex coords
+		n.push_back(zero_vector); // default normal
+		int const mt_ret(mt_obj_file_load ? read_parallel() : 2);
+		if (mt_ret == 0) return 0; // error
+		if (mt_ret == 2 && !read_serial()) return 0; // parallel parser not used
 		remove_excess_cap(v);
 		remove_excess_cap(n);
 		remove_excess_cap(tc);
@@ -811,7 +1161,7 @@ bool write_model3d_file(string const &base_fn, model3d &cur_model) {
 	out_fn += ".model3d";
 	cur_model.calc_tangent_vectors(); // tangent vectors are needed for writing
 				
-	if (!cur_model.write_to_disk(out_fn)) {
+	if (!cur_model.write_to_disk(out_fn, model3d_file_compress)) {
 		cerr << "Error writing model3d file " << out_fn << endl;
 		return 0;
 	}
@@ -846,6 +1196,7 @@ bool load_model_file(string const &filename, model3ds &models, geom_xform_t cons
 			check_obj_file_ext(filename, ext);
 			//test_other_obj_loader(filename); // placeholder for testing other object file loaders (tinyobjloader, assimp, etc.)
 			if (!reader.read(xf, recalc_normals, verbose)) {models.pop_back(); return 0;}
+			if (write_file && model_mat_lod_thresh > 0.0) {cur_model.compute_area_per_tri();} // compute before writing so that it's stored in the file
 			if (write_file && !write_model3d_file(filename, cur_model)) return 0; // don't need to pop the model
 		}
 	}
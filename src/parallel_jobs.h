@@ -0,0 +1,27 @@
+// 3D World - shared job runner for updates that can't use omp parallel loops
+// by Frank Gennari
+// 10/17/26
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <vector>
+
+// runs func(job, thread_ix) for each job in [0, num_jobs), with num_threads threads pulling jobs from a shared counter; the calling thread is thread 0;
+// used by updates that may already be running inside an omp parallel region (for example alongside the draw thread), where nested omp loops would be serialized
+template<typename F> void run_jobs_parallel(unsigned num_jobs, unsigned num_threads, F const &func) {
+	if (num_threads > num_jobs) {num_threads = num_jobs;}
+
+	if (num_threads <= 1) {
+		for (unsigned job = 0; job < num_jobs; ++job) {func(job, 0);}
+		return;
+	}
+	std::atomic<unsigned> next_job(0);
+	auto run_jobs([&](unsigned thread_ix) {
+		for (unsigned job = next_job++; job < num_jobs; job = next_job++) {func(job, thread_ix);}
+	});
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < num_threads; ++t) {threads.emplace_back(run_jobs, t);}
+	run_jobs(0);
+	for (auto &t : threads) {t.join();}
+}
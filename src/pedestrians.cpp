@@ -120,68 +120,43 @@ bool pedestrian_t::is_valid_pos(vect_cube_t const &colliders, bool &ped_at_dest,
 	return 1;
 }
 
-void register_ped_coll(pedestrian_t &p1, pedestrian_t &p2, unsigned pid1, unsigned pid2) {
-	p1.collided = p1.ped_coll = 1; p1.colliding_ped = pid2;
-	p2.collided = p2.ped_coll = 1; p2.colliding_ped = pid1;
-}
+// Note: only this ped is modified; other peds are read from the start-of-frame state grid, so each ped of a colliding pair detects the collision itself
+bool pedestrian_t::check_ped_ped_coll(ped_manager_t const &ped_mgr, unsigned pid, float delta_dir) {
+	if (in_building) return 0; // no ped-ped collisions in buildings (yet)
+	ped_state_grid_t const &grid(ped_mgr.get_ped_grid());
+	float const timestep(2.0*TICKS_PER_SECOND), lookahead_dist(timestep*speed); // how far we can travel in 2s
+	float const prox_radius(1.2*radius + lookahead_dist), prox_radius_sq(prox_radius*prox_radius); // assume other ped has a similar radius
+	// need to check for coll between two peds crossing the street from different sides, since they won't be in the same plot while in the street
+	bool const check_next_plot(in_the_road && next_plot != plot);
+	vector3d force(zero_vector);
 
-bool pedestrian_t::check_ped_ped_coll_range(vector<pedestrian_t> &peds, unsigned pid, unsigned ped_start, unsigned target_plot, float prox_radius, vector3d &force) {
-	float const prox_radius_sq(prox_radius*prox_radius);
-
-	for (auto i = peds.begin()+ped_start; i != peds.end(); ++i) { // check every ped until we exit target_plot
-		if (i->plot != target_plot) break; // moved to a new plot, no collision, done; since plots are globally unique across cities, we don't need to check cities
-		float const dist_sq(p2p_dist_xy_sq(pos, i->pos));
-		if (dist_sq > prox_radius_sq) continue; // proximity test
-		float const r_sum(0.6f*(radius + i->radius)); // using a smaller radius to allow peds to get close to each other
-		if (dist_sq < r_sum*r_sum) {register_ped_coll(*this, *i, pid, (i - peds.begin())); return 1;} // collision
-		if (speed < TOLERANCE) continue;
-		vector3d const delta_v(vel - i->vel), delta_p((pos.x - i->pos.x), (pos.y - i->pos.y), 0.0);
+	bool const coll(grid.for_each_near(pos, prox_radius, [&](unsigned ix) {
+		if (ix == pid) return 0; // skip self
+		ped_state_t const &p(grid.get(ix));
+		// since plots are globally unique across cities, we don't need to check cities
+		if (p.plot != plot && !(check_next_plot && p.plot == next_plot)) return 0;
+		float const dist_sq(p2p_dist_xy_sq(pos, p.pos));
+		if (dist_sq > prox_radius_sq) return 0; // proximity test
+		float const r_sum(0.6f*(radius + p.radius)); // using a smaller radius to allow peds to get close to each other
+		if (dist_sq < r_sum*r_sum) {collided = ped_coll = 1; colliding_ped = ix; return 1;} // collision
+		if (speed < TOLERANCE) return 0;
+		vector3d const delta_v(vel - p.vel), delta_p((pos.x - p.pos.x), (pos.y - p.pos.y), 0.0);
 		float const dp(-dot_product_xy(delta_v, delta_p));
-		if (dp <= 0.0) continue; // diverging, no avoidance needed
+		if (dp <= 0.0) return 0; // diverging, no avoidance needed
 		float const dv_mag(delta_v.mag()), dist(sqrt(dist_sq)), fmag(dist/(dist - 0.9*r_sum));
-		if (dv_mag < TOLERANCE) continue;
+		if (dv_mag < TOLERANCE) return 0;
 		vector3d const rejection(delta_p - (dp/(dv_mag*dv_mag))*delta_v); // component of velocity perpendicular to delta_p (avoid dir)
 		float const rmag(rejection.mag()), rel_vel(max(dv_mag/speed, 0.5f)); // higher when peds are converging
-		if (rmag < TOLERANCE) continue;
+		if (rmag < TOLERANCE) return 0;
 		float const force_mult(dp/(dv_mag*dist)); // stronger with head-on collisions
 		force += rejection*(rel_vel*force_mult*fmag/rmag);
-		//cout << TXT(r_sum) << TXT(dist) << TXT(fmag) << ", dv: " << delta_v.str() << ", dp: " << delta_p.str() << ", rej: " << rejection.str() << ", force: " << force.str() << endl;
-	} // for i
-	return 0;
-}
-
-bool pedestrian_t::check_ped_ped_coll(ped_manager_t const &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, float delta_dir) {
-	if (in_building) return 0; // no ped-ped collisions in buildings (yet)
-	assert(pid < peds.size());
-	float const timestep(2.0*TICKS_PER_SECOND), lookahead_dist(timestep*speed); // how far we can travel in 2s
-	float const prox_radius(1.2*radius + lookahead_dist); // assume other ped has a similar radius
-	vector3d force(zero_vector);
-	if (check_ped_ped_coll_range(peds, pid, pid+1, plot, prox_radius, force)) return 1;
-
-	if (in_the_road && next_plot != plot) {
-		// need to check for coll between two peds crossing the street from different sides, since they won't be in the same plot while in the street
-		unsigned const ped_ix(ped_mgr.get_first_ped_at_plot(next_plot));
-		assert(ped_ix <= peds.size()); // could be at the end
-		if (check_ped_ped_coll_range(peds, pid, ped_ix, next_plot, prox_radius, force)) return 1;
-	}
+		return 0;
+	}));
+	if (coll) return 1;
 	if (force != zero_vector) {set_velocity((0.1*delta_dir)*force + ((1.0 - delta_dir)/speed)*vel);} // apply ped repulsive force
 	return 0;
 }
 
-bool pedestrian_t::check_ped_ped_coll_stopped(vector<pedestrian_t> &peds, unsigned pid) {
-	if (in_building) return 0; // no ped-ped collisions in buildings (yet)
-	assert(pid < peds.size());
-
-	// Note: shouldn't have to check peds in the next plot, assuming that if we're stopped, they likely are as well, and won't be walking toward us
-	for (auto i = peds.begin()+pid+1; i != peds.end(); ++i) { // check every ped until we exit target_plot
-		if (i->plot != plot) break; // moved to a new plot, no collision, done; since plots are globally unique across cities, we don't need to check cities
-		if (!dist_xy_less_than(pos, i->pos, 0.6f*(radius + i->radius))) continue; // no collision
-		i->collided = i->ped_coll = 1; i->colliding_ped = pid;
-		return 1; // Note: could omit this return and continue processing peds
-	} // for i
-	return 0;
-}
-
 bool pedestrian_t::try_place_in_plot(cube_t const &plot_cube, vect_cube_t const &colliders, unsigned plot_id, rand_gen_t &rgen) {
 	pos    = rand_xy_pt_in_cube(plot_cube, radius, rgen);
 	pos.z += radius; // place on top of the plot
@@ -197,109 +172,13 @@ float path_finder_t::path_t::calc_length_up_to(const_iterator i) const {
 	for (auto p = begin(); p+1 != i; ++p) {len += p2p_dist(*p, *(p+1));}
 	return len;
 }
-cube_t path_finder_t::path_t::calc_bcube() const { // Note: could probably get away with only x/y bounds
-	assert(!empty());
-	cube_t bcube(front(), front());
-	for (auto i = begin()+1; i != end(); ++i) {bcube.union_with_pt(*i);}
-	return bcube;
-}
 
 // path_finder_t
-bool path_finder_t::add_pt_to_path(point const &p, path_t &path) const {
-	if (!plot_bcube.contains_pt_xy(p)) return 0; // outside the plot - invalid
-	path.push_back(p);
-	return 1;
-}
-
-bool path_finder_t::add_pts_around_cube_xy(path_t &path, path_t const &cur_path, path_t::const_iterator p, cube_t const &c, bool dir) {
-	point const &n(*(p+1));
-	if (c.contains_pt_xy(*p) || c.contains_pt_xy(n)) return 0; // point contained in cube - likely two overlapping/adjacent building cubes - fail
+void path_finder_t::build_path_to_node(unsigned node_ix, path_t &path) const {
 	path.clear();
-	path.insert(path.end(), cur_path.begin(), p+1); // add the prefix, including p
-	cube_t ec(c);
-	ec.expand_by_xy(gap); // expand cubes in x and y
-	point const corners [4] = {point( c.x1(),  c.y1(), p->z), point( c.x1(),  c.y2(), p->z), point( c.x2(),  c.y2(), p->z), point( c.x2(),  c.y1(), p->z)}; // CW
-	point const ecorners[4] = {point(ec.x1(), ec.y1(), p->z), point(ec.x1(), ec.y2(), p->z), point(ec.x2(), ec.y2(), p->z), point(ec.x2(), ec.y1(), p->z)}; // CW; expanded cube
-	vector3d const delta(n - *p); // not normalized
-	// find the two closest corners to the left and right
-	float min_dp1(0.0), min_dp2(0.0);
-	unsigned cix1(4), cix2(4); // start at invalid values
-	//cout << TXT(p->x) << TXT(p->y) << TXT(n.x) << TXT(n.y) << TXT(delta.x) << TXT(delta.y) << TXT(c.x1()) << TXT(c.x2()) << TXT(c.y1()) << TXT(c.y2()) << endl;
-
-	for (unsigned i = 0; i < 4; ++i) {
-		vector3d const delta2(corners[i] - *p); // unexpanded corners
-		float const dp(dot_product_xy(delta, delta2)/delta2.mag());
-		bool const turn_dir(cross_product_xy(delta, delta2) < 0.0);
-		//cout << TXT(delta2.x) << TXT(delta2.y) << TXT(i) << TXT(dp) << TXT(turn_dir) << endl;
-		if ((turn_dir ? cix1 : cix2) == 4 || dp < (turn_dir ? min_dp1 : min_dp2)) {(turn_dir ? min_dp1 : min_dp2) = dp; (turn_dir ? cix1 : cix2) = i;}
-	}
-	//cout << TXT(dir) << TXT(min_dp1) << TXT(min_dp2) << TXT(cix1) << TXT(cix2) << endl;
-	if (cix1 == 4 || cix2 == 4) return 0; // something bad happened (floating-point error?), fail
-	unsigned dest_cix(dir ? cix2 : cix1);
-	bool const move_dir((((dest_cix+1)&3) == (dir ? cix1 : cix2)) ? 0 : 1); // CCW/CW based on which dir moves around the other side of the cube
-	if (check_line_clip_xy(*p, ecorners[dest_cix], c.d)) return 0; // something bad happened (floating-point error?), fail
-	if (!add_pt_to_path(ecorners[dest_cix], path)) return 0; // expanded corner
-
-	if (check_line_clip_xy(n, ecorners[dest_cix], c.d)) { // no path to dest, add another point
-		if (move_dir) {dest_cix = (dest_cix+1)&3;} else {dest_cix = (dest_cix+3)&3;}
-		assert(dest_cix != (dir ? cix1 : cix2));
-		if (!add_pt_to_path(ecorners[dest_cix], path)) return 0; // expanded corner
-
-		if (check_line_clip_xy(n, ecorners[dest_cix], c.d)) { // no path to dest, add another point
-			if (move_dir) {dest_cix = (dest_cix+1)&3;} else {dest_cix = (dest_cix+3)&3;}
-			if (!add_pt_to_path(ecorners[dest_cix], path)) return 0; // expanded corner
-			//assert(!check_line_clip_xy(n, ecorners[dest_cix], c.d)); // must have a path now
-		}
-	}
-	path.insert(path.end(), p+1, cur_path.end()); // add the suffix, including p+1
+	for (int n = node_ix; n >= 0; n = nodes[n].parent) {path.push_back(nodes[n].p);}
+	std::reverse(path.begin(), path.end());
 	path.calc_length();
-	return 1;
-}
-
-void path_finder_t::find_best_path_recur(path_t const &cur_path, unsigned depth) {
-	if (depth >= MAX_PATH_DEPTH) return; // depth is too high, fail (stack not allocated)
-	if (cur_path.length >= best_path.length) return; // bound (best path length is set to an upper bound even when not valid)
-	cube_t const bcube(cur_path.calc_bcube());
-	path_t::const_iterator first_int_p(cur_path.end());
-	float tmin(1.0);
-	unsigned cix(0);
-
-	for (unsigned ix = 0; ix < avoid.size(); ++ix) {
-		if (used[ix]) continue; // done with this cube
-		cube_t const &c(avoid[ix]);
-		if (!c.intersects_xy(bcube)) continue;
-
-		for (auto p = cur_path.begin(); p+1 != cur_path.end() && p <= first_int_p; ++p) { // iterate over line segments up to/including first_int_p, skip last point
-			float c_tmin, c_tmax;
-			if (!get_line_clip_xy(*p, *(p+1), c.d, c_tmin, c_tmax)) continue;
-			if (p < first_int_p || c_tmin < tmin) {first_int_p = p; tmin = c_tmin; cix = ix;} // intersection
-		}
-	} // for ix
-	if (first_int_p != cur_path.end()) {
-		assert(tmin < 1.0);
-		path_t &next_path(path_stack[depth]);
-		assert(!used[cix]);
-		used[cix] = 1; // mark this cube used so that we don't try to intersect it again (and to avoid floating-point errors with line adjacency)
-
-		for (unsigned d = 0; d < 2; ++d) {
-			if (add_pts_around_cube_xy(next_path, cur_path, first_int_p, avoid[cix], d)) {find_best_path_recur(next_path, depth+1);} // recursive call
-		}
-		assert(used[cix]);
-		used[cix] = 0; // mark cube as unused
-		if (first_int_p == cur_path.begin() || found_complete_path()) return; // path is no good, terminate
-		// calculate the length of the partial path; add twice the distance we're short (to the destination) as a penalty
-		float const partial_len(cur_path.calc_length_up_to(first_int_p+1) + 2.0*p2p_dist(*first_int_p, dest));
-		if (partial_len >= partial_path.length) return; // not better
-		partial_path.clear();
-		partial_path.insert(partial_path.end(), cur_path.begin(), first_int_p+1); // record best partial path seen
-		partial_path.length = partial_len;
-		return;
-	}
-	if (cur_path.length < best_path.length) { // this test almost always succeeds
-		best_path = cur_path; // if we got here without returning above, this is the best path seen so far
-		partial_path.clear(); // not using partial_path after this point
-		partial_path.length = 0.0;
-	}
 }
 
 bool path_finder_t::shorten_path(path_t &path) const {
@@ -318,23 +197,119 @@ bool path_finder_t::shorten_path(path_t &path) const {
 }
 
 bool path_finder_t::find_best_path() {
-	used.clear();
-	used.resize(avoid.size(), 0);
 	best_path.clear();
 	partial_path.clear();
-	cur_path.clear();
-	cur_path.init(pos, dest);
-	best_path.length = partial_path.length = 5.0*cur_path.length; // add an upper bound of 4x length to avoid too much recursion
-	find_best_path_recur(cur_path, 0); // depth=0
-	shorten_path(best_path); // see if we can remove any path points; this rarely has a big effect on path length, so it's okay to save time by doing this after the length test
+	best_path.length = partial_path.length = 0.0;
+	nodes.clear();
+	open_set.clear();
+	nodes.emplace_back(pos); // start node
+	// add expanded cube corners as candidate waypoints; skip any that are outside the plot or inside another cube
+	for (auto c = avoid.begin(); c != avoid.end(); ++c) {
+		cube_t ec(*c);
+		ec.expand_by_xy(gap);
+		point const ecorners[4] = {point(ec.x1(), ec.y1(), pos.z), point(ec.x1(), ec.y2(), pos.z), point(ec.x2(), ec.y2(), pos.z), point(ec.x2(), ec.y1(), pos.z)};
+
+		for (unsigned i = 0; i < 4; ++i) {
+			if (plot_bcube.contains_pt_xy(ecorners[i]) && !any_cube_contains_pt_xy(avoid, ecorners[i])) {nodes.emplace_back(ecorners[i]);}
+		}
+	} // for c
+	unsigned const dest_ix(nodes.size());
+	nodes.emplace_back(dest);
+	float const max_len(5.0*p2p_dist(pos, dest)); // upper bound of 5x straight line length
+	float best_partial_score(FLT_MAX);
+	unsigned best_partial_ix(0), num_expanded(0);
+	auto const heap_comp([](pair<float, unsigned> const &a, pair<float, unsigned> const &b) {return (a.first > b.first);}); // min heap
+	nodes[0].g = 0.0;
+	nodes[0].f = max_len/5.0; // straight line distance to dest
+	open_set.emplace_back(nodes[0].f, 0);
+
+	while (!open_set.empty() && num_expanded < MAX_PATH_EXPANSIONS) {
+		std::pop_heap(open_set.begin(), open_set.end(), heap_comp);
+		unsigned const cur(open_set.back().second);
+		open_set.pop_back();
+		node_t &n(nodes[cur]);
+		if (n.closed) continue; // stale entry
+		n.closed = 1;
+		++num_expanded;
+		if (cur == dest_ix) {build_path_to_node(dest_ix, best_path); break;} // done
+		// score partial paths as length plus twice the distance we're short (to the destination) as a penalty
+		float const partial_score(n.g + 2.0*p2p_dist(n.p, dest));
+		if (cur != 0 && partial_score < best_partial_score) {best_partial_score = partial_score; best_partial_ix = cur;}
+
+		for (unsigned i = 1; i < nodes.size(); ++i) { // visit neighbors; start is never a neighbor
+			node_t &nb(nodes[i]);
+			if (nb.closed) continue;
+			float const g(n.g + p2p_dist(n.p, nb.p));
+			if (g >= nb.g) continue; // not an improvement
+			float const f(g + p2p_dist(nb.p, dest));
+			if (f > max_len) continue; // too long
+			if (line_int_cubes_xy(n.p, nb.p, avoid)) continue; // not visible; test this last because it's the most expensive
+			nb.g = g;
+			nb.f = f;
+			nb.parent = cur;
+			open_set.emplace_back(f, i);
+			std::push_heap(open_set.begin(), open_set.end(), heap_comp);
+		} // for i
+	} // while
+	++stats.num_runs;
+	stats.num_expanded += num_expanded;
+	max_eq(stats.max_expanded, num_expanded);
+	if (!found_complete_path() && best_partial_ix > 0) {build_path_to_node(best_partial_ix, partial_path);}
+	shorten_path(best_path); // see if we can remove any path points
 	shorten_path(partial_path);
-	//cout << TXT(avoid.size()) << TXT(cur_path.length) << TXT(best_path.length) << found_path() << endl;
+	//cout << TXT(avoid.size()) << TXT(nodes.size()) << TXT(num_expanded) << TXT(best_path.length) << found_path() << endl;
 	return found_path();
 }
 
+unsigned path_finder_t::get_avoid_hash() const {
+	unsigned h(avoid.size());
+
+	for (auto c = avoid.begin(); c != avoid.end(); ++c) {
+		for (unsigned d = 0; d < 2; ++d) { // only x/y matter
+			for (unsigned e = 0; e < 2; ++e) {
+				uint32_t v;
+				memcpy(&v, &c->d[d][e], sizeof(v));
+				h = 31*h + v;
+			}
+		}
+	}
+	return h;
+}
+
+uint64_t path_finder_t::get_cache_key(unsigned plot_id) const {
+	// quantize start and dest to cells of ~ped radius (gap is 10% of radius), relative to the plot
+	float const inv_cell(0.1/max(gap, TOLERANCE));
+	auto quantize([&](float v, float lo) {return uint64_t(min(2047, max(0, int((v - lo)*inv_cell))));}); // 11 bits
+	uint64_t key(plot_id & 0xFFFFF); // 20 bits
+	key = (key << 11) | quantize(pos .x, plot_bcube.x1());
+	key = (key << 11) | quantize(pos .y, plot_bcube.y1());
+	key = (key << 11) | quantize(dest.x, plot_bcube.x1());
+	key = (key << 11) | quantize(dest.y, plot_bcube.y1());
+	return key;
+}
+
+bool path_finder_t::check_cached_path(uint64_t key, unsigned avoid_hash) {
+	path_cache_t::entry_t const *const entry(path_cache->find(key));
+	if (entry == nullptr) return 0;
+	vector<point> const &path(entry->path);
+	if (entry->avoid_hash != avoid_hash) return 0; // colliders have changed; the entry will be replaced with the newly found path
+	assert(path.size() >= 2);
+	// the cached path was from a nearby start point to a nearby dest; make sure the first and last segments are still clear from our actual points
+	if (line_int_cubes_xy(pos, path[1], avoid)) return 0;
+	if (line_int_cubes_xy(path[path.size()-2], dest, avoid)) return 0;
+	best_path.assign(path.begin(), path.end());
+	best_path.front() = pos;
+	best_path.back () = dest;
+	best_path.calc_length();
+	partial_path.clear();
+	++stats.num_cache_hits;
+	return 1;
+}
+
 // Note: avoid must be non-overlapping and should be non-adjacent; even better if cubes are separated enough that peds can pass between them (> 2*ped radius)
 // return values: 0=failed, 1=valid path, 2=init contained, 3=straight path (no collisions)
-unsigned path_finder_t::run(point const &pos_, point const &dest_, cube_t const &plot_bcube_, float gap_, point &new_dest) {
+// plot_id is used for path caching; pass -1 to disable caching
+unsigned path_finder_t::run(point const &pos_, point const &dest_, cube_t const &plot_bcube_, float gap_, point &new_dest, int plot_id) {
 	if (!line_int_cubes_xy(pos_, dest_, avoid)) return 3; // no work to be done, leave dest as it is
 	pos = pos_; dest = dest_; plot_bcube = plot_bcube_; gap = gap_;
 	//if (any_cube_contains_pt_xy(avoid, dest)) return 0; // invalid dest pos - ignore for now and let path finding deal with it when we get to that pos
@@ -369,13 +344,43 @@ unsigned path_finder_t::run(point const &pos_, point const &dest_, cube_t const
 			}
 		} // for i
 	}
-	if (!find_best_path()) return 0; // if we fail to find a path, leave new_dest unchanged
+	bool const use_cache(path_cache != nullptr && plot_id >= 0 && next_pt_ix == 1 && !debug); // only cache paths from unmodified start points
+	unsigned const avoid_hash(use_cache ? get_avoid_hash() : 0);
+	uint64_t const cache_key(use_cache ? get_cache_key(plot_id) : 0);
+
+	if (!use_cache || !check_cached_path(cache_key, avoid_hash)) {
+		if (!find_best_path()) return 0; // if we fail to find a path, leave new_dest unchanged
+
+		if (use_cache && found_complete_path() && best_path.size() >= 2) { // added to the shared cache later by the caller
+			new_cache_entries.emplace_back(cache_key, avoid_hash, best_path.length, best_path);
+		}
+	}
 	vector<point> const &path(get_best_path());
 	assert(next_pt_ix < path.size());
 	new_dest = path[next_pt_ix]; // set dest to next point on the best path
 	return (next_pt_ix ? 1 : 2); // return 2 for the init contained case
 }
 
+// path_cache_t
+bool path_cache_t::entry_t::operator<(entry_t const &e) const {
+	if (key        != e.key       ) return (key        < e.key       );
+	if (length     != e.length    ) return (length     < e.length    ); // prefer shorter paths
+	if (avoid_hash != e.avoid_hash) return (avoid_hash < e.avoid_hash);
+	return (path < e.path);
+}
+
+void path_cache_t::add_entries(vector<entry_t> &entries) {
+	sort(entries.begin(), entries.end());
+
+	for (auto i = entries.begin(); i != entries.end(); ++i) {
+		if (i != entries.begin() && i->key == (i-1)->key) continue; // keep the first entry for each key
+		if (cache.size() >= MAX_PATH_CACHE_SIZE) {cache.clear();} // simple bound on memory usage
+		auto it(cache.find(i->key));
+		if (it == cache.end()) {cache.emplace(i->key, std::move(*i));} else {it->second = std::move(*i);} // replace any stale entry
+	}
+	entries.clear();
+}
+
 // pedestrian_t
 point pedestrian_t::get_dest_pos(cube_t const &plot_bcube, cube_t const &next_plot_bcube, ped_manager_t const &ped_mgr) const {
 	if (is_stopped && target_valid()) {return target_pos;} // stay the course (this case only needed for debug drawing)
@@ -476,17 +481,13 @@ void pedestrian_t::move(ped_manager_t const &ped_mgr, cube_t const &plot_bcube,
 	anim_time += timestep*speed;
 }
 
-void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, rand_gen_t &rgen, float delta_dir) {
+// Note: may be called in parallel for different peds; dest selection and crosswalk marking modify shared state and are done serially in ped_manager_t::next_frame()
+void pedestrian_t::next_frame(ped_manager_t &ped_mgr, path_finder_t &path_finder, unsigned pid, float delta_dir) {
 	if (destroyed)    return; // destroyed
 	if (speed == 0.0) return; // not moving, no update needed
 	if (in_building)  return; // building update/movement logic handled elsewhere
-
-	// navigation with destination
-	if (at_dest) {
-		register_at_dest();
-		ped_mgr.choose_new_ped_plot_pos(*this);
-	}
-	if (at_crosswalk) {ped_mgr.mark_crosswalk_in_use(*this);}
+	rand_gen_t rgen;
+	rgen.set_state(ssn, frame_counter); // per-ped random sequence so that results don't depend on update order
 	// movement logic
 	cube_t const &plot_bcube(ped_mgr.get_city_plot_bcube_for_peds(city, plot));
 	cube_t const &next_plot_bcube(ped_mgr.get_city_plot_bcube_for_peds(city, next_plot));
@@ -498,8 +499,7 @@ void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds
 			target_pos = all_zeros;
 			go(); // back up or turn so that we don't walk forward into the street? move() should attempt to rotate in place
 		}
-		else {
-			check_ped_ped_coll_stopped(peds, pid); // still need to check for other peds colliding with us; this doesn't always work
+		else { // other peds check for collisions with us against our start-of-frame state
 			collided = ped_coll = 0;
 			return;
 		}
@@ -508,11 +508,10 @@ void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds
 	vect_cube_t const &colliders(ped_mgr.get_colliders_for_plot(city, plot));
 	bool outside_plot(0);
 
-	if (collided) {} // already collided with a previous ped this frame, handled below
-	else if (!check_inside_plot(ped_mgr, prev_pos, plot_bcube, next_plot_bcube)) {collided = outside_plot = 1;} // outside the plot, treat as a collision with the plot bounds
+	if (!check_inside_plot(ped_mgr, prev_pos, plot_bcube, next_plot_bcube)) {collided = outside_plot = 1;} // outside the plot, treat as a collision with the plot bounds
 	else if (!is_valid_pos(colliders, at_dest, &ped_mgr)) {collided = 1;} // collided with a static collider
 	else if (check_road_coll(ped_mgr, plot_bcube, next_plot_bcube)) {collided = 1;} // collided with something in the road (stoplight, streetlight, etc.)
-	else if (check_ped_ped_coll(ped_mgr, peds, pid, delta_dir)) {collided = 1;} // collided with another pedestrian
+	else if (check_ped_ped_coll(ped_mgr, pid, delta_dir)) {collided = 1;} // collided with another pedestrian
 	else { // no collisions
 		//cout << TXT(pid) << TXT(plot) << TXT(dest_plot) << TXT(next_plot) << TXT(at_dest) << TXT(delta_dir) << TXT((unsigned)stuck_count) << TXT(collided) << endl;
 		vector3d dest_pos(get_dest_pos(plot_bcube, next_plot_bcube, ped_mgr));
@@ -527,12 +526,12 @@ void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds
 			}
 			// run only every several frames to reduce runtime; also run when at dest and when close to the current target pos or at the destination
 			if (at_dest || update_path) {
-				get_avoid_cubes(ped_mgr, colliders, dest_pos, ped_mgr.path_finder.get_avoid_vector());
+				get_avoid_cubes(ped_mgr, colliders, dest_pos, path_finder.get_avoid_vector());
 				target_pos = all_zeros;
 				cube_t union_plot_bcube(plot_bcube);
 				union_plot_bcube.union_with_cube(next_plot_bcube); // this is the area the ped is constrained to (both plots + road in between)
 				// run path finding between pos and dest_pos using avoid cubes
-				if (ped_mgr.path_finder.run(pos, dest_pos, union_plot_bcube, 0.1*radius, dest_pos)) {target_pos = dest_pos;}
+				if (path_finder.run(pos, dest_pos, union_plot_bcube, 0.1*radius, dest_pos, plot)) {target_pos = dest_pos;}
 			}
 			else if (target_valid()) {dest_pos = target_pos;} // use previous frame's dest if valid
 			vector3d dest_dir((dest_pos.x - pos.x), (dest_pos.y - pos.y), 0.0); // zval=0, not normalized
@@ -562,8 +561,7 @@ void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds
 			else {pos += rgen.signed_rand_vector_spherical_xy()*(0.1*radius); } // shift randomly by 10% radius to get unstuck
 		}
 		if (ped_coll) {
-			assert(colliding_ped < peds.size());
-			vector3d const coll_dir(peds[colliding_ped].pos - pos);
+			vector3d const coll_dir(ped_mgr.get_ped_grid().get(colliding_ped).pos - pos);
 			new_dir = cross_product(vel, plus_z);
 			if (dot_product_xy(new_dir, coll_dir) > 0.0) {new_dir = -new_dir;} // orient away from the other ped
 		}
@@ -793,10 +791,37 @@ void ped_manager_t::register_ped_new_plot(pedestrian_t const &ped) {
 	if (!need_to_sort_city.empty()) {need_to_sort_city[ped.city] = 1;}
 	need_to_sort_peds = 1;
 }
-void ped_manager_t::move_ped_to_next_plot(pedestrian_t &ped) {
+void ped_manager_t::move_ped_to_next_plot(pedestrian_t &ped) { // Note: called during the parallel update; plot changes are registered serially afterward
 	if (ped.next_plot == ped.plot) return; // already there (error?)
-	ped.plot = ped.next_plot; // assumes plot is adjacent; doesn't actually do any moving, only registers the move
-	register_ped_new_plot(ped);
+	ped.plot = ped.next_plot; // assumes plot is adjacent; doesn't actually do any moving
+}
+
+void ped_state_grid_t::build(vector<pedestrian_t> const &peds) {
+	state.clear();
+	for (pedestrian_t const &p : peds) {state.emplace_back(p);}
+	float max_search_radius(0.0);
+
+	for (pedestrian_t const &p : peds) { // cell size must cover the largest ped collision search radius, so that a 3x3 block of cells is enough
+		if (!p.destroyed && !p.in_building) {max_eq(max_search_radius, (1.2f*p.radius + 2.0f*TICKS_PER_SECOND*p.speed));}
+	}
+	cell_sz     = max(max_search_radius, ped_manager_t::get_ped_radius());
+	inv_cell_sz = 1.0/cell_sz;
+	unsigned num_buckets(1);
+	while (num_buckets < peds.size()) {num_buckets <<= 1;} // power of two, at least one bucket per ped
+	hash_mask = num_buckets - 1;
+	// counting sort of peds by bucket; stable, so peds within each bucket are in index order
+	cell_start.clear();
+	cell_start.resize(num_buckets+1, 0);
+	vector<unsigned> bucket(state.size());
+
+	for (unsigned i = 0; i < state.size(); ++i) {
+		bucket[i] = get_hash(get_cell_coord(state[i].pos.x), get_cell_coord(state[i].pos.y));
+		++cell_start[bucket[i]+1];
+	}
+	for (unsigned b = 0; b < num_buckets; ++b) {cell_start[b+1] += cell_start[b];}
+	ped_ixs.resize(state.size());
+	vector<unsigned> pos(cell_start.begin(), cell_start.end()-1);
+	for (unsigned i = 0; i < state.size(); ++i) {ped_ixs[pos[bucket[i]]++] = i;}
 }
 
 void ped_manager_t::next_frame() {
@@ -804,7 +829,7 @@ void ped_manager_t::next_frame() {
 	float const delta_dir(1.2*(1.0 - pow(0.7f, fticks))); // controls pedestrian turning rate
 
 	if (!peds.empty()) {
-		//timer_t timer("Ped Update"); // ~3.9ms for 10K peds
+		//timer_t timer("Ped Update"); // ~3.9ms for 10K peds serial
 
 		// Note: should make sure this is after sorting cars, so that road_ix values are actually in order; however, that makes things slower, and is unlikely to make a difference
 	#pragma omp critical(modify_car_data)
@@ -816,7 +841,36 @@ void ped_manager_t::next_frame() {
 		if (first_frame) { // choose initial ped destinations (must be after building setup, etc.)
 			for (auto i = peds.begin(); i != peds.end(); ++i) {choose_dest_building_or_parked_car(*i);}
 		}
-		for (auto i = peds.begin(); i != peds.end(); ++i) {i->next_frame(*this, peds, (i - peds.begin()), rgen, delta_dir);}
+		for (auto i = peds.begin(); i != peds.end(); ++i) { // serial part: these modify rgen and city state
+			if (i->destroyed || i->speed == 0.0 || i->in_building) continue; // same as pedestrian_t::next_frame()
+
+			if (i->at_dest) { // navigation with destination
+				i->register_at_dest();
+				choose_new_ped_plot_pos(*i);
+			}
+			if (i->at_crosswalk) {mark_crosswalk_in_use(*i);}
+		} // for i
+		ped_grid.build(peds); // other peds are only read through this
+		unsigned const peds_per_job = 256;
+		unsigned const num_jobs((peds.size() + peds_per_job - 1)/peds_per_job), num_threads(min(num_jobs, get_city_update_num_threads()));
+		path_finders.resize(max(num_threads, 1U));
+		for (path_finder_t &pf : path_finders) {pf.set_path_cache(&path_cache);}
+
+		run_jobs_parallel(num_jobs, num_threads, [&](unsigned job, unsigned thread_ix) {
+			unsigned const start(job*peds_per_job), end(min((unsigned)peds.size(), (start + peds_per_job)));
+			for (unsigned i = start; i < end; ++i) {peds[i].next_frame(*this, path_finders[thread_ix], i, delta_dir);}
+		});
+		for (unsigned i = 0; i < peds.size(); ++i) {
+			if (peds[i].plot != ped_grid.get(i).plot) {register_ped_new_plot(peds[i]);}
+		}
+		for (path_finder_t &pf : path_finders) { // serial part: add new paths to the cache in a thread independent order, and accumulate stats
+			vector<path_cache_t::entry_t> &entries(pf.get_new_cache_entries());
+			new_cache_entries.insert(new_cache_entries.end(), std::make_move_iterator(entries.begin()), std::make_move_iterator(entries.end()));
+			entries.clear();
+			path_stats.add(pf.get_stats());
+			pf.clear_stats();
+		}
+		path_cache.add_entries(new_cache_entries);
 		if (need_to_sort_peds) {sort_by_city_and_plot();}
 		first_frame = 0;
 	}
@@ -825,6 +879,13 @@ void ped_manager_t::next_frame() {
 	}
 }
 
+void ped_manager_t::show_path_finder_stats() { // stats since the last call
+	path_finder_stats_t const &s(path_stats);
+	cout << "Ped path finding: runs: " << s.num_runs << ", cache hits: " << s.num_cache_hits << ", nodes expanded: " << s.num_expanded
+		 << ", per run: " << (s.num_runs ? float(s.num_expanded)/float(s.num_runs) : 0.0f) << ", max per run: " << s.max_expanded << endl;
+	path_stats = path_finder_stats_t();
+}
+
 pedestrian_t const *ped_manager_t::get_ped_at(point const &p1, point const &p2) const { // Note: p1/p2 in local TT space
 	for (unsigned city = 0; city+1 < by_city.size(); ++city) {
 		if (!get_expanded_city_bcube_for_peds(city).line_intersects(p1, p2)) continue; // skip
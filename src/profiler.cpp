@@ -4,6 +4,7 @@
 
 #include "3DWorld.h"
 #include "profiler.h"
+#include <mutex>
 
 using std::string;
 
@@ -17,6 +18,7 @@ template <typename T> class timing_profiler {
 		void add(T t) {++count; time += t; tmax = max(tmax, t);}
 	};
 	map<string, entry_t> entries;
+	std::mutex mutex; // register_time() may be called from background threads (tile generation)
 
 public:
 	bool enabled;
@@ -25,6 +27,7 @@ public:
 	void clear() {entries.clear();}
 
 	void register_time(const char *str, T delta_time) {
+		std::lock_guard<std::mutex> lock(mutex);
 		if (enabled) {entries[str].add(delta_time);}
 		else {cout << str << " time = " << delta_time << endl;}
 	}
@@ -6,8 +6,10 @@
 #include "mesh.h"
 #include "model3d.h"
 #include "binary_file_io.h"
+#include <glm/gtc/packing.hpp>
 #include <atomic>
 #include <thread>
+#include <mutex>
 
 
 bool const COLOR_FROM_COBJ_TEX = 0; // 0 = fast/average color, 1 = true color
@@ -20,14 +22,16 @@ float const ICE_ALBEDO    = 0.8;
 
 bool keep_beams(0); // debugging mode
 bool kill_raytrace(0);
-bool no_stat_moving(0); // generally not thread safe for dynamic lighting update, since BVH is rebuilt per-frame; also, wrong to cache lighting for moving cobjs
+bool no_stat_moving(0); // wrong to cache lighting for moving cobjs; the static moving BVH is double buffered, so it's safe to query from lighting threads
 unsigned NPTS(50000), NRAYS(40000), LOCAL_RAYS(1000000), GLOBAL_RAYS(1000000), DYNAMIC_RAYS(1000000), NUM_THREADS(1), MAX_RAY_BOUNCES(20);
 std::atomic<unsigned long long> tot_rays(0), num_hits(0), cells_touched(0);
 unsigned const NUM_RAY_SPLITS [NUM_LIGHTING_TYPES] = {1, 1, 1, 1, 1}; // sky, global, local, cobj_accum, dynamic
 unsigned const INIT_RAY_SPLITS[NUM_LIGHTING_TYPES] = {1, 4, 1, 1, 1}; // sky, global, local, cobj_accum, dynamic
+unsigned const NUM_DETERMINISTIC_LT_JOBS = 64; // for deterministic_lighting mode; independent of thread count
+unsigned const LIGHT_RAY_PACKET_SIZE = MAX_LINE_PACKET_SIZE; // primary rays traced together through the BVHs
 
-extern bool has_snow, combined_gu, global_lighting_update, lighting_update_offline, store_cobj_accum_lighting_as_blocked;
-extern int read_light_files[], write_light_files[], display_mode, DISABLE_WATER;
+extern bool has_snow, combined_gu, global_lighting_update, lighting_update_offline, deterministic_lighting, lighting_file_half_float, store_cobj_accum_lighting_as_blocked;
+extern int world_mode, read_light_files[], write_light_files[], display_mode, DISABLE_WATER;
 extern float water_plane_z, temperature, snow_depth, ray_step_size_mult, first_ray_weight[];
 extern char *lighting_file[];
 extern point sun_pos, moon_pos;
@@ -214,7 +218,7 @@ light_volume_local &get_local_light_volume(int ltype) {
 }
 
 
-unsigned add_path_to_lmcs(lmap_manager_t *lmgr, cube_t *bcube, point p1, point const &p2, float weight, colorRGBA const &color, int ltype, bool first_pt) {
+unsigned add_path_to_lmcs(lmap_manager_t *lmgr, cube_t *bcube, point p1, point const &p2, float weight, colorRGBA const &color, int ltype, bool first_pt, lmap_accum_buffer_t *abuf) {
 
 	bool const dynamic(is_ltype_dynamic(ltype));
 	if (first_pt && dynamic) return 0; // since dynamic lights already have a direct lighting component, we skip the first ray here to avoid double counting it
@@ -241,8 +245,8 @@ unsigned add_path_to_lmcs(lmap_manager_t *lmgr, cube_t *bcube, point p1, point c
 		for (unsigned s = 0; s < nsteps; ++s) {
 			lmcell *lmc(lmgr->get_lmcell_round_down(p1));
 		
-			if (lmc != NULL) { // could use a mutex here, but it seems too slow
-				float *color(lmc->get_offset(ltype));
+			if (lmc != NULL) { // if abuf is null, this is a racy update from multiple threads; could use a mutex here, but it seems too slow
+				float *color(abuf ? abuf->get_cell_vals(lmgr->get_cell_ix(lmc)) : lmc->get_offset(ltype));
 				ADD_LIGHT_CONTRIB(cw, color);
 				if (ltype != LIGHTING_LOCAL) {color[3] += weight;}
 			}
@@ -252,14 +256,24 @@ unsigned add_path_to_lmcs(lmap_manager_t *lmgr, cube_t *bcube, point p1, point c
 			bcube->assign_or_union_with_pt(p1);
 			bcube->union_with_pt(p2);
 		}
-		lmgr->was_updated = 1;
+		if (!abuf) {lmgr->was_updated = 1;} // else set when abuf is merged
 	}
 	return nsteps;
 }
 
 
-void cast_light_ray(lmap_manager_t *lmgr, point p1, point p2, float weight, float weight0, colorRGBA color, float line_length,
-	int ignore_cobj, int ltype, unsigned depth, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map, cube_t *bcube=nullptr)
+struct light_ray_hit_t { // first intersection of a light ray with cobjs and models, from a packet query
+	point cpos;
+	vector3d cnorm;
+	colorRGBA model_color;
+	int cindex;
+	bool coll, model_coll;
+	light_ray_hit_t() : cindex(-1), coll(0), model_coll(0) {}
+};
+
+// if first_hit is passed in, p1 and p2 must already be clipped to the scene
+void cast_light_ray(lmap_manager_t *lmgr, lmap_accum_buffer_t *abuf, point p1, point p2, float weight, float weight0, colorRGBA color, float line_length,
+	int ignore_cobj, int ltype, unsigned depth, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map, cube_t *bcube=nullptr, light_ray_hit_t const *first_hit=nullptr)
 {
 	if (depth > MAX_RAY_BOUNCES) return;
 	if (ltype == LIGHTING_DYNAMIC && depth > 4) return; // use a sensible default since this is running during rendering
@@ -268,20 +282,33 @@ void cast_light_ray(lmap_manager_t *lmgr, point p1, point p2, float weight, floa
 
 	// find intersection point with scene cobjs
 	point orig_p1(p1);
-	if (!do_line_clip_scene(p1, p2, min(zbottom, czmin), max(ztop, czmax))) return;
-	if ((display_mode & 0x01) && is_under_mesh(p1)) return;
+
+	if (first_hit == nullptr) {
+		if (!do_line_clip_scene(p1, p2, min(zbottom, czmin), max(ztop, czmax))) return;
+		if ((display_mode & 0x01) && is_under_mesh(p1)) return;
+	}
 	int cindex(-1), xpos(0), ypos(0);
 	point cpos(p2);
 	vector3d cnorm;
 	float t(0.0), zval(0.0);
-	bool snow_coll(0), ice_coll(0), water_coll(0), mesh_coll(0);
+	bool coll(0), model_coll(0), snow_coll(0), ice_coll(0), water_coll(0), mesh_coll(0);
 	vector3d const dir((p2 - p1).get_norm());
-	bool coll(check_coll_line_exact(p1, p2, cpos, cnorm, cindex, 0.0, ignore_cobj, 1, 0, 1, 1, (p1 == orig_p1), no_stat_moving)); // fast=1, exclude voxels, maybe skip init colls
-	assert(coll ? (cindex >= 0 && cindex < (int)coll_objects.size()) : (cindex == -1));
-
-	// find the intersection point with the model3ds
 	colorRGBA model_color;
-	bool const model_coll(all_models.check_coll_line(p1, cpos, cpos, cnorm, model_color, 1));
+
+	if (first_hit) {
+		coll        = first_hit->coll;
+		model_coll  = first_hit->model_coll;
+		cpos        = first_hit->cpos;
+		cnorm       = first_hit->cnorm;
+		cindex      = first_hit->cindex;
+		model_color = first_hit->model_color;
+	}
+	else {
+		coll = check_coll_line_exact(p1, p2, cpos, cnorm, cindex, 0.0, ignore_cobj, 1, 0, 1, 1, (p1 == orig_p1), no_stat_moving); // fast=1, exclude voxels, maybe skip init colls
+		assert(coll ? (cindex >= 0 && cindex < (int)coll_objects.size()) : (cindex == -1));
+		// find the intersection point with the model3ds
+		model_coll = all_models.check_coll_line(p1, cpos, cpos, cnorm, model_color, 1);
+	}
 	coll |= model_coll;
 
 	// find intersection point with mesh (approximate)
@@ -336,7 +363,7 @@ void cast_light_ray(lmap_manager_t *lmgr, point p1, point p2, float weight, floa
 	if (!coll) return; // more efficient to do this up here and let a reverse ray from the sky light this path
 
 	// walk from p1 to p2, adding light to all lightmap cells encountered
-	cells_touched += add_path_to_lmcs(lmgr, bcube, p1, p2, weight, color, ltype, (depth == 0));
+	cells_touched += add_path_to_lmcs(lmgr, bcube, p1, p2, weight, color, ltype, (depth == 0), abuf);
 	++num_hits;
 	//if (!coll)    return;
 	if (p1 == p2) return; // line must have started inside a cobj - this is bad, but what can we do?
@@ -442,7 +469,7 @@ void cast_light_ray(lmap_manager_t *lmgr, point p1, point p2, float weight, floa
 							point const p_int(p_end + (p2 - p_end)*t);
 
 							if (!dist_less_than(p2, p_int, get_step_size())) {	
-								cells_touched += add_path_to_lmcs(lmgr, bcube, p2, p_int, weight, color, ltype, (depth == 0));
+								cells_touched += add_path_to_lmcs(lmgr, bcube, p2, p_int, weight, color, ltype, (depth == 0), abuf);
 								++num_hits;
 							}
 							if (calc_refraction_angle(v_refract, v_refract2, -cnorm2, cobj.cp.refract_ix, 1.0)) {
@@ -460,7 +487,7 @@ void cast_light_ray(lmap_manager_t *lmgr, point p1, point p2, float weight, floa
 						no_transmit = 1; // total internal reflection (could process an internal reflection)
 					}
 				}
-				if (!no_transmit) {cast_light_ray(lmgr, p2, p_end, tweight, weight0, color, line_length, cindex, ltype, depth+1, rgen, accum_map, bcube);} // transmitted
+				if (!no_transmit) {cast_light_ray(lmgr, abuf, p2, p_end, tweight, weight0, color, line_length, cindex, ltype, depth+1, rgen, accum_map, bcube);} // transmitted
 			}
 			weight *= rweight; // reflected weight
 		}
@@ -489,21 +516,83 @@ void cast_light_ray(lmap_manager_t *lmgr, point p1, point p2, float weight, floa
 			//assert(dot_product(v_new, cnorm) >= 0.0); // too strong - may fail due to FP rounding
 		}
 		p2 = p1 + v_new*line_length; // ending point: effectively at infinity
-		cast_light_ray(lmgr, cpos, p2, weight/num_splits, weight0, color, line_length, cindex, ltype, depth+1, rgen, accum_map, bcube);
+		cast_light_ray(lmgr, abuf, cpos, p2, weight/num_splits, weight0, color, line_length, cindex, ltype, depth+1, rgen, accum_map, bcube);
 	}
 }
 
 
+// primary rays from a light source share an origin or a direction, so they're traced through the cobj and model BVHs together
+// in coherent packets; each ray is then continued individually by cast_light_ray() from its first hit
+class light_ray_packet_t {
+	lmap_manager_t *lmgr;
+	lmap_accum_buffer_t *abuf;
+	float weight, line_length;
+	colorRGBA color;
+	int ltype;
+	rand_gen_t &rgen;
+	cobj_ray_accum_map_t *accum_map;
+	unsigned num;
+	point p1[LIGHT_RAY_PACKET_SIZE], p2[LIGHT_RAY_PACKET_SIZE];
+
+public:
+	light_ray_packet_t(lmap_manager_t *lmgr_, lmap_accum_buffer_t *abuf_, float weight_, colorRGBA const &color_, float line_length_, int ltype_,
+		rand_gen_t &rgen_, cobj_ray_accum_map_t *accum_map_) :
+		lmgr(lmgr_), abuf(abuf_), weight(weight_), line_length(line_length_), color(color_), ltype(ltype_), rgen(rgen_), accum_map(accum_map_), num(0) {}
+	~light_ray_packet_t() {assert(num == 0);} // must be flushed
+
+	void add_ray(point const &start_pt, point const &end_pt) {
+		point pa(start_pt), pb(end_pt);
+		if (!do_line_clip_scene(pa, pb, min(zbottom, czmin), max(ztop, czmax)) || ((display_mode & 0x01) && is_under_mesh(pa))) {++tot_rays; return;}
+
+		if (pa == start_pt) { // starts inside the scene, so may need to skip initial collisions; trace it by itself
+			cast_light_ray(lmgr, abuf, start_pt, end_pt, weight, weight, color, line_length, -1, ltype, 0, rgen, accum_map);
+			return;
+		}
+		p1[num] = pa;
+		p2[num] = pb;
+		if (++num == LIGHT_RAY_PACKET_SIZE) {flush();}
+	}
+	void flush() {
+		if (num == 0) return;
+		point cpos[LIGHT_RAY_PACKET_SIZE], end_pts[LIGHT_RAY_PACKET_SIZE];
+		vector3d cnorm[LIGHT_RAY_PACKET_SIZE];
+		colorRGBA model_color[LIGHT_RAY_PACKET_SIZE];
+		int cindex[LIGHT_RAY_PACKET_SIZE];
+		unsigned const coll_mask((world_mode == WMODE_GROUND) ? check_coll_lines_exact_tree(num, p1, p2, cpos, cnorm, cindex, -1, 0, 1, 0, no_stat_moving) : 0);
+
+		for (unsigned i = 0; i < num; ++i) {
+			if (!(coll_mask & (1U << i))) {cpos[i] = p2[i]; cindex[i] = -1;}
+			end_pts[i] = cpos[i];
+		}
+		unsigned const model_mask(all_models.check_coll_lines(num, p1, end_pts, cpos, cnorm, model_color, 1));
+
+		for (unsigned i = 0; i < num; ++i) {
+			light_ray_hit_t hit;
+			hit.coll        = ((coll_mask  & (1U << i)) != 0);
+			hit.model_coll  = ((model_mask & (1U << i)) != 0);
+			hit.cpos        = cpos[i];
+			hit.cnorm       = cnorm[i];
+			hit.cindex      = cindex[i];
+			hit.model_color = model_color[i];
+			assert(hit.coll ? (hit.cindex >= 0 && hit.cindex < (int)coll_objects.size()) : (hit.cindex == -1));
+			cast_light_ray(lmgr, abuf, p1[i], p2[i], weight, weight, color, line_length, -1, ltype, 0, rgen, accum_map, nullptr, &hit);
+		}
+		num = 0;
+	}
+};
+
+
 struct rt_data {
 	unsigned ix, num, job_id, checksum;
 	int rseed, ltype;
-	bool is_thread, verbose, randomized, is_running;
+	bool is_thread, verbose, randomized, is_running, finished;
 	cube_t update_bcube;
 	lmap_manager_t *lmgr;
+	lmap_accum_buffer_t accum_buf; // only enabled for jobs that accumulate per-thread
 	cobj_ray_accum_map_t accum_map;
 
 	rt_data(unsigned i=0, unsigned n=0, int s=1, bool t=0, bool v=0, bool r=0, int lt=0, unsigned jid=0)
-		: ix(i), num(n), job_id(jid), checksum(0), rseed(s), ltype(lt), is_thread(t), verbose(v), randomized(r), is_running(0), lmgr(nullptr) {update_bcube.set_to_zeros();}
+		: ix(i), num(n), job_id(jid), checksum(0), rseed(s), ltype(lt), is_thread(t), verbose(v), randomized(r), is_running(0), finished(0), lmgr(nullptr) {update_bcube.set_to_zeros();}
 
 	void pre_run(rand_gen_t &rgen) {
 		assert(lmgr);
@@ -516,18 +605,44 @@ struct rt_data {
 		assert(is_running); // can this fail due to race conditions? too strong? remove?
 		is_running = 0;
 	}
+	lmap_accum_buffer_t *get_abuf() {return (accum_buf.is_enabled() ? &accum_buf : nullptr);}
+
+	void merge_accum_buf() { // adds to lmgr and frees the buffer; partial results from killed jobs are dropped
+		if (!kill_raytrace) {accum_buf.add_to(*lmgr, ltype);}
+		accum_buf.clear();
+	}
 };
 
 
 template<typename T> class thread_manager_t {
 
 	vector<std::thread> threads;
+	std::atomic<unsigned> next_job;
+	std::mutex merge_mutex;
+	unsigned next_merge; // index of the next job whose accum buffer is to be merged
+
+	static void run_jobs(thread_manager_t *tm, void (*func)(rt_data *)) { // each thread takes the next unstarted job until none are left
+		for (unsigned j = tm->next_job++; j < tm->data.size(); j = tm->next_job++) {
+			func((rt_data *)(&tm->data[j]));
+			tm->finish_job(j);
+		}
+	}
+	// accum buffers are merged in job order so that the result doesn't depend on thread scheduling, and are freed as soon as they're merged;
+	// only buffers for jobs that finished ahead of an earlier running job are kept
+	void finish_job(unsigned j) {
+		if (!data[j].accum_buf.is_enabled()) return;
+		std::lock_guard<std::mutex> lock(merge_mutex);
+		data[j].finished = 1;
+		for (; next_merge < data.size() && data[next_merge].finished; ++next_merge) {data[next_merge].merge_accum_buf();}
+	}
 public:
-	vector<T> data; // to be filled in by the caller
+	vector<T> data; // to be filled in by the caller; one entry per job, which can be more than the number of threads
 
+	thread_manager_t() : next_job(0), next_merge(0) {}
 	bool is_active() const {return (!threads.empty());}
 
 	bool any_threads_running() const {
+		if (next_job < data.size()) return 1; // some jobs haven't been started yet
 		for (auto i = data.begin(); i != data.end(); ++i) {if (i->is_running) return 1;}
 		return 0;
 	}
@@ -535,14 +650,20 @@ public:
 		data.clear();
 		threads.clear();
 	}
-	void create(unsigned num_threads) {
+	void create(unsigned num_threads, unsigned num_jobs) {
 		assert(!is_active());
-		data.resize(num_threads);
+		assert(num_jobs >= num_threads);
+		data.resize(num_jobs);
 		threads.resize(num_threads);
 	}
 	void run(void (*func)(rt_data *)) {
-		assert(threads.size() == data.size());
-		for (unsigned t = 0; t < threads.size(); ++t) {threads[t] = std::thread(func, (rt_data *)(&data[t]));}
+		assert(threads.size() <= data.size());
+		next_job = next_merge = 0;
+		for (unsigned t = 0; t < threads.size(); ++t) {threads[t] = std::thread(run_jobs, this, func);}
+	}
+	void run_on_this_thread(void (*func)(rt_data *)) {
+		next_job = next_merge = 0;
+		run_jobs(this, func);
 	}
 	void join() {
 		for (unsigned t = 0; t < threads.size(); ++t) {threads[t].join();}
@@ -582,7 +703,8 @@ void check_for_lighting_finished() { // to be called about once per frame
 
 	if (!thread_manager.is_active()) return; // inactive
 	if (thread_manager.any_threads_running()) return; // still running
-	thread_manager.join_and_clear(); // clear() or join_and_clear()?
+	thread_manager.join(); // accum buffers are merged by the threads as jobs finish
+	thread_manager.clear();
 	update_lmap_from_temp_copy();
 }
 
@@ -593,19 +715,25 @@ void launch_threaded_job(unsigned num_threads, void (*start_func)(rt_data *), bo
 	kill_current_raytrace_threads();
 	assert(num_threads > 0 && num_threads < 100);
 	assert(!keep_beams || num_threads == 1); // could use a mutex instead to make this legal
-	bool const single_thread(num_threads == 1);
+	bool const single_thread(num_threads == 1), dynamic(is_ltype_dynamic(ltype));
+	// per-thread accumulation is used unless this is a progressive update that's drawn while in progress;
+	// deterministic mode splits the work into a fixed number of jobs rather than one per thread
+	bool const use_accum_buf(!dynamic && (blocking || use_temp_lmap || deterministic_lighting));
+	unsigned const num_jobs((deterministic_lighting && !dynamic) ? NUM_DETERMINISTIC_LT_JOBS : num_threads);
+	num_threads = min(num_threads, num_jobs); // extra threads would have no jobs
 	if (verbose) {cout << "Computing lighting on " << num_threads << " threads." << endl;}
-	thread_manager.create(num_threads);
+	thread_manager.create(num_threads, num_jobs);
 	vector<rt_data> &data(thread_manager.data);
 	if (use_temp_lmap) {thread_temp_lmap.init_from(lmap_manager);}
+	lmap_manager_t *const lmgr(use_temp_lmap ? &thread_temp_lmap : &lmap_manager);
 
 	for (unsigned t = 0; t < data.size(); ++t) {
-		// create a custom lmap_manager_t for each thread then merge them together?
-		data[t] = rt_data(t, num_threads, 234323*(t+1), !single_thread, (verbose && t == 0), randomized, ltype, job_id);
-		data[t].lmgr = (use_temp_lmap ? &thread_temp_lmap : &lmap_manager);
+		data[t] = rt_data(t, num_jobs, 234323*(t+1), !single_thread, (verbose && t == 0), randomized, ltype, job_id);
+		data[t].lmgr = lmgr;
+		if (use_accum_buf) {data[t].accum_buf.init(*lmgr);}
 	}
 	if (single_thread && blocking) { // threads disabled
-		start_func((rt_data *)(&data[0]));
+		thread_manager.run_on_this_thread(start_func);
 	}
 	else {
 		thread_manager.run(start_func);
@@ -640,21 +768,21 @@ bool cube_light_src_vect::ray_intersects_any(point const &start_pt, point const
 }
 
 
-void trace_one_global_ray(lmap_manager_t *lmgr, point const &pos, point const &pt, colorRGBA const &color, float ray_wt,
-	int ltype, bool is_scene_cube, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map, float line_length)
-{
+void trace_one_global_ray(light_ray_packet_t &packet, point const &pos, point const &pt, bool is_scene_cube, float line_length) {
+
 	point const end_pt(pt + (pt - pos).get_norm()*line_length);
 	if (is_scene_cube && global_cube_lights.ray_intersects_any(pt, end_pt)) return; // don't double count
-	cast_light_ray(lmgr, pos, end_pt, ray_wt, ray_wt, color, line_length, -1, ltype, 0, rgen, accum_map);
+	packet.add_ray(pos, end_pt);
 }
 
 
-void trace_ray_block_global_cube(lmap_manager_t *lmgr, cube_t const &bnds, point const &pos, colorRGBA const &color, float ray_wt,
+void trace_ray_block_global_cube(lmap_manager_t *lmgr, lmap_accum_buffer_t *abuf, cube_t const &bnds, point const &pos, colorRGBA const &color, float ray_wt,
 	unsigned nrays, int ltype, unsigned disabled_edges, bool is_scene_cube, bool verbose, bool randomized, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map)
 {
 	float const line_length(2.0*get_scene_radius());
 	vector3d const ldir((bnds.get_cube_center() - pos).get_norm());
 	float proj_area[3] = {0}, tot_area(0.0);
+	light_ray_packet_t packet(lmgr, abuf, ray_wt, color, line_length, ltype, rgen, accum_map); // all rays start at pos
 
 	for (unsigned i = 0; i < 3; ++i) { // adjust the number or weight of rays based on sun/moon position, or simply modify color scale?
 		if (disabled_edges & EFLAGS[i][ldir[i] < 0.0]) continue; // should this be here, or should we just skip them later?
@@ -680,7 +808,7 @@ void trace_ray_block_global_cube(lmap_manager_t *lmgr, cube_t const &bnds, point
 				if (verbose && ((s%1000) == 0)) {increment_printed_number(s/1000);}
 				pt[d0] = rgen.rand_uniform(bnds.d[d0][0], bnds.d[d0][1]);
 				pt[d1] = rgen.rand_uniform(bnds.d[d1][0], bnds.d[d1][1]);
-				trace_one_global_ray(lmgr, pos, pt, color, ray_wt, ltype, is_scene_cube, rgen, accum_map, line_length);
+				trace_one_global_ray(packet, pos, pt, is_scene_cube, line_length);
 			}
 		}
 		else {
@@ -697,10 +825,11 @@ void trace_ray_block_global_cube(lmap_manager_t *lmgr, cube_t const &bnds, point
 					if (kill_raytrace) break;
 					if (verbose && ((num%1000) == 0)) increment_printed_number(num/1000);
 					pt[d1] = bnds.d[d1][0] + (s1 + rgen.rand_uniform(0.0, 1.0))*len1/n1;
-					trace_one_global_ray(lmgr, pos, pt, color, ray_wt, ltype, is_scene_cube, rgen, accum_map, line_length);
+					trace_one_global_ray(packet, pos, pt, is_scene_cube, line_length);
 				}
 			}
 		}
+		packet.flush();
 		if (verbose) {cout << endl;}
 	} // for i
 }
@@ -718,14 +847,14 @@ void trace_ray_block_global_light(rt_data *data, point const &pos, colorRGBA con
 		float const ray_wt(RAY_WEIGHT*weight*color.alpha/GLOBAL_RAYS);
 		assert(ray_wt > 0.0);
 		cube_t const bnds(get_scene_bounds());
-		trace_ray_block_global_cube(data->lmgr, bnds, pos, color, ray_wt, max(1U, GLOBAL_RAYS/data->num), LIGHTING_GLOBAL, 0, 1, data->verbose, data->randomized, rgen, &data->accum_map);
+		trace_ray_block_global_cube(data->lmgr, data->get_abuf(), bnds, pos, color, ray_wt, max(1U, GLOBAL_RAYS/data->num), LIGHTING_GLOBAL, 0, 1, data->verbose, data->randomized, rgen, &data->accum_map);
 	}
 	for (cube_light_src_vect::const_iterator i = global_cube_lights.begin(); i != global_cube_lights.end(); ++i) {
 		if (data->num == 0 || i->num_rays == 0) continue; // disabled
 		if (data->verbose) {cout << "Cube volume light source " << (i - global_cube_lights.begin()) << " of " << global_cube_lights.size() << endl;}
 		unsigned const num_rays(i->num_rays/data->num);
 		float const cube_weight(RAY_WEIGHT*weight*i->intensity/i->num_rays);
-		trace_ray_block_global_cube(data->lmgr, i->bounds, pos, color, cube_weight, num_rays, LIGHTING_GLOBAL, i->disabled_edges, 0, data->verbose, data->randomized, rgen, &data->accum_map);
+		trace_ray_block_global_cube(data->lmgr, data->get_abuf(), i->bounds, pos, color, cube_weight, num_rays, LIGHTING_GLOBAL, i->disabled_edges, 0, data->verbose, data->randomized, rgen, &data->accum_map);
 		cube_start_rays += num_rays;
 	}
 	if (data->verbose) {
@@ -770,6 +899,7 @@ void trace_ray_block_sky(rt_data *data) {
 		}
 		sort(pts.begin(), pts.end());
 		if (data->verbose) {cout << "Sky light source progress (of " << block_npts << "): 0";}
+		light_ray_packet_t packet(data->lmgr, data->get_abuf(), ray_wt, WHITE, line_length, LIGHTING_SKY, rgen, &data->accum_map);
 
 		for (unsigned p = 0; p < block_npts; ++p) {
 			if (kill_raytrace) break;
@@ -788,9 +918,10 @@ void trace_ray_block_sky(rt_data *data) {
 				if (dot_product(dirs[r], pt) >= 0.0) continue; // can get here when (-Z_SCENE_SIZE, Z_SCENE_SIZE) does not contain (czmin, czmax)
 				point const end_pt(pt + dirs[r]*line_length);
 				if (sky_cube_lights.ray_intersects_any(pt, end_pt)) continue; // don't double count
-				cast_light_ray(data->lmgr, pt, end_pt, ray_wt, ray_wt, WHITE, line_length, -1, LIGHTING_SKY, 0, rgen, &data->accum_map);
+				packet.add_ray(pt, end_pt); // rays from the same point are traced together
 				++start_rays;
 			}
+			packet.flush();
 		}
 		if (data->verbose) {cout << endl;}
 	}
@@ -809,7 +940,7 @@ void trace_ray_block_sky(rt_data *data) {
 			vector3d dir(rgen.signed_rand_vector_spherical().get_norm()); // need high quality distribution
 			dir.z = -fabs(dir.z); // make sure z is negative since this is supposed to be light from the sky
 			point const end_pt(pt + dir*line_length);
-			cast_light_ray(data->lmgr, pt, end_pt, cube_weight, cube_weight, i->color, line_length, -1, LIGHTING_SKY, 0, rgen, &data->accum_map);
+			cast_light_ray(data->lmgr, data->get_abuf(), pt, end_pt, cube_weight, cube_weight, i->color, line_length, -1, LIGHTING_SKY, 0, rgen, &data->accum_map);
 		}
 		if (data->verbose) {cout << endl;}
 	}
@@ -856,7 +987,7 @@ void trace_ray_block_cobj_accum(rt_data *data) {
 			if (kill_raytrace) break; // not needed?
 			assert(r->weight > 0.0);
 			float const weight0(ray_wt ? ray_wt : r->weight);
-			cast_light_ray(data->lmgr, r->pos, r->get_p2(line_length), r->weight, weight0, r->get_color(), line_length, -1, LIGHTING_COBJ_ACCUM, 0, rgen, nullptr, nullptr);
+			cast_light_ray(data->lmgr, data->get_abuf(), r->pos, r->get_p2(line_length), r->weight, weight0, r->get_color(), line_length, -1, LIGHTING_COBJ_ACCUM, 0, rgen, nullptr, nullptr);
 		}
 	}
 	data->post_run();
@@ -891,13 +1022,13 @@ void trace_ray_block_cobj_accum_single_update(rt_data *data) {
 		if (cur_hit == prev_hit) continue; // no change in hit status
 		float const weight(r->weight*(cur_hit ? -1.0 : 1.0)); // if ray is newly blocked, subtract its contribution by negating its weight
 		// Note: cobj is ignored here because it can't be in both the prev and cur position at the same time, and temporarily moving it isn't thread safe
-		cast_light_ray(data->lmgr, r->pos, end_pt, weight, (ray_wt ? ray_wt : r->weight), r->get_color(), line_length, cid, LIGHTING_COBJ_ACCUM, 0, rgen, nullptr, &data->update_bcube);
+		cast_light_ray(data->lmgr, data->get_abuf(), r->pos, end_pt, weight, (ray_wt ? ray_wt : r->weight), r->get_color(), line_length, cid, LIGHTING_COBJ_ACCUM, 0, rgen, nullptr, &data->update_bcube);
 	}
 	data->post_run();
 }
 
 
-void ray_trace_local_light_source(lmap_manager_t *lmgr, light_source const &ls, float line_length, unsigned num_rays, rand_gen_t &rgen, int ltype, unsigned N_RAYS) {
+void ray_trace_local_light_source(lmap_manager_t *lmgr, lmap_accum_buffer_t *abuf, light_source const &ls, float line_length, unsigned num_rays, rand_gen_t &rgen, int ltype, unsigned N_RAYS) {
 
 	colorRGBA lcolor(ls.get_color());
 	if (N_RAYS == 0 || lcolor.alpha == 0.0) return; // nothing to do
@@ -944,7 +1075,7 @@ void ray_trace_local_light_source(lmap_manager_t *lmgr, light_source const &ls,
 					start_pt[d1] = rgen.rand_uniform(cube.d[d1][0], cube.d[d1][1]);
 					start_pt[d2] = rgen.rand_uniform(cube.d[d2][0], cube.d[d2][1]);
 					point const end_pt(start_pt + dir*line_length);
-					cast_light_ray(lmgr, start_pt, end_pt, ray_wt, ray_wt, lcolor, line_length, -1, ltype, 0, rgen, nullptr); // init_cobj not used here
+					cast_light_ray(lmgr, abuf, start_pt, end_pt, ray_wt, ray_wt, lcolor, line_length, -1, ltype, 0, rgen, nullptr); // init_cobj not used here
 				} // for n
 			} // for dir
 		} // for dim
@@ -990,7 +1121,7 @@ void ray_trace_local_light_source(lmap_manager_t *lmgr, light_source const &ls,
 			if (line_light) {start_pt += n*delta;} // fixed spacing along the length of the line
 		}
 		point const end_pt(start_pt + dir*line_length);
-		cast_light_ray(lmgr, start_pt, end_pt, weight, weight, lcolor, line_length, init_cobj, ltype, 0, rgen, nullptr);
+		cast_light_ray(lmgr, abuf, start_pt, end_pt, weight, weight, lcolor, line_length, init_cobj, ltype, 0, rgen, nullptr);
 	} // for n
 }
 
@@ -1010,7 +1141,7 @@ void trace_ray_block_local(rt_data *data) {
 	for (unsigned i = 0; i < light_sources_a.size(); ++i) {
 		if (data->verbose) {increment_printed_number(i);}
 		unsigned const light_nrays(light_sources_a[i].get_num_rays()), NRAYS(light_nrays ? light_nrays : LOCAL_RAYS), num_rays(max(1U, NRAYS/data->num));
-		ray_trace_local_light_source(data->lmgr, light_sources_a[i], line_length, num_rays, rgen, data->ltype, NRAYS);
+		ray_trace_local_light_source(data->lmgr, data->get_abuf(), light_sources_a[i], line_length, num_rays, rgen, data->ltype, NRAYS);
 	}
 	if (data->verbose) {cout << endl;}
 	data->post_run();
@@ -1034,7 +1165,7 @@ void trace_ray_block_dynamic(rt_data *data) {
 		//if (!ls.is_enabled()) continue; // error?
 		float const line_length(min(4.0f*ls.get_radius(), max_line_length)); // limit ray length to improve perf
 		unsigned const light_nrays(ls.get_num_rays()), NRAYS(light_nrays ? light_nrays : DYNAMIC_RAYS), num_rays(max(1U, NRAYS/data->num));
-		ray_trace_local_light_source(nullptr, ls, line_length, num_rays, rgen, data->ltype, NRAYS); // lmgr is unused, so leave it as null
+		ray_trace_local_light_source(nullptr, nullptr, ls, line_length, num_rays, rgen, data->ltype, NRAYS); // lmgr is unused, so leave it as null
 	}
 	data->post_run();
 }
@@ -1075,10 +1206,10 @@ void compute_ray_trace_lighting(unsigned ltype, bool verbose) {
 			// if writing both the cobj accum file and the sky lighting file, and not storing sky lighting as blocked,
 			// we need to rewrite sky lighting to include unblocked cobj accum light
 			if (!store_cobj_accum_lighting_as_blocked && write_light_files[LIGHTING_SKY]) {
-				lmap_manager.write_data_to_file(lighting_file[LIGHTING_SKY], LIGHTING_SKY);
+				lmap_manager.write_data_to_file(lighting_file[LIGHTING_SKY], LIGHTING_SKY, lighting_file_half_float);
 			}
 		}
-		else {lmap_manager.write_data_to_file(fn, c_ltype);}
+		else {lmap_manager.write_data_to_file(fn, c_ltype, lighting_file_half_float);}
 	}
 }
 
@@ -1097,7 +1228,7 @@ void check_update_global_lighting(unsigned lights) {
 	if (GLOBAL_RAYS == 0 && global_cube_lights.empty()) return; // nothing to do
 	if (!pre_lighting_update()) return; // lmap is not yet allocated
 	// Note: we could check if the sun/moon is visible, but it might have been visible previously and now is not, and in that case we still need to update lighting
-	no_stat_moving = 1; // disable static moving cobjs for async updates, which aren't thread safe because the BVH is rebuilt every frame; no need to set back after first frame
+	// static moving cobjs are included: their BVH is double buffered, so async updates see a complete tree that reflects their current positions
 	lmap_manager.clear_lighting_values(LIGHTING_GLOBAL);
 	launch_threaded_job(max(1U, NUM_THREADS-1), rt_funcs[LIGHTING_GLOBAL], 0, 0, lighting_update_offline, 0, LIGHTING_GLOBAL); // reserve a thread for rendering
 }
@@ -1131,14 +1262,104 @@ void check_all_platform_cobj_lighting_update() {
 // lmap_manager_t
 
 
-bool lmap_manager_t::read_data_from_file(char const *const fn, int ltype) {
+// lightmap file format version 2: header followed by one 64-byte aligned array per color component (SoA) in vldata_alloc order;
+// this can be memory mapped and scattered directly into the lmcells without reading the whole file into a temp buffer;
+// legacy (version 1) files start with the number of cells followed by all components of each cell (AoS) and are still supported
+unsigned const LMAP_FILE_MAGIC   = 0x4D4C4433; // "3DLM"
+unsigned const LMAP_FILE_VERSION = 2;
+unsigned const LMAP_FILE_ALIGN   = 64;
+unsigned const LMAP_FLAG_HALF    = 0x01; // components are stored as 16-bit half floats
+float    const MAX_HALF_FLOAT    = 65504.0;
 
-	assert(fn != nullptr);
-	binary_file_reader reader;
-	if (!reader.open(fn)) return 0;
-	cout << "Reading lighting file from " << fn << endl;
-	unsigned data_size(0);
-	if (!reader.read(&data_size, sizeof(unsigned), 1)) return 0;
+struct lmap_file_header_t { // size = 64
+	unsigned magic, version, ltype, dsz, num_cells, xsize, ysize, zsize, flags, data_offset, comp_stride;
+	float comp_scale[4]; // multiplier applied to stored values on read; used to keep half floats in range
+	unsigned pad;
+
+	lmap_file_header_t() {static_assert(sizeof(lmap_file_header_t) == 64, "unexpected lmap_file_header_t size"); memset(this, 0, sizeof(*this));}
+	unsigned get_elem_size() const {return ((flags & LMAP_FLAG_HALF) ? sizeof(uint16_t) : sizeof(float));}
+	size_t get_file_size() const {return (data_offset + size_t(dsz)*comp_stride);}
+};
+
+size_t align_lmap_file_offset(size_t val) {return LMAP_FILE_ALIGN*((val + LMAP_FILE_ALIGN - 1)/LMAP_FILE_ALIGN);}
+
+
+bool lmap_manager_t::check_file_header(lmap_file_header_t const &header, char const *const fn, int ltype) const {
+
+	if (header.version != LMAP_FILE_VERSION) {
+		cerr << "Error: Lighting file " << fn << " has unsupported version " << header.version << ". Ignoring file." << endl;
+		return 0;
+	}
+	if (header.num_cells != vldata_alloc.size() || header.xsize != lm_xsize || header.ysize != lm_ysize || header.zsize != lm_zsize) {
+		cerr << "Error: Lighting file " << fn << " size of " << header.num_cells << " (" << header.xsize << "x" << header.ysize << "x" << header.zsize
+			 << ") does not equal the expected size of " << vldata_alloc.size() << " (" << lm_xsize << "x" << lm_ysize << "x" << lm_zsize << "). Ignoring file." << endl;
+		return 0;
+	}
+	if ((int)header.ltype != ltype || header.dsz != lmcell::get_dsz(ltype)) {
+		cerr << "Error: Lighting file " << fn << " is for lighting type " << header.ltype << " rather than " << ltype << ". Ignoring file." << endl;
+		return 0;
+	}
+	if (header.data_offset < sizeof(lmap_file_header_t) || header.comp_stride < size_t(header.num_cells)*header.get_elem_size()) {
+		cerr << "Error: Lighting file " << fn << " has an invalid header. Ignoring file." << endl;
+		return 0;
+	}
+	return 1;
+}
+
+// copies one color component from a packed (stride=1) or interleaved array into all lmcells; src doesn't need to be aligned
+void lmap_manager_t::set_component(int ltype, unsigned comp, void const *src, unsigned stride, bool is_half, float scale) {
+
+	assert(comp < lmcell::get_dsz(ltype) && stride > 0);
+	unsigned char const *const data((unsigned char const *)src);
+	unsigned const elem_sz(is_half ? sizeof(uint16_t) : sizeof(float)), step(stride*elem_sz);
+
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < (int)vldata_alloc.size(); ++i) {
+		unsigned char const *const ptr(data + size_t(i)*step);
+		float val(0.0);
+
+		if (is_half) {
+			uint16_t hval;
+			memcpy(&hval, ptr, sizeof(uint16_t));
+			val = scale*glm::unpackHalf1x16(hval);
+		}
+		else {memcpy(&val, ptr, sizeof(float));}
+		vldata_alloc[i].get_offset(ltype)[comp] = val;
+	}
+}
+
+bool lmap_manager_t::read_data_from_mapped_file(mapped_file_reader const &mfr, char const *const fn, int ltype) {
+
+	unsigned char const *const data(mfr.get_data());
+	unsigned const sz(lmcell::get_dsz(ltype));
+	unsigned first_val(0);
+	if (!mfr.in_range(0, sizeof(unsigned))) {cerr << "Error reading header from lighting file " << fn << endl; return 0;}
+	memcpy(&first_val, data, sizeof(unsigned));
+
+	if (first_val != LMAP_FILE_MAGIC) { // legacy format
+		if (first_val != vldata_alloc.size()) {
+			cerr << "Error: Lighting file " << fn << " data size of " << first_val
+				 << " does not equal the expected size of " << vldata_alloc.size() << ". Ignoring file." << endl;
+			return 0;
+		}
+		if (!mfr.in_range(sizeof(unsigned), size_t(first_val)*sz*sizeof(float))) {cerr << "Error reading data from lighting file " << fn << endl; return 0;}
+		for (unsigned n = 0; n < sz; ++n) {set_component(ltype, n, (data + sizeof(unsigned) + n*sizeof(float)), sz, 0, 1.0);}
+		return 1;
+	}
+	lmap_file_header_t header;
+	if (!mfr.in_range(0, sizeof(header))) {cerr << "Error reading header from lighting file " << fn << endl; return 0;}
+	memcpy(&header, data, sizeof(header));
+	if (!check_file_header(header, fn, ltype)) return 0;
+	if (!mfr.in_range(0, header.get_file_size())) {cerr << "Error reading data from lighting file " << fn << endl; return 0;}
+	bool const is_half(header.flags & LMAP_FLAG_HALF);
+
+	for (unsigned n = 0; n < sz; ++n) {
+		set_component(ltype, n, (data + header.data_offset + size_t(n)*header.comp_stride), 1, is_half, header.comp_scale[n]);
+	}
+	return 1;
+}
+
+bool lmap_manager_t::read_legacy_data_from_stream(binary_file_reader &reader, unsigned data_size, char const *const fn, int ltype) {
 
 	if (data_size != vldata_alloc.size()) {
 		cerr << "Error: Lighting file " << fn << " data size of " << data_size
@@ -1147,33 +1368,93 @@ bool lmap_manager_t::read_data_from_file(char const *const fn, int ltype) {
 	}
 	unsigned const sz = lmcell::get_dsz(ltype);
 	vector<float> data(data_size*sz);
-	unsigned pos(0);
 
 	if (!reader.read(&data.front(), sizeof(float), data.size())) {
 		cerr << "Error reading data from ligthing file " << fn << endl;
 		return 0;
 	}
-	for (vector<lmcell>::iterator i = vldata_alloc.begin(); i != vldata_alloc.end(); ++i) {
-		float *ptr(i->get_offset(ltype));
-		for (unsigned n = 0; n < sz; ++n) {ptr[n] = data[pos++];}
+	for (unsigned n = 0; n < sz; ++n) {set_component(ltype, n, &data[n], sz, 0, 1.0);}
+	return 1;
+}
+
+bool lmap_manager_t::read_data_from_file(char const *const fn, int ltype) {
+
+	assert(fn != nullptr);
+
+	if (!binary_file_io::is_gz_file(fn)) { // uncompressed file, use memory mapping
+		mapped_file_reader mfr;
+
+		if (mfr.open(fn)) {
+			cout << "Reading lighting file from " << fn << endl;
+			return read_data_from_mapped_file(mfr, fn, ltype);
+		}
+	}
+	binary_file_reader reader; // gzipped, or memory mapping failed
+	if (!reader.open(fn)) return 0;
+	cout << "Reading lighting file from " << fn << endl;
+	lmap_file_header_t header;
+	if (!reader.read(&header.magic, sizeof(unsigned), 1)) return 0;
+	if (header.magic != LMAP_FILE_MAGIC) {return read_legacy_data_from_stream(reader, header.magic, fn, ltype);}
+
+	if (!reader.read(&header.version, sizeof(header)-sizeof(unsigned), 1)) {
+		cerr << "Error reading header from lighting file " << fn << endl;
+		return 0;
+	}
+	if (!check_file_header(header, fn, ltype)) return 0;
+	vector<unsigned char> data(header.data_offset - sizeof(header)); // skip padding
+	if (!data.empty() && !reader.read(data.data(), 1, data.size())) return 0;
+	data.resize(header.comp_stride);
+
+	for (unsigned n = 0; n < header.dsz; ++n) { // read one component at a time
+		if (!reader.read(data.data(), 1, data.size())) {
+			cerr << "Error reading data from ligthing file " << fn << endl;
+			return 0;
+		}
+		set_component(ltype, n, data.data(), 1, (header.flags & LMAP_FLAG_HALF), header.comp_scale[n]);
 	}
-	assert(pos == data.size());
 	return 1;
 }
 
 
-bool lmap_manager_t::write_data_to_file(char const *const fn, int ltype) const {
+bool lmap_manager_t::write_data_to_file(char const *const fn, int ltype, bool half_float) const {
 
 	if (fn == nullptr || strcmp(fn, "''") == 0 || strcmp(fn, "\"\"") == 0) return 0; // don't write
 	binary_file_writer writer;
 	if (!writer.open(fn)) return 0;
 	cout << "Writing lighting file to " << fn << endl;
-	unsigned const data_size((unsigned)vldata_alloc.size()); // should be size_t?
-	if (!writer.write(&data_size, sizeof(unsigned), 1)) return 0;
 	unsigned const sz(lmcell::get_dsz(ltype));
+	lmap_file_header_t header;
+	header.magic       = LMAP_FILE_MAGIC;
+	header.version     = LMAP_FILE_VERSION;
+	header.ltype       = ltype;
+	header.dsz         = sz;
+	header.num_cells   = (unsigned)vldata_alloc.size(); // should be size_t?
+	header.xsize       = lm_xsize;
+	header.ysize       = lm_ysize;
+	header.zsize       = lm_zsize;
+	header.flags       = (half_float ? LMAP_FLAG_HALF : 0);
+	header.data_offset = align_lmap_file_offset(sizeof(header));
+	header.comp_stride = align_lmap_file_offset(size_t(header.num_cells)*header.get_elem_size());
+	vector<unsigned char> data(header.comp_stride, 0); // one component
+	float *const fdata((float *)data.data());
+	uint16_t *const hdata((uint16_t *)data.data());
+
+	for (unsigned n = 0; n < sz; ++n) {
+		float max_val(0.0);
+		for (auto i = vldata_alloc.begin(); i != vldata_alloc.end(); ++i) {max_val = max(max_val, fabs(i->get_offset(ltype)[n]));}
+		header.comp_scale[n] = ((half_float && max_val > MAX_HALF_FLOAT) ? max_val/MAX_HALF_FLOAT : 1.0);
+	}
+	if (!writer.write(&header, sizeof(header), 1)) return 0;
+	if (!writer.write(data.data(), 1, header.data_offset - sizeof(header))) return 0; // padding (zeros)
 
-	for (vector<lmcell>::const_iterator i = vldata_alloc.begin(); i != vldata_alloc.end(); ++i) { // const_iterator?
-		if (!writer.write(i->get_offset(ltype), sizeof(float), sz)) {
+	for (unsigned n = 0; n < sz; ++n) {
+		float const inv_scale(1.0/header.comp_scale[n]);
+
+		for (unsigned i = 0; i < header.num_cells; ++i) {
+			float const val(vldata_alloc[i].get_offset(ltype)[n]);
+			if (half_float) {hdata[i] = glm::packHalf1x16(inv_scale*val);} else {fdata[i] = val;}
+		}
+		if (!writer.write(data.data(), 1, data.size())) { // one write per component
 			cerr << "Error writing data to ligthing file " << fn << endl;
 			return 0;
 		}
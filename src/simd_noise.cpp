@@ -0,0 +1,445 @@
+// 3D World - SIMD batched simplex/perlin noise
+// by Frank Gennari
+// 10/17/26
+#include "3DWorld.h"
+#include "simd_noise.h"
+#include "vfloat8.h"
+#include "upsurface.h" // for MAX_FREQ_BINS
+#include <glm/gtc/noise.hpp>
+#include <chrono>
+
+
+extern int mesh_gen_mode, mesh_gen_shape, mesh_freq_filter;
+
+void gen_rx_ry(float &rx, float &ry);
+float get_noise_zval(float xval, float yval, int mode, int shape);
+void get_noise_zvals_batch(float const *xvals, float const *yvals, float *zvals, unsigned num, int mode, int shape);
+
+
+// Ports of the GLM noise functions (Ashima Arts/Stefan Gustavson webgl-noise), one sample per lane;
+// operations are kept in the same order as in GLM so that results match the scalar path
+namespace {
+
+VFLOAT8_INLINE vfloat8 mod289(vfloat8 const &x) {return x - vfloor(x*(1.0f/289.0f))*289.0f;} // detail::mod289()
+VFLOAT8_INLINE vfloat8 mod_289(vfloat8 const &x) {return x - vfloat8(289.0f)*vfloor(x/289.0f);} // glm::mod(x, 289)
+VFLOAT8_INLINE vfloat8 permute(vfloat8 const &x) {return mod289(((x*34.0f) + 1.0f)*x);}
+VFLOAT8_INLINE vfloat8 taylor_inv_sqrt(vfloat8 const &r) {return vfloat8(1.79284291400159f) - vfloat8(0.85373472095314f)*r;}
+VFLOAT8_INLINE vfloat8 fade(vfloat8 const &t) {return (t*t*t)*(t*(t*6.0f - 15.0f) + 10.0f);}
+
+vfloat8 simplex_2d(vfloat8 const &vx, vfloat8 const &vy) { // glm::simplex(vec2)
+
+	float const Cx(0.211324865405187f), Cy(0.366025403784439f), Cz(-0.577350269189626f), Cw(0.024390243902439f);
+	vfloat8 const vdot(vx*Cy + vy*Cy);
+	vfloat8 ix(vfloor(vx + vdot)), iy(vfloor(vy + vdot));
+	vfloat8 const idot(ix*Cx + iy*Cx);
+	vfloat8 const x0x(vx - ix + idot), x0y(vy - iy + idot);
+	vfloat8 const i1_mask(cmp_gt(x0x, x0y)); // i1 = (1,0) or (0,1)
+	vfloat8 const i1x(mask_and(i1_mask, vfloat8(1.0f))), i1y(vfloat8(1.0f) - i1x);
+	vfloat8 const x12x(x0x + Cx - i1x), x12y(x0y + Cx - i1y), x12z(x0x + Cz), x12w(x0y + Cz);
+	ix = mod_289(ix);
+	iy = mod_289(iy);
+	vfloat8 const p0(permute(permute(iy       ) + ix       ));
+	vfloat8 const p1(permute(permute(iy +  i1y) + ix +  i1x));
+	vfloat8 const p2(permute(permute(iy + 1.0f) + ix + 1.0f));
+	vfloat8 const zero(0.0f);
+	vfloat8 m0(vmax(vfloat8(0.5f) - (x0x *x0x  + x0y *x0y ), zero));
+	vfloat8 m1(vmax(vfloat8(0.5f) - (x12x*x12x + x12y*x12y), zero));
+	vfloat8 m2(vmax(vfloat8(0.5f) - (x12z*x12z + x12w*x12w), zero));
+	m0 = m0*m0; m0 = m0*m0;
+	m1 = m1*m1; m1 = m1*m1;
+	m2 = m2*m2; m2 = m2*m2;
+	vfloat8 const x_0(vfloat8(2.0f)*vfract(p0*Cw) - 1.0f), x_1(vfloat8(2.0f)*vfract(p1*Cw) - 1.0f), x_2(vfloat8(2.0f)*vfract(p2*Cw) - 1.0f);
+	vfloat8 const h0(vabs(x_0) - 0.5f), h1(vabs(x_1) - 0.5f), h2(vabs(x_2) - 0.5f);
+	vfloat8 const a0(x_0 - vfloor(x_0 + 0.5f)), a1(x_1 - vfloor(x_1 + 0.5f)), a2(x_2 - vfloor(x_2 + 0.5f));
+	m0 *= taylor_inv_sqrt(a0*a0 + h0*h0);
+	m1 *= taylor_inv_sqrt(a1*a1 + h1*h1);
+	m2 *= taylor_inv_sqrt(a2*a2 + h2*h2);
+	vfloat8 const g0(a0*x0x + h0*x0y), g1(a1*x12x + h1*x12y), g2(a2*x12z + h2*x12w);
+	return vfloat8(130.0f)*(m0*g0 + m1*g1 + m2*g2);
+}
+
+vfloat8 perlin_2d(vfloat8 const &px, vfloat8 const &py) { // glm::perlin(vec2)
+
+	vfloat8 const fpx(vfloor(px)), fpy(vfloor(py));
+	vfloat8 const ix0(mod_289(fpx)), iy0(mod_289(fpy)), ix1(mod_289(fpx + 1.0f)), iy1(mod_289(fpy + 1.0f));
+	vfloat8 const fx0(vfract(px)), fy0(vfract(py)), fx1(fx0 - 1.0f), fy1(fy0 - 1.0f);
+	vfloat8 const ix[4] = {ix0, ix1, ix0, ix1}, iy[4] = {iy0, iy0, iy1, iy1}, fx[4] = {fx0, fx1, fx0, fx1}, fy[4] = {fy0, fy0, fy1, fy1};
+	vfloat8 n[4]; // n00, n10, n01, n11
+
+	for (unsigned k = 0; k < 4; ++k) {
+		vfloat8 const i(permute(permute(ix[k]) + iy[k]));
+		vfloat8 gx(vfloat8(2.0f)*vfract(i/41.0f) - 1.0f);
+		vfloat8 gy(vabs(gx) - 0.5f);
+		gx = gx - vfloor(gx + 0.5f);
+		vfloat8 const norm(taylor_inv_sqrt(gx*gx + gy*gy));
+		gx *= norm;
+		gy *= norm;
+		n[k] = gx*fx[k] + gy*fy[k];
+	}
+	vfloat8 const fade_x(fade(fx0)), fade_y(fade(fy0));
+	return vfloat8(2.3f)*vmix(vmix(n[0], n[1], fade_x), vmix(n[2], n[3], fade_x), fade_y);
+}
+
+vfloat8 simplex_3d(vfloat8 const &vx, vfloat8 const &vy, vfloat8 const &vz) { // glm::simplex(vec3)
+
+	float const Cx(float(1.0/6.0)), Cy(float(1.0/3.0));
+	vfloat8 const vdot(vx*Cy + vy*Cy + vz*Cy);
+	vfloat8 ix(vfloor(vx + vdot)), iy(vfloor(vy + vdot)), iz(vfloor(vz + vdot));
+	vfloat8 const idot(ix*Cx + iy*Cx + iz*Cx);
+	vfloat8 const x0x(vx - ix + idot), x0y(vy - iy + idot), x0z(vz - iz + idot);
+	vfloat8 const one(1.0f), zero(0.0f);
+	vfloat8 const gx(vstep(x0y, x0x)), gy(vstep(x0z, x0y)), gz(vstep(x0x, x0z));
+	vfloat8 const lx(one - gx), ly(one - gy), lz(one - gz);
+	vfloat8 const i1x(vmin(gx, lz)), i1y(vmin(gy, lx)), i1z(vmin(gz, ly));
+	vfloat8 const i2x(vmax(gx, lz)), i2y(vmax(gy, lx)), i2z(vmax(gz, ly));
+	vfloat8 const xs[4] = {x0x, (x0x - i1x + Cx), (x0x - i2x + Cy), (x0x - 0.5f)};
+	vfloat8 const ys[4] = {x0y, (x0y - i1y + Cx), (x0y - i2y + Cy), (x0y - 0.5f)};
+	vfloat8 const zs[4] = {x0z, (x0z - i1z + Cx), (x0z - i2z + Cy), (x0z - 0.5f)};
+	ix = mod289(ix);
+	iy = mod289(iy);
+	iz = mod289(iz);
+	vfloat8 const oxs[4] = {zero, i1x, i2x, one}, oys[4] = {zero, i1y, i2y, one}, ozs[4] = {zero, i1z, i2z, one};
+	float const n_(0.142857142857f), nsx(n_*2.0f), nsy(n_*0.5f - 1.0f), nsz(n_*1.0f);
+	vfloat8 m[4], d[4];
+
+	for (unsigned k = 0; k < 4; ++k) {
+		vfloat8 const p(permute(permute(permute(iz + ozs[k]) + iy + oys[k]) + ix + oxs[k]));
+		vfloat8 const j(p - vfloat8(49.0f)*vfloor(p*nsz*nsz)); // mod(p,7*7)
+		vfloat8 const x_(vfloor(j*nsz));
+		vfloat8 const y_(vfloor(j - vfloat8(7.0f)*x_)); // mod(j,N)
+		vfloat8 const x(x_*nsx + nsy), y(y_*nsx + nsy);
+		vfloat8 const h(one - vabs(x) - vabs(y));
+		vfloat8 const sh(zero - vstep(h, zero));
+		vfloat8 px(x + (vfloor(x)*2.0f + 1.0f)*sh), py(y + (vfloor(y)*2.0f + 1.0f)*sh), pz(h);
+		vfloat8 const norm(taylor_inv_sqrt(px*px + py*py + pz*pz));
+		px *= norm; py *= norm; pz *= norm;
+		vfloat8 mk(vmax(vfloat8(0.6f) - (xs[k]*xs[k] + ys[k]*ys[k] + zs[k]*zs[k]), zero));
+		mk   = mk*mk;
+		m[k] = mk*mk;
+		d[k] = px*xs[k] + py*ys[k] + pz*zs[k];
+	}
+	return vfloat8(42.0f)*((m[0]*d[0] + m[1]*d[1]) + (m[2]*d[2] + m[3]*d[3]));
+}
+
+vfloat8 perlin_3d(vfloat8 const &px, vfloat8 const &py, vfloat8 const &pz) { // glm::perlin(vec3)
+
+	vfloat8 const fpx(vfloor(px)), fpy(vfloor(py)), fpz(vfloor(pz));
+	vfloat8 const ix0(mod289(fpx)), iy0(mod289(fpy)), iz0(mod289(fpz)), ix1(mod289(fpx + 1.0f)), iy1(mod289(fpy + 1.0f)), iz1(mod289(fpz + 1.0f));
+	vfloat8 const fx0(vfract(px)), fy0(vfract(py)), fz0(vfract(pz)), fx1(fx0 - 1.0f), fy1(fy0 - 1.0f), fz1(fz0 - 1.0f);
+	vfloat8 const ix[4] = {ix0, ix1, ix0, ix1}, iy[4] = {iy0, iy0, iy1, iy1}, fx[4] = {fx0, fx1, fx0, fx1}, fy[4] = {fy0, fy0, fy1, fy1};
+	vfloat8 const zero(0.0f), half(0.5f);
+	vfloat8 n[2][4]; // {n000, n100, n010, n110}, {n001, n101, n011, n111}
+
+	for (unsigned k = 0; k < 4; ++k) {
+		vfloat8 const ixy(permute(permute(ix[k]) + iy[k]));
+
+		for (unsigned zi = 0; zi < 2; ++zi) {
+			vfloat8 const ixyz(permute(ixy + (zi ? iz1 : iz0)));
+			vfloat8 gx(ixyz*float(1.0/7.0));
+			vfloat8 gy(vfract(vfloor(gx)*float(1.0/7.0)) - 0.5f);
+			gx = vfract(gx);
+			vfloat8 const gz(half - vabs(gx) - vabs(gy));
+			vfloat8 const sz(vstep(gz, zero));
+			gx -= sz*(vstep(zero, gx) - 0.5f);
+			gy -= sz*(vstep(zero, gy) - 0.5f);
+			vfloat8 const norm(taylor_inv_sqrt(gx*gx + gy*gy + gz*gz));
+			n[zi][k] = (gx*norm)*fx[k] + (gy*norm)*fy[k] + (gz*norm)*(zi ? fz1 : fz0);
+		}
+	}
+	vfloat8 const fade_x(fade(fx0)), fade_y(fade(fy0)), fade_z(fade(fz0));
+	vfloat8 nz[4];
+	for (unsigned k = 0; k < 4; ++k) {nz[k] = vmix(n[0][k], n[1][k], fade_z);}
+	return vfloat8(2.2f)*vmix(vmix(nz[0], nz[2], fade_y), vmix(nz[1], nz[3], fade_y), fade_x);
+}
+
+vfloat8 fractal_noise_2d(vfloat8 const &xv, vfloat8 const &yv, unsigned num_octaves, float rx, float ry, int shape, bool use_simplex) { // matches gen_noise()
+
+	vfloat8 zval(0.0f);
+	float mag(1.0), freq(1.0);
+	float const lacunarity(1.92), gain(0.5);
+
+	for (unsigned i = 0; i < num_octaves; ++i) {
+		vfloat8 const px(xv*freq + rx), py(yv*freq + ry);
+		vfloat8 noise(use_simplex ? simplex_2d(px, py) : perlin_2d(px, py));
+		switch (shape) {
+		case 0: break; // linear - do nothing
+		case 1: noise = vabs(noise) - 0.40f; break; // billowy
+		case 2: noise = vfloat8(0.45f) - vabs(noise); break; // ridged
+		}
+		zval += noise*mag;
+		mag  *= gain;
+		freq *= lacunarity;
+		rx   *= 1.5;
+		ry   *= 1.5;
+	}
+	return zval;
+}
+
+void gen_noise_2d_group(float const *xv, float const *yv, float *zv, unsigned num_octaves, float rx, float ry, int shape, bool use_simplex, bool domain_warp) {
+
+	vfloat8 x(vfloat8::load(xv)), y(vfloat8::load(yv));
+
+	if (domain_warp) { // same offsets as get_noise_zval()
+		float const scale(0.2);
+		vfloat8 const dx1(fractal_noise_2d(x, y, num_octaves, rx, ry, shape, use_simplex));
+		vfloat8 const dy1(fractal_noise_2d((x + 5.2f), (y + 1.3f), num_octaves, rx, ry, shape, use_simplex));
+		vfloat8 const wx(x + dx1*scale), wy(y + dy1*scale);
+		vfloat8 const dx2(fractal_noise_2d((wx + 1.7f), (wy + 9.2f), num_octaves, rx, ry, shape, use_simplex));
+		vfloat8 const dy2(fractal_noise_2d((wx + 8.3f), (wy + 2.8f), num_octaves, rx, ry, shape, use_simplex));
+		x += dx2*scale;
+		y += dy2*scale;
+	}
+	fractal_noise_2d(x, y, num_octaves, rx, ry, shape, use_simplex).store(zv);
+}
+
+void gen_noise_3d_group(float const *xv, float const *yv, float const *zv, float *vals, unsigned num_octaves, float mag, float freq, float rx, float ry, bool use_perlin) {
+
+	vfloat8 const x(vfloat8::load(xv)), y(vfloat8::load(yv)), z(vfloat8::load(zv));
+	vfloat8 val(0.0f);
+	float const lacunarity(1.92), gain(0.5);
+
+	for (unsigned n = 0; n < num_octaves; ++n) {
+		vfloat8 const px(x*freq + rx), py(y*freq + ry), pz(z*freq + (rx - ry));
+		val  += (use_perlin ? perlin_3d(px, py, pz) : simplex_3d(px, py, pz))*mag;
+		mag  *= gain;
+		freq *= lacunarity;
+	}
+	val.store(vals);
+}
+
+} // end anonymous namespace
+
+
+// the partial group at the end is padded by repeating the last input value
+void gen_noise_2d_batch(float const *xv, float const *yv, float *zv, unsigned num, unsigned num_octaves,
+	float rx, float ry, int shape, bool use_simplex, bool domain_warp)
+{
+	unsigned const num_full(num & ~7U);
+
+	for (unsigned i = 0; i < num_full; i += 8) {
+		gen_noise_2d_group((xv + i), (yv + i), (zv + i), num_octaves, rx, ry, shape, use_simplex, domain_warp);
+	}
+	if (num_full == num) return;
+	float x[8], y[8], z[8];
+
+	for (unsigned i = 0; i < 8; ++i) {
+		unsigned const ix(min((num_full + i), (num - 1)));
+		x[i] = xv[ix]; y[i] = yv[ix];
+	}
+	gen_noise_2d_group(x, y, z, num_octaves, rx, ry, shape, use_simplex, domain_warp);
+	for (unsigned i = num_full; i < num; ++i) {zv[i] = z[i - num_full];}
+}
+
+void gen_noise_3d_batch(float const *xv, float const *yv, float const *zv, float *vals, unsigned num, unsigned num_octaves,
+	float mag, float freq, float rx, float ry, bool use_perlin)
+{
+	unsigned const num_full(num & ~7U);
+
+	for (unsigned i = 0; i < num_full; i += 8) {
+		gen_noise_3d_group((xv + i), (yv + i), (zv + i), (vals + i), num_octaves, mag, freq, rx, ry, use_perlin);
+	}
+	if (num_full == num) return;
+	float x[8], y[8], z[8], v[8];
+
+	for (unsigned i = 0; i < 8; ++i) {
+		unsigned const ix(min((num_full + i), (num - 1)));
+		x[i] = xv[ix]; y[i] = yv[ix]; z[i] = zv[ix];
+	}
+	gen_noise_3d_group(x, y, z, v, num_octaves, mag, freq, rx, ry, use_perlin);
+	for (unsigned i = num_full; i < num; ++i) {vals[i] = v[i - num_full];}
+}
+
+
+// *** noise_gen_3d kernels ***
+
+namespace {
+
+// sine of any input: reduce to [-pi, pi], fold into [-pi/2, pi/2], then a 9th order Taylor polynomial (max error ~4e-6);
+// SINF() uses sin_table lookups with an error of up to ~2e-4, so results agree to within the table error
+VFLOAT8_INLINE vfloat8 vsin(vfloat8 const &a) {
+
+	vfloat8 x(a - vfloor(a*(1.0f/TWO_PI) + 0.5f)*TWO_PI);
+	x = select(cmp_gt(x, vfloat8( PI_TWO)), vfloat8( PI) - x, x);
+	x = select(cmp_lt(x, vfloat8(-PI_TWO)), vfloat8(-PI) - x, x);
+	vfloat8 const x2(x*x);
+	return x*(vfloat8(1.0f) + x2*(vfloat8(-1.0f/6.0f) + x2*(vfloat8(1.0f/120.0f) + x2*(vfloat8(-1.0f/5040.0f) + x2*(1.0f/362880.0f)))));
+}
+
+void noise_gen_3d_group(float const *rdata, unsigned num_sines, float const *x, float const *y, float const *z, float *vals) { // 8 points
+
+	vfloat8 const vx(vfloat8::load(x)), vy(vfloat8::load(y)), vz(vfloat8::load(z));
+	vfloat8 val(0.0f);
+
+	for (unsigned k = 0; k < num_sines; ++k) { // same sum as noise_gen_3d::get_val(point)
+		float const *const r(rdata + NUM_SINE_PARAMS*k);
+		val += vfloat8(r[0])*vsin(vx*r[1] + r[2])*vsin(vy*r[3] + r[4])*vsin(vz*r[5] + r[6]);
+	}
+	val.store(vals);
+}
+
+} // end anonymous namespace
+
+
+void noise_gen_3d::get_vals(float const *xs, float const *ys, float const *zs, float *vals, unsigned num) const {
+
+	unsigned const num_full(num & ~7U);
+	for (unsigned i = 0; i < num_full; i += 8) {noise_gen_3d_group(rdata, num_sines, (xs + i), (ys + i), (zs + i), (vals + i));}
+	if (num_full == num) return;
+	float x[8], y[8], z[8], v[8];
+
+	for (unsigned i = 0; i < 8; ++i) {
+		unsigned const ix(min((num_full + i), (num - 1)));
+		x[i] = xs[ix]; y[i] = ys[ix]; z[i] = zs[ix];
+	}
+	noise_gen_3d_group(rdata, num_sines, x, y, z, v);
+	for (unsigned i = num_full; i < num; ++i) {vals[i] = v[i - num_full];}
+}
+
+void noise_gen_3d::transpose_vals(vector<float> const &vals, unsigned num, vector<float> &vals_t) const {
+
+	assert(vals.size() == num*num_sines);
+	unsigned const num_padded((num + 7) & ~7U);
+	vals_t.resize(num_sines*num_padded);
+
+	for (unsigned k = 0; k < num_sines; ++k) {
+		for (unsigned i = 0; i < num_padded; ++i) {vals_t[k*num_padded + i] = ((i < num) ? vals[i*num_sines + k] : 0.0f);}
+	}
+}
+
+// evaluates get_val(x, y, z, xyz_vals) for all z in [0, nz), where zvals_t is xyz_vals[2] transposed with transpose_vals(); vals must have space for nz values
+void noise_gen_3d::get_vals_z_column(unsigned x, unsigned y, vector<float> const xyz_vals[3], vector<float> const &zvals_t, unsigned nz, float *vals) const {
+
+	unsigned const num_padded((nz + 7) & ~7U);
+	assert(num_sines*x+num_sines <= xyz_vals[0].size() && num_sines*y+num_sines <= xyz_vals[1].size());
+	assert(zvals_t.size() == num_sines*num_padded);
+	float const *const xv(&xyz_vals[0][x*num_sines]);
+	float const *const yv(&xyz_vals[1][y*num_sines]);
+	float xy[TOT_NUM_SINES];
+	for (unsigned k = 0; k < num_sines; ++k) {xy[k] = xv[k]*yv[k];}
+
+	for (unsigned z = 0; z < num_padded; z += 8) {
+		vfloat8 val(0.0f);
+		for (unsigned k = 0; k < num_sines; ++k) {val += vfloat8(xy[k])*vfloat8::load(&zvals_t[k*num_padded + z]);}
+
+		if (z + 8 <= nz) {val.store(vals + z);}
+		else { // partial group at the end
+			float v[8];
+			val.store(v);
+			for (unsigned i = z; i < nz; ++i) {vals[i] = v[i - z];}
+		}
+	}
+}
+
+
+// compares the batched kernels against the scalar GLM path for speed and max error; single threaded, enabled with "noise_benchmark 1"
+void run_noise_benchmark() {
+
+	typedef std::chrono::high_resolution_clock clock_t;
+	auto elapsed_ms = [](clock_t::time_point const &t) {return std::chrono::duration<double, std::milli>(clock_t::now() - t).count();};
+	unsigned const num(1 << 16), num_3d_octaves(max(1, ((int)MAX_FREQ_BINS - mesh_freq_filter)));
+	char const *const simd_type(
+#if defined(VFLOAT8_AVX)
+		"AVX"
+#elif defined(VFLOAT8_SSE2)
+		"SSE2"
+#else
+		"scalar"
+#endif
+		);
+	rand_gen_t rgen;
+	vector<float> xv(num), yv(num), zv(num), ref(num), res(num);
+
+	for (unsigned i = 0; i < num; ++i) { // similar range to tiled terrain tile coordinates
+		xv[i] = rgen.rand_uniform(-2000.0, 2000.0);
+		yv[i] = rgen.rand_uniform(-2000.0, 2000.0);
+		zv[i] = rgen.rand_uniform(-1.0, 1.0);
+	}
+	cout << "Noise benchmark: " << num << " samples, " << simd_type << " kernel" << endl;
+	char const *const mode_names[3] = {"simplex", "perlin", "domain warp"};
+	int const modes[3] = {MGEN_SIMPLEX, MGEN_PERLIN, MGEN_DWARP_GPU};
+
+	for (unsigned m = 0; m < 3; ++m) {
+		auto t1(clock_t::now());
+		for (unsigned i = 0; i < num; ++i) {ref[i] = get_noise_zval(xv[i], yv[i], modes[m], mesh_gen_shape);}
+		double const glm_time(elapsed_ms(t1));
+		auto t2(clock_t::now());
+		get_noise_zvals_batch(&xv.front(), &yv.front(), &res.front(), num, modes[m], mesh_gen_shape);
+		double const simd_time(elapsed_ms(t2));
+		float max_err(0.0), max_val(0.0);
+		for (unsigned i = 0; i < num; ++i) {max_err = max(max_err, fabs(res[i] - ref[i])); max_val = max(max_val, fabs(ref[i]));}
+		cout << "  2D " << mode_names[m] << ": GLM " << glm_time << "ms, SIMD " << simd_time << "ms, speedup " << glm_time/max(simd_time, 0.001)
+			 << "x, max error " << max_err << " (max value " << max_val << ")" << endl;
+	}
+	float rx, ry;
+	gen_rx_ry(rx, ry);
+
+	for (unsigned p = 0; p < 2; ++p) { // simplex, perlin
+		auto t1(clock_t::now());
+
+		for (unsigned i = 0; i < num; ++i) { // same loop as voxel_manager::create_procedural()
+			glm::vec3 const v(xv[i], yv[i], zv[i]);
+			float val(0.0), nmag(1.0), nfreq(0.25);
+			float const lacunarity(1.92), gain(0.5);
+
+			for (unsigned n = 0; n < num_3d_octaves; ++n) {
+				glm::vec3 const nv(nfreq*v + glm::vec3(rx, ry, rx-ry));
+				val   += nmag*(p ? glm::perlin(nv) : glm::simplex(nv));
+				nmag  *= gain;
+				nfreq *= lacunarity;
+			}
+			ref[i] = val;
+		}
+		double const glm_time(elapsed_ms(t1));
+		auto t2(clock_t::now());
+		gen_noise_3d_batch(&xv.front(), &yv.front(), &zv.front(), &res.front(), num, num_3d_octaves, 1.0, 0.25, rx, ry, (p != 0));
+		double const simd_time(elapsed_ms(t2));
+		float max_err(0.0);
+		for (unsigned i = 0; i < num; ++i) {max_err = max(max_err, fabs(res[i] - ref[i]));}
+		cout << "  3D " << mode_names[p] << ": GLM " << glm_time << "ms, SIMD " << simd_time << "ms, speedup " << glm_time/max(simd_time, 0.001)
+			 << "x, max error " << max_err << endl;
+	}
+	// noise_gen_3d sine sums, as used for planets and asteroids; the SIMD sin() is more accurate than sin_table, so allow for the table error
+	noise_gen_3d ngen;
+	ngen.set_rand_seeds(123, 456);
+	ngen.gen_sines(1.0, 1.0);
+	float sum_mag(0.0);
+	for (unsigned k = 0; k < ngen.num_sines; ++k) {sum_mag += ngen.rdata[NUM_SINE_PARAMS*k];}
+	float const tolerance(1.0E-3*sum_mag);
+
+	for (unsigned i = 0; i < num; ++i) {xv[i] *= 0.001; yv[i] *= 0.001;} // scale to [-2, 2] to match planet surface coordinates
+	auto t1(clock_t::now());
+	for (unsigned i = 0; i < num; ++i) {ref[i] = ngen.get_val(point(xv[i], yv[i], zv[i]));}
+	double const scalar_time(elapsed_ms(t1));
+	auto t2(clock_t::now());
+	ngen.get_vals(&xv.front(), &yv.front(), &zv.front(), &res.front(), num);
+	double const simd_time(elapsed_ms(t2));
+	float max_err(0.0);
+	for (unsigned i = 0; i < num; ++i) {max_err = max(max_err, fabs(res[i] - ref[i]));}
+	cout << "  sines: scalar " << scalar_time << "ms, SIMD " << simd_time << "ms, speedup " << scalar_time/max(simd_time, 0.001)
+		 << "x, max error " << max_err << " (tolerance " << tolerance << ")" << ((max_err <= tolerance) ? "" : " FAILED") << endl;
+	// table-driven grid evaluation, as in voxel_manager::create_procedural()
+	unsigned const grid_sz(40), xyz_num[3] = {grid_sz, grid_sz, grid_sz}; // 64000 samples
+	vector<float> xyz_vals[3], zvals_t, grid_ref(grid_sz*grid_sz*grid_sz), grid_res(grid_ref.size());
+	ngen.gen_xyz_vals(point(-2.0, -2.0, -1.0), vector3d(0.1, 0.1, 0.05), xyz_num, xyz_vals);
+	ngen.transpose_vals(xyz_vals[2], grid_sz, zvals_t);
+	auto t3(clock_t::now());
+
+	for (unsigned y = 0; y < grid_sz; ++y) {
+		for (unsigned x = 0; x < grid_sz; ++x) {
+			for (unsigned z = 0; z < grid_sz; ++z) {grid_ref[(y*grid_sz + x)*grid_sz + z] = ngen.get_val(x, y, z, xyz_vals);}
+		}
+	}
+	double const grid_scalar_time(elapsed_ms(t3));
+	auto t4(clock_t::now());
+
+	for (unsigned y = 0; y < grid_sz; ++y) {
+		for (unsigned x = 0; x < grid_sz; ++x) {ngen.get_vals_z_column(x, y, xyz_vals, zvals_t, grid_sz, &grid_res[(y*grid_sz + x)*grid_sz]);}
+	}
+	double const grid_simd_time(elapsed_ms(t4));
+	float grid_err(0.0);
+	for (unsigned i = 0; i < grid_res.size(); ++i) {grid_err = max(grid_err, fabs(grid_res[i] - grid_ref[i]));}
+	float const grid_tolerance(1.0E-5*sum_mag); // same inputs, only the summation order differs
+	cout << "  sine grid: scalar " << grid_scalar_time << "ms, SIMD " << grid_simd_time << "ms, speedup " << grid_scalar_time/max(grid_simd_time, 0.001)
+		 << "x, max error " << grid_err << " (tolerance " << grid_tolerance << ")" << ((grid_err <= grid_tolerance) ? "" : " FAILED") << endl;
+}
+
@@ -0,0 +1,15 @@
+// 3D World - SIMD batched simplex/perlin noise
+// by Frank Gennari
+// 10/17/26
+#pragma once
+
+// These evaluate the same fractal sums as the scalar GLM loops in mesh_gen.cpp and voxels.cpp, 8 samples at a time
+
+// fractal 2D noise as in gen_noise(), with optional domain warping as in get_noise_zval(); shape: 0=linear, 1=billowy, 2=ridged
+void gen_noise_2d_batch(float const *xv, float const *yv, float *zv, unsigned num, unsigned num_octaves,
+	float rx, float ry, int shape, bool use_simplex, bool domain_warp);
+// fractal 3D noise as used for voxel terrain; vals are written, not accumulated
+void gen_noise_3d_batch(float const *xv, float const *yv, float const *zv, float *vals, unsigned num, unsigned num_octaves,
+	float mag, float freq, float rx, float ry, bool use_perlin);
+void run_noise_benchmark();
+
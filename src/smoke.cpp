@@ -8,11 +8,11 @@
 #include "shaders.h"
 #include "draw_utils.h"
 #include "physics_objects.h" // for fire_elem_t
+#include "vfloat8.h"
 
 
 bool const DYNAMIC_SMOKE     = 1; // looks cool
 int const SMOKE_SKIPVAL      = 8;
-int const SMOKE_SEND_SKIP    = 8;
 int const INDIR_LT_SEND_SKIP = 12;
 
 float const SMOKE_DENSITY    = 1.0;
@@ -25,7 +25,7 @@ float const SMOKE_THRESH     = 1.0/255.0;
 
 
 bool smoke_visible(0), smoke_exists(0), have_indir_smoke_tex(0);
-unsigned smoke_tid(0), last_smoke_update(0);
+unsigned smoke_tid(0);
 colorRGB const_indir_color(BLACK);
 cube_t cur_smoke_bb;
 vector<unsigned char> smoke_tex_data; // several MB
@@ -52,35 +52,6 @@ bool check_smoke_bounds(point const &pt) {
 }
 
 
-struct smoke_entry_t {
-	short zmin, zmax;
-	smoke_entry_t() {clear();}
-	bool valid() const {return (zmin < zmax);}
-	void clear() {zmin = 10000; zmax = 0;}
-	void update(short zval) {zmin = min(zmin, zval); zmax = max(zmax, short(zval+1));}
-};
-
-class smoke_grid_t {
-	vector<smoke_entry_t> zrng; // z smoke ranges for each xy grid element
-public:
-	void ensure_zrng() {
-		if (zrng.empty()) {zrng.resize(XY_MULT_SIZE);} else {assert((int)zrng.size() == XY_MULT_SIZE);}
-	}
-	void register_smoke(int x, int y, int z) {
-		ensure_zrng();
-		assert(!point_outside_mesh(x, y));
-		zrng[y*MESH_X_SIZE + x].update(z);
-	}
-	smoke_entry_t &get_z_range(int x, int y) {
-		ensure_zrng();
-		assert(!point_outside_mesh(x, y));
-		return zrng[y*MESH_X_SIZE + x];
-	}
-};
-
-smoke_grid_t smoke_grid;
-
-
 struct smoke_manager {
 	bool enabled, smoke_vis;
 	float tot_smoke;
@@ -110,6 +81,15 @@ struct smoke_manager {
 		tot_smoke += smoke_amt;
 		enabled    = 1;
 	}
+	void add_block(cube_t const &bc, float smoke_amt) { // conservative version of add_smoke() for a block of cells
+		if (camera_pdu.cube_visible(bc) && check_smoke_bounds(bc.get_cube_center())) {
+			bbox.union_with_cube(bc);
+			cur_smoke_bb.union_with_cube(bc);
+			smoke_vis = 1;
+		}
+		tot_smoke += smoke_amt;
+		enabled    = 1;
+	}
 	void adj_bbox() {
 		for (unsigned i = 0; i < 3; ++i) {
 			float const dval(SCENE_SIZE[i]/MESH_SIZE[i]);
@@ -119,66 +99,377 @@ struct smoke_manager {
 	}
 };
 
-smoke_manager smoke_man, next_smoke_man;
+smoke_manager smoke_man;
 
 
 inline void adjust_smoke_val(float &val, float delta) {val = max(0.0f, min(SMOKE_MAX_VAL, (val + delta)));}
 
-void add_smoke(point const &pos, float val) {
 
-	if (!DYNAMIC_SMOKE || (display_mode & 0x80) || !game_mode || val == 0.0 || pos.z >= czmax) return;
-	lmcell *const lmc(lmap_manager.get_lmcell(pos));
-	if (!lmc) return;
-	int const xpos(get_xpos(pos.x)), ypos(get_ypos(pos.y));
-	if (point_outside_mesh(xpos, ypos) || pos.z >= v_collision_matrix[ypos][xpos].zmax || pos.z < mesh_height[ypos][xpos]) return; // above all cobjs/outside
-	if (no_smoke_over_mesh && !is_mesh_disabled(xpos, ypos)) return;
-	if (!check_smoke_bounds(pos)) return;
-	//if (!check_coll_line(pos, point(pos.x, pos.y, czmax), cindex, -1, 1, 0)) return; // too slow
-	adjust_smoke_val(lmc->smoke, SMOKE_DENSITY*val);
-	smoke_exists |= smoke_man.is_smoke_visible(pos);
-	smoke_grid.register_smoke(xpos, ypos, get_zpos(pos.z));
+// Sparse smoke density grid: MESH_X_SIZE x MESH_Y_SIZE x MESH_SIZE[2] cells split into 8x8x8 blocks that are only allocated where there is smoke;
+// each block stores double buffered densities and flow rates as separate arrays so that a z row of 8 cells can be updated with one vfloat8
+unsigned const SMOKE_BLOCK_BITS  = 3;
+unsigned const SMOKE_BLOCK_SZ    = (1 << SMOKE_BLOCK_BITS);
+unsigned const SMOKE_BLOCK_MASK  = (SMOKE_BLOCK_SZ - 1);
+unsigned const SMOKE_BLOCK_CELLS = SMOKE_BLOCK_SZ*SMOKE_BLOCK_SZ*SMOKE_BLOCK_SZ;
+unsigned const SMOKE_EMPTY_FRAMES= 16; // number of frames a block must be empty before it's freed, to avoid reallocating blocks at the smoke boundary
+
+struct smoke_block_t {
+	float den [2][SMOKE_BLOCK_CELLS]; // double buffered density, indexed by (y*SZ + x)*SZ + z
+	float flow[3][SMOKE_BLOCK_CELLS]; // flow through the +x/+y/+z face of each cell; x and y are premultiplied by the xy rate
+	float edge_loss[SMOKE_BLOCK_CELLS]; // constant loss per frame into mesh edges and unallocated lmap columns, which have infinite capacity
+	int bx, by, bz;
+	unsigned empty_frames;
+	float tot_smoke;
+	unsigned char face_mask; // bit set for each {-x, +x, -y, +y, -z, +z} face that has smoke
+	bool in_use, dirty;
+
+	smoke_block_t() : bx(0), by(0), bz(0), empty_frames(0), tot_smoke(0.0), face_mask(0), in_use(0), dirty(0) {}
+	static unsigned get_ix(unsigned x, unsigned y, unsigned z) {return ((y << SMOKE_BLOCK_BITS) + x)*SMOKE_BLOCK_SZ + z;}
+	cube_t get_bcube() const;
+};
+
+class smoke_grid_t {
+	vector<int> block_ixs; // index into blocks for each block position, -1 if not allocated
+	vector<smoke_block_t> blocks;
+	vector<unsigned> free_list, active;
+	unsigned nbx, nby, nbz, cur;
+	float xy_rate, zu_rate, zd_rate;
+
+	int get_block_ix(int bx, int by, int bz) const {
+		if (bx < 0 || by < 0 || bz < 0 || bx >= (int)nbx || by >= (int)nby || bz >= (int)nbz) return -1;
+		return block_ixs[(by*nbx + bx)*nbz + bz];
+	}
+	smoke_block_t const *get_block(int bx, int by, int bz) const {int const ix(get_block_ix(bx, by, bz)); return ((ix < 0) ? nullptr : &blocks[ix]);}
+	void calc_block_flow(smoke_block_t &b) const;
+	void step_block(smoke_block_t &b) const;
+	void free_block(unsigned ix);
+public:
+	smoke_grid_t() : nbx(0), nby(0), nbz(0), cur(0), xy_rate(0.0), zu_rate(0.0), zd_rate(0.0) {}
+	bool empty() const {return active.empty();}
+	void init();
+	void clear();
+	smoke_block_t *alloc_block(int bx, int by, int bz);
+	float get_smoke(int x, int y, int z) const;
+	void add_smoke(int x, int y, int z, float val);
+	void update_flow(int x1, int y1, int x2, int y2);
+	void step();
+	void update_smoke_man(smoke_manager &sm) const;
+	void upload_dirty_blocks();
+};
+
+smoke_grid_t smoke_grid;
+
+
+cube_t smoke_block_t::get_bcube() const {
+	int const x1(bx << SMOKE_BLOCK_BITS), y1(by << SMOKE_BLOCK_BITS), z1(bz << SMOKE_BLOCK_BITS), sz(SMOKE_BLOCK_SZ);
+	return cube_t(get_xval(x1), get_xval(x1+sz), get_yval(y1), get_yval(y1+sz), get_zval(z1), get_zval(z1+sz));
 }
 
-void diffuse_smoke_xy(int x, int y, int z, lmcell &adj, float rate, int dim, int dir) {
+void smoke_grid_t::init() { // called when the first block is allocated, since the mesh size isn't known until then
+
+	if (!block_ixs.empty()) return; // already initialized
+	nbx = (MESH_X_SIZE  + SMOKE_BLOCK_MASK) >> SMOKE_BLOCK_BITS;
+	nby = (MESH_Y_SIZE  + SMOKE_BLOCK_MASK) >> SMOKE_BLOCK_BITS;
+	nbz = (MESH_SIZE[2] + SMOKE_BLOCK_MASK) >> SMOKE_BLOCK_BITS;
+	block_ixs.resize(nbx*nby*nbz, -1);
+	// rates are per frame now that every active cell is updated each frame; z rates were previously applied every SMOKE_SKIPVAL frames
+	xy_rate = SMOKE_DIS_XY;
+	zu_rate = SMOKE_DIS_ZU/SMOKE_SKIPVAL;
+	zd_rate = SMOKE_DIS_ZD/SMOKE_SKIPVAL;
+}
+
+void smoke_grid_t::clear() {
+	block_ixs.clear();
+	blocks.clear();
+	free_list.clear();
+	active.clear();
+	cur = 0;
+}
+
+void smoke_grid_t::calc_block_flow(smoke_block_t &b) const { // copy flow from lmap cells and precompute edge losses
+
+	int const X(MESH_X_SIZE), Y(MESH_Y_SIZE), Z(MESH_SIZE[2]);
+	float const z_edge_loss(0.5f*(zu_rate + zd_rate));
+
+	for (unsigned y = 0; y < SMOKE_BLOCK_SZ; ++y) {
+		for (unsigned x = 0; x < SMOKE_BLOCK_SZ; ++x) {
+			int const gx((b.bx << SMOKE_BLOCK_BITS) + x), gy((b.by << SMOKE_BLOCK_BITS) + y);
+			lmcell const *const vldata((gx < X && gy < Y) ? lmap_manager.get_column(gx, gy) : nullptr);
+			bool xm_edge(0), ym_edge(0), xp_edge(0), yp_edge(0);
+
+			if (vldata != nullptr) { // neighbors off the mesh or with unallocated lmap columns are edges
+				xm_edge = (gx   == 0 || !lmap_manager.get_column(gx-1, gy));
+				ym_edge = (gy   == 0 || !lmap_manager.get_column(gx, gy-1));
+				xp_edge = (gx+1 >= X || !lmap_manager.get_column(gx+1, gy));
+				yp_edge = (gy+1 >= Y || !lmap_manager.get_column(gx, gy+1));
+			}
 
-	float delta(0.0); // Note: not using fticks due to instability
-	lmcell *vldata(point_outside_mesh(x, y) ? nullptr : lmap_manager.get_column(x, y));
+			for (unsigned z = 0; z < SMOKE_BLOCK_SZ; ++z) {
+				unsigned const ix(smoke_block_t::get_ix(x, y, z));
+				int const gz((b.bz << SMOKE_BLOCK_BITS) + z);
 
-	if (vldata) {
-		lmcell &lmc(vldata[z]);
-		unsigned char const flow(dir ? adj.pflow[dim] : lmc.pflow[dim]);
-		if (flow == 0) return;
-		float const cur_smoke(lmc.smoke);
-		delta  = rate*(flow/255.0f)*(adj.smoke - cur_smoke); // diffusion out of current cell and into cell xyz (can be negative)
-		adjust_smoke_val(lmc.smoke, delta);
-		delta  = (lmc.smoke - cur_smoke); // actual change
-		if (lmc.smoke > 0.0) {smoke_grid.register_smoke(x, y, z);}
+				if (vldata == nullptr || gz >= Z) { // outside the lmap: no flow in or out
+					UNROLL_3X(b.flow[i_][ix] = 0.0;)
+					b.edge_loss[ix] = 0.0;
+					continue;
+				}
+				lmcell const &lmc(vldata[gz]);
+				b.flow[0][ix] = (xp_edge ? 0.0f : xy_rate*lmc.pflow[0]/255.0f);
+				b.flow[1][ix] = (yp_edge ? 0.0f : xy_rate*lmc.pflow[1]/255.0f);
+				b.flow[2][ix] = ((gz+1 >= Z) ? 0.0f : lmc.pflow[2]/255.0f);
+				b.edge_loss[ix] = xy_rate*(int(xm_edge) + int(xp_edge) + int(ym_edge) + int(yp_edge)) + z_edge_loss*(int(gz == 0) + int(gz+1 == Z));
+			}
+		}
 	}
-	else { // edge cell has infinite smoke capacity and zero total smoke
-		delta = rate;
+}
+
+smoke_block_t *smoke_grid_t::alloc_block(int bx, int by, int bz) {
+
+	init();
+	assert(bx >= 0 && by >= 0 && bz >= 0 && bx < (int)nbx && by < (int)nby && bz < (int)nbz);
+	int &bix(block_ixs[(by*nbx + bx)*nbz + bz]);
+	if (bix >= 0) return &blocks[bix]; // already allocated
+	
+	if (!free_list.empty()) {bix = free_list.back(); free_list.pop_back();}
+	else {bix = blocks.size(); blocks.push_back(smoke_block_t());}
+	smoke_block_t &b(blocks[bix]);
+	b.bx = bx; b.by = by; b.bz = bz;
+	b.empty_frames = 0;
+	b.tot_smoke    = 0.0;
+	b.face_mask    = 0;
+	b.in_use       = 1;
+	b.dirty        = 0;
+	for (unsigned n = 0; n < 2; ++n) {std::fill(b.den[n], b.den[n]+SMOKE_BLOCK_CELLS, 0.0f);}
+	calc_block_flow(b);
+	active.push_back(bix);
+	return &b;
+}
+
+void smoke_grid_t::free_block(unsigned ix) {
+	smoke_block_t &b(blocks[ix]);
+	assert(b.in_use);
+	block_ixs[(b.by*nbx + b.bx)*nbz + b.bz] = -1;
+	b.in_use = 0;
+	free_list.push_back(ix);
+}
+
+float smoke_grid_t::get_smoke(int x, int y, int z) const {
+	if (empty()) return 0.0;
+	smoke_block_t const *const b(get_block((x >> SMOKE_BLOCK_BITS), (y >> SMOKE_BLOCK_BITS), (z >> SMOKE_BLOCK_BITS)));
+	return (b ? b->den[cur][smoke_block_t::get_ix((x & SMOKE_BLOCK_MASK), (y & SMOKE_BLOCK_MASK), (z & SMOKE_BLOCK_MASK))] : 0.0f);
+}
+
+void smoke_grid_t::add_smoke(int x, int y, int z, float val) {
+	smoke_block_t *const b(alloc_block((x >> SMOKE_BLOCK_BITS), (y >> SMOKE_BLOCK_BITS), (z >> SMOKE_BLOCK_BITS)));
+	adjust_smoke_val(b->den[cur][smoke_block_t::get_ix((x & SMOKE_BLOCK_MASK), (y & SMOKE_BLOCK_MASK), (z & SMOKE_BLOCK_MASK))], val);
+	b->empty_frames = 0;
+	b->dirty        = 1;
+}
+
+void smoke_grid_t::update_flow(int x1, int y1, int x2, int y2) { // x2/y2 are inclusive; called when lmap flow changes
+
+	if (empty()) return;
+	// include one extra cell on each side because edge losses depend on adjacent columns
+	int const bx1(max(x1-1, 0) >> SMOKE_BLOCK_BITS), by1(max(y1-1, 0) >> SMOKE_BLOCK_BITS), bx2((x2+1) >> SMOKE_BLOCK_BITS), by2((y2+1) >> SMOKE_BLOCK_BITS);
+
+	for (unsigned i : active) {
+		smoke_block_t &b(blocks[i]);
+		if (b.bx >= bx1 && b.bx <= bx2 && b.by >= by1 && b.by <= by2) {calc_block_flow(b);}
+	}
+}
+
+// Jacobi form of the previous in-place update: the flux through each face is proportional to the density difference times the flow of the lower cell,
+// and z flux uses the up rate for smoke moving up and the down rate for smoke moving down
+void smoke_grid_t::step_block(smoke_block_t &b) const {
+
+	unsigned const S(SMOKE_BLOCK_SZ + 2); // block plus a one cell halo
+	float den[S][S][S], fx[S][S][S], fy[S][S][S], fz[S][S][S]; // {y, x, z}; flows are only needed for the low side halo
+	memset(den, 0, sizeof(den)); memset(fx, 0, sizeof(fx)); memset(fy, 0, sizeof(fy)); memset(fz, 0, sizeof(fz));
+	float const *const src(b.den[cur]);
+	float *const dest(b.den[1-cur]);
+
+	for (unsigned y = 0; y < SMOKE_BLOCK_SZ; ++y) { // copy the block interior
+		for (unsigned x = 0; x < SMOKE_BLOCK_SZ; ++x) {
+			unsigned const ix(smoke_block_t::get_ix(x, y, 0));
+			memcpy(&den[y+1][x+1][1], src        +ix, SMOKE_BLOCK_SZ*sizeof(float));
+			memcpy(&fx [y+1][x+1][1], b.flow[0]+ix, SMOKE_BLOCK_SZ*sizeof(float));
+			memcpy(&fy [y+1][x+1][1], b.flow[1]+ix, SMOKE_BLOCK_SZ*sizeof(float));
+			memcpy(&fz [y+1][x+1][1], b.flow[2]+ix, SMOKE_BLOCK_SZ*sizeof(float));
+		}
+	}
+	// gather the faces of the six adjacent blocks; missing blocks have zero smoke and no flow in either direction, so smoke at the faces
+	// of this block is held there rather than lost until step() allocates the neighbor
+	unsigned const L(SMOKE_BLOCK_SZ-1), H(S-2); // H = halo index of the last interior cell
+	smoke_block_t const *nb(nullptr);
+
+	if ((nb = get_block(b.bx-1, b.by, b.bz))) {
+		for (unsigned y = 0; y < SMOKE_BLOCK_SZ; ++y) {
+			for (unsigned z = 0; z < SMOKE_BLOCK_SZ; ++z) {unsigned const ix(smoke_block_t::get_ix(L, y, z)); den[y+1][0][z+1] = nb->den[cur][ix]; fx[y+1][0][z+1] = nb->flow[0][ix];}
+		}
+	}
+	if ((nb = get_block(b.bx+1, b.by, b.bz))) {
+		for (unsigned y = 0; y < SMOKE_BLOCK_SZ; ++y) {
+			for (unsigned z = 0; z < SMOKE_BLOCK_SZ; ++z) {den[y+1][S-1][z+1] = nb->den[cur][smoke_block_t::get_ix(0, y, z)];}
+		}
+	}
+	else {
+		for (unsigned y = 0; y < SMOKE_BLOCK_SZ; ++y) {
+			for (unsigned z = 0; z < SMOKE_BLOCK_SZ; ++z) {fx[y+1][H][z+1] = 0.0;}
+		}
+	}
+	if ((nb = get_block(b.bx, b.by-1, b.bz))) {
+		for (unsigned x = 0; x < SMOKE_BLOCK_SZ; ++x) {
+			for (unsigned z = 0; z < SMOKE_BLOCK_SZ; ++z) {unsigned const ix(smoke_block_t::get_ix(x, L, z)); den[0][x+1][z+1] = nb->den[cur][ix]; fy[0][x+1][z+1] = nb->flow[1][ix];}
+		}
+	}
+	if ((nb = get_block(b.bx, b.by+1, b.bz))) {
+		for (unsigned x = 0; x < SMOKE_BLOCK_SZ; ++x) {
+			for (unsigned z = 0; z < SMOKE_BLOCK_SZ; ++z) {den[S-1][x+1][z+1] = nb->den[cur][smoke_block_t::get_ix(x, 0, z)];}
+		}
+	}
+	else {
+		for (unsigned x = 0; x < SMOKE_BLOCK_SZ; ++x) {
+			for (unsigned z = 0; z < SMOKE_BLOCK_SZ; ++z) {fy[H][x+1][z+1] = 0.0;}
+		}
+	}
+	if ((nb = get_block(b.bx, b.by, b.bz-1))) {
+		for (unsigned y = 0; y < SMOKE_BLOCK_SZ; ++y) {
+			for (unsigned x = 0; x < SMOKE_BLOCK_SZ; ++x) {unsigned const ix(smoke_block_t::get_ix(x, y, L)); den[y+1][x+1][0] = nb->den[cur][ix]; fz[y+1][x+1][0] = nb->flow[2][ix];}
+		}
+	}
+	if ((nb = get_block(b.bx, b.by, b.bz+1))) {
+		for (unsigned y = 0; y < SMOKE_BLOCK_SZ; ++y) {
+			for (unsigned x = 0; x < SMOKE_BLOCK_SZ; ++x) {den[y+1][x+1][S-1] = nb->den[cur][smoke_block_t::get_ix(x, y, 0)];}
+		}
+	}
+	else {
+		for (unsigned y = 0; y < SMOKE_BLOCK_SZ; ++y) {
+			for (unsigned x = 0; x < SMOKE_BLOCK_SZ; ++x) {fz[y+1][x+1][H] = 0.0;}
+		}
+	}
+	// apply the 7-point stencil one z row at a time
+	vfloat8 const zero(0.0f), max_val(SMOKE_MAX_VAL), thresh(SMOKE_THRESH), zu(zu_rate), zd(zd_rate);
+	vfloat8 tot(zero), has_smoke(zero), face_xm(zero), face_xp(zero), face_ym(zero), face_yp(zero);
+	float face_zm(0.0), face_zp(0.0);
+
+	for (unsigned y = 1; y <= SMOKE_BLOCK_SZ; ++y) {
+		for (unsigned x = 1; x <= SMOKE_BLOCK_SZ; ++x) {
+			unsigned const ix(smoke_block_t::get_ix(x-1, y-1, 0));
+			vfloat8 const c(vfloat8::load(&den[y][x][1]));
+			vfloat8 v(c - vfloat8::load(b.edge_loss + ix));
+			v += vfloat8::load(&fx[y][x  ][1])*(vfloat8::load(&den[y][x+1][1]) - c); // +x face
+			v += vfloat8::load(&fx[y][x-1][1])*(vfloat8::load(&den[y][x-1][1]) - c); // -x face
+			v += vfloat8::load(&fy[y  ][x][1])*(vfloat8::load(&den[y+1][x][1]) - c); // +y face
+			v += vfloat8::load(&fy[y-1][x][1])*(vfloat8::load(&den[y-1][x][1]) - c); // -y face
+			vfloat8 const up  (vfloat8::load(&fz[y][x][1])*(c - vfloat8::load(&den[y][x][2]))); // flux up through the +z face
+			vfloat8 const down(vfloat8::load(&fz[y][x][0])*(vfloat8::load(&den[y][x][0]) - c)); // flux up through the -z face
+			v -= select(cmp_gt(up,   zero), zu, zd)*up;
+			v += select(cmp_gt(down, zero), zu, zd)*down;
+			v  = vmin(vmax(v, zero), max_val);
+			v  = select(cmp_lt(v, thresh), zero, v);
+			v.store(dest + ix);
+			tot += v;
+			vfloat8 const nz(cmp_gt(v, zero));
+			has_smoke = select(nz, nz, has_smoke);
+			if (x == 1)              {face_xm = select(nz, nz, face_xm);}
+			if (x == SMOKE_BLOCK_SZ) {face_xp = select(nz, nz, face_xp);}
+			if (y == 1)              {face_ym = select(nz, nz, face_ym);}
+			if (y == SMOKE_BLOCK_SZ) {face_yp = select(nz, nz, face_yp);}
+			face_zm += dest[ix];
+			face_zp += dest[ix + SMOKE_BLOCK_SZ - 1];
+		} // for x
+	} // for y
+	float tot_vals[8];
+	tot.store(tot_vals);
+	b.tot_smoke = 0.0;
+	for (unsigned i = 0; i < 8; ++i) {b.tot_smoke += tot_vals[i];}
+	b.face_mask = (movemask(face_xm) ? 1 : 0) | (movemask(face_xp) ? 2 : 0) | (movemask(face_ym) ? 4 : 0) | (movemask(face_yp) ? 8 : 0) | ((face_zm > 0.0) ? 16 : 0) | ((face_zp > 0.0) ? 32 : 0);
+	bool const block_has_smoke(movemask(has_smoke) != 0);
+	b.dirty |= (block_has_smoke || b.empty_frames == 0); // needs to be uploaded if it has smoke now or had smoke in the previous frame
+	b.empty_frames = (block_has_smoke ? 0 : (b.empty_frames + 1));
+}
+
+void smoke_grid_t::step() { // called once per frame
+
+	if (empty()) return;
+	//timer_t timer("Smoke Grid Step");
+	// all blocks are processed in parallel: they read the current buffer of themselves and their neighbors and write their own next buffer
+#pragma omp parallel for schedule(dynamic,4)
+	for (int i = 0; i < (int)active.size(); ++i) {step_block(blocks[active[i]]);}
+	cur = 1 - cur;
+	int const dirs[6][3] = {{-1,0,0}, {1,0,0}, {0,-1,0}, {0,1,0}, {0,0,-1}, {0,0,1}};
+	unsigned const num_active(active.size());
+
+	for (unsigned i = 0; i < num_active; ++i) { // allocate neighbors that smoke can flow into; new blocks are added to the end of active
+		smoke_block_t const &b(blocks[active[i]]);
+		unsigned char const face_mask(b.face_mask);
+		if (face_mask == 0) continue;
+		int const bx0(b.bx), by0(b.by), bz0(b.bz); // copy since alloc_block() can reallocate blocks
+
+		for (unsigned d = 0; d < 6; ++d) {
+			if (!(face_mask & (1 << d))) continue;
+			int const bx(bx0 + dirs[d][0]), by(by0 + dirs[d][1]), bz(bz0 + dirs[d][2]);
+			if (bx < 0 || by < 0 || bz < 0 || bx >= (int)nbx || by >= (int)nby || bz >= (int)nbz) continue; // off the edge of the grid
+			if (get_block_ix(bx, by, bz) < 0) {alloc_block(bx, by, bz);}
+		}
+	}
+	for (unsigned i = 0; i < active.size(); ++i) { // free blocks that have been empty for a while
+		if (blocks[active[i]].empty_frames < SMOKE_EMPTY_FRAMES || blocks[active[i]].dirty) continue;
+		free_block(active[i]);
+		active[i] = active.back();
+		active.pop_back();
+		--i;
+	}
+}
+
+void smoke_grid_t::update_smoke_man(smoke_manager &sm) const {
+
+	for (unsigned i : active) {
+		smoke_block_t const &b(blocks[i]);
+		if (b.tot_smoke > 0.0) {sm.add_block(b.get_bcube(), b.tot_smoke);}
 	}
-	adjust_smoke_val(adj.smoke, -delta);
 }
 
-void diffuse_smoke_z(int x, int y, int z, lmcell &adj, lmcell *vldata, float pos_rate, float neg_rate, int dim, int dir) {
+void smoke_grid_t::upload_dirty_blocks() { // update the smoke texture for the blocks that changed, merging blocks in each xy column
 
-	float delta(0.0); // Note: not using fticks due to instability
+	if (active.empty()) return;
+	vector<pair<unsigned, unsigned>> cols; // {(by*nbx + bx), bz}
 
-	if (z >= 0 && z < MESH_SIZE[2]) {
-		lmcell &lmc(vldata[z]);
-		unsigned char const flow(dir ? adj.pflow[dim] : lmc.pflow[dim]);
-		if (flow == 0) return;
-		float const cur_smoke(lmc.smoke);
-		delta  = (flow/255.0f)*(adj.smoke - cur_smoke); // diffusion out of current cell and into cell xyz (can be negative)
-		delta *= ((delta < 0.0) ? neg_rate : pos_rate);
-		adjust_smoke_val(lmc.smoke, delta);
-		delta  = (lmc.smoke - cur_smoke); // actual change
-		if (lmc.smoke > 0.0) {smoke_grid.register_smoke(x, y, z);}
+	for (unsigned i : active) {
+		smoke_block_t &b(blocks[i]);
+		if (!b.dirty) continue;
+		cols.emplace_back((b.by*nbx + b.bx), b.bz);
+		b.dirty = 0;
 	}
-	else { // edge cell has infinite smoke capacity and zero total smoke
-		delta = 0.5f*(pos_rate + neg_rate);
+	sort(cols.begin(), cols.end());
+
+	for (unsigned i = 0; i < cols.size();) {
+		unsigned const col(cols[i].first), bz1(cols[i].second);
+		unsigned bz2(bz1 + 1);
+		for (++i; i < cols.size() && cols[i].first == col && cols[i].second == bz2; ++i) {++bz2;} // merge adjacent z blocks
+		unsigned const x1((col%nbx) << SMOKE_BLOCK_BITS), y1((col/nbx) << SMOKE_BLOCK_BITS), z1(bz1 << SMOKE_BLOCK_BITS);
+		unsigned const x2(min(x1+SMOKE_BLOCK_SZ, (unsigned)MESH_X_SIZE)), y2(min(y1+SMOKE_BLOCK_SZ, (unsigned)MESH_Y_SIZE)), z2(min((bz2 << SMOKE_BLOCK_BITS), (unsigned)MESH_SIZE[2]));
+		update_smoke_indir_tex_range(x1, x2, y1, y2, z1, z2, 0); // smoke only
 	}
-	adjust_smoke_val(adj.smoke, -delta);
+}
+
+void reset_smoke_grid() {smoke_grid.clear();} // called when the lmap is freed
+void update_smoke_grid_flow(int x1, int y1, int x2, int y2) {smoke_grid.update_flow(x1, y1, x2, y2);}
+
+
+void add_smoke(point const &pos, float val) {
+
+	if (!DYNAMIC_SMOKE || (display_mode & 0x80) || !game_mode || val == 0.0 || pos.z >= czmax) return;
+	lmcell *const lmc(lmap_manager.get_lmcell(pos));
+	if (!lmc) return;
+	int const xpos(get_xpos(pos.x)), ypos(get_ypos(pos.y)), zpos(get_zpos(pos.z));
+	if (point_outside_mesh(xpos, ypos) || pos.z >= v_collision_matrix[ypos][xpos].zmax || pos.z < mesh_height[ypos][xpos]) return; // above all cobjs/outside
+	if (zpos < 0 || zpos >= MESH_SIZE[2]) return;
+	if (no_smoke_over_mesh && !is_mesh_disabled(xpos, ypos)) return;
+	if (!check_smoke_bounds(pos)) return;
+	//if (!check_coll_line(pos, point(pos.x, pos.y, czmax), cindex, -1, 1, 0)) return; // too slow
+	smoke_grid.add_smoke(xpos, ypos, zpos, SMOKE_DENSITY*val);
+	smoke_exists |= smoke_man.is_smoke_visible(pos);
 }
 
 
@@ -186,64 +477,17 @@ void distribute_smoke() { // called at most once per frame
 
 	//RESET_TIME;
 	if (!DYNAMIC_SMOKE || !smoke_exists || !animate2) return;
-	assert(SMOKE_SKIPVAL > 0);
-	static int cur_skip(0);
-	static rand_gen_t rgen;
-	
-	if (cur_skip == 0) {
-		//cout << "tot_smoke: " << smoke_man.tot_smoke << ", enabled: " << smoke_exists << ", visible: " << smoke_visible << endl;
-		smoke_man     = next_smoke_man;
-		smoke_man.adj_bbox();
-		smoke_visible = smoke_man.smoke_vis;
-		smoke_exists  = smoke_man.enabled;
-		next_smoke_man.reset();
-	}
 	/*if ((display_mode & 0x10) && !smoke_bounds.empty()) {
 		cur_smoke_bb = smoke_bounds[0];
 		for (vector<cube_t>::const_iterator i = smoke_bounds.begin()+1; i != smoke_bounds.end(); ++i) {cur_smoke_bb.union_with_cube(*i);}
 	}*/
-	float const xy_rate(SMOKE_DIS_XY*SMOKE_SKIPVAL);
-	int const dx(rgen.rand() & 1), dy(rgen.rand() & 1); // randomize the processing order
-	
-	// openmp doesn't really help here
-	for (int y = cur_skip; y < MESH_Y_SIZE; y += SMOKE_SKIPVAL) { // split the computation across several frames
-		for (int x = 0; x < MESH_X_SIZE; ++x) {
-			lmcell *vldata(lmap_manager.get_column(x, y));
-			if (vldata == NULL) continue;
-			smoke_entry_t &zrange(smoke_grid.get_z_range(x, y));
-			//smoke_entry_t zrange; zrange.zmin = 0; zrange.zmax = MESH_Z_SIZE;
-			if (!zrange.valid()) continue;
-			bool any_z_has_smoke(0);
-			
-			for (int z = zrange.zmin; z < zrange.zmax; ++z) {
-				lmcell &lmc(vldata[z]);
-				if (lmc.smoke < SMOKE_THRESH) {lmc.smoke = 0.0;}
-				if (lmc.smoke == 0.0) continue;
-				//if (get_zval(z) > v_collision_matrix[y][x].zmax) {lmc.smoke = 0.0; continue;} // open space above - smoke goes up
-				next_smoke_man.add_smoke(x, y, z, lmc.smoke);
-
-				if (dx) {
-					diffuse_smoke_xy(x+1, y, z, lmc, xy_rate, 0, 1);
-					diffuse_smoke_xy(x-1, y, z, lmc, xy_rate, 0, 0);
-				} else {
-					diffuse_smoke_xy(x-1, y, z, lmc, xy_rate, 0, 0);
-					diffuse_smoke_xy(x+1, y, z, lmc, xy_rate, 0, 1);
-				}
-				if (dy) {
-					diffuse_smoke_xy(x, y+1, z, lmc, xy_rate, 1, 1);
-					diffuse_smoke_xy(x, y-1, z, lmc, xy_rate, 1, 0);
-				} else {
-					diffuse_smoke_xy(x, y-1, z, lmc, xy_rate, 1, 0);
-					diffuse_smoke_xy(x, y+1, z, lmc, xy_rate, 1, 1);
-				}
-				diffuse_smoke_z(x, y, (z - 1), lmc, vldata, SMOKE_DIS_ZD, SMOKE_DIS_ZU, 2, 0);
-				diffuse_smoke_z(x, y, (z + 1), lmc, vldata, SMOKE_DIS_ZU, SMOKE_DIS_ZD, 2, 1);
-				any_z_has_smoke = 1;
-			} // for z
-			if (!any_z_has_smoke) {zrange.clear();} // mark this xy as not having smoke
-		} // for x
-	} // for y
-	cur_skip = (cur_skip+1) % SMOKE_SKIPVAL;
+	smoke_grid.step(); // updates all active blocks every frame
+	smoke_man.reset();
+	smoke_grid.update_smoke_man(smoke_man);
+	//cout << "tot_smoke: " << smoke_man.tot_smoke << ", enabled: " << smoke_man.enabled << ", visible: " << smoke_man.smoke_vis << endl;
+	smoke_man.adj_bbox();
+	smoke_visible = smoke_man.smoke_vis;
+	smoke_exists  = (smoke_man.enabled || !smoke_grid.empty()); // keep running until all blocks have been freed
 	//PRINT_TIME("Distribute Smoke");
 }
 
@@ -254,16 +498,13 @@ float get_smoke_at_pos(point const &pos) {
 	if (pos.z <= czmin0 || pos.z >= czmax) return 0.0;
 	int const x(get_xpos(pos.x)), y(get_ypos(pos.y)), z(get_zpos(pos.z));
 	if (point_outside_mesh(x, y) || z < 0 || z >= MESH_SIZE[2]) return 0.0;
-	lmcell const *const vldata(lmap_manager.get_column(x, y));
-	return ((vldata == NULL) ? 0.0 : vldata[z].smoke);
+	return smoke_grid.get_smoke(x, y, z);
 }
 
 
 void reset_smoke_tex_data() {smoke_tex_data.clear();}
 
 
-#define CLEAR_Z_RANGE(z1, z2) for (int z = z1; z < (int)z2; ++z) {data[4*(off + z)+3] = 0;}
-
 void update_smoke_row(vector<unsigned char> &data, vector<unsigned> const &llvol_ixs, lmcell const &default_lmc,
 	unsigned x_start, unsigned x_end, unsigned z_start, unsigned z_end, unsigned y, bool update_lighting)
 {
@@ -286,22 +527,10 @@ void update_smoke_row(vector<unsigned char> &data, vector<unsigned> const &llvol
 				if (local_light_volumes[llvol_ixs[i]]->check_xy_bounds(x, y)) {llv_ix_s = min(i, llv_ix_s); llv_ix_e = max(i+1, llv_ix_e);}
 			}
 		}
-		else { // update smoke only
-			smoke_entry_t const &zrange(smoke_grid.get_z_range(x, y));
-			
-			if (!zrange.valid()) { // no smoke in this row
-				CLEAR_Z_RANGE(z_start, z_end);
-				continue;
-			}
-			CLEAR_Z_RANGE(z_start, zrange.zmin);
-			CLEAR_Z_RANGE(zrange.zmax, z_end);
-			z_start = zrange.zmin;
-			z_end   = zrange.zmax;
-		}
 		for (unsigned z = z_start; z < z_end; ++z) {
 			unsigned const off2(ncomp*(off + z));
-			if (vlm == NULL || vlm[z].smoke == 0.0) {data[off2+3] = 0;}
-			else {data[off2+3] = (unsigned char)(255*CLIP_TO_01(smoke_scale*vlm[z].smoke));} // alpha: smoke
+			float const smoke((vlm == NULL) ? 0.0f : smoke_grid.get_smoke(x, y, z));
+			data[off2+3] = ((smoke == 0.0) ? 0 : (unsigned char)(255*CLIP_TO_01(smoke_scale*smoke))); // alpha: smoke
 			if (!do_lighting) continue; // lighting not needed
 				
 			if (check_z_thresh && get_zval(z+1) < mh) { // adjust by one because GPU will interpolate the texel
@@ -371,7 +600,6 @@ bool upload_smoke_indir_texture() {
 		have_indir_smoke_tex = 0;
 		return 0;
 	}
-	assert((MESH_Y_SIZE%SMOKE_SEND_SKIP) == 0);
 	// ok when texture z size is not a power of 2
 	unsigned const sz(MESH_X_SIZE*MESH_Y_SIZE*MESH_SIZE[2]), ncomp(4);
 
@@ -394,18 +622,23 @@ bool upload_smoke_indir_texture() {
 		if ((*i)->needs_update()) {(*i)->mark_updated(); lighting_changed = 1;}
 	}
 	bool const full_update(smoke_tid == 0 || (!no_sun_lpos_update && lighting_changed));
-	bool const could_have_smoke(smoke_exists || last_smoke_update > 0);
+	bool const could_have_smoke(!smoke_grid.empty());
 	if (!full_update && !could_have_smoke && !lmap_manager.was_updated && !lighting_changed) return 0; // return 1?
 	if (full_update ) {last_cur_ambient  = cur_ambient; last_cur_diffuse = cur_diffuse;}
-	if (smoke_exists) {last_smoke_update = SMOKE_SEND_SKIP;} else if (last_smoke_update > 0) {--last_smoke_update;}
 	static int cur_block(0);
-	unsigned const skipval(could_have_smoke ? SMOKE_SEND_SKIP : INDIR_LT_SEND_SKIP);
-	unsigned const block_size(MESH_Y_SIZE/skipval);
-	unsigned const y_start(full_update ? 0           :  cur_block*block_size);
-	unsigned const y_end  (full_update ? MESH_Y_SIZE : (y_start + block_size));
-	update_smoke_indir_tex_range(0, MESH_X_SIZE, y_start, y_end, 0, MESH_SIZE[2], full_update);
-	cur_block = (full_update ? 0 : (cur_block+1) % skipval);
-	if (cur_block == 0) {lmap_manager.was_updated = 0;} // only stop updating after we wrap around to the beginning again
+	static unsigned sweep_blocks_left(0); // lighting changed without a full update (static sun with a local light volume change): sweep the whole texture
+	if (lighting_changed && !full_update) {sweep_blocks_left = INDIR_LT_SEND_SKIP;}
+
+	if (full_update || lmap_manager.was_updated || sweep_blocks_left > 0) { // incremental lighting updates are spread across several frames
+		unsigned const block_size(MESH_Y_SIZE/INDIR_LT_SEND_SKIP);
+		unsigned const y_start(full_update ? 0           :  cur_block*block_size);
+		unsigned const y_end  (full_update ? MESH_Y_SIZE : (y_start + block_size));
+		update_smoke_indir_tex_range(0, MESH_X_SIZE, y_start, y_end, 0, MESH_SIZE[2], full_update);
+		cur_block = (full_update ? 0 : (cur_block+1) % INDIR_LT_SEND_SKIP);
+		if (cur_block == 0) {lmap_manager.was_updated = 0;} // only stop updating after we wrap around to the beginning again
+		sweep_blocks_left = (full_update ? 0 : (sweep_blocks_left - (sweep_blocks_left > 0)));
+	}
+	smoke_grid.upload_dirty_blocks(); // smoke changes every frame, but only in the active blocks
 	have_indir_smoke_tex = 1;
 	//PRINT_TIME("Smoke + Indir Upload");
 	return 1;
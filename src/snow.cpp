@@ -6,6 +6,7 @@
 #include "gl_ext_arb.h"
 #include "shaders.h"
 #include "model3d.h"
+#include "binary_file_io.h"
 
 
 unsigned const VOXELS_PER_DIV = 8; // 1024 for 128 vertex mesh
@@ -46,6 +47,11 @@ struct zval_avg {
 	//       so we can have at max 64M snowflakes.
 	//       However, we can get snow to stack up at a vertical edge so we need to clamp the count
 	void update(float zval) {if (c < MAX_COUNT) {++c; z += zval;}}
+	void merge(zval_avg const &zv) { // clamp to MAX_COUNT while preserving the average
+		unsigned const tot_c(unsigned(c) + zv.c);
+		z += zv.z;
+		if (tot_c > MAX_COUNT) {z *= float(MAX_COUNT)/tot_c; c = MAX_COUNT;} else {c = tot_c;}
+	}
 	bool valid() const {return (c > 0);}
 	float getz() const {return z/c;}
 };
@@ -231,9 +237,62 @@ public:
 };
 
 
-class voxel_map : public map<voxel_t, zval_avg> { // must be a sorted map
+class voxel_hash_map_t { // open addressing hash map with linear probing, used to accumulate snow hits within one thread
+
+	vector<voxel_z_pair> slots; // unused slots have a zero count
+	unsigned num_used;
+
+	static unsigned hash(voxel_t const &v) {
+		unsigned h((unsigned short)v.p[0]*73856093U ^ (unsigned short)v.p[1]*19349663U ^ (unsigned short)v.p[2]*83492791U);
+		h ^= (h >> 15);
+		return h*0x2C1B3C6DU;
+	}
+	zval_avg &get_entry(voxel_t const &v) { // inserts an empty entry if not found; caller must make it valid
+		if (2*(num_used + 1) > slots.size()) {grow();} // keep the load factor at or below 0.5
+		unsigned const mask(slots.size() - 1);
+
+		for (unsigned ix = (hash(v) & mask); ; ix = ((ix + 1) & mask)) {
+			voxel_z_pair &s(slots[ix]);
+			if (s.z.valid()) {if (s.v == v) return s.z; continue;}
+			s.v = v;
+			++num_used;
+			return s.z;
+		}
+	}
+	void grow() {
+		vector<voxel_z_pair> old_slots(max((size_t)1024, 2*slots.size()));
+		old_slots.swap(slots);
+		num_used = 0;
+		for (voxel_z_pair const &s : old_slots) {if (s.z.valid()) {get_entry(s.v) = s.z;}}
+	}
+public:
+	voxel_hash_map_t() : num_used(0) {}
+	unsigned size() const {return num_used;}
+	vector<voxel_z_pair> const &get_slots() const {return slots;}
+	void update(voxel_t const &v, float zval) {get_entry(v).update(zval);}
+	void merge (voxel_t const &v, zval_avg const &zv) {get_entry(v).merge(zv);}
+	void clear() {slots.clear(); num_used = 0;}
+};
+
+
+class voxel_map { // sorted (by x, y, z) flat array of voxels with snow; entries are marked as removed rather than erased
+
+	vector<voxel_z_pair> data;
+	vector<unsigned char> removed;
+	size_t first; // first entry that may not be removed
+
 public:
-	zval_avg find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth, voxel_map *cur_x_map=NULL);
+	voxel_map() : first(0) {}
+	size_t size() const {return data.size();}
+	bool empty() {
+		while (first < data.size() && removed[first]) {++first;}
+		return (first == data.size());
+	}
+	voxel_z_pair const &front() const {assert(first < data.size() && !removed[first]); return data[first];}
+	void pop_front() {assert(first < data.size()); removed[first++] = 1;}
+	void set_sorted_data(vector<voxel_z_pair> &d) {data.swap(d); removed.clear(); removed.resize(data.size(), 0); first = 0;}
+	void create_from_hash_maps(vector<voxel_hash_map_t> &maps);
+	zval_avg find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth, bool remove, bool include_removed=0);
 	bool read(char const *const fn);
 	bool write(char const *const fn) const;
 };
@@ -244,21 +303,69 @@ struct data_block { // packed voxel_z_pair for read/write
 	count_type c;
 	float z;
 
-	void add_to_map(voxel_map &vmap) const {
-		voxel_t v;
-		for (unsigned i = 0; i < 3; ++i) v.p[i] = p[i];
-		vmap[v] = zval_avg(c, z);
+	data_block() {}
+	data_block(voxel_z_pair const &vz) : c(vz.z.c), z(vz.z.z) {UNROLL_3X(p[i_] = vz.v.p[i_];)}
+	voxel_z_pair get_voxel_z_pair() const {return voxel_z_pair(voxel_t(p[0], p[1], p[2]), zval_avg(c, z));}
+};
+
+struct snow_file_header_t {
+	char magic[8];
+	unsigned version, block_sz;
+	uint64_t num_blocks;
+	float vox_delta[3];
+	unsigned sorted;
+};
+char const SNOW_FILE_MAGIC[8] = {'3', 'D', 'W', 'S', 'N', 'O', 'W', '\0'};
+unsigned const SNOW_FILE_VERSION = 1;
+
+bool voxel_z_pair_less(voxel_z_pair const &a, voxel_z_pair const &b) {return (a.v < b.v);}
+
+
+// merges per-thread hash maps: each thread splits its map into x partitions, then each partition is merged and sorted in parallel
+void voxel_map::create_from_hash_maps(vector<voxel_hash_map_t> &maps) {
+
+	int const num_x(int(2.0*X_SCENE_SIZE*vox_delta.x) + 2), num_parts(max(1, min(num_x, 4*omp_get_max_threads_3dw())));
+	vector<vector<vector<voxel_z_pair>>> parts(maps.size()); // {thread, partition}
+
+#pragma omp parallel for schedule(dynamic,1)
+	for (int t = 0; t < (int)maps.size(); ++t) {
+		parts[t].resize(num_parts);
+
+		for (voxel_z_pair const &s : maps[t].get_slots()) {
+			if (!s.z.valid()) continue;
+			int const p(max(0, min(num_parts-1, int(s.v.p[0])*num_parts/num_x))); // partitions are contiguous ranges of x
+			parts[t][p].push_back(s);
+		}
+		maps[t].clear(); // free memory
 	}
-	void set_from_map_iter(voxel_map::const_iterator it) {
-		for (unsigned i = 0; i < 3; ++i) p[i] = it->first.p[i];
-		c = it->second.c;
-		z = it->second.z;
+	vector<vector<voxel_z_pair>> merged(num_parts);
+
+#pragma omp parallel for schedule(dynamic,1)
+	for (int p = 0; p < num_parts; ++p) {
+		voxel_hash_map_t pmap;
+
+		for (unsigned t = 0; t < parts.size(); ++t) {
+			for (voxel_z_pair const &s : parts[t][p]) {pmap.merge(s.v, s.z);}
+			vector<voxel_z_pair>().swap(parts[t][p]); // free memory
+		}
+		vector<voxel_z_pair> &m(merged[p]);
+		m.reserve(pmap.size());
+		for (voxel_z_pair const &s : pmap.get_slots()) {if (s.z.valid()) {m.push_back(s);}}
+		sort(m.begin(), m.end(), voxel_z_pair_less);
 	}
-};
+	vector<size_t> offsets(num_parts+1, 0);
+	for (int p = 0; p < num_parts; ++p) {offsets[p+1] = offsets[p] + merged[p].size();}
+	vector<voxel_z_pair> sorted(offsets.back());
+
+#pragma omp parallel for schedule(dynamic,1)
+	for (int p = 0; p < num_parts; ++p) {std::copy(merged[p].begin(), merged[p].end(), sorted.begin()+offsets[p]);}
+	set_sorted_data(sorted);
+}
 
 
 // this tends to take a large fraction of the preprocessing time
-zval_avg voxel_map::find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth, voxel_map *cur_x_map) {
+// remove: mark the entries that were used as removed; include_removed: also use removed entries (for the previous x row, which is fully removed)
+zval_avg voxel_map::find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth, bool remove, bool include_removed) {
 
 	coord_type best_dz(0);
 	zval_avg res;
@@ -266,17 +373,13 @@ zval_avg voxel_map::find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth,
 	v2_s.p[2] -= min(Z_CHECK_RANGE, (int)v2_s.p[2]);
 	v2_e.p[2] += Z_CHECK_RANGE+1; // one past the end
 
-	for (iterator it = lower_bound(v2_s); it != end() && it->first < v2_e;) { // Note: no increment of it
-		zval_avg const z2(it->second);
+	for (size_t i = (std::lower_bound(data.begin(), data.end(), voxel_z_pair(v2_s), voxel_z_pair_less) - data.begin()); i < data.size() && data[i].v < v2_e; ++i) {
+		if (removed[i] && !include_removed) continue;
+		zval_avg const z2(data[i].z);
 		assert(z2.valid());
-		if (zv_old.valid() && fabs(z2.getz() - zv_old.getz()) > depth) {++it; continue;} // delta z too large
-		voxel_t const v2(it->first);
-
-		if (cur_x_map) {
-			erase(it++);
-			(*cur_x_map)[v2] = z2;
-		} else {++it;}
-		coord_type const dz(v2.p[2] - v.p[2]);
+		if (zv_old.valid() && fabs(z2.getz() - zv_old.getz()) > depth) continue; // delta z too large
+		if (remove) {removed[i] = 1;}
+		coord_type const dz(data[i].v.p[2] - v.p[2]);
 		if (!res.valid() || abs(dz) < abs(best_dz)) {best_dz = dz;}
 		res.c += z2.c;
 		res.z += z2.z;
@@ -286,48 +389,67 @@ zval_avg voxel_map::find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth,
 }
 
 
+// reads the current format with a header and the previous format, which starts with vox_delta; blocks are read with a single call
 bool voxel_map::read(char const *const fn) {
 
-	FILE *fp;
 	assert(fn != NULL);
-	if (!open_file(fp, fn, "snow map", "rb")) return 0;
+	binary_file_reader reader;
+	if (!reader.open(fn)) return 0;
 	cout << "Reading snow file from " << fn << endl;
-	size_t const n(fread(&vox_delta, sizeof(float), 3, fp));
-	assert(n == 3);
-	unsigned map_size(0);
-	size_t const sz_read(fread(&map_size, sizeof(unsigned), 1, fp));
-	assert(sz_read == 1);
-	
-	for (unsigned i = 0; i < map_size; ++i) {
-		data_block data;
-		size_t const nr(fread(&data, sizeof(data_block), 1, fp));
-		assert(nr == 1);
-		data.add_to_map(*this);
+	snow_file_header_t header;
+	uint64_t num_blocks(0);
+	bool sorted(0);
+	if (!reader.read(header.magic, sizeof(char), 8)) {cerr << "Error reading header from snow file " << fn << endl; return 0;}
+
+	if (memcmp(header.magic, SNOW_FILE_MAGIC, 8) == 0) {
+		if (!reader.read(&header.version, sizeof(header) - 8, 1)) {cerr << "Error reading header from snow file " << fn << endl; return 0;}
+
+		if (header.version != SNOW_FILE_VERSION || header.block_sz != sizeof(data_block)) {
+			cerr << "Error: Unsupported snow file version " << header.version << " in " << fn << endl;
+			return 0;
+		}
+		vox_delta.assign(header.vox_delta[0], header.vox_delta[1], header.vox_delta[2]);
+		num_blocks = header.num_blocks;
+		sorted     = (header.sorted != 0);
 	}
-	checked_fclose(fp);
+	else { // old format: vox_delta followed by a 32-bit count; the first 8 bytes are vox_delta.x and vox_delta.y
+		unsigned map_size(0);
+		memcpy(&vox_delta.x, header.magic, 2*sizeof(float));
+		if (!reader.read(&vox_delta.z, sizeof(float), 1) || !reader.read(&map_size, sizeof(unsigned), 1)) {cerr << "Error reading snow file " << fn << endl; return 0;}
+		num_blocks = map_size;
+	}
+	vector<data_block> blocks(num_blocks);
+	if (num_blocks > 0 && !reader.read(blocks.data(), sizeof(data_block), blocks.size())) {cerr << "Error reading data from snow file " << fn << endl; return 0;}
+	vector<voxel_z_pair> vzs(blocks.size());
+#pragma omp parallel for schedule(static,4096)
+	for (int i = 0; i < (int)blocks.size(); ++i) {vzs[i] = blocks[i].get_voxel_z_pair();}
+	if (!sorted && !std::is_sorted(vzs.begin(), vzs.end(), voxel_z_pair_less)) {sort(vzs.begin(), vzs.end(), voxel_z_pair_less);} // old files are sorted as well
+	set_sorted_data(vzs);
 	return 1;
 }
 
 
 bool voxel_map::write(char const *const fn) const {
 
-	FILE *fp;
 	assert(fn != NULL);
-	if (!open_file(fp, fn, "snow map", "wb")) return 0;
+	binary_file_writer writer;
+	if (!writer.open(fn)) return 0;
 	cout << "Writing snow file to " << fn << endl;
-	size_t const n(fwrite(&vox_delta, sizeof(float), 3, fp));
-	assert(n == 3);
-	unsigned const map_size((unsigned)size()); // should be size_t?
-	size_t const sz_write(fwrite(&map_size, sizeof(map_size), 1, fp));
-	assert(sz_write == 1);
-
-	for (const_iterator i = begin(); i != end(); ++i) {
-		data_block data;
-		data.set_from_map_iter(i);
-		size_t const nw(fwrite(&data, sizeof(data_block), 1, fp));
-		assert(nw == 1);
-	}
-	checked_fclose(fp);
+	snow_file_header_t header;
+	memcpy(header.magic, SNOW_FILE_MAGIC, 8);
+	header.version    = SNOW_FILE_VERSION;
+	header.block_sz   = sizeof(data_block);
+	header.num_blocks = data.size();
+	UNROLL_3X(header.vox_delta[i_] = vox_delta[i_];)
+	header.sorted     = 1;
+	vector<data_block> blocks(data.size());
+#pragma omp parallel for schedule(static,4096)
+	for (int i = 0; i < (int)data.size(); ++i) {blocks[i] = data_block(data[i]);}
+
+	if (!writer.write(&header, sizeof(header), 1) || (!blocks.empty() && !writer.write(blocks.data(), sizeof(data_block), blocks.size()))) {
+		cerr << "Error writing snow file " << fn << endl;
+		return 0;
+	}
 	return 1;
 }
 
@@ -496,6 +618,7 @@ void create_snow_map(voxel_map &vmap) {
 	vector3d wind_vector(0.25*(zval - zbottom)*wind);
 	wind_vector.z = 0.0; // zval is unused/ignored
 	all_models.build_cobj_trees(1);
+	vector<voxel_hash_map_t> thread_maps(max(1, omp_get_max_threads_3dw())); // per-thread maps avoid synchronization when adding hits
 	cout << "Snow accumulation progress (out of " << num_per_dim << "):     0";
 
 #pragma omp parallel for schedule(dynamic,1)
@@ -539,13 +662,14 @@ void create_snow_map(voxel_map &vmap) {
 				++iter;
 			} // end while
 			if (!invalid) {
-				voxel_t const voxel(pos2);
-#pragma omp critical(snow_map_update)
-				vmap[voxel].update(pos2.z);
+				unsigned const tid(omp_get_thread_num_3dw());
+				assert(tid < thread_maps.size());
+				thread_maps[tid].update(voxel_t(pos2), pos2.z);
 			}
 		} // for x
 	} // for y
 	cout << endl;
+	vmap.create_from_hash_maps(thread_maps);
 }
 
 
@@ -560,7 +684,6 @@ void add_strip(strip_vect_t const &strip, bool is_edge, int xval, int y_start) {
 void create_snow_strips(voxel_map &vmap) {
 
 	// create strips of snow for rendering
-	voxel_map cur_x_map, last_x_map;
 	unsigned const num_xy_voxels(VOXELS_PER_DIV*VOXELS_PER_DIV*XY_MULT_SIZE);
 	float const delta_depth(snow_depth*num_xy_voxels/(1024.0f*1024.0f*num_snowflakes));
 	unsigned n_strips(0), n_edge_strips(0), strip_len(0), edge_strip_len(0);
@@ -571,20 +694,17 @@ void create_snow_strips(voxel_map &vmap) {
 	snow_strips.reserve(8*num_xy_voxels/MAX_STRIP_LEN); // should be more than enough
 
 	while (!vmap.empty()) {
-		pair<voxel_t, zval_avg> start(*vmap.begin());
-		voxel_t v1(start.first);
-		zval_avg zv(start.second);
+		voxel_z_pair const start(vmap.front());
+		voxel_t v1(start.v);
+		zval_avg zv(start.z);
 		assert(zv.valid());
 
-		if (v1.p[0] != last_x) { // we moved on to the next x-value, so update the x maps
+		if (v1.p[0] != last_x) { // we moved on to the next x-value
 			last_x = v1.p[0];
-			last_x_map.clear();
-			cur_x_map.swap(last_x_map);
 			bool const did_ins(x_strip_map.insert(make_pair(last_x, (unsigned)snow_strips.size())).second);
 			assert(did_ins); // map should guarantee strictly increasing x
 		}
-		vmap.erase(vmap.begin());
-		cur_x_map[v1] = zv;
+		vmap.pop_front();
 		vs.resize(0);
 		--v1.p[1];
 		vs.push_back(voxel_z_pair(v1)); // zero start
@@ -593,7 +713,7 @@ void create_snow_strips(voxel_map &vmap) {
 		
 		while (1) { // generate a strip in y with constant x
 			++v1.p[1];
-			zv = vmap.find_adj_z(v1, zv, snow_depth, &cur_x_map);
+			zv = vmap.find_adj_z(v1, zv, snow_depth, 1); // remove=1
 			//if (!zv.valid()) --v1.p[1]; // move back one step
 			vs.push_back(voxel_z_pair(v1, zv));
 			if (!zv.valid()) break; // end of strip
@@ -617,7 +737,7 @@ void create_snow_strips(voxel_map &vmap) {
 				bool const end_element(i == 0 || i+1 == sz);
 				voxel_t v2(vs[i].v);
 				++v2.p[0]; // move to next x row
-				zval_avg z2(vmap.find_adj_z(v2, vs[i].z, snow_depth));
+				zval_avg z2(vmap.find_adj_z(v2, vs[i].z, snow_depth, 0));
 				if (end_element) z2.c = 0; // zero terminate start/end points
 				strip.add(vs[i], delta_depth); // first edge
 				strip.add(voxel_z_pair(v2, z2), delta_depth); // second edge
@@ -626,7 +746,7 @@ void create_snow_strips(voxel_map &vmap) {
 				if ((end_pos - start_pos) <= 3) continue; // too small for edge srtips
 				voxel_t v3(vs[i].v);
 				--v3.p[0]; // move to prev x row
-				zval_avg z3(last_x_map.find_adj_z(v3, vs[i].z, snow_depth));
+				zval_avg z3(vmap.find_adj_z(v3, vs[i].z, snow_depth, 0, 1)); // all of the previous x row has been removed
 				
 				if (!end_element && !z3.valid()) {
 					last_edge = (unsigned)edge_strip.size() + 2;
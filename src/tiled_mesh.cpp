@@ -23,6 +23,7 @@ float const DRAW_DIST_TILES   = 1.5;
 float const CREATE_DIST_TILES = 1.6;
 float const CLEAR_DIST_TILES  = 1.6;
 float const DELETE_DIST_TILES = 1.8;
+float const SYNC_GEN_DIST_TILES= 1.0; // in tile widths; closer tiles are generated on the main thread even when the tile gen pool is enabled
 float const GRASS_LOD_SCALE   = 15.0; // smaller = more grass detail
 float const GRASS_DIST_SLOPE  = 0.25;
 float const GRASS_THRESH      = 1.6;
@@ -51,8 +52,9 @@ hmap_brush_param_t cur_brush_param;
 tile_offset_t model3d_offset;
 
 extern bool inf_terrain_scenery, enable_tiled_mesh_ao, underwater, fog_enabled, volume_lighting, combined_gu, enable_depth_clamp, tt_triplanar_tex, use_grass_tess;
-extern bool use_instanced_pine_trees, enable_tt_model_reflect, water_is_lava, tt_fire_button_down, flashlight_on;
-extern unsigned grass_density, max_unique_trees, shadow_map_sz, num_birds_per_tile, num_fish_per_tile, erosion_iters_tt, num_rnd_grass_blocks;
+extern bool use_instanced_pine_trees, enable_tt_model_reflect, water_is_lava, tt_fire_button_down, flashlight_on, deterministic_erosion, tile_gen_force_cpu_noise;
+extern thread_local bool mesh_gen_force_cpu;
+extern unsigned grass_density, max_unique_trees, shadow_map_sz, num_birds_per_tile, num_fish_per_tile, erosion_iters_tt, num_rnd_grass_blocks, num_tile_gen_threads;
 extern int DISABLE_WATER, display_mode, tree_mode, leaf_color_changed, ground_effects_level, animate2, iticks, num_trees, window_width, window_height;
 extern int invert_mh_image, is_cloudy, camera_surf_collide, show_fog, mesh_gen_mode, mesh_gen_shape, cloud_model, precip_mode, auto_time_adv, draw_model;
 extern float zmax, zmin, water_plane_z, mesh_scale, mesh_scale_z, vegetation, relh_adj_tex, grass_length, grass_width, fticks, cloud_height_offset, clouds_per_tile;
@@ -77,6 +79,7 @@ void setup_detail_normal_map(shader_t &s, float tscale);
 void draw_distant_mesh_bottom(float terrain_zmin);
 bool no_grass_under_buildings();
 bool check_buildings_no_grass(point const &pos);
+void omp_set_num_threads_3dw(int num);
 colorRGBA get_avg_color_for_landscape_tex(unsigned id); // defined later in this file
 
 
@@ -429,9 +432,15 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 	mzmax = -FAR_DISTANCE;
 	unsigned const block_size(zvsize/4), context_sz(stride + 2*AO_RAY_LEN);
 	bool const using_hmap(using_tiled_terrain_hmap_tex()), add_detail(using_hmap_with_detail()); // add procedural detail to heightmap
+	// seamless tiled erosion needs the heights in a border around the tile; heightmaps are eroded during load instead
+	bool const tiled_erosion(deterministic_erosion && erosion_iters_tt > 0 && !using_hmap);
+	unsigned const erosion_margin(tiled_erosion ? get_tiled_erosion_margin() : 0);
+	vector<float> erosion_zvals;
+	float *context_zvals(nullptr);
+	unsigned ctx_sz(0), ctx_off(0);
 
 	// When using AO + GPU noise generation, it's faster to compute the AO + context and clip the zvals from this rather than making two separate compute calls (one without blocking)
-	if (enable_tiled_mesh_ao && !using_hmap && mesh_gen_mode >= MGEN_SIMPLEX_GPU) {
+	if (enable_tiled_mesh_ao && !using_hmap && mesh_gen_mode >= MGEN_SIMPLEX_GPU && !mesh_gen_force_cpu && erosion_margin <= AO_RAY_LEN) {
 		bool results_ready(setup_height_gen(height_gen, get_xval(x1 - AO_RAY_LEN), get_yval(y1 - AO_RAY_LEN), deltax, deltay, context_sz, context_sz, 0, no_wait)); // cache_values=0
 		if (!results_ready) {assert(no_wait); return 0;} // cached heights are not yet ready
 		ao_zvals.resize(context_sz*context_sz);
@@ -440,11 +449,28 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 		for (int y = 0; y < (int)context_sz; ++y) {
 			for (unsigned x = 0; x < context_sz; ++x) {ao_zvals[y*context_sz + x] = height_gen.eval_index(x, y);}
 		}
+		context_zvals = &ao_zvals.front(); ctx_sz = context_sz; ctx_off = AO_RAY_LEN;
+	}
+	else if (tiled_erosion) {
+		ctx_sz = zvsize + 2*erosion_margin; ctx_off = erosion_margin;
+		bool results_ready(setup_height_gen(height_gen, get_xval(x1 - ctx_off), get_yval(y1 - ctx_off), deltax, deltay, ctx_sz, ctx_sz, 0, no_wait)); // cache_values=0
+		if (!results_ready) {assert(no_wait); return 0;} // cached heights are not yet ready
+		erosion_zvals.resize(ctx_sz*ctx_sz);
+
+#pragma omp parallel for schedule(static,1)
+		for (int y = 0; y < (int)ctx_sz; ++y) {
+			for (unsigned x = 0; x < ctx_sz; ++x) {erosion_zvals[y*ctx_sz + x] = height_gen.eval_index(x, y);}
+		}
+		context_zvals = &erosion_zvals.front();
 	}
 	else {
 		bool results_ready(setup_height_gen(height_gen, get_xval(x1), get_yval(y1), deltax, deltay, zvsize, zvsize, 0, no_wait)); // cache_values=0
 		if (!results_ready) {assert(no_wait); return 0;} // cached heights are not yet ready
 	}
+	if (tiled_erosion) { // erode the context, which includes the margin; droplet density matches the per-tile erosion_iters_tt
+		assert(context_zvals != nullptr && ctx_off >= erosion_margin);
+		apply_erosion_tiled(context_zvals, ctx_sz, ctx_sz, (x1 - ctx_off), (y1 - ctx_off), zmin, float(erosion_iters_tt)/float(zvsize*zvsize));
+	}
 	float const xy_mult(1.0/float(size)), wpz_max(get_water_z_height() + ocean_wave_height);
 
 #pragma omp parallel for schedule(static,1)
@@ -457,8 +483,8 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 				if (add_detail) {zval += HMAP_DETAIL_MAG*height_gen.eval_index(x, y);} // less hard-coded - scale by delta between adjacent zvals?
 			}
 			else {
-				if (!ao_zvals.empty()) {zval = ao_zvals[(y + AO_RAY_LEN)*context_sz + (x + AO_RAY_LEN)];} // use AO zvals
-				else                   {zval = height_gen.eval_index(x, y);} // use height gen
+				if (context_zvals) {zval = context_zvals[(y + ctx_off)*ctx_sz + (x + ctx_off)];} // use AO/erosion context zvals
+				else               {zval = height_gen.eval_index(x, y);} // use height gen
 
 				if (USE_PARAMS_HSCALE) {
 					float const xv(float(x)*xy_mult), yv(float(y)*xy_mult);
@@ -467,7 +493,7 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 			}
 		} // for x
 	} // for y
-	if (!using_hmap) {apply_erosion(&zvals.front(), zvsize, zvsize, zmin, erosion_iters_tt);} // heightmap is eroded during load
+	if (!using_hmap && !tiled_erosion) {apply_erosion(&zvals.front(), zvsize, zvsize, zmin, erosion_iters_tt);} // heightmap is eroded during load
 
 	for (unsigned yy = 0; yy < 4; ++yy) {
 		for (unsigned xx = 0; xx < 4; ++xx) {
@@ -500,6 +526,19 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 	return 1; // results are ready
 }
 
+// called by tile gen workers with mesh_gen_force_cpu set; everything here only reads/writes this tile's data;
+// texture weights, trees, scenery, and mesh shadows are left to the main thread because they depend on xoff2/yoff2, adjacent tiles, and GPU state;
+// returns 0 if generation was stopped early because the job was cancelled
+bool tile_t::gen_in_background(mesh_xy_grid_cache_t &height_gen, std::atomic<bool> const &cancelled) {
+
+	create_zvals(height_gen, 0);
+	if (cancelled) return 0;
+	if (enable_tiled_mesh_ao) {calc_mesh_ao_lighting();}
+	if (cancelled) return 0;
+	calc_normal_data();
+	return 1;
+}
+
 void tile_t::get_z_minmax_for_area(point const &pos, float radius, float &zmin, float &zmax) const {
 
 	float const rx1(pos.x - radius), ry1(pos.y - radius), rx2(pos.x + radius), ry2(pos.y + radius);
@@ -618,17 +657,21 @@ void tile_t::calc_mesh_ao_lighting() {
 }
 
 
+void get_adj_tiles_toward_light(tile_xy_pair const &tp, point const &lpos, tile_xy_pair adj_tp[2]) { // these feed shadows into tile tp
+	adj_tp[0] = tile_xy_pair((tp.x + ((lpos.x < 0.0) ? -1 : 1)), tp.y);
+	adj_tp[1] = tile_xy_pair(tp.x, (tp.y + ((lpos.y < 0.0) ? -1 : 1)));
+}
+
 void tile_t::calc_shadows_for_light(unsigned l) {
 
 	if (is_distant) return; // Note: can be made to work, but won't work as-is
 	assert(!smask[l].empty());
-	tile_xy_pair const tp(get_tile_xy_pair());
 
 	// pull from adjacent tiles that already had their shadows calculated
 	float const *sh_in[2] = {0, 0};
 	point const lpos(get_light_pos(l));
-	tile_xy_pair const adj_tp[2] = {tile_xy_pair((tp.x + ((lpos.x < 0.0) ? -1 : 1)), tp.y),
-									tile_xy_pair(tp.x, (tp.y + ((lpos.y < 0.0) ? -1 : 1)))}; // toward the light source
+	tile_xy_pair adj_tp[2]; // toward the light source
+	get_adj_tiles_toward_light(get_tile_xy_pair(), lpos, adj_tp);
 
 	for (unsigned d = 0; d < 2; ++d) { // d = tile adjacency dimension, shared edge is in !d
 		sh_out[l][!d].resize(zvsize, MESH_MIN_Z); // init value really should not be used, but it sometimes is
@@ -648,6 +691,21 @@ void tile_t::calc_shadows_for_light(unsigned l) {
 	((l == LIGHT_SUN) ? sun_shadows_invalid : moon_shadows_invalid) = 1;
 }
 
+// calculates shadows for adjacent tiles that feed into this one and have no outputs yet, so that calc_shadows_for_light() won't recurse;
+// must be called serially before calculating shadows for a group of tiles in parallel
+void tile_t::calc_adj_shadow_inputs(unsigned l) {
+
+	if (is_distant) return;
+	tile_xy_pair adj_tp[2];
+	get_adj_tiles_toward_light(get_tile_xy_pair(), get_light_pos(l), adj_tp);
+
+	for (unsigned d = 0; d < 2; ++d) {
+		tile_t *adj_tile(get_tile_from_xy(adj_tp[d]));
+		if (adj_tile == NULL || adj_tile->is_distant || !adj_tile->sh_out[l][!d].empty()) continue; // no adjacent tile, or already has outputs
+		adj_tile->calc_shadows((l == LIGHT_SUN), (l == LIGHT_MOON), 1);
+	}
+}
+
 
 void tile_t::proc_tile_queue(tile_t *init_tile, unsigned l) {
 
@@ -819,10 +877,10 @@ void create_or_update_texture(unsigned &tid, bool tid_is_valid, unsigned stride,
 	}
 }
 
-void tile_t::upload_normal_texture(bool tid_is_valid) {
+void tile_t::calc_normal_data() {
 
-	//timer_t timer("Create Normal Texture");
-	vector<unsigned char> normal_data(4*stride*stride, 0);
+	//timer_t timer("Calc Normal Data");
+	normal_data.resize(4*stride*stride, 0);
 	min_normal_z = 1.0;
 
 	for (unsigned y = 0; y < stride; ++y) {
@@ -833,7 +891,14 @@ void tile_t::upload_normal_texture(bool tid_is_valid) {
 			UNROLL_3X(normal_data[ix_off+i_] = (unsigned char)(127.0*(norm[i_] + 1.0)););
 		}
 	}
+}
+
+void tile_t::upload_normal_texture(bool tid_is_valid) {
+
+	//timer_t timer("Create Normal Texture");
+	if (normal_data.empty()) {calc_normal_data();} // not precomputed by a tile gen worker
 	create_or_update_texture(normal_tid, tid_is_valid, stride, normal_data);
+	vector<unsigned char>().swap(normal_data); // free the memory; recomputed if the texture is ever recreated
 }
 
 void tile_t::upload_shadow_map_texture(bool tid_is_valid) {
@@ -1006,144 +1071,152 @@ void get_texture_ixs(int &sand_tex_ix, int &dirt_tex_ix, int &grass_tex_ix, int
 }
 
 
-void tile_t::create_texture(mesh_xy_grid_cache_t &height_gen) {
+void tile_t::calc_weight_data(mesh_xy_grid_cache_t &height_gen) {
 
-	//timer_t timer("Create Tile Weights Texture");
+	//timer_t timer("Calc Tile Weights");
 	assert(zvals.size() == zvsize*zvsize);
 	unsigned const tsize(stride), num_texels(tsize*tsize);
 	int sand_tex_ix(-1), dirt_tex_ix(-1), grass_tex_ix(-1), rock_tex_ix(-1), snow_tex_ix(-1);
 	get_texture_ixs(sand_tex_ix, dirt_tex_ix, grass_tex_ix, rock_tex_ix, snow_tex_ix);
-
-	if (weight_tid == 0) { // create weights
-		has_any_grass = has_tunnel = 0;
-		grass_blocks.clear();
-		mesh_weight_data.resize(4*num_texels); // RGBA
-		unsigned const grass_block_dim(get_grass_block_dim());
-		float const xy_mult(1.0/float(size)), water_level(get_water_z_height());
-		float const MESH_NOISE_SCALE = 0.003;
-		float const MESH_NOISE_FREQ  = 80.0;
-		float const dz_inv(1.0f/(zmax - zmin));
-		float const noise_scale(((mesh_gen_shape == 2) ? 2.0 : 1.0)*MESH_NOISE_SCALE*mesh_scale_z); // add more noise for ridged
-		float const steep_mult_grass(1.0f/(sthresh[0][1] - sthresh[0][0]));
-		float const steep_mult_snow (1.0f/(sthresh[1][1] - sthresh[1][0]));
-		float const steep_mult_rock (1.0f/(0.8f*sthresh[0][0] - 0.5f*sthresh[0][0]));
-		float const vnz_scale((mesh_gen_mode == MGEN_DWARP_GPU) ? SQRT2 : 1.0); // allow for steeper slopes when domain warping is used
-		int const llc_x(x1 - xoff2), llc_y(y1 - yoff2);
-		point const query_pos(get_xval(tsize/2 + llc_x), get_yval(tsize/2 + llc_y), 0.0);
-		bool const check_mesh_mask(check_mesh_disable(query_pos, radius)), check_buildings(no_grass_under_buildings());
-		int k1, k2, k3, k4;
-		height_gen.build_arrays(MESH_NOISE_FREQ*get_xval(x1), MESH_NOISE_FREQ*get_yval(y1), MESH_NOISE_FREQ*deltax,
-			MESH_NOISE_FREQ*deltay, tsize, tsize, 0, 1); // force_sine_mode=1
-		vector<float> rand_vals(tsize*tsize);
-		//bool const same_dirt(params[0][1].dirt == params[0][0].dirt && params[1][0].dirt == params[0][0].dirt && params[1][1].dirt == params[0][0].dirt);
-		vector<cube_t> exclude_cubes, allow_cubes;
-		get_city_sphere_coll_cubes(query_pos, radius, 1, 1, exclude_cubes, &allow_cubes);
-		has_tunnel |= tile_contains_tunnel(get_mesh_bcube());
+	has_any_grass = has_tunnel = 0;
+	grass_blocks.clear();
+	mesh_weight_data.resize(4*num_texels); // RGBA
+	unsigned const grass_block_dim(get_grass_block_dim());
+	float const xy_mult(1.0/float(size)), water_level(get_water_z_height());
+	float const MESH_NOISE_SCALE = 0.003;
+	float const MESH_NOISE_FREQ  = 80.0;
+	float const dz_inv(1.0f/(zmax - zmin));
+	float const noise_scale(((mesh_gen_shape == 2) ? 2.0 : 1.0)*MESH_NOISE_SCALE*mesh_scale_z); // add more noise for ridged
+	float const steep_mult_grass(1.0f/(sthresh[0][1] - sthresh[0][0]));
+	float const steep_mult_snow (1.0f/(sthresh[1][1] - sthresh[1][0]));
+	float const steep_mult_rock (1.0f/(0.8f*sthresh[0][0] - 0.5f*sthresh[0][0]));
+	float const vnz_scale((mesh_gen_mode == MGEN_DWARP_GPU) ? SQRT2 : 1.0); // allow for steeper slopes when domain warping is used
+	int const llc_x(x1 - xoff2), llc_y(y1 - yoff2);
+	point const query_pos(get_xval(tsize/2 + llc_x), get_yval(tsize/2 + llc_y), 0.0);
+	bool const check_mesh_mask(check_mesh_disable(query_pos, radius)), check_buildings(no_grass_under_buildings());
+	int k1, k2, k3, k4;
+	height_gen.build_arrays(MESH_NOISE_FREQ*get_xval(x1), MESH_NOISE_FREQ*get_yval(y1), MESH_NOISE_FREQ*deltax,
+		MESH_NOISE_FREQ*deltay, tsize, tsize, 0, 1); // force_sine_mode=1
+	vector<float> rand_vals(tsize*tsize);
+	//bool const same_dirt(params[0][1].dirt == params[0][0].dirt && params[1][0].dirt == params[0][0].dirt && params[1][1].dirt == params[0][0].dirt);
+	vector<cube_t> exclude_cubes, allow_cubes;
+	get_city_sphere_coll_cubes(query_pos, radius, 1, 1, exclude_cubes, &allow_cubes);
+	has_tunnel |= tile_contains_tunnel(get_mesh_bcube());
 
 #pragma omp parallel for schedule(static,1) num_threads(2)
-		for (int y = 0; y < (int)tsize-DEBUG_TILE_BOUNDS; ++y) {
-			for (unsigned x = 0; x < tsize-DEBUG_TILE_BOUNDS; ++x) {
-				rand_vals[y*tsize + x] = noise_scale*height_gen.eval_index(x, y, 50);
-			}
+	for (int y = 0; y < (int)tsize-DEBUG_TILE_BOUNDS; ++y) {
+		for (unsigned x = 0; x < tsize-DEBUG_TILE_BOUNDS; ++x) {
+			rand_vals[y*tsize + x] = noise_scale*height_gen.eval_index(x, y, 50);
 		}
-		for (unsigned y = 0; y < tsize-DEBUG_TILE_BOUNDS; ++y) { // not threadsafe
-			float const yv(float(y)*xy_mult);
+	}
+	for (unsigned y = 0; y < tsize-DEBUG_TILE_BOUNDS; ++y) { // not threadsafe
+		float const yv(float(y)*xy_mult);
 
-			for (unsigned x = 0; x < tsize-DEBUG_TILE_BOUNDS; ++x) {
-				unsigned const ix_val(y*tsize + x), off(4*ix_val);
+		for (unsigned x = 0; x < tsize-DEBUG_TILE_BOUNDS; ++x) {
+			unsigned const ix_val(y*tsize + x), off(4*ix_val);
 
-				if (check_mesh_mask && check_mesh_disable(point(get_xval(x + llc_x)+0.5*DX_VAL, get_yval(y + llc_y)+0.5*DY_VAL, 0.0), HALF_DXY)) {
-					mesh_weight_data[off+0] = mesh_weight_data[off+1] = 255; // set invalid values to flag as transparent
-					mesh_weight_data[off+2] = mesh_weight_data[off+3] = 0;   // make sure grass is disabled
-					has_tunnel = 1; // Note: should be covered by the tile_contains_tunnel(), but we include this case for safety
-					continue;
-				}
-				float weights[NTEX_DIRT] = {0};
-				unsigned const ix(y*zvsize + x);
-				float const mh00(zvals[ix]), mh01(zvals[ix+1]), mh10(zvals[ix+zvsize]), mh11(zvals[ix+zvsize+1]);
-				float const mhmin(min(min(mh00, mh01), min(mh10, mh11))), mhmax(max(max(mh00, mh01), max(mh10, mh11)));
-				float const rand_offset(rand_vals[y*tsize + x]);
-				float const relh1(relh_adj_tex + (mhmin - zmin)*dz_inv + rand_offset);
-				float const relh2(relh_adj_tex + (mhmax - zmin)*dz_inv + rand_offset);
-				get_tids(relh1, k1, k2);
-				get_tids(relh2, k3, k4);
-				bool const same_tid(k1 == k4);
-				float t(0.0);
-				k2 = k4;
-			
-				if (!same_tid) {
-					float const relh(relh_adj_tex + (mh00 - zmin)*dz_inv);
-					get_tids(relh, k1, k2, &t);
-				}
-				float weight_scale(1.0);
-				bool const grass(lttex_dirt[k1].id == GROUND_TEX || lttex_dirt[k2].id == GROUND_TEX), snow(lttex_dirt[k2].id == SNOW_TEX);
-				has_any_grass |= grass;
-
-				if (grass || snow) {
-					float const *const sti(sthresh[snow]);
-					vector3d const normal(get_norm_not_normalized(ix));
-					float vnz(vnz_scale*normal.z/normal.mag());
-					// add random noise here as well to produce dry patches of dirt and sand in the grass
-					if (grass && vnz > sti[1]) {vnz = CLIP_TO_01(1.0f + 20.0f*rand_offset);}
-
-					if (vnz < sti[1]) { // handle steep slopes (dirt/rock texture replaces grass texture)
-						if (grass) { // ground/grass
-							float rock_weight((lttex_dirt[k1].id == GROUND_TEX || lttex_dirt[k2].id == ROCK_TEX) ? t : 0.0);
-							float const steepness(1.0 - CLIP_TO_01((vnz - 0.5f*sti[0])*steep_mult_rock));
-							rock_weight  = rock_weight*(1.0 - steepness) + steepness;
-							weight_scale = CLIP_TO_01((vnz - sti[0])*steep_mult_grass);
-							weights[rock_tex_ix] += (1.0 - weight_scale)*rock_weight;
-							weights[dirt_tex_ix] += (1.0 - weight_scale)*(1.0 - rock_weight);
-						}
-						else { // snow
-							weight_scale = CLIP_TO_01(2.0f*(vnz - sti[0])*steep_mult_snow);
-							weights[rock_tex_ix] += 1.0 - weight_scale;
-						}
+			if (check_mesh_mask && check_mesh_disable(point(get_xval(x + llc_x)+0.5*DX_VAL, get_yval(y + llc_y)+0.5*DY_VAL, 0.0), HALF_DXY)) {
+				mesh_weight_data[off+0] = mesh_weight_data[off+1] = 255; // set invalid values to flag as transparent
+				mesh_weight_data[off+2] = mesh_weight_data[off+3] = 0;   // make sure grass is disabled
+				has_tunnel = 1; // Note: should be covered by the tile_contains_tunnel(), but we include this case for safety
+				continue;
+			}
+			float weights[NTEX_DIRT] = {0};
+			unsigned const ix(y*zvsize + x);
+			float const mh00(zvals[ix]), mh01(zvals[ix+1]), mh10(zvals[ix+zvsize]), mh11(zvals[ix+zvsize+1]);
+			float const mhmin(min(min(mh00, mh01), min(mh10, mh11))), mhmax(max(max(mh00, mh01), max(mh10, mh11)));
+			float const rand_offset(rand_vals[y*tsize + x]);
+			float const relh1(relh_adj_tex + (mhmin - zmin)*dz_inv + rand_offset);
+			float const relh2(relh_adj_tex + (mhmax - zmin)*dz_inv + rand_offset);
+			get_tids(relh1, k1, k2);
+			get_tids(relh2, k3, k4);
+			bool const same_tid(k1 == k4);
+			float t(0.0);
+			k2 = k4;
+		
+			if (!same_tid) {
+				float const relh(relh_adj_tex + (mh00 - zmin)*dz_inv);
+				get_tids(relh, k1, k2, &t);
+			}
+			float weight_scale(1.0);
+			bool const grass(lttex_dirt[k1].id == GROUND_TEX || lttex_dirt[k2].id == GROUND_TEX), snow(lttex_dirt[k2].id == SNOW_TEX);
+			has_any_grass |= grass;
+
+			if (grass || snow) {
+				float const *const sti(sthresh[snow]);
+				vector3d const normal(get_norm_not_normalized(ix));
+				float vnz(vnz_scale*normal.z/normal.mag());
+				// add random noise here as well to produce dry patches of dirt and sand in the grass
+				if (grass && vnz > sti[1]) {vnz = CLIP_TO_01(1.0f + 20.0f*rand_offset);}
+
+				if (vnz < sti[1]) { // handle steep slopes (dirt/rock texture replaces grass texture)
+					if (grass) { // ground/grass
+						float rock_weight((lttex_dirt[k1].id == GROUND_TEX || lttex_dirt[k2].id == ROCK_TEX) ? t : 0.0);
+						float const steepness(1.0 - CLIP_TO_01((vnz - 0.5f*sti[0])*steep_mult_rock));
+						rock_weight  = rock_weight*(1.0 - steepness) + steepness;
+						weight_scale = CLIP_TO_01((vnz - sti[0])*steep_mult_grass);
+						weights[rock_tex_ix] += (1.0 - weight_scale)*rock_weight;
+						weights[dirt_tex_ix] += (1.0 - weight_scale)*(1.0 - rock_weight);
+					}
+					else { // snow
+						weight_scale = CLIP_TO_01(2.0f*(vnz - sti[0])*steep_mult_snow);
+						weights[rock_tex_ix] += 1.0 - weight_scale;
 					}
 				}
-				weights[k2] += weight_scale*t;
-				weights[k1] += weight_scale*(1.0 - t);
-				float const xv(float(x)*xy_mult);
+			}
+			weights[k2] += weight_scale*t;
+			weights[k1] += weight_scale*(1.0 - t);
+			float const xv(float(x)*xy_mult);
 
-				// convert dirt to sand only when there is vegetation; even though it doesn't make sense to have dirt when there's no vegetation, it adds more texture variety
-				if (vegetation > 0.0) {
-					float const dirt_scale(BILINEAR_INTERP(params, dirt, xv, yv)); // slow
+			// convert dirt to sand only when there is vegetation; even though it doesn't make sense to have dirt when there's no vegetation, it adds more texture variety
+			if (vegetation > 0.0) {
+				float const dirt_scale(BILINEAR_INTERP(params, dirt, xv, yv)); // slow
 
-					if (dirt_scale < 1.0) { // apply dirt scale: convert dirt to sand
-						weights[sand_tex_ix] += (1.0 - dirt_scale)*weights[dirt_tex_ix];
-						weights[dirt_tex_ix] *= dirt_scale;
-					}
+				if (dirt_scale < 1.0) { // apply dirt scale: convert dirt to sand
+					weights[sand_tex_ix] += (1.0 - dirt_scale)*weights[dirt_tex_ix];
+					weights[dirt_tex_ix] *= dirt_scale;
 				}
-				if (grass) {
-					float grass_scale((mhmin < water_level) ? 0.0f : BILINEAR_INTERP(params, grass, xv, yv)); // no grass under water
-					bool replace_grass_with_dirt(0);
+			}
+			if (grass) {
+				float grass_scale((mhmin < water_level) ? 0.0f : BILINEAR_INTERP(params, grass, xv, yv)); // no grass under water
+				bool replace_grass_with_dirt(0);
 
-					if (grass_scale > 0.0 && !exclude_cubes.empty()) { // exclude bridges and tunnels here
-						point const test_pt(get_xval(x + llc_x + xoff)+0.5*DX_VAL, get_yval(y + llc_y + yoff)+0.5*DY_VAL, 0.0);
-						replace_grass_with_dirt = (check_bcubes_sphere_coll(exclude_cubes, test_pt, HALF_DXY, 1) && !check_bcubes_sphere_coll(allow_cubes, test_pt, HALF_DXY, 1));
-					}
-					if (!replace_grass_with_dirt && check_buildings && grass_scale > 0.0 && mh01 == mh00 && mh10 == mh00 && mh11 == mh00) { // look for area flattened under a building
-						point const test_pt(get_xval(x + llc_x + xoff)+0.5*DX_VAL, get_yval(y + llc_y + yoff)+0.5*DY_VAL, mh00);
-						replace_grass_with_dirt = check_buildings_no_grass(test_pt); // xy_only 1.61 => 1.76
-					}
-					if (replace_grass_with_dirt) {
-						weights[dirt_tex_ix] += weights[grass_tex_ix]; // replace grass with dirt
-						weights[grass_tex_ix] = 0.0;
-						grass_scale = 0.0;
-					}
-					else if (grass_scale < 1.0) { // apply grass scale: convert grass to sand
-						float const gscale(CLIP_TO_01(2.5f*(grass_scale - 0.5f) + 0.5f));
-						weights[sand_tex_ix ] += (1.0 - gscale)*weights[grass_tex_ix];
-						weights[grass_tex_ix] *= gscale;
-					}
-					if (grass_scale > 0.0) {add_grass_block_at(x, y, mhmin, mhmax, grass_block_dim);}
-				} // end grass
-				for (unsigned i = 0; i < NTEX_DIRT-1; ++i) { // Note: weights should sum to 1.0, so we can calculate w4 as 1.0-w0-w1-w2-w3
-					mesh_weight_data[off+i] = ((weights[i] <= 0.01) ? 0 : ((weights[i] >= 0.99) ? 255 : (unsigned char)(255.0*weights[i])));
+				if (grass_scale > 0.0 && !exclude_cubes.empty()) { // exclude bridges and tunnels here
+					point const test_pt(get_xval(x + llc_x + xoff)+0.5*DX_VAL, get_yval(y + llc_y + yoff)+0.5*DY_VAL, 0.0);
+					replace_grass_with_dirt = (check_bcubes_sphere_coll(exclude_cubes, test_pt, HALF_DXY, 1) && !check_bcubes_sphere_coll(allow_cubes, test_pt, HALF_DXY, 1));
 				}
-			} // for x
-		} // for y
-	}
+				if (!replace_grass_with_dirt && check_buildings && grass_scale > 0.0 && mh01 == mh00 && mh10 == mh00 && mh11 == mh00) { // look for area flattened under a building
+					point const test_pt(get_xval(x + llc_x + xoff)+0.5*DX_VAL, get_yval(y + llc_y + yoff)+0.5*DY_VAL, mh00);
+					replace_grass_with_dirt = check_buildings_no_grass(test_pt); // xy_only 1.61 => 1.76
+				}
+				if (replace_grass_with_dirt) {
+					weights[dirt_tex_ix] += weights[grass_tex_ix]; // replace grass with dirt
+					weights[grass_tex_ix] = 0.0;
+					grass_scale = 0.0;
+				}
+				else if (grass_scale < 1.0) { // apply grass scale: convert grass to sand
+					float const gscale(CLIP_TO_01(2.5f*(grass_scale - 0.5f) + 0.5f));
+					weights[sand_tex_ix ] += (1.0 - gscale)*weights[grass_tex_ix];
+					weights[grass_tex_ix] *= gscale;
+				}
+				if (grass_scale > 0.0) {add_grass_block_at(x, y, mhmin, mhmax, grass_block_dim);}
+			} // end grass
+			for (unsigned i = 0; i < NTEX_DIRT-1; ++i) { // Note: weights should sum to 1.0, so we can calculate w4 as 1.0-w0-w1-w2-w3
+				mesh_weight_data[off+i] = ((weights[i] <= 0.01) ? 0 : ((weights[i] >= 0.99) ? 255 : (unsigned char)(255.0*weights[i])));
+			}
+		} // for x
+	} // for y
+}
+
+void tile_t::create_texture(mesh_xy_grid_cache_t &height_gen) {
+
+	//timer_t timer("Create Tile Weights Texture");
+	assert(zvals.size() == zvsize*zvsize);
+	unsigned const num_texels(stride*stride);
+	int sand_tex_ix(-1), dirt_tex_ix(-1), grass_tex_ix(-1), rock_tex_ix(-1), snow_tex_ix(-1);
+	get_texture_ixs(sand_tex_ix, dirt_tex_ix, grass_tex_ix, rock_tex_ix, snow_tex_ix);
+
+	if (weight_tid == 0) {calc_weight_data(height_gen);} // create weights
 	else { // use existing weights
 		assert(recalc_tree_grass_weights); // can only get here in this case
 		assert(mesh_weight_data.size() == 4*num_texels);
@@ -2065,6 +2138,136 @@ void lightning_strike_t::end_draw() const {
 }
 
 
+// *** tile_gen_pool_t ***
+
+
+void tile_gen_pool_t::start(unsigned num_threads) {
+
+	if (!threads.empty() || num_threads == 0) return; // already started, or disabled
+	exiting = 0;
+	for (unsigned i = 0; i < num_threads; ++i) {threads.emplace_back(&tile_gen_pool_t::worker_loop, this);}
+}
+
+void tile_gen_pool_t::stop() {
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		exiting = 1;
+		for (job_t &job : jobs) {job.cancelled = 1;}
+	}
+	work_cv.notify_all();
+	for (std::thread &t : threads) {t.join();}
+	threads.clear();
+	for (job_t &job : jobs) {delete job.tile;}
+	jobs.clear();
+	in_pool.clear();
+}
+
+void tile_gen_pool_t::clear() { // cancel all jobs and wait for running jobs to exit; threads are kept
+
+	std::unique_lock<std::mutex> lock(mutex);
+	for (job_t &job : jobs) {job.cancelled = 1;}
+	done_cv.wait(lock, [this] {for (job_t const &job : jobs) {if (job.running) return 0;} return 1;});
+	for (job_t &job : jobs) {delete job.tile;}
+	jobs.clear();
+	in_pool.clear();
+}
+
+tile_gen_pool_t::job_t *tile_gen_pool_t::find_job(tile_xy_pair const &txy) { // mutex must be held
+	for (job_t &job : jobs) {if (job.tile->get_tile_xy_pair() == txy) return &job;}
+	return nullptr;
+}
+
+tile_gen_pool_t::job_t *tile_gen_pool_t::get_next_pending() { // mutex must be held; returns the pending job with the lowest priority value
+	job_t *next(nullptr);
+
+	for (job_t &job : jobs) {
+		if (job.running || job.done || job.cancelled) continue;
+		if (next == nullptr || job.priority < next->priority) {next = &job;}
+	}
+	return next;
+}
+
+void tile_gen_pool_t::worker_loop() {
+
+	omp_set_num_threads_3dw(1); // parallelism comes from generating several tiles at once; don't oversubscribe the cores used by the main thread
+	mesh_gen_force_cpu = 1; // thread_local; the pool is only used with GPU noise modes if tile_gen_force_cpu_noise is set, in which case all tiles use CPU noise
+	mesh_xy_grid_cache_t height_gen; // reused across tiles
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (1) {
+		job_t *job(nullptr);
+		work_cv.wait(lock, [&] {return (exiting || (job = get_next_pending()) != nullptr);});
+		if (exiting) break;
+		job->running = 1;
+		lock.unlock();
+		bool const complete(job->tile->gen_in_background(height_gen, job->cancelled));
+		lock.lock();
+		job->running = 0;
+		job->done    = complete; // if stopped early and then kept again, the job is pending and will be restarted
+		done_cv.notify_all();
+	}
+}
+
+void tile_gen_pool_t::begin_update() { // mark all jobs as unwanted; tiles still in range are marked as wanted again with keep()
+	std::lock_guard<std::mutex> lock(mutex);
+	for (job_t &job : jobs) {job.wanted = 0;}
+}
+
+void tile_gen_pool_t::add(tile_t *tile, float priority) {
+
+	assert(tile != nullptr);
+	bool const did_ins(in_pool.insert(tile->get_tile_xy_pair()).second);
+	assert(did_ins);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.emplace_back(tile, priority);
+	}
+	work_cv.notify_one();
+}
+
+void tile_gen_pool_t::keep(tile_xy_pair const &txy, float priority) {
+
+	std::lock_guard<std::mutex> lock(mutex);
+	job_t *const job(find_job(txy));
+	assert(job != nullptr);
+	job->wanted    = 1;
+	job->priority  = priority; // the camera may have moved
+	job->cancelled = 0; // cancelled by end_update() but still running; if the worker already stopped early, the job will be rerun
+}
+
+// removes the job for this tile from the pool; returns the tile, with is_done set if it was generated, or unset if it was never started
+tile_t *tile_gen_pool_t::wait_for(tile_xy_pair const &txy, bool &is_done) {
+
+	std::unique_lock<std::mutex> lock(mutex);
+	job_t *const job(find_job(txy));
+	assert(job != nullptr);
+	job->cancelled = 0; // in case it was cancelled while running and the tile came back into range
+	if (job->running) {done_cv.wait(lock, [job] {return !job->running;});} // done is unset if the worker stopped early
+	is_done = job->done;
+	tile_t *const tile(job->tile);
+
+	for (auto i = jobs.begin(); i != jobs.end(); ++i) {
+		if (&(*i) == job) {jobs.erase(i); break;}
+	}
+	in_pool.erase(txy);
+	return tile;
+}
+
+void tile_gen_pool_t::end_update(vector<tile_t *> &done_tiles) { // cancel unwanted jobs and return finished tiles
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (auto i = jobs.begin(); i != jobs.end(); ) { // Note: no ++i
+		if (!i->wanted) {i->cancelled = 1;} // tile has left the create range
+		if (i->running || !(i->done || i->cancelled)) {++i; continue;} // still in progress
+		in_pool.erase(i->tile->get_tile_xy_pair());
+		if (i->cancelled) {delete i->tile;} else {done_tiles.push_back(i->tile);}
+		i = jobs.erase(i);
+	}
+}
+
+
 // *** tile_draw_t ***
 
 
@@ -2078,7 +2281,8 @@ void tile_draw_t::clear(bool no_regen_buildings) {
 	for (tile_map::iterator i = tiles.begin(); i != tiles.end(); ++i) {i->second->clear();} // may not be necessary
 	to_draw.clear();
 	tiles.clear();
-	shadow_recomp_queue.clear();
+	shadow_scheduler.clear();
+	gen_pool.clear();
 	if (!no_regen_buildings && !have_cities()) {buildings_valid = 0;} // can't regenerate buildings after cities and cars have been placed
 }
 
@@ -2142,25 +2346,48 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 			++num_erased;
 		} else {++i;}
 	}
+	// background tile generation reads the heightmap, so it's disabled when buildings flatten it first or when the user is editing it
+	// GPU noise tiles are generated on the main thread unless tile_gen_force_cpu_noise is set, since background tiles must use CPU noise and tile edges must match
+	bool const force_cpu_gen(num_tile_gen_threads > 0 && tile_gen_force_cpu_noise), gpu_mode(mesh_gen_mode >= MGEN_SIMPLEX_GPU && !force_cpu_gen);
+	bool const use_gen_pool(num_tile_gen_threads > 0 && !gpu_mode && !create_buildings_first && inf_terrain_fire_mode == FM_NONE);
+	vector<tile_t *> pool_done_tiles;
+	if (use_gen_pool) {gen_pool.start(num_tile_gen_threads);}
+	gen_pool.begin_update();
+
 	for (int y = y1; y <= y2; ++y ) { // create new tiles
 		for (int x = x1; x <= x2; ++x ) {
 			tile_xy_pair const txy(x, y);
 			if (tiles.find(txy) != tiles.end()) continue; // already exists
 			tile_t tile(get_tile_size(), x, y);
 			if (tile.get_rel_dist_to_camera() >= CREATE_DIST_TILES) continue; // too far away to create
-			tile_t *new_tile(new tile_t(tile));
-			to_gen_zvals.push_back(make_pair(new_tile->get_draw_priority(), new_tile));
+			float const priority(tile.get_draw_priority());
+
+			if (use_gen_pool && tile.get_dist_to_camera_in_tiles() >= SYNC_GEN_DIST_TILES) { // generate in the background
+				if (gen_pool.contains(txy)) {gen_pool.keep(txy, priority);}
+				else {gen_pool.add(new tile_t(tile), priority);}
+				continue;
+			}
+			tile_t *new_tile(nullptr);
+
+			if (gen_pool.contains(txy)) { // needed now: wait for the background job, or take it over if it hasn't started
+				bool is_done(0);
+				new_tile = gen_pool.wait_for(txy, is_done);
+				if (is_done) {pool_done_tiles.push_back(new_tile); continue;}
+			}
+			else {new_tile = new tile_t(tile);}
+			to_gen_zvals.push_back(make_pair(priority, new_tile));
 			// in this mode, we need to place buildings and flatten the heightmap before calculating tile heights
 			if (create_buildings_first) {create_buildings_tile(x, y, 1);}
 		} // for x
 	} // for y
+	gen_pool.end_update(pool_done_tiles); // cancels jobs for tiles that are no longer in range
+	for (auto i = pool_done_tiles.begin(); i != pool_done_tiles.end(); ++i) {insert_tile(*i);} // only GPU uploads remain, done in pre_draw()
 	//if (to_gen_zvals.size() < max_cpu_tiles) {to_gen_zvals.clear();} // block until at least max_cpu_tiles tiles to generate (lower average gen time, but causes more slow frames/lag)
 	unsigned const num_to_gen(to_gen_zvals.size());
-	unsigned gen_this_frame(min(num_to_gen, max_tile_gen_per_frame));
-	bool const gpu_mode(mesh_gen_mode >= MGEN_SIMPLEX_GPU);
+	unsigned gen_this_frame(use_gen_pool ? num_to_gen : min(num_to_gen, max_tile_gen_per_frame)); // with the pool, only the few tiles near the camera are generated here
 	
 	// to balance tile gen time across frames, generate a number of tiles equal to the average of this frame and the previous frame
-	if (gen_this_frame > 1 && gen_this_frame < max_tile_gen_per_frame && inf_terrain_fire_mode == FM_NONE) { // disable this mode when editing mesh height to prevent visual artifacts
+	if (!use_gen_pool && gen_this_frame > 1 && gen_this_frame < max_tile_gen_per_frame && inf_terrain_fire_mode == FM_NONE) { // disable this mode when editing mesh height to prevent visual artifacts
 		gen_this_frame = min(gen_this_frame, (gen_this_frame + tiles_gen_prev_frame + 1)/2); // round up
 	}
 	tiles_gen_prev_frame = num_to_gen;
@@ -2179,9 +2406,9 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 		to_gen_zvals.resize(tgz_pos);
 	}
 	else {
-		// if there are fewer than 4 tiles to generate, use CPU simplex rather than GPU simplex to avoid stalling/flusing the graphics pipeline
-		int const prev_mesh_gen_mode(mesh_gen_mode);
-		if (gpu_mode && gen_this_frame <= max_cpu_tiles) {mesh_gen_mode = MGEN_SIMPLEX;} // GPU simplex => CPU simplex
+		// if there are fewer than 4 tiles to generate, use CPU simplex rather than GPU simplex to avoid stalling/flusing the graphics pipeline;
+		// the CPU kernel supports domain warping, so the results match the GPU tiles
+		if (force_cpu_gen || (gpu_mode && gen_this_frame <= max_cpu_tiles)) {mesh_gen_force_cpu = 1;} // GPU simplex => CPU simplex
 		if (gen_this_frame < num_to_gen) {sort(to_gen_zvals.begin(), to_gen_zvals.end());} // sort by priority if not all generated
 		//ostringstream oss; oss << "Gen " << gen_this_frame << " tiles"; timer_t timer(oss.str());
 
@@ -2192,7 +2419,7 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 			insert_tile(tile);
 		}
 		to_gen_zvals.clear();
-		mesh_gen_mode = prev_mesh_gen_mode;
+		mesh_gen_force_cpu = 0;
 	}
 	for (tile_map::iterator i = tiles.begin(); i != tiles.end(); ++i) { // calculate terrain_zmin and updated building tiles
 		float const rel_dist(i->second->get_rel_dist_to_camera());
@@ -2215,12 +2442,13 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 	sun_change  &= (dot_product(sun_pos.get_norm(),  last_sun.get_norm())  < toler);
 	moon_change &= (dot_product(moon_pos.get_norm(), last_moon.get_norm()) < toler);
 
-	if (mesh_shadows_enabled() && (sun_change || moon_change) && shadow_recomp_queue.empty()) { // light source change
+	shadow_scheduler.update_budget();
+
+	if (mesh_shadows_enabled() && (sun_change || moon_change) && shadow_scheduler.empty()) { // light source change
 		if (auto_time_adv && !moon_change) { // auto time advance shadow map update for sun change only - triger a shadow recompute
-			for (auto i = tiles.begin(); i != tiles.end(); ++i) { // triger a shadow recompute
-				shadow_recomp_queue.emplace_back(-p2p_dist(sun_pos, i->second->get_center()), i->second->get_tile_xy_pair());
-			}
-			sort(shadow_recomp_queue.begin(), shadow_recomp_queue.end()); // sort by decreasing distance to light source
+			vector<tile_xy_pair> tps;
+			for (auto i = tiles.begin(); i != tiles.end(); ++i) {tps.push_back(i->first);}
+			shadow_scheduler.build(tps, get_light_pos(LIGHT_SUN));
 		}
 		else { // invalidate and recompute all shadows on moon change (infrequent) or user sun pos change
 			for (tile_map::iterator i = tiles.begin(); i != tiles.end(); ++i) {i->second->clear_shadows(sun_change, moon_change);}
@@ -2228,18 +2456,7 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 		last_sun  = sun_pos;
 		last_moon = moon_pos;
 	}
-	unsigned num_shadow_updates = 12; // hard max per frame
-
-	while (!shadow_recomp_queue.empty() && num_shadow_updates > 0) { // perform some queued shadow map updates, starting at light source
-		tile_xy_pair const tp(shadow_recomp_queue.back().second);
-		shadow_recomp_queue.pop_back();
-		tile_map::const_iterator it(tiles.find(tp));
-		if (it == tiles.end()) continue; // tile no longer exists/was deleted
-		// recompute shadows; tiles feeding in (closer to the light) should have already been calculated
-		it->second->clear_shadows(1, 0); // update sun shadows only
-		it->second->check_shadow_map_and_normal_texture(1); // no_push=1
-		--num_shadow_updates;
-	}
+	process_shadow_updates();
 	// Note: we could regen trees and scenery if water was just turned on to remove underwater vegetation
 	//if ((GET_TIME_MS() - timer1) > 100) {PRINT_TIME("Tiled Terrain Update");}
 	return terrain_zmin;
@@ -2248,6 +2465,74 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 float tile_draw_t::get_actual_zmin() const {return min(zmin, terrain_zmin);}
 
 
+void tile_shadow_scheduler_t::build(vector<tile_xy_pair> const &tps, point const &lpos) {
+
+	clear();
+	if (tps.empty()) return;
+	dir_x = ((lpos.x < 0.0) ? -1 : 1);
+	dir_y = ((lpos.y < 0.0) ? -1 : 1);
+	// a tile depends on its neighbors at +dir_x and +dir_y, which have a rank one higher; higher rank = closer to the light
+	int rmin(0), rmax(0);
+
+	for (auto i = tps.begin(); i != tps.end(); ++i) {
+		int const rank(dir_x*i->x + dir_y*i->y);
+		if (i == tps.begin()) {rmin = rmax = rank;} else {min_eq(rmin, rank); max_eq(rmax, rank);}
+	}
+	wavefronts.resize(rmax - rmin + 1);
+	for (auto i = tps.begin(); i != tps.end(); ++i) {wavefronts[rmax - (dir_x*i->x + dir_y*i->y)].push_back(*i);}
+}
+
+bool tile_shadow_scheduler_t::light_dir_changed(point const &lpos) const {
+	return (((lpos.x < 0.0) ? -1 : 1) != dir_x || ((lpos.y < 0.0) ? -1 : 1) != dir_y);
+}
+
+void tile_shadow_scheduler_t::rebuild_remaining(point const &lpos) { // the light crossed an axis, so the dependencies have changed
+
+	vector<tile_xy_pair> tps;
+	for (unsigned i = next_wavefront; i < wavefronts.size(); ++i) {vector_add_to(wavefronts[i], tps);}
+	build(tps, lpos);
+}
+
+void tile_shadow_scheduler_t::update_budget() { // called once per frame
+
+	float const target_frame_ms = 1000.0/60.0, min_budget_ms = 1.0, max_budget_ms = 8.0;
+	int const cur_time(GET_TIME_MS());
+
+	if (last_frame_time > 0 && !empty()) { // grow the budget slowly while there's headroom and back off quickly when frames are slow
+		float const frame_ms(cur_time - last_frame_time);
+		if (frame_ms > target_frame_ms) {budget_ms = max(min_budget_ms, 0.75f*budget_ms);}
+		else {budget_ms = min(max_budget_ms, (budget_ms + 0.5f));}
+	}
+	last_frame_time = cur_time;
+}
+
+void tile_draw_t::process_shadow_updates() { // perform some scheduled shadow updates, one wavefront at a time starting at the light source
+
+	if (shadow_scheduler.empty()) return;
+	point const lpos(get_light_pos(LIGHT_SUN));
+	if (shadow_scheduler.light_dir_changed(lpos)) {shadow_scheduler.rebuild_remaining(lpos);}
+	int const start_time(GET_TIME_MS());
+	vector<tile_t *> wf_tiles;
+
+	do {
+		vector<tile_xy_pair> const &wavefront(shadow_scheduler.wavefronts[shadow_scheduler.next_wavefront++]);
+		wf_tiles.clear();
+
+		for (auto i = wavefront.begin(); i != wavefront.end(); ++i) {
+			tile_map::const_iterator it(tiles.find(*i));
+			if (it != tiles.end()) {wf_tiles.push_back(it->second.get());} // skip tiles that were deleted
+		}
+		for (auto i = wf_tiles.begin(); i != wf_tiles.end(); ++i) {(*i)->clear_shadows(1, 0);} // update sun shadows only
+		// tiles feeding in (closer to the light) were calculated in an earlier wavefront; this fills in any that are not part of this update
+		for (auto i = wf_tiles.begin(); i != wf_tiles.end(); ++i) {(*i)->calc_adj_shadow_inputs(LIGHT_SUN);}
+
+#pragma omp parallel for schedule(dynamic,1) if (wf_tiles.size() > 1)
+		for (int i = 0; i < (int)wf_tiles.size(); ++i) {wf_tiles[i]->calc_shadows(1, 0, 1);} // no_push=1
+		for (auto i = wf_tiles.begin(); i != wf_tiles.end(); ++i) {(*i)->check_shadow_map_and_normal_texture(1);} // GPU upload; no_push=1
+	} while (!shadow_scheduler.empty() && (GET_TIME_MS() - start_time) < shadow_scheduler.budget_ms);
+}
+
+
 float const mesh_tex_cscale [NTEX_DIRT] = {1.0, 1.0, TT_GRASS_COLOR_SCALE, 0.5, 1.0}; // darker grass and rock
 float const mesh_tex_scale  [NTEX_DIRT] = {1.0, 1.0, 4.0, 1.0,  1.0};
 int const normal_tids_dirt  [NTEX_DIRT] = {ROCK2_NORMAL_TEX, ROCK3_NORMAL_TEX, /*DIRT_NORMAL_TEX*/ROCK3_NORMAL_TEX, ROCK1_NORMAL_TEX, ROCK_NORMAL_TEX};
@@ -13,6 +13,11 @@
 #include "tree_3dw.h"
 #include "shadow_map.h"
 #include "animals.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <list>
 
 
 bool const ENABLE_TREE_LOD    = 1; // faster but has popping artifacts
@@ -102,6 +107,7 @@ struct tile_xy_pair {
 	int x, y;
 	tile_xy_pair(int x_=0, int y_=0) : x(x_), y(y_) {}
 	bool operator<(tile_xy_pair const &t) const {return ((y == t.y) ? (x < t.x) : (y < t.y));}
+	bool operator==(tile_xy_pair const &t) const {return (x == t.x && y == t.y);}
 	void operator+=(tile_xy_pair const &tp) {x += tp.x; y += tp.y;}
 	void operator-=(tile_xy_pair const &tp) {x -= tp.x; y -= tp.y;}
 	tile_xy_pair operator+(tile_xy_pair const &tp) const {return tile_xy_pair(x+tp.x, y+tp.y);}
@@ -173,7 +179,7 @@ private:
 	float sub_zmin[4][4] = {0}, sub_zmax[4][4] = {0};
 	vector<float> zvals, ao_zvals;
 	vector<tree_map_val> tree_map;
-	vector<unsigned char> mesh_weight_data, weight_data, ao_lighting;
+	vector<unsigned char> mesh_weight_data, weight_data, ao_lighting, normal_data; // normal_data is only kept between a tile gen worker and the upload
 	vector<unsigned char> smask[NUM_LIGHT_SRC];
 	vector<float> sh_out[NUM_LIGHT_SRC][2];
 	vect_smap_t<tile_smap_data_t> smap_data;
@@ -282,6 +288,7 @@ public:
 	void clear_vbo_tid(tile_shadow_map_manager *smap_manager);
 	void clear_pine_tree_vbos() {pine_trees.clear_vbos();}
 	bool create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait);
+	bool gen_in_background(mesh_xy_grid_cache_t &height_gen, std::atomic<bool> const &cancelled);
 	void get_z_minmax_for_area(point const &pos, float radius, float &zmin, float &zmax) const;
 	float get_zval_at(float x, float y, bool in_global_space) const;
 
@@ -294,6 +301,7 @@ public:
 	// *** shadows ***
 	void calc_mesh_ao_lighting();
 	void calc_shadows_for_light(unsigned l);
+	void calc_adj_shadow_inputs(unsigned l);
 	static void proc_tile_queue(tile_t *init_tile, unsigned l);
 	void calc_shadows(bool calc_sun, bool calc_moon, bool no_push=0);
 
@@ -314,6 +322,7 @@ public:
 	void apply_ao_shadows_for_trees(tile_t const *const tile, bool no_adj_test);
 	void apply_tree_ao_shadows();
 	void check_shadow_map_and_normal_texture(bool no_push=0);
+	void calc_normal_data();
 	void upload_normal_texture(bool tid_is_valid);
 	void upload_shadow_map_texture(bool tid_is_valid);
 	void setup_shadow_maps(tile_shadow_map_manager &smap_manager, bool cleanup_only);
@@ -323,6 +332,7 @@ public:
 	// *** mesh creation ***
 	void ensure_height_tid();
 	unsigned get_grass_block_dim() const {return (1+(size-1)/GRASS_BLOCK_SZ);} // ceil
+	void calc_weight_data(mesh_xy_grid_cache_t &height_gen);
 	void create_texture(mesh_xy_grid_cache_t &height_gen);
 	void add_grass_block_at(unsigned x, unsigned y, float mhmin, float mhmax, unsigned grass_block_dim);
 	void create_or_update_weight_tex();
@@ -407,6 +417,62 @@ public:
 }; // tile_t
 
 
+// persistent background threads that generate tile heights, AO, and normals; the main thread computes texture weights, inserts finished tiles, and uploads to the GPU
+class tile_gen_pool_t {
+
+	struct job_t {
+		tile_t *tile;
+		float priority;
+		bool running, done, wanted;
+		std::atomic<bool> cancelled; // read by the worker between stages without holding the lock
+		job_t(tile_t *tile_, float priority_) : tile(tile_), priority(priority_), running(0), done(0), wanted(1), cancelled(0) {}
+	};
+	std::list<job_t> jobs; // only the main thread adds and removes jobs; workers change job state under the lock
+	set<tile_xy_pair> in_pool; // main thread only
+	vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable work_cv, done_cv;
+	bool exiting;
+
+	void worker_loop();
+	job_t *find_job(tile_xy_pair const &txy);
+	job_t *get_next_pending();
+public:
+	tile_gen_pool_t() : exiting(0) {}
+	~tile_gen_pool_t() {stop();}
+	void start(unsigned num_threads);
+	void stop();
+	void clear();
+	bool empty() const {return in_pool.empty();}
+	bool contains(tile_xy_pair const &txy) const {return (in_pool.find(txy) != in_pool.end());}
+	void begin_update();
+	void add(tile_t *tile, float priority);
+	void keep(tile_xy_pair const &txy, float priority);
+	tile_t *wait_for(tile_xy_pair const &txy, bool &is_done);
+	void end_update(vector<tile_t *> &done_tiles);
+}; // tile_gen_pool_t
+
+
+// tiles whose sun shadows are recomputed after the sun moves, grouped into wavefronts along the shadow propagation direction;
+// each tile only depends on tiles in the previous wavefront, so the tiles of a wavefront can be computed in parallel
+struct tile_shadow_scheduler_t {
+
+	vector<vector<tile_xy_pair>> wavefronts; // in processing order, closest to the light first
+	unsigned next_wavefront;
+	int dir_x, dir_y; // direction toward the light used to build the wavefronts
+	int last_frame_time;
+	float budget_ms; // per-frame time budget, adapted to the measured frame time
+
+	tile_shadow_scheduler_t() : next_wavefront(0), dir_x(0), dir_y(0), last_frame_time(0), budget_ms(4.0) {}
+	bool empty() const {return (next_wavefront >= wavefronts.size());}
+	void clear() {wavefronts.clear(); next_wavefront = 0;}
+	void build(vector<tile_xy_pair> const &tps, point const &lpos);
+	bool light_dir_changed(point const &lpos) const;
+	void rebuild_remaining(point const &lpos);
+	void update_budget();
+}; // tile_shadow_scheduler_t
+
+
 class tile_draw_t : public indexed_vbo_manager_t {
 
 	typedef map<tile_xy_pair, std::unique_ptr<tile_t> > tile_map;
@@ -428,7 +494,8 @@ class tile_draw_t : public indexed_vbo_manager_t {
 	tree_lod_render_t lod_renderer;
 	crack_ibuf_t crack_ibuf;
 	tile_shadow_map_manager smap_manager;
-	vector<pair<float, tile_xy_pair>> shadow_recomp_queue;
+	tile_shadow_scheduler_t shadow_scheduler;
+	tile_gen_pool_t gen_pool;
 
 	struct occluder_pts_t {
 		point cube_pts[4];
@@ -437,6 +504,7 @@ class tile_draw_t : public indexed_vbo_manager_t {
 	vector<tile_t *> occluders; // reused across draw calls
 	vector<cube_t> test_cubes; // reused across draw calls
 	void insert_tile(tile_t *tile);
+	void process_shadow_updates();
 
 public:
 	tile_draw_t();
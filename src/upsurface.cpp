@@ -6,12 +6,19 @@
 #include "universe.h"
 #include "sinf.h"
 #include "textures.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 
 float const M_ATTEN_FACTOR = 0.5;
 float const F_ATTEN_FACTOR = 0.4;
 
 extern int display_mode;
+extern unsigned num_planet_gen_threads, planet_surface_cache_mb;
+extern string planet_surface_cache_dir;
+
+void omp_set_num_threads_3dw(int num);
 
 
 void noise_gen_3d::gen_sines(float mag, float freq) {
@@ -162,6 +169,17 @@ float upsurface::get_height_at(point const &pt, bool use_cache) const {
 }
 
 
+void upsurface::get_heights_at(point const *pts, float *heights, unsigned num) const { // batched version of get_height_at() without the cache
+
+	static thread_local vector<float> xs, ys, zs;
+	xs.resize(num); ys.resize(num); zs.resize(num);
+	for (unsigned i = 0; i < num; ++i) {xs[i] = pts[i].x; ys[i] = pts[i].y; zs[i] = pts[i].z;}
+	get_vals(xs.data(), ys.data(), zs.data(), heights, num);
+	float const scale(1.5f/max_mag);
+	for (unsigned i = 0; i < num; ++i) {heights[i] = 0.5*(max(-1.0f, min(1.0f, scale*heights[i])) + 1.0);} // duplicate code
+}
+
+
 void upsurface::setup_draw_sphere(point const &pos, float radius, float dp, int ndiv, float const *const pmap) {
 
 	sd.set_data(pos, radius, ndiv, pmap, dp, (pmap ? NULL : this));
@@ -169,6 +187,18 @@ void upsurface::setup_draw_sphere(point const &pos, float radius, float dp, int
 }
 
 
+void upsurface::copy_gen_data(upsurface const &s) { // copies the generated sines and heightmap, but not the draw state
+
+	static_cast<noise_gen_3d &>(*this) = s;
+	type       = s.type;
+	ssize      = s.ssize;
+	max_mag    = s.max_mag;
+	min_cutoff = s.min_cutoff;
+	heightmap  = s.heightmap;
+	val_cache.clear();
+}
+
+
 upsurface::~upsurface() {
 
 	spn.free_data();
@@ -176,36 +206,57 @@ upsurface::~upsurface() {
 }
 
 
-void urev_body::gen_surface() {
+// *** rocky_surface_gen_t ***
 
-	set_rseeds();
-	surface.reset(new upsurface(type)); // may delete a previous surface
-	float mag(SURFACE_HEIGHT*radius), freq(((type == UTYPE_MOON) ? 1.5 : 1.0)*INITIAL_FREQ*TWO_PI);
-	surface->rgen = rgen; // just copy it?
-	surface->gen(mag, freq);
+
+rocky_surface_gen_t::rocky_surface_gen_t(urev_body const &body, unsigned tsize_) : type(body.type), tsize(tsize_), radius(body.radius), temp(body.temp),
+	water(body.water), lava(body.lava), atmos(body.atmos), snow_thresh(body.snow_thresh), wr_scale(1.0/max(0.01, (1.0 - body.water))), rgen(body.rgen)
+{
+	body.get_colors(a, b);
+}
+
+
+uint64_t rocky_surface_gen_t::get_key() const { // FNV-1a hash of everything that affects the generated surface and texture
+
+	uint64_t key(14695981039346656037ULL);
+	auto add_bytes([&key](void const *ptr, unsigned size) {
+		for (unsigned i = 0; i < size; ++i) {key = (key ^ ((uint8_t const *)ptr)[i])*1099511628211ULL;}
+	});
+	float const params[6] = {radius, temp, water, lava, atmos, snow_thresh};
+	add_bytes(&rgen.rseed1, sizeof(rgen.rseed1));
+	add_bytes(&rgen.rseed2, sizeof(rgen.rseed2));
+	add_bytes(&type,  sizeof(type));
+	add_bytes(&tsize, sizeof(tsize));
+	add_bytes(params, sizeof(params));
+	add_bytes(a, 3);
+	add_bytes(b, 3);
+	return key;
 }
 
 
 // Note: many planet/sphere renderers use a texture with width = 2*height, which yields square regions at the equator
 // here we use a square texture for simplicity, so that this code can be shared with (and be similar to)
 // the rest of the 3DWorld sphere generation and drawing code; it also produces more uniform regions near the poles
-void urev_body::gen_texture_data_and_heightmap(unsigned char *data, unsigned size) {
+// Note: may be called from a background thread, so this only reads our own snapshot of the body's state
+void rocky_surface_gen_t::gen(upsurface &surface, unsigned char *data) const {
 
 	//RESET_TIME;
-	get_colors(a, b);
+	float mag(SURFACE_HEIGHT*radius), freq(((type == UTYPE_MOON) ? 1.5 : 1.0)*INITIAL_FREQ*TWO_PI);
+	surface.type = type;
+	surface.rgen = rgen; // just copy it?
+	surface.gen(mag, freq);
+	unsigned const size(tsize);
 	unsigned size_p2(0);
 	for (unsigned sz = size; sz > 1; sz >>= 1, ++size_p2);
 	assert((1U<<size_p2) == size); // size must be a power of 2
-	assert(surface != nullptr);
 	unsigned const table_size(MAX_TEXTURE_SIZE << 1); // larger is more accurate
-	static float xtable[TOT_NUM_SINES*table_size], ytable[TOT_NUM_SINES*table_size];
-	surface->setup(size, max(water, lava), 1); // use_heightmap=1
-	unsigned const num_sines(surface->num_sines);
-	float const *const rdata(surface->rdata);
-	float const mt2(0.5*(table_size-1)), scale(1.5/surface->max_mag);
+	surface.setup(size, max(water, lava), 1); // use_heightmap=1
+	unsigned const num_sines(surface.num_sines);
+	vector<float> xtable(num_sines*table_size), ytable(num_sines*table_size); // not static, since multiple threads may generate surfaces
+	float const *const rdata(surface.rdata);
+	float const mt2(0.5*(table_size-1)), scale(1.5/surface.max_mag);
 	float const delta(TWO_PI/size), sin_ds(sin(delta)), cos_ds(cos(delta));
 	unsigned const pole_thresh(size>>3);
-	wr_scale = 1.0/max(0.01, (1.0 - water));
 
 	for (unsigned i = 0; i < table_size; ++i) { // build sin table
 		unsigned const offset(i*num_sines);
@@ -248,7 +299,7 @@ void urev_body::gen_texture_data_and_heightmap(unsigned char *data, unsigned siz
 				for (unsigned k = 0; k < num_sines; ++k) {val += ztable[k]*xtable[ox1+k]*ytable[oy1+k];}
 			}
 			val = 0.5*(max(-1.0f, min(1.0f, scale*val)) + 1.0);
-			surface->heightmap[hmoff + j] = val;
+			surface.heightmap[hmoff + j] = val;
 			get_surface_color((data + index), val, phi);
 			sin_s = s*cos_ds + c*sin_ds;
 			cos_s = c*cos_ds - s*sin_ds;
@@ -258,6 +309,248 @@ void urev_body::gen_texture_data_and_heightmap(unsigned char *data, unsigned siz
 }
 
 
+// *** planet_surface_cache_t ***
+
+
+// LRU cache of generated rocky planet and moon surfaces and textures, keyed by rocky_surface_gen_t::get_key();
+// surfaces are generated by background threads in priority order (largest screen size first), and optionally written to and read from disk
+class planet_surface_cache_t {
+
+	struct result_t {
+		upsurface surface; // generated sines and heightmap; copied into the body's surface, which owns the draw state
+		vector<unsigned char> tex_data;
+		size_t get_mem() const {return (sizeof(result_t) + surface.heightmap.size()*sizeof(float) + tex_data.size());}
+	};
+	typedef std::shared_ptr<result_t const> p_result_t;
+
+	struct cache_entry_t {
+		p_result_t result;
+		unsigned last_used;
+		cache_entry_t(p_result_t const &result_, unsigned last_used_) : result(result_), last_used(last_used_) {}
+	};
+	struct job_t {
+		rocky_surface_gen_t sgen;
+		float priority;
+		bool running;
+		job_t(rocky_surface_gen_t const &sgen_, float priority_) : sgen(sgen_), priority(priority_), running(0) {}
+	};
+	map<uint64_t, cache_entry_t> cache;
+	map<uint64_t, job_t> jobs; // pending and running
+	vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable work_cv, done_cv;
+	size_t mem_used;
+	unsigned use_counter;
+	bool exiting;
+
+	string get_filename(uint64_t key) const;
+	p_result_t read_from_disk(uint64_t key) const;
+	void write_to_disk(uint64_t key, result_t const &result) const;
+	p_result_t generate(rocky_surface_gen_t const &sgen) const;
+	void add_to_cache(uint64_t key, p_result_t const &result);
+	void worker_loop();
+public:
+	planet_surface_cache_t() : mem_used(0), use_counter(0), exiting(0) {}
+	~planet_surface_cache_t() {stop();}
+	void start(unsigned num_threads);
+	void stop();
+	bool get(rocky_surface_gen_t const &sgen, float priority, bool wait, p_upsurface &surface, vector<unsigned char> &tex_data);
+	void prefetch(rocky_surface_gen_t const &sgen, float priority);
+}; // planet_surface_cache_t
+
+planet_surface_cache_t planet_surface_cache;
+
+
+void planet_surface_cache_t::start(unsigned num_threads) {
+
+	if (!threads.empty() || num_threads == 0) return; // already started, or disabled
+	exiting = 0;
+	for (unsigned i = 0; i < num_threads; ++i) {threads.emplace_back(&planet_surface_cache_t::worker_loop, this);}
+}
+
+void planet_surface_cache_t::stop() {
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		exiting = 1;
+	}
+	work_cv.notify_all();
+	for (std::thread &t : threads) {t.join();}
+	threads.clear();
+	jobs.clear();
+}
+
+string planet_surface_cache_t::get_filename(uint64_t key) const {
+
+	if (planet_surface_cache_dir.empty()) return string(); // disk cache disabled
+	std::ostringstream oss;
+	oss << planet_surface_cache_dir << "/surf_" << std::hex << key << ".bin";
+	return oss.str();
+}
+
+// file format: key, num_sines, rdata, max_mag, min_cutoff, ssize, heightmap, tex_data
+planet_surface_cache_t::p_result_t planet_surface_cache_t::read_from_disk(uint64_t key) const {
+
+	string const fn(get_filename(key));
+	if (fn.empty()) return nullptr;
+	FILE *fp(fopen(fn.c_str(), "rb"));
+	if (fp == nullptr) return nullptr; // not cached; this is not an error
+	std::shared_ptr<result_t> result(new result_t);
+	upsurface &s(result->surface);
+	uint64_t file_key(0);
+	bool ok(fread(&file_key, sizeof(uint64_t), 1, fp) == 1 && file_key == key);
+	ok = ok && (fread(&s.num_sines, sizeof(unsigned), 1, fp) == 1) && s.num_sines <= TOT_NUM_SINES;
+	ok = ok && (fread(s.rdata, sizeof(float), SINE_DATA_SIZE, fp) == SINE_DATA_SIZE);
+	ok = ok && (fread(&s.max_mag, sizeof(float), 1, fp) == 1) && (fread(&s.min_cutoff, sizeof(float), 1, fp) == 1);
+	ok = ok && (fread(&s.ssize, sizeof(unsigned), 1, fp) == 1) && s.ssize <= MAX_TEXTURE_SIZE;
+
+	if (ok) {
+		s.heightmap.resize(s.ssize*s.ssize);
+		result->tex_data.resize(3*s.ssize*s.ssize);
+		ok = (fread(s.heightmap.data(), sizeof(float), s.heightmap.size(), fp) == s.heightmap.size());
+		ok = ok && (fread(result->tex_data.data(), sizeof(unsigned char), result->tex_data.size(), fp) == result->tex_data.size());
+	}
+	checked_fclose(fp);
+	if (!ok) {std::cerr << "Error reading planet surface cache file " << fn << "; surface will be regenerated" << endl; return nullptr;}
+	return result;
+}
+
+void planet_surface_cache_t::write_to_disk(uint64_t key, result_t const &result) const {
+
+	string const fn(get_filename(key));
+	if (fn.empty()) return;
+	FILE *fp(fopen(fn.c_str(), "wb"));
+	if (fp == nullptr) {std::cerr << "Error opening planet surface cache file " << fn << " for write" << endl; return;}
+	upsurface const &s(result.surface);
+	bool ok(fwrite(&key, sizeof(uint64_t), 1, fp) == 1);
+	ok = ok && (fwrite(&s.num_sines, sizeof(unsigned), 1, fp) == 1);
+	ok = ok && (fwrite(s.rdata, sizeof(float), SINE_DATA_SIZE, fp) == SINE_DATA_SIZE);
+	ok = ok && (fwrite(&s.max_mag, sizeof(float), 1, fp) == 1) && (fwrite(&s.min_cutoff, sizeof(float), 1, fp) == 1);
+	ok = ok && (fwrite(&s.ssize, sizeof(unsigned), 1, fp) == 1);
+	ok = ok && (fwrite(s.heightmap.data(), sizeof(float), s.heightmap.size(), fp) == s.heightmap.size());
+	ok = ok && (fwrite(result.tex_data.data(), sizeof(unsigned char), result.tex_data.size(), fp) == result.tex_data.size());
+	checked_fclose(fp);
+	if (!ok) {std::cerr << "Error writing planet surface cache file " << fn << endl;}
+}
+
+planet_surface_cache_t::p_result_t planet_surface_cache_t::generate(rocky_surface_gen_t const &sgen) const { // doesn't modify the cache, so no lock is needed
+
+	uint64_t const key(sgen.get_key());
+	p_result_t const disk_result(read_from_disk(key));
+	if (disk_result) return disk_result;
+	std::shared_ptr<result_t> result(new result_t);
+	result->tex_data.resize(3*sgen.tsize*sgen.tsize);
+	sgen.gen(result->surface, result->tex_data.data());
+	write_to_disk(key, *result);
+	return result;
+}
+
+void planet_surface_cache_t::add_to_cache(uint64_t key, p_result_t const &result) { // mutex must be locked by the caller
+
+	if (!cache.emplace(key, cache_entry_t(result, ++use_counter)).second) return; // already cached
+	mem_used += result->get_mem();
+	size_t const max_mem(size_t(planet_surface_cache_mb) << 20);
+
+	while (mem_used > max_mem && cache.size() > 1) { // evict least recently used entries; results in use by bodies have already been copied
+		auto lru(cache.begin());
+
+		for (auto i = cache.begin(); i != cache.end(); ++i) {
+			if (i->second.last_used < lru->second.last_used) {lru = i;}
+		}
+		if (lru->first == key) break; // don't evict the entry we just added
+		assert(mem_used >= lru->second.result->get_mem());
+		mem_used -= lru->second.result->get_mem();
+		cache.erase(lru);
+	}
+}
+
+void planet_surface_cache_t::worker_loop() {
+
+	omp_set_num_threads_3dw(1); // parallelism comes from generating several surfaces at once; don't oversubscribe the cores used by the main thread
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (1) {
+		job_t *job(nullptr);
+		uint64_t key(0);
+
+		work_cv.wait(lock, [&]() -> bool {
+			if (exiting) return 1;
+
+			for (auto i = jobs.begin(); i != jobs.end(); ++i) { // choose the highest priority job that isn't running
+				if (!i->second.running && (job == nullptr || i->second.priority > job->priority)) {job = &i->second; key = i->first;}
+			}
+			return (job != nullptr);
+		});
+		if (exiting) break;
+		job->running = 1;
+		rocky_surface_gen_t const sgen(job->sgen);
+		lock.unlock();
+		p_result_t const result(generate(sgen));
+		lock.lock();
+		add_to_cache(key, result);
+		jobs.erase(key);
+		done_cv.notify_all();
+	}
+}
+
+// returns 1 and fills in surface and tex_data if the result is cached, or if wait=1 or background generation is disabled;
+// otherwise, queues the surface for background generation and returns 0
+bool planet_surface_cache_t::get(rocky_surface_gen_t const &sgen, float priority, bool wait, p_upsurface &surface, vector<unsigned char> &tex_data) {
+
+	uint64_t const key(sgen.get_key());
+	std::unique_lock<std::mutex> lock(mutex);
+	if (threads.empty()) {start(num_planet_gen_threads);}
+	bool const can_wait(wait || threads.empty()); // generate on this thread if background generation is disabled
+	p_result_t result;
+
+	while (1) {
+		auto it(cache.find(key));
+		if (it != cache.end()) {it->second.last_used = ++use_counter; result = it->second.result; break;} // found
+		auto job(jobs.find(key));
+
+		if (job == jobs.end()) { // not queued
+			if (can_wait) break; // generate below
+			jobs.emplace(key, job_t(sgen, priority));
+			work_cv.notify_one();
+			return 0;
+		}
+		job->second.priority = max(job->second.priority, priority); // this is now needed for drawing
+		if (!can_wait) return 0; // still being generated
+		if (!job->second.running) {jobs.erase(job); break;} // not started - take it over and generate below
+		done_cv.wait(lock); // wait for the worker to finish
+	}
+	if (!result) { // generate on this thread
+		lock.unlock();
+		result = generate(sgen);
+		lock.lock();
+		add_to_cache(key, result);
+	}
+	lock.unlock();
+	surface.reset(new upsurface(sgen.type)); // may delete a previous surface
+	surface->copy_gen_data(result->surface);
+	tex_data = result->tex_data;
+	return 1;
+}
+
+void planet_surface_cache_t::prefetch(rocky_surface_gen_t const &sgen, float priority) {
+
+	if (num_planet_gen_threads == 0) return; // no background threads
+	uint64_t const key(sgen.get_key());
+	std::lock_guard<std::mutex> lock(mutex);
+	if (cache.find(key) != cache.end()) return; // already cached
+	auto job(jobs.find(key));
+	if (job != jobs.end()) {job->second.priority = max(job->second.priority, priority); return;} // already queued
+	if (threads.empty()) {start(num_planet_gen_threads);}
+	jobs.emplace(key, job_t(sgen, priority));
+	work_cv.notify_one();
+}
+
+bool get_rocky_surface(rocky_surface_gen_t const &sgen, float priority, bool wait, p_upsurface &surface, vector<unsigned char> &tex_data) {
+	return planet_surface_cache.get(sgen, priority, wait, surface, tex_data);
+}
+void prefetch_rocky_surface(rocky_surface_gen_t const &sgen, float priority) {planet_surface_cache.prefetch(sgen, priority);}
+
+
 bool urev_body::surface_test(float rad, point const &p, float &coll_r, bool simple) const {
 
 	// not quite right - should take into consideration peaks in surrounding geometry that also intersect the sphere
@@ -49,6 +49,10 @@ public:
 	void gen_xyz_vals(point const &start, vector3d const &step, unsigned const xyz_num[3], vector<float> xyz_vals[3]);
 	float get_val(unsigned x, unsigned y, unsigned z, vector<float> const xyz_vals[3]) const;
 	float get_val(point const &pt) const;
+	// SIMD versions of the above in simd_noise.cpp that evaluate 8 points per iteration from SoA inputs
+	void get_vals(float const *xs, float const *ys, float const *zs, float *vals, unsigned num) const;
+	void transpose_vals(vector<float> const &vals, unsigned num, vector<float> &vals_t) const; // [i*num_sines + k] => [k*round_up_8(num) + i]
+	void get_vals_z_column(unsigned x, unsigned y, vector<float> const xyz_vals[3], vector<float> const &zvals_t, unsigned nz, float *vals) const;
 };
 
 
@@ -77,8 +81,10 @@ public:
 	~upsurface();
 	void gen(float mag, float freq, unsigned ntests=N_RAND_MAG_TESTS, float mm_scale=1.0);
 	void setup(unsigned size, float mcut, bool alloc_hmap);
+	void copy_gen_data(upsurface const &s);
 	float get_one_minus_cutoff() const {return 1.0/max(0.01, (1.0 - min_cutoff));} // avoid div-by-zero
 	float get_height_at(point const &pt, bool use_cache=0) const;
+	void get_heights_at(point const *pts, float *heights, unsigned num) const;
 	void setup_draw_sphere(point const &pos, float radius, float dp, int ndiv, float const *const pmap);
 	void calc_rmax() {rmax = sd.get_rmax();}
 	void free_context() {sd.clear_vbos();}
@@ -0,0 +1,118 @@
+// 3D World - 8-wide SIMD float vector for batched math kernels
+// by Frank Gennari
+// 10/17/26
+#pragma once
+
+// Uses a single AVX register when the compiler targets AVX (/arch:AVX2 or -mavx2), otherwise a pair of SSE2 registers;
+// the scalar fallback keeps non-x86 builds working. Operations mirror the GLM functions they replace so that results match.
+#if defined(__AVX__)
+#define VFLOAT8_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VFLOAT8_SSE2
+#include <emmintrin.h>
+#else
+#define VFLOAT8_SCALAR
+#include <cmath>
+#endif
+
+#ifdef _MSC_VER
+#define VFLOAT8_INLINE __forceinline
+#else
+#define VFLOAT8_INLINE inline __attribute__((always_inline))
+#endif
+
+#ifndef VFLOAT8_SCALAR
+#define HAS_SIMD_VFLOAT8
+#endif
+
+
+struct vfloat8 {
+
+#if defined(VFLOAT8_AVX)
+	__m256 v;
+	VFLOAT8_INLINE vfloat8() {}
+	VFLOAT8_INLINE vfloat8(__m256 v_) : v(v_) {}
+	VFLOAT8_INLINE vfloat8(float f) : v(_mm256_set1_ps(f)) {}
+	static VFLOAT8_INLINE vfloat8 load (float const *p) {return _mm256_loadu_ps(p);}
+	VFLOAT8_INLINE void store(float *p) const {_mm256_storeu_ps(p, v);}
+	friend VFLOAT8_INLINE vfloat8 operator+(vfloat8 const &a, vfloat8 const &b) {return _mm256_add_ps(a.v, b.v);}
+	friend VFLOAT8_INLINE vfloat8 operator-(vfloat8 const &a, vfloat8 const &b) {return _mm256_sub_ps(a.v, b.v);}
+	friend VFLOAT8_INLINE vfloat8 operator*(vfloat8 const &a, vfloat8 const &b) {return _mm256_mul_ps(a.v, b.v);}
+	friend VFLOAT8_INLINE vfloat8 operator/(vfloat8 const &a, vfloat8 const &b) {return _mm256_div_ps(a.v, b.v);}
+	friend VFLOAT8_INLINE vfloat8 vmin (vfloat8 const &a, vfloat8 const &b) {return _mm256_min_ps(a.v, b.v);}
+	friend VFLOAT8_INLINE vfloat8 vmax (vfloat8 const &a, vfloat8 const &b) {return _mm256_max_ps(a.v, b.v);}
+	friend VFLOAT8_INLINE vfloat8 vfloor(vfloat8 const &a) {return _mm256_floor_ps(a.v);}
+	friend VFLOAT8_INLINE vfloat8 vabs (vfloat8 const &a) {return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v);}
+	// comparisons return a per-lane mask of all ones or all zeros
+	friend VFLOAT8_INLINE vfloat8 cmp_lt(vfloat8 const &a, vfloat8 const &b) {return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ);}
+	friend VFLOAT8_INLINE vfloat8 cmp_gt(vfloat8 const &a, vfloat8 const &b) {return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ);}
+	friend VFLOAT8_INLINE vfloat8 mask_and(vfloat8 const &m, vfloat8 const &a) {return _mm256_and_ps(m.v, a.v);}
+	friend VFLOAT8_INLINE vfloat8 select(vfloat8 const &m, vfloat8 const &a, vfloat8 const &b) {return _mm256_blendv_ps(b.v, a.v, m.v);} // m ? a : b
+	friend VFLOAT8_INLINE unsigned movemask(vfloat8 const &m) {return _mm256_movemask_ps(m.v);} // one bit per lane
+
+#elif defined(VFLOAT8_SSE2)
+	__m128 lo, hi;
+	VFLOAT8_INLINE vfloat8() {}
+	VFLOAT8_INLINE vfloat8(__m128 lo_, __m128 hi_) : lo(lo_), hi(hi_) {}
+	VFLOAT8_INLINE vfloat8(float f) : lo(_mm_set1_ps(f)), hi(lo) {}
+	static VFLOAT8_INLINE vfloat8 load (float const *p) {return vfloat8(_mm_loadu_ps(p), _mm_loadu_ps(p+4));}
+	VFLOAT8_INLINE void store(float *p) const {_mm_storeu_ps(p, lo); _mm_storeu_ps(p+4, hi);}
+	friend VFLOAT8_INLINE vfloat8 operator+(vfloat8 const &a, vfloat8 const &b) {return vfloat8(_mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi));}
+	friend VFLOAT8_INLINE vfloat8 operator-(vfloat8 const &a, vfloat8 const &b) {return vfloat8(_mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi));}
+	friend VFLOAT8_INLINE vfloat8 operator*(vfloat8 const &a, vfloat8 const &b) {return vfloat8(_mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi));}
+	friend VFLOAT8_INLINE vfloat8 operator/(vfloat8 const &a, vfloat8 const &b) {return vfloat8(_mm_div_ps(a.lo, b.lo), _mm_div_ps(a.hi, b.hi));}
+	friend VFLOAT8_INLINE vfloat8 vmin (vfloat8 const &a, vfloat8 const &b) {return vfloat8(_mm_min_ps(a.lo, b.lo), _mm_min_ps(a.hi, b.hi));}
+	friend VFLOAT8_INLINE vfloat8 vmax (vfloat8 const &a, vfloat8 const &b) {return vfloat8(_mm_max_ps(a.lo, b.lo), _mm_max_ps(a.hi, b.hi));}
+	friend VFLOAT8_INLINE vfloat8 vfloor(vfloat8 const &a) {return vfloat8(floor4(a.lo), floor4(a.hi));}
+	friend VFLOAT8_INLINE vfloat8 vabs (vfloat8 const &a) {__m128 const s(_mm_set1_ps(-0.0f)); return vfloat8(_mm_andnot_ps(s, a.lo), _mm_andnot_ps(s, a.hi));}
+	friend VFLOAT8_INLINE vfloat8 cmp_lt(vfloat8 const &a, vfloat8 const &b) {return vfloat8(_mm_cmplt_ps(a.lo, b.lo), _mm_cmplt_ps(a.hi, b.hi));}
+	friend VFLOAT8_INLINE vfloat8 cmp_gt(vfloat8 const &a, vfloat8 const &b) {return vfloat8(_mm_cmpgt_ps(a.lo, b.lo), _mm_cmpgt_ps(a.hi, b.hi));}
+	friend VFLOAT8_INLINE vfloat8 mask_and(vfloat8 const &m, vfloat8 const &a) {return vfloat8(_mm_and_ps(m.lo, a.lo), _mm_and_ps(m.hi, a.hi));}
+	friend VFLOAT8_INLINE vfloat8 select(vfloat8 const &m, vfloat8 const &a, vfloat8 const &b) {return vfloat8(sel4(m.lo, a.lo, b.lo), sel4(m.hi, a.hi, b.hi));}
+	friend VFLOAT8_INLINE unsigned movemask(vfloat8 const &m) {return (_mm_movemask_ps(m.lo) | (_mm_movemask_ps(m.hi) << 4));}
+private:
+	static VFLOAT8_INLINE __m128 sel4(__m128 m, __m128 a, __m128 b) {return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));}
+	static VFLOAT8_INLINE __m128 floor4(__m128 a) { // SSE2 has no round instruction; values >= 2^23 are already integers
+		__m128 const t(_mm_cvtepi32_ps(_mm_cvttps_epi32(a))); // truncate toward zero
+		__m128 const f(_mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1.0f)))); // round negative values down
+		__m128 const in_range(_mm_cmplt_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), a), _mm_set1_ps(8388608.0f)));
+		return sel4(in_range, f, a);
+	}
+
+#else // scalar fallback
+	float v[8];
+	VFLOAT8_INLINE vfloat8() {}
+	VFLOAT8_INLINE vfloat8(float f) {for (unsigned i = 0; i < 8; ++i) {v[i] = f;}}
+	static VFLOAT8_INLINE vfloat8 load (float const *p) {vfloat8 r; for (unsigned i = 0; i < 8; ++i) {r.v[i] = p[i];} return r;}
+	VFLOAT8_INLINE void store(float *p) const {for (unsigned i = 0; i < 8; ++i) {p[i] = v[i];}}
+#define VFLOAT8_OP2(name, expr) friend VFLOAT8_INLINE vfloat8 name(vfloat8 const &a, vfloat8 const &b) {vfloat8 r; for (unsigned i = 0; i < 8; ++i) {r.v[i] = (expr);} return r;}
+	VFLOAT8_OP2(operator+, a.v[i] + b.v[i])
+	VFLOAT8_OP2(operator-, a.v[i] - b.v[i])
+	VFLOAT8_OP2(operator*, a.v[i] * b.v[i])
+	VFLOAT8_OP2(operator/, a.v[i] / b.v[i])
+	VFLOAT8_OP2(vmin, ((a.v[i] < b.v[i]) ? a.v[i] : b.v[i]))
+	VFLOAT8_OP2(vmax, ((a.v[i] > b.v[i]) ? a.v[i] : b.v[i]))
+	VFLOAT8_OP2(cmp_lt, ((a.v[i] < b.v[i]) ? all_ones() : 0.0f))
+	VFLOAT8_OP2(cmp_gt, ((a.v[i] > b.v[i]) ? all_ones() : 0.0f))
+	VFLOAT8_OP2(mask_and, ((a.v[i] != 0.0f) ? b.v[i] : 0.0f)) // masks are only ever all_ones() or zero
+#undef VFLOAT8_OP2
+	friend VFLOAT8_INLINE vfloat8 vfloor(vfloat8 const &a) {vfloat8 r; for (unsigned i = 0; i < 8; ++i) {r.v[i] = std::floor(a.v[i]);} return r;}
+	friend VFLOAT8_INLINE vfloat8 vabs  (vfloat8 const &a) {vfloat8 r; for (unsigned i = 0; i < 8; ++i) {r.v[i] = std::fabs (a.v[i]);} return r;}
+	friend VFLOAT8_INLINE vfloat8 select(vfloat8 const &m, vfloat8 const &a, vfloat8 const &b) {
+		vfloat8 r; for (unsigned i = 0; i < 8; ++i) {r.v[i] = ((m.v[i] != 0.0f) ? a.v[i] : b.v[i]);} return r;
+	}
+	friend VFLOAT8_INLINE unsigned movemask(vfloat8 const &m) {unsigned r(0); for (unsigned i = 0; i < 8; ++i) {if (m.v[i] != 0.0f) {r |= (1 << i);}} return r;}
+private:
+	static VFLOAT8_INLINE float all_ones() {return 1.0f;} // any nonzero value works as a mask here
+#endif
+public:
+	friend VFLOAT8_INLINE vfloat8 vfract(vfloat8 const &a) {return a - vfloor(a);}
+	friend VFLOAT8_INLINE vfloat8 vmix(vfloat8 const &x, vfloat8 const &y, vfloat8 const &a) {return x + a*(y - x);} // same form as glm::mix()
+	friend VFLOAT8_INLINE vfloat8 vstep(vfloat8 const &edge, vfloat8 const &x) {return select(cmp_lt(x, edge), vfloat8(0.0f), vfloat8(1.0f));} // glm::step()
+	friend VFLOAT8_INLINE vfloat8 operator-(vfloat8 const &a) {return vfloat8(0.0f) - a;}
+	VFLOAT8_INLINE vfloat8 &operator+=(vfloat8 const &a) {*this = *this + a; return *this;}
+	VFLOAT8_INLINE vfloat8 &operator-=(vfloat8 const &a) {*this = *this - a; return *this;}
+	VFLOAT8_INLINE vfloat8 &operator*=(vfloat8 const &a) {*this = *this * a; return *this;}
+};
+
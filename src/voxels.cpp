@@ -11,7 +11,8 @@
 #include "file_utils.h"
 #include "openal_wrap.h"
 #include "cobj_bsp_tree.h"
-#include <glm/gtc/noise.hpp>
+#include "simd_noise.h"
+#include <chrono>
 
 
 bool const DEBUG_BLOCKS    = 0;
@@ -31,6 +32,7 @@ bool voxel_ppb_enable_falling(0);
 
 extern bool group_back_face_cull, voxel_shadows_updated;
 extern int dynamic_mesh_scroll, rand_gen_index, scrolling, display_mode, display_framerate, voxel_editing, mesh_gen_mode, mesh_freq_filter;
+extern unsigned NUM_THREADS;
 extern float FAR_CLIP;
 extern double tfticks;
 extern coll_obj_group coll_objects;
@@ -85,7 +87,7 @@ template<typename V> void voxel_grid<V>::init_grid(unsigned nx_, unsigned ny_, u
 	unsigned const tot_size(nx * ny * nz);
 	assert(tot_size > 0);
 	clear();
-	resize(tot_size, default_val);
+	if (sparse) {bricks.init(nx, ny, nz, default_val);} else {resize(tot_size, default_val);}
 }
 
 template<typename V> void voxel_grid<V>::init(unsigned nx_, unsigned ny_, unsigned nz_, vector3d const &vsz_,
@@ -162,10 +164,15 @@ template<> void voxel_grid<float>::downsample_2x() { // modify in place, perserv
 			}
 		}
 	}
-	swap(dsv);
-	for (iterator i = begin(); i != end(); ++i) {*i /= 8;} // average voxel values
+	for (auto i = dsv.begin(); i != dsv.end(); ++i) {*i /= 8;} // average voxel values
 	nx = dsnx; ny = dsny; nz = dsnz;
 	vsz *= 2.0;
+
+	if (sparse) {
+		bricks.init(nx, ny, nz, 0.0);
+		set_from_dense(dsv);
+	}
+	else {swap(dsv);}
 }
 
 template<> void voxel_grid<cube_t>::downsample_2x() {assert(0);} // not supported
@@ -182,6 +189,61 @@ template<typename V> void voxel_grid<V>::get_bcube_ix_bounds(cube_t const &bcube
 }
 
 
+template<typename V> bool voxel_grid<V>::is_uniform_range(unsigned x1, unsigned y1, unsigned z1, unsigned x2, unsigned y2, unsigned z2) const {
+
+	if (!sparse) return 0;
+	V val, brick_val;
+	if (!bricks.is_uniform(x1, y1, z1, val)) return 0;
+
+	for (unsigned y = (y1 & ~VOXEL_BRICK_MASK); y <= y2; y += VOXEL_BRICK_SZ) { // iterate over the starting voxel of each brick
+		for (unsigned x = (x1 & ~VOXEL_BRICK_MASK); x <= x2; x += VOXEL_BRICK_SZ) {
+			for (unsigned z = (z1 & ~VOXEL_BRICK_MASK); z <= z2; z += VOXEL_BRICK_SZ) {
+				if (!bricks.is_uniform(x, y, z, brick_val) || !(brick_val == val)) return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+
+template<typename V> vector<V> const &voxel_grid<V>::get_dense_vals(vector<V> &temp) const {
+
+	if (!sparse) return *this;
+	temp.resize(size());
+	unsigned ix(0);
+
+	for (unsigned y = 0; y < ny; ++y) {
+		for (unsigned x = 0; x < nx; ++x) {
+			for (unsigned z = 0; z < nz; ++z, ++ix) {temp[ix] = bricks.get(x, y, z);}
+		}
+	}
+	return temp;
+}
+
+
+template<typename V> void voxel_grid<V>::set_from_dense(vector<V> const &vals) {
+
+	assert(vals.size() == size());
+	if (!sparse) {vector<V>::operator=(vals); return;}
+	unsigned ix(0);
+
+	for (unsigned y = 0; y < ny; ++y) {
+		for (unsigned x = 0; x < nx; ++x) {
+			for (unsigned z = 0; z < nz; ++z, ++ix) {bricks.set(x, y, z, vals[ix]);}
+		}
+	}
+	compress();
+}
+
+
+template<typename V> void voxel_grid<V>::print_mem_stats(char const *const name) const {
+
+	cout << name << ": " << nx << "x" << ny << "x" << nz << (sparse ? " sparse" : " dense");
+	if (sparse) {cout << ", " << bricks.get_num_allocated() << " of " << bricks.get_num_bricks() << " bricks allocated";}
+	cout << ", mem " << get_mem_usage()/1024 << "KB (dense " << size()*sizeof(V)/1024 << "KB)" << endl;
+}
+
+
 // Note: voxel read/write is unused
 template<typename T> bool read_pod(T &v, FILE *fp, char const *const name) {
 	if (fread(&v, sizeof(T), 1, fp) != 1) {
@@ -208,17 +270,22 @@ template<typename V> bool voxel_grid<V>::read(FILE *fp) {
 	if (!read_pod(vsz, fp, "voxel vsz") || !read_pod(center, fp, "voxel center") || !read_pod(lo_pos, fp, "voxel lo_pos")) return 0;
 	if (!read_pod(sz, fp, "voxel_grid size")) return 0;
 	
-	if (empty()) {
-		resize(sz);
-	}
-	else if (sz != size()) {
-		cerr << "Error reading voxel_grid size: expected " << size() << " but got " << sz << endl;
-		return 0;
+	if (!empty()) {
+		if (sz != size()) {
+			cerr << "Error reading voxel_grid size: expected " << size() << " but got " << sz << endl;
+			return 0;
+		}
 	}
-	if (fread(&front(), sizeof(V), size(), fp) != size()) {
+	else if (sparse) {bricks.init(nx, ny, nz, V());}
+	vector<V> temp; // sparse grids are stored in the same dense format
+	vector<V> &vals(sparse ? temp : *this);
+	vals.resize(sz);
+
+	if (fread(&vals.front(), sizeof(V), sz, fp) != sz) {
 		cerr << "Error reading voxel_grid data" << endl;
 		return 0;
 	}
+	if (sparse) {set_from_dense(temp);}
 	return 1;
 }
 
@@ -231,8 +298,10 @@ template<typename V> bool voxel_grid<V>::write(FILE *fp) const {
 	if (!write_pod(xblocks, fp, "voxel xblocks") || !write_pod(yblocks, fp, "voxel yblocks")) return 0;
 	if (!write_pod(vsz, fp, "voxel vsz") || !write_pod(center, fp, "voxel center") || !write_pod(lo_pos, fp, "voxel lo_pos")) return 0;
 	if (!write_pod(sz, fp, "voxel_grid size")) return 0;
+	vector<V> temp;
+	vector<V> const &vals(get_dense_vals(temp));
 	
-	if (fwrite(&front(), sizeof(V), size(), fp) != size()) {
+	if (fwrite(&vals.front(), sizeof(V), sz, fp) != sz) {
 		cerr << "Error writing voxel_grid data" << endl;
 		return 0;
 	}
@@ -278,7 +347,7 @@ void voxel_manager::clear() {
 void voxel_manager::create_procedural(float mag, float freq, vector3d const &offset, bool normalize_to_1, int rseed1, int rseed2, int gen_mode) {
 
 	unsigned const xyz_num[3] = {nx, ny, nz};
-	vector<float> xyz_vals[3];
+	vector<float> xyz_vals[3], zvals_t;
 	noise_gen_3d ngen;
 	float rx(0.0), ry(0.0);
 	float const zscale((params.invert ? -1.0 : 1.0)*params.z_gradient/(nz-1));
@@ -287,6 +356,7 @@ void voxel_manager::create_procedural(float mag, float freq, vector3d const &off
 		ngen.set_rand_seeds(rseed1, rseed2);
 		ngen.gen_sines(mag, freq); // create sine table
 		ngen.gen_xyz_vals((lo_pos + offset), vsz, xyz_num, xyz_vals); // create xyz values
+		ngen.transpose_vals(xyz_vals[2], nz, zvals_t); // z-major for SIMD evaluation of z columns
 	}
 	else {
 		gen_rx_ry(rx, ry);
@@ -301,40 +371,99 @@ void voxel_manager::create_procedural(float mag, float freq, vector3d const &off
 		cshader.add_uniform_float("start_freq", 0.25*freq);
 		cshader.add_uniform_float("rx", rx);
 		cshader.add_uniform_float("ry", ry);
-		cshader.gen_matrix_R32F(*this, tid); // write directly to voxel values
-		if (normalize_to_1) {for (iterator i = begin(); i != end(); ++i) {*i = CLIP_TO_pm1(*i);}}
+		vector<float> temp;
+		vector<float> &vals(is_sparse() ? temp : *this); // write directly to dense voxel values
+		cshader.gen_matrix_R32F(vals, tid);
+		if (normalize_to_1) {for (auto i = vals.begin(); i != vals.end(); ++i) {*i = CLIP_TO_pm1(*i);}}
+		if (is_sparse()) {set_from_dense(temp);}
 		cshader.end_shader();
 		free_texture(tid);
 		return;
 	}
+	unsigned const num_octaves(max(1, ((int)MAX_FREQ_BINS - mesh_freq_filter)));
+
+	// fills nvals[z1,z2) with the noise values of one z column
+	auto gen_noise_column = [&](unsigned x, unsigned y, unsigned z1, unsigned z2, vector<float> &xs, vector<float> &ys, vector<float> &zs, vector<float> &nvals) {
+		nvals.resize(nz);
+
+		if (gen_mode == MGEN_SINE) { // SIMD sines, batched over z
+			ngen.get_vals_z_column(x, y, xyz_vals, zvals_t, nz, &nvals.front());
+		}
+		else if (z1 < z2) { // SIMD perlin/simplex, batched over z
+			xs.resize(nz); ys.resize(nz); zs.resize(nz);
+
+			for (unsigned z = z1; z < z2; ++z) {
+				point const pos(get_pt_at(x, y, z) + offset);
+				xs[z] = pos.x; ys[z] = pos.y; zs[z] = pos.z;
+			}
+			gen_noise_3d_batch(&xs[z1], &ys[z1], &zs[z1], &nvals[z1], (z2 - z1), num_octaves, mag, 0.25*freq, rx, ry, (gen_mode == MGEN_PERLIN));
+		}
+	};
+	if (is_sparse()) { // generate one column of bricks at a time, compressing bricks that end up uniform
+		unsigned const nbx(get_num_voxel_bricks(nx)), nby(get_num_voxel_bricks(ny)), nbz(get_num_voxel_bricks(nz));
+		vector<int> brick_sat(nbz, 0); // +/-1 if every voxel in this z layer of bricks clips to +/-1
+		unsigned zgen_start(nz), zgen_end(0); // range of z values that need noise
+
+		if (normalize_to_1) {
+			// octaves with a gain of 0.5 sum to less than 2*mag; add some margin for the noise range
+			float noise_bound(2.2f*fabs(mag));
+			if (gen_mode == MGEN_SINE) {noise_bound = 0.0; for (unsigned k = 0; k < ngen.num_sines; ++k) {noise_bound += fabs(ngen.rdata[NUM_SINE_PARAMS*k]);}}
+
+			for (unsigned bz = 0; bz < nbz; ++bz) {
+				unsigned const z1(bz << VOXEL_BRICK_BITS), z2(min(nz, (z1 + VOXEL_BRICK_SZ)) - 1);
+				float const zv1(z1*zscale), zv2(z2*zscale);
+				if      (min(zv1, zv2) - noise_bound >=  1.0) {brick_sat[bz] =  1;}
+				else if (max(zv1, zv2) + noise_bound <= -1.0) {brick_sat[bz] = -1;}
+			}
+		}
+		for (unsigned bz = 0; bz < nbz; ++bz) {
+			if (brick_sat[bz]) continue;
+			zgen_start = min(zgen_start, (bz << VOXEL_BRICK_BITS));
+			zgen_end   = min(nz, ((bz + 1) << VOXEL_BRICK_BITS));
+		}
+
+		#pragma omp parallel for schedule(dynamic,1)
+		for (int bix = 0; bix < int(nbx*nby); ++bix) {
+			unsigned const bx(bix%nbx), by(bix/nbx), x1(bx << VOXEL_BRICK_BITS), y1(by << VOXEL_BRICK_BITS);
+			unsigned const x2(min(nx, (x1 + VOXEL_BRICK_SZ))), y2(min(ny, (y1 + VOXEL_BRICK_SZ)));
+			vector<float> xs, ys, zs, nvals; // one z column of noise inputs/outputs
+
+			for (unsigned bz = 0; bz < nbz; ++bz) {
+				if (brick_sat[bz]) {set_brick_uniform(bx, by, bz, brick_sat[bz]);}
+			}
+			for (unsigned y = y1; y < y2 && zgen_start < zgen_end; ++y) {
+				for (unsigned x = x1; x < x2; ++x) {
+					gen_noise_column(x, y, zgen_start, zgen_end, xs, ys, zs, nvals);
+
+					for (unsigned z = zgen_start; z < zgen_end; ++z) {
+						if (brick_sat[z >> VOXEL_BRICK_BITS]) continue;
+						float val(nvals[z] + z*zscale);
+						if (normalize_to_1) {val = CLIP_TO_pm1(val);}
+						set(x, y, z, val);
+					}
+				}
+			}
+			compress_range(x1, y1, x2, y2); // this brick column is only written by this thread
+		}
+		return;
+	}
+
 	#pragma omp parallel for schedule(static,1)
 	for (int y = 0; y < (int)ny; ++y) { // generate voxel values
+		vector<float> xs, ys, zs, nvals; // one z column of noise inputs/outputs
+
 		for (unsigned x = 0; x < nx; ++x) {
-			for (unsigned z = 0; z < nz; ++z) {
-				float val(0.0);
+			gen_noise_column(x, y, 0, nz, xs, ys, zs, nvals);
 
-				if (gen_mode == MGEN_SINE) { // sines
-#if 1
-					val = ngen.get_val(x, y, z, xyz_vals);
-#else
+			for (unsigned z = 0; z < nz; ++z) {
+				float val(nvals[z]);
+#if 0 // warped sines
+				if (gen_mode == MGEN_SINE) {
 					point pos(get_pt_at(x, y, z));
 					pos += 20.0*fabs(ngen.get_val(0.01*pos))*vector3d(1,1,1); // warp
 					val = ngen.get_val(pos);
-#endif
-				}
-				else { // GLM perlin/simplex (slow)
-					point const pos(get_pt_at(x, y, z) + offset);
-					glm::vec3 const v(pos.x, pos.y, pos.z);
-					float nmag(mag), nfreq(0.25*freq);
-					float const lacunarity(1.92), gain(0.5);
-
-					for (int n = 0; n < max(1, ((int)MAX_FREQ_BINS - mesh_freq_filter)); ++n) {
-						glm::vec3 const nv(nfreq*v + glm::vec3(rx, ry, rx-ry));
-						val   += nmag*((gen_mode == MGEN_PERLIN) ? glm::perlin(nv) : glm::simplex(nv));
-						nmag  *= gain;
-						nfreq *= lacunarity;
-					}
 				}
+#endif
 				val += z*zscale;
 				if (normalize_to_1) {val = CLIP_TO_pm1(val);}
 				set(x, y, z, val); // scale value?
@@ -473,7 +602,7 @@ void voxel_manager::atten_to_sphere(float val, float inner_radius, bool atten_in
 				else if (atten_inner) {
 					adj = (radius - inner_radius)/inner_radius;
 				}
-				get_ref(x, y, z) += val*adj;
+				if (adj != 0.0) {get_ref(x, y, z) += val*adj;}
 			}
 		}
 	}
@@ -504,11 +633,10 @@ unsigned voxel_manager::add_triangles_for_voxel(tri_data_t::value_type &tri_vert
 
 	for (unsigned yhi = 0; yhi < 2; ++yhi) {
 		for (unsigned xhi = 0; xhi < 2; ++xhi) {
-			unsigned const ix(get_ix(xv[xhi], yv[yhi], z));
-			if (all_under_mesh) {all_under_mesh = ((outside[ix] & UNDER_MESH_BIT) != 0);}
+			if (all_under_mesh) {all_under_mesh = ((outside.get(xv[xhi], yv[yhi], z) & UNDER_MESH_BIT) != 0);}
 			
 			for (unsigned zhi = 0; zhi < 2; ++zhi) {
-				if (outside[ix + zv[zhi]-z] & 7) {cix |= 1 << ((xhi^yhi) + 2*yhi + 4*zhi);} // outside or on edge
+				if (outside.get(xv[xhi], yv[yhi], zv[zhi]) & 7) {cix |= 1 << ((xhi^yhi) + 2*yhi + 4*zhi);} // outside or on edge
 			}
 		}
 	}
@@ -534,9 +662,8 @@ unsigned voxel_manager::add_triangles_for_voxel(tri_data_t::value_type &tri_vert
 
 		for (unsigned d = 0; d < 2; ++d) {
 			unsigned const yhi((eix[d] & 2) >> 1), xhi(yhi ^ (eix[d] & 1)), zhi(eix[d] >> 2);
-			unsigned const ix(get_ix(xv[xhi], yv[yhi], zv[zhi]));
 			xhv &= xhi; yhv &= yhi; zhv &= zhi;
-			vals[d] = ((outside[ix] & 7) == ON_EDGE_BIT) ? params.isolevel : operator[](ix);
+			vals[d] = ((outside.get(xv[xhi], yv[yhi], zv[zhi]) & 7) == ON_EDGE_BIT) ? params.isolevel : get(xv[xhi], yv[yhi], zv[zhi]);
 			pts[d].assign(cube.d[0][xhi], cube.d[1][yhi], cube.d[2][zhi]);
 		}
 		vlist[i] = interpolate_pt(params.isolevel, pts[0], pts[1], vals[0], vals[1]);
@@ -583,6 +710,7 @@ void voxel_manager::determine_voxels_outside() { // determine inside/outside poi
 
 	assert(!empty());
 	assert(vsz.x > 0.0 && vsz.y > 0.0 && vsz.z > 0.0);
+	outside.set_sparse(is_sparse());
 	outside.init(nx, ny, nz, vsz, center, 0, params.num_blocks);
 	bool const sphere_mode(params.atten_sphere_mode());
 
@@ -596,6 +724,7 @@ void voxel_manager::determine_voxels_outside() { // determine inside/outside poi
 			for (unsigned z = 0; z < nz; ++z) {calc_outside_val(x, y, z, (z < zix));}
 		}
 	}
+	outside.compress();
 }
 
 
@@ -702,7 +831,7 @@ void voxel_model::remove_unconnected_outside_modified_blocks(bool postproc_brush
 
 		for (vector<pt_ix_t>::const_iterator i = updated_pts.begin(); i != updated_pts.end(); ++i) {
 			unsigned ix(i->ix);
-			float const val(operator[](ix));
+			float const val(get(ix));
 			make_voxel_outside(ix);
 			assert(ix > 0); --ix; // move down one z step
 			operator[](ix) = val;
@@ -726,11 +855,11 @@ void voxel_model::remove_unconnected_outside_modified_blocks(bool postproc_brush
 #define FLOOD_FILL_INNER(pos, min_range, max_range, step) \
 	if (pos >= min_range + 1) { \
 		unsigned const ix(cur - step); \
-		if (outside[ix] == fill_val) {work.push_back(ix); outside[ix] |= bit_mask;} \
+		if (outside.get(ix) == fill_val) {work.push_back(ix); outside[ix] |= bit_mask;} \
 	} \
 	if (pos + 1 < max_range) { \
 		unsigned const ix(cur + step); \
-		if (outside[ix] == fill_val) {work.push_back(ix); outside[ix] |= bit_mask;} \
+		if (outside.get(ix) == fill_val) {work.push_back(ix); outside[ix] |= bit_mask;} \
 	}
 
 void voxel_manager::flood_fill_range(unsigned x1, unsigned y1, unsigned x2, unsigned y2, vector<unsigned> &work, unsigned char fill_val, unsigned char bit_mask) {
@@ -741,7 +870,7 @@ void voxel_manager::flood_fill_range(unsigned x1, unsigned y1, unsigned x2, unsi
 		unsigned const cur(work.back());
 		work.pop_back();
 		assert(cur < outside.size());
-		assert(outside[cur] & bit_mask);
+		assert(outside.get(cur) & bit_mask);
 		assert(nxnz > 0 && nz > 0);
 		unsigned const y(cur/nxnz), cur_xz(cur - y*nxnz), x(cur_xz/nz), z(cur_xz - x*nz);
 		FLOOD_FILL_INNER(x, x1, x2, nz);
@@ -766,7 +895,7 @@ void voxel_manager::remove_unconnected_outside_range(bool keep_at_edge, unsigned
 
 		if (x >= x1 && x <= x2 && y >= y1 && y <= y2) {
 			unsigned const ix(outside.get_ix(x, y, nz/2));
-			assert(outside[ix] != UNDER_MESH_BIT); // outside or above mesh
+			assert(outside.get(ix) != UNDER_MESH_BIT); // outside or above mesh
 			work.push_back(ix); // inside, anchored to the mesh
 			outside[ix] |= ANCHORED_BIT; // mark as anchored
 		}
@@ -777,7 +906,7 @@ void voxel_manager::remove_unconnected_outside_range(bool keep_at_edge, unsigned
 				unsigned ix(outside.get_ix(x, y, 0));
 
 				for (unsigned z = 0; z < nz; ++z, ++ix) {
-					if (outside[ix] != UNDER_MESH_BIT) continue; // outside or above mesh
+					if (outside.get(ix) != UNDER_MESH_BIT) continue; // outside or above mesh
 					work.push_back(ix); // inside, anchored to the mesh
 					outside[ix] |= ANCHORED_BIT; // mark as anchored
 				}
@@ -793,7 +922,7 @@ void voxel_manager::remove_unconnected_outside_range(bool keep_at_edge, unsigned
 
 				for (unsigned z = 0; z < nz; ++z) {
 					unsigned const ix(outside.get_ix(x, y, z));
-					if (outside[ix] == 1) continue; // outside
+					if (outside.get(ix) == 1) continue; // outside
 					work.push_back(ix); // inside, anchored to the mesh
 					outside[ix] |= ANCHORED_BIT; // mark as anchored
 				}
@@ -809,11 +938,12 @@ void voxel_manager::remove_unconnected_outside_range(bool keep_at_edge, unsigned
 
 			for (unsigned z = 0; z < nz; ++z) {
 				unsigned const ix(outside.get_ix(x, y, z));
+				unsigned char const oval(outside.get(ix));
 
-				if (outside[ix] > 1) { // anchored, on edge, or under mesh
-					outside[ix] &= ~ANCHORED_BIT; // remove anchored bit
+				if (oval > 1) { // anchored, on edge, or under mesh
+					outside.set(ix, (oval & ~ANCHORED_BIT)); // remove anchored bit
 				}
-				else if (outside[ix] != 1) { // inside and non-anchored
+				else if (oval != 1) { // inside and non-anchored
 					if (updated_pts) {updated_pts->push_back(pt_ix_t(get_pt_at(x, y, z), ix));}
 					if (!mark_only ) {make_voxel_outside(ix);}
 					had_update = 1;
@@ -822,6 +952,8 @@ void voxel_manager::remove_unconnected_outside_range(bool keep_at_edge, unsigned
 			if (had_update && xy_updated) {xy_updated->push_back(y*nx + x);}
 		}
 	}
+	outside.compress_range(x1, y1, x2, y2); // anchored bits have been removed, so filled bricks are uniform again
+	if (!mark_only) {compress_range(x1, y1, x2, y2);}
 }
 
 
@@ -834,7 +966,7 @@ void voxel_manager::remove_interior_holes() {
 		for (unsigned x = 0; x < nx; ++x) {
 			unsigned const ix(outside.get_ix(x, y, nz-1));
 
-			if (outside[ix]) {
+			if (outside.get(ix)) {
 				work.push_back(ix);
 				outside[ix] |= ANCHORED_BIT; // mark as anchored
 			}
@@ -845,31 +977,36 @@ void voxel_manager::remove_interior_holes() {
 
 	// if inside but not anchored mark as outside
 	for (unsigned ix = 0; ix < size(); ++ix) {
-		if (outside[ix] & ANCHORED_BIT) { // anchored
-			outside[ix] &= ~ANCHORED_BIT; // remove anchored bit
+		unsigned char const oval(outside.get(ix));
+
+		if (oval & ANCHORED_BIT) { // anchored
+			outside.set(ix, (oval & ~ANCHORED_BIT)); // remove anchored bit
 		}
-		else if (outside[ix] == 1) { // outside, not on edge or under mesh, and non-anchored
+		else if (oval == 1) { // outside, not on edge or under mesh, and non-anchored
 			make_voxel_inside(ix);
 		}
 	}
+	outside.compress();
+	compress();
 }
 
 
 void voxel_manager::make_voxel_outside(unsigned ix) {
-	outside[ix] = 1; // make outside
-	operator[](ix) = params.isolevel - (params.invert ? -TOLERANCE : TOLERANCE); // change voxel value to be outside
+	outside.set(ix, 1); // make outside
+	set(ix, (params.isolevel - (params.invert ? -TOLERANCE : TOLERANCE))); // change voxel value to be outside
 }
 void voxel_manager::make_voxel_inside(unsigned ix) {
-	outside[ix] = 0; // make inside
-	operator[](ix) = params.isolevel + (params.invert ? -TOLERANCE : TOLERANCE); // change voxel value to be inside
+	outside.set(ix, 0); // make inside
+	set(ix, (params.isolevel + (params.invert ? -TOLERANCE : TOLERANCE))); // change voxel value to be inside
 }
 
 
 bool voxel_manager::point_inside_volume(point const &pos) const {
 
 	if (outside.empty()) return 0;
-	unsigned ix(0);
-	return (outside.get_ix(pos, ix) && !is_outside(ix));
+	int i[3]; // x,y,z
+	outside.get_xyz(pos, i);
+	return (outside.is_valid_range(i) && (outside.get(i[0], i[1], i[2]) & 3) == 0); // same as !is_outside(), without the index decode for sparse grids
 }
 
 
@@ -1001,7 +1138,7 @@ unsigned voxel_model::get_block_ix(unsigned voxel_ix) const {
 }
 
 
-voxel_model::voxel_model(noise_texture_manager_t *ntg, bool use_mesh_, unsigned num_lod_levels) : voxel_manager(use_mesh_), volume_added(0), noise_tex_gen(ntg) {
+voxel_model::voxel_model(noise_texture_manager_t *ntg, bool use_mesh_, unsigned num_lod_levels) : voxel_manager(use_mesh_), volume_added(0), noise_tex_gen(ntg), last_render_lod(0) {
 
 	assert(num_lod_levels > 0);
 	tri_data.resize(num_lod_levels);
@@ -1026,6 +1163,8 @@ void voxel_model::clear() {
 	}
 	modified_blocks.clear();
 	next_frame_modified_blocks.clear();
+	remesh_queue.clear();
+	remesh_stats = voxel_remesh_stats_t();
 	ao_lighting.clear();
 	voxel_manager::clear();
 	volume_added = 0;
@@ -1055,19 +1194,35 @@ bool voxel_model::clear_block(unsigned block_ix) {
 }
 
 
+bool voxel_model::clear_block_lod(unsigned block_ix, unsigned lod) {
+
+	assert(lod < tri_data.size());
+	if (tri_data[lod].empty()) return 0; // tri_data was already cleared
+	assert(block_ix < tri_data[lod].size());
+	bool const was_nonempty(!tri_data[lod][block_ix].empty());
+	tri_data[lod][block_ix].clear();
+	if (lod == 0) {clear_block_cobjs(block_ix);} // cobjs are created from LOD 0
+	return was_nonempty;
+}
+
+
 bool voxel_model_ground::clear_block(unsigned block_ix) {
 
 	bool const ret(voxel_model::clear_block(block_ix));
+	clear_block_cobjs(block_ix);
+	return ret;
+}
 
-	if (add_cobjs) {
-		assert(block_ix < data_blocks.size());
 
-		for (vector<unsigned>::const_iterator i = data_blocks[block_ix].cids.begin(); i != data_blocks[block_ix].cids.end(); ++i) {
-			remove_coll_object(*i);
-		}
-		data_blocks[block_ix].clear();
+void voxel_model_ground::clear_block_cobjs(unsigned block_ix) {
+
+	if (!add_cobjs) return;
+	assert(block_ix < data_blocks.size());
+
+	for (vector<unsigned>::const_iterator i = data_blocks[block_ix].cids.begin(); i != data_blocks[block_ix].cids.end(); ++i) {
+		remove_coll_object(*i);
 	}
-	return ret;
+	data_blocks[block_ix].clear();
 }
 
 
@@ -1086,6 +1241,8 @@ unsigned voxel_model::create_block(voxel_ix_cache &vix_cache, unsigned block_ix,
 	for (unsigned y = ybix*yblocks; y < (ybix+1)*yblocks; y += step) {
 		for (unsigned x = xbix*xblocks; x < (xbix+1)*xblocks; x += step) {
 			for (unsigned z = 0; z < nz; z += step) {
+				// cells with all corners in uniform outside bricks of the same value can't contain the surface
+				if (outside.is_sparse() && outside.is_uniform_range(x, y, z, min(x+step, nx-1), min(y+step, ny-1), min(z+step, nz-1))) continue;
 				count += add_triangles_for_voxel(tri_block, vix_cache, x, y, z, xbix*xblocks, ybix*yblocks, count_only, lod_level);
 			}
 		}
@@ -1231,8 +1388,9 @@ void voxel_model::calc_ao_lighting_for_block(unsigned block_ix, bool increase_on
 
 						for (unsigned s = 0; s < max_steps; ++s) { // take steps in this direction
 							ix += i->dist_per_step; // increment first to skip the current voxel
+							unsigned char const oval(outside.get(ix));
 						
-							if (outside[ix] == 0 || (outside[ix] & end_ray_flags)) {
+							if (oval == 0 || (oval & end_ray_flags)) {
 								cur_val = s*i->nsteps_inv; // Note: ambient obscurance - uses actual distance to occluder
 								break; // voxel known to be inside the volume or under the mesh
 							}
@@ -1254,6 +1412,7 @@ void voxel_model::calc_ao_lighting_for_block(unsigned block_ix, bool increase_on
 			} // for z
 		} // for x
 	} // for y
+	ao_lighting.compress_range(xbix*xblocks, ybix*yblocks, x_end, y_end);
 }
 
 
@@ -1268,6 +1427,7 @@ void voxel_model::calc_ao_lighting() {
 
 	if (empty() || scrolling) return; // too slow for scrolling
 	if (params.ao_radius == 0.0 || params.ao_weight_scale == 0.0) return; // no AO lighting
+	ao_lighting.set_sparse(is_sparse());
 	ao_lighting.init(nx, ny, nz, vsz, center, 255, params.num_blocks);
 	calc_ao_dirs();
 
@@ -1305,11 +1465,11 @@ bool voxel_model::update_voxel_sphere_region(point const &center, float radius,
 				float const dist(max(0.0f, (p2p_dist(center, pos) - dist_adjust)));
 				if (spherical && dist >= radius) continue; // too far
 				// update voxel values, linear falloff with distance from center (ending at 0.0 at radius)
-				float &val(get_ref(x, y, z));
-				float const prev_val(val);
-				val += val_at_center*pow(min(1.0f, (1.0f - dist/radius)), (float)falloff_exp);
+				float const prev_val(get(x, y, z));
+				float val(prev_val + val_at_center*pow(min(1.0f, (1.0f - dist/radius)), (float)falloff_exp));
 				if (params.normalize_to_1) val = CLIP_TO_pm1(val);
-				if (val == prev_val) continue; // no change
+				if (val == prev_val) continue; // no change; this avoids allocating saturated sparse bricks
+				set(x, y, z, val);
 				calc_outside_val(x, y, z, ((outside.get(x, y, z) & UNDER_MESH_BIT) != 0));
 				was_updated = 1;
 				(val_is_outside(val,      params) ? saw_outside : saw_inside) = 1;
@@ -1330,6 +1490,8 @@ bool voxel_model::update_voxel_sphere_region(point const &center, float radius,
 			}
 		}
 	}
+	compress_range(bounds[0][0], bounds[1][0], bounds[0][1]+1, bounds[1][1]+1); // the brush may have filled or cleared entire bricks
+	outside.compress_range(bounds[0][0], bounds[1][0], bounds[0][1]+1, bounds[1][1]+1);
 	if (!saw_inside || !saw_outside) return 0; // nothing else to do
 	std::copy(blocks_to_update.begin(), blocks_to_update.end(), inserter(modified_blocks, modified_blocks.begin()));
 
@@ -1368,61 +1530,160 @@ unsigned voxel_model::get_texture_at(point const &pos) const {
 }
 
 
-void voxel_model::proc_pending_updates(bool postproc_brushes_mode) {
-
-	if (modified_blocks.empty()) return;
-	//RESET_TIME;
+void voxel_model::proc_pending_updates(bool postproc_brushes_mode, point const *priority_pos) {
 
-	if (params.remove_unconnected >= 2) {
-		if (postproc_brushes_mode) { // iterate until all blocks stop falling
-			std::set<unsigned> orig_modified_blocks(modified_blocks);
+	if (!modified_blocks.empty()) {
+		if (params.remove_unconnected >= 2) {
+			if (postproc_brushes_mode) { // iterate until all blocks stop falling
+				std::set<unsigned> orig_modified_blocks(modified_blocks);
 
-			while (!modified_blocks.empty()) { // modified_blocks should decrease in size during iteration
-				remove_unconnected_outside_modified_blocks(1);
-				modified_blocks = next_frame_modified_blocks;
-				next_frame_modified_blocks.clear();
+				while (!modified_blocks.empty()) { // modified_blocks should decrease in size during iteration
+					remove_unconnected_outside_modified_blocks(1);
+					modified_blocks = next_frame_modified_blocks;
+					next_frame_modified_blocks.clear();
+				}
+				modified_blocks.swap(orig_modified_blocks); // restore so we can update all the original blocks that were modified
+			}
+			else { // only call once (fall one step)
+				remove_unconnected_outside_modified_blocks(0);
 			}
-			modified_blocks.swap(orig_modified_blocks); // restore so we can update all the original blocks that were modified
-			//PRINT_TIME("  Process Brush Updates");
 		}
-		else { // only call once (fall one step)
-			remove_unconnected_outside_modified_blocks(0);
+		queue_modified_blocks();
+		modified_blocks = next_frame_modified_blocks;
+		next_frame_modified_blocks.clear();
+		volume_added = 0;
+	}
+	proc_remesh_queue(postproc_brushes_mode, priority_pos); // brushes applied at load time are processed all at once
+}
+
+
+double get_remesh_time_ms() { // thread safe, unlike GET_TIME_MS()
+	return 1000.0*std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void voxel_model::queue_modified_blocks() {
+
+	double const cur_time(get_remesh_time_ms());
+	unsigned const all_lods((1U << tri_data.size()) - 1);
+
+	for (auto i = modified_blocks.begin(); i != modified_blocks.end(); ++i) {
+		auto it(remesh_queue.find(*i));
+
+		if (it == remesh_queue.end()) {
+			remesh_queue[*i] = remesh_entry_t(all_lods, volume_added, cur_time);
+			++remesh_stats.num_queued;
+		}
+		else { // already queued; rebuild all LODs again, but keep the original time for latency
+			it->second.lod_mask      = all_lods;
+			it->second.volume_added |= volume_added;
+			++remesh_stats.num_merged;
 		}
 	}
-	bool something_removed(0);
-	vector<unsigned> blocks_to_update(modified_blocks.begin(), modified_blocks.end());
-	
-	// FIXME: can we only remove/add voxels within the modified region of each block?
-	//        or, create the block first and only remove triangles that don't exist in the new block + add triangles that don't exist in the old block?
-	for (unsigned i = 0; i < blocks_to_update.size(); ++i) {
-		something_removed |= clear_block(blocks_to_update[i]);
+}
+
+
+struct remesh_work_t {
+	unsigned lod_dist, block_ix, lod;
+	float dist;
+	remesh_work_t(unsigned lod_dist_, float dist_, unsigned block_ix_, unsigned lod_) : lod_dist(lod_dist_), block_ix(block_ix_), lod(lod_), dist(dist_) {}
+	bool operator<(remesh_work_t const &w) const {return ((lod_dist == w.lod_dist) ? (dist < w.dist) : (lod_dist < w.lod_dist));}
+};
+
+// rebuilds queued {block, LOD} pairs starting with the LOD that was last drawn, near to far, until the time budget is used up
+void voxel_model::proc_remesh_queue(bool no_time_limit, point const *priority_pos) {
+
+	if (remesh_queue.empty()) return;
+	double const start_time(get_remesh_time_ms());
+	float const budget(no_time_limit ? 0.0 : params.remesh_budget_ms);
+	unsigned const cur_lod(min(last_render_lod, unsigned(tri_data.size()-1)));
+	vector<remesh_work_t> work;
+	remesh_stats.max_queue_depth = max(remesh_stats.max_queue_depth, (unsigned)remesh_queue.size());
+
+	for (auto i = remesh_queue.begin(); i != remesh_queue.end(); ++i) {
+		unsigned const xbix(i->first%params.num_blocks), ybix(i->first/params.num_blocks);
+		point const block_center(point((xbix+0.5)*xblocks, (ybix+0.5)*yblocks, nz/2)*vsz + lo_pos);
+		float const dist(priority_pos ? p2p_dist(*priority_pos, block_center) : 0.0);
+
+		for (unsigned lod = 0; lod < tri_data.size(); ++lod) {
+			if (i->second.lod_mask & (1U << lod)) {work.emplace_back(abs((int)lod - (int)cur_lod), dist, i->first, lod);}
+		}
 	}
-	if (something_removed) {purge_coll_freed(0);} // unecessary?
-	vector<unsigned> num_added(blocks_to_update.size(), 0);
+	sort(work.begin(), work.end());
+	unsigned const batch_sz(max(1U, NUM_THREADS));
+	std::set<unsigned> updated_blocks, lod0_blocks, ao_increase_only;
+	bool something_removed(0);
 	unsigned tot_num_added(0);
-
-	#pragma omp parallel for schedule(dynamic,1)
-	for (int i = 0; i < (int)blocks_to_update.size(); ++i) {
-		num_added[i] = (create_block_all_lods(blocks_to_update[i], 0, 0) > 0);
+	vector<unsigned> num_added;
+	vector<double> remesh_times;
+
+	for (unsigned w = 0; w < work.size();) { // process in batches of one block per thread
+		unsigned const batch_end(min((unsigned)work.size(), (w + batch_sz))), num(batch_end - w);
+		bool removed(0);
+		for (unsigned i = w; i < batch_end; ++i) {removed |= clear_block_lod(work[i].block_ix, work[i].lod);} // serial, since this may remove cobjs
+		if (removed) {purge_coll_freed(0);} // unecessary?
+		something_removed |= removed;
+		num_added.assign(num, 0);
+		remesh_times.assign(num, 0.0);
+
+		#pragma omp parallel for schedule(dynamic,1)
+		for (int i = 0; i < (int)num; ++i) {
+			double const block_start_time(get_remesh_time_ms());
+			voxel_ix_cache vix_cache;
+			num_added   [i] = (create_block(vix_cache, work[w+i].block_ix, 0, 0, work[w+i].lod) > 0);
+			remesh_times[i] = get_remesh_time_ms() - block_start_time;
+		}
+		double const cur_time(get_remesh_time_ms());
+
+		for (unsigned i = 0; i < num; ++i) {
+			remesh_work_t const &wi(work[w+i]);
+			auto it(remesh_queue.find(wi.block_ix));
+			assert(it != remesh_queue.end());
+			updated_blocks.insert(wi.block_ix);
+
+			if (wi.lod == 0) {
+				tot_num_added += num_added[i];
+				lod0_blocks.insert(wi.block_ix);
+				if (!it->second.volume_added) {ao_increase_only.insert(wi.block_ix);}
+			}
+			remesh_stats.tot_remesh_time += remesh_times[i];
+			remesh_stats.max_remesh_time  = max(remesh_stats.max_remesh_time, remesh_times[i]);
+			++remesh_stats.num_remeshed;
+			it->second.lod_mask &= ~(1U << wi.lod);
+			if (it->second.lod_mask != 0) continue; // more LODs to build
+			double const latency(cur_time - it->second.queue_time);
+			remesh_stats.tot_latency += latency;
+			remesh_stats.max_latency  = max(remesh_stats.max_latency, latency);
+			remesh_queue.erase(it);
+		}
+		w = batch_end;
+		if (budget > 0.0 && (cur_time - start_time) > budget) break; // out of time, continue next frame
 	}
-	for (auto i = num_added.begin(); i != num_added.end(); ++i) {tot_num_added += *i;}
+	++remesh_stats.num_frames;
 
 	// Note: this part only needs to be done once per block at the end of the while loop, but in practice is fast anyway
 	if (tot_num_added > 0 || something_removed) { // something was added or removed
 		if (!boundary_vnmap[0].empty()) { // fix block boundary vertex normals
-			for (unsigned i = 0; i < blocks_to_update.size(); ++i) {
-				update_boundary_normals_for_block(blocks_to_update[i], 0);
-			}
+			for (auto i = updated_blocks.begin(); i != updated_blocks.end(); ++i) {update_boundary_normals_for_block(*i, 0);}
 		}
-		for (unsigned i = 0; i < blocks_to_update.size(); ++i) { // blocks will be sorted by y then x
-			calc_ao_lighting_for_block(blocks_to_update[i], !volume_added); // update can only remove, so lighting can only increase
+		vector<unsigned> const blocks_to_update(lod0_blocks.begin(), lod0_blocks.end()); // sorted by y then x
+
+		for (unsigned i = 0; i < blocks_to_update.size(); ++i) { // update can only remove, so lighting can only increase
+			calc_ao_lighting_for_block(blocks_to_update[i], (ao_increase_only.find(blocks_to_update[i]) != ao_increase_only.end()));
 		}
-		update_blocks_hook(blocks_to_update, tot_num_added);
-		//PRINT_TIME(postproc_brushes_mode ? "  Process Voxel Updates" : "Process Voxel Updates");
+		if (!blocks_to_update.empty()) {update_blocks_hook(blocks_to_update, tot_num_added);}
+	}
+	if (remesh_queue.empty()) { // done with this set of edits
+		if (remesh_stats.num_frames > 1) {remesh_stats.print();} // only print if the work was spread across frames
+		remesh_stats = voxel_remesh_stats_t();
 	}
-	modified_blocks = next_frame_modified_blocks;
-	next_frame_modified_blocks.clear();
-	volume_added = 0;
+}
+
+
+void voxel_remesh_stats_t::print() const {
+	cout << "Voxel remesh: queued " << num_queued << " blocks, merged " << num_merged << ", remeshed " << num_remeshed << " block LODs over " << num_frames
+		 << " frames, max queue depth " << max_queue_depth << ", latency avg " << get_avg_latency() << "ms max " << max_latency
+		 << "ms, time per block avg " << get_avg_remesh_time() << "ms max " << max_remesh_time << "ms" << endl;
 }
 
 
@@ -1528,6 +1789,7 @@ void voxel_model::build(bool verbose, bool do_ao_lighting) {
 	case 5: atten_to_sphere  (atten_thresh, params.radius_val, 1, 1); break;
 	default: assert(0);
 	}
+	compress(); // recompress any sparse bricks that are still uniform
 	if (verbose) {PRINT_TIME("  Atten at Top/Edges");}
 	determine_voxels_outside();
 	if (verbose) {PRINT_TIME("  Determine Voxels Outside");}
@@ -1562,6 +1824,11 @@ void voxel_model::build(bool verbose, bool do_ao_lighting) {
 		calc_ao_lighting();
 		if (verbose) {PRINT_TIME("  Voxel AO Lighting");}
 	}
+	if (verbose) {
+		float_voxel_grid::print_mem_stats("  Voxel values");
+		outside.print_mem_stats("  Voxel outside");
+		if (!ao_lighting.empty()) {ao_lighting.print_mem_stats("  Voxel AO lighting");}
+	}
 }
 
 
@@ -1674,7 +1941,10 @@ void voxel_model_space::setup_tex_gen_for_rendering(shader_t &s) {
 	voxel_model::setup_tex_gen_for_rendering(s);
 	
 	if (!ao_lighting.empty()) {
-		if (ao_tid == 0) {ao_tid = create_3d_texture(nx, ny, nz, 1, ao_lighting, GL_LINEAR, GL_CLAMP_TO_EDGE);}
+		if (ao_tid == 0) {
+			vector<unsigned char> temp;
+			ao_tid = create_3d_texture(nx, ny, nz, 1, ao_lighting.get_dense_vals(temp), GL_LINEAR, GL_CLAMP_TO_EDGE);
+		}
 		set_3d_texture_as_current(ao_tid, 9);
 	}
 	if (shadow_tid == 0) {
@@ -1690,6 +1960,7 @@ void voxel_model_space::setup_tex_gen_for_rendering(shader_t &s) {
 void voxel_model::core_render(shader_t &s, unsigned lod_level, bool is_shadow_pass, bool no_vfc) {
 
 	assert(lod_level < tri_data.size() && lod_level < pt_to_ix.size());
+	last_render_lod = lod_level; // remesh this LOD first after edits
 
 	for (vector<pt_ix_t>::const_iterator i = pt_to_ix[lod_level].begin(); i != pt_to_ix[lod_level].end(); ++i) {
 		if (DEBUG_BLOCKS) {
@@ -1937,6 +2208,8 @@ float gen_voxel_rock(voxel_model &model, point const &center, float radius, unsi
 	params.num_blocks     = num_blocks; // in each of x and y - subdivision not needed? it produces seams
 	params.ao_atten_power = 1.5; // user-specified? seems like a good value for asteroids
 	params.ao_radius      = 1.0*radius;
+	params.sparse_storage = global_voxel_params.sparse_storage;
+	params.remesh_budget_ms = global_voxel_params.remesh_budget_ms;
 
 	while (1) { // loop until we get a valid asteroid
 		rseed = 27751*rseed + 123; // make unique for each iteration
@@ -1983,6 +2256,12 @@ bool parse_voxel_option(FILE *fp) {
 	else if (str == "normalize_to_1") {
 		if (!read_bool(fp, global_voxel_params.normalize_to_1)) voxel_file_err("normalize_to_1", error);
 	}
+	else if (str == "remesh_budget_ms") {
+		if (!read_float(fp, global_voxel_params.remesh_budget_ms) || global_voxel_params.remesh_budget_ms < 0.0) voxel_file_err("remesh_budget_ms", error);
+	}
+	else if (str == "sparse_storage") {
+		if (!read_bool(fp, global_voxel_params.sparse_storage)) voxel_file_err("sparse_storage", error);
+	}
 	else if (str == "mag") {
 		if (!read_float(fp, global_voxel_params.mag)) voxel_file_err("mag", error);
 	}
@@ -2123,7 +2402,8 @@ bool update_voxel_sphere_region(point const &center, float radius, float val_at_
 }
 
 void proc_voxel_updates() {
-	terrain_voxel_model.proc_pending_updates();
+	point const camera(get_camera_pos());
+	terrain_voxel_model.proc_pending_updates(0, &camera); // remesh blocks near the camera first
 }
 
 bool check_voxel_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj, bool exact) {
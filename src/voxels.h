@@ -5,6 +5,7 @@
 
 #include "3DWorld.h"
 #include "model3d.h"
+#include <atomic>
 
 struct coll_tquad;
 
@@ -18,6 +19,8 @@ struct voxel_params_t {
 	float isolevel, elasticity, mag, freq, atten_thresh, tex_scale, noise_scale, noise_freq, tex_mix_saturate, z_gradient, height_eval_freq, radius_val;
 	float ao_radius, ao_weight_scale, ao_atten_power, spec_mag, spec_exp;
 	bool make_closed_surface, invert, remove_under_mesh, add_cobjs, normalize_to_1, top_tex_used, detail_normal_map;
+	float remesh_budget_ms; // time per frame for rebuilding edited blocks; 0 = no limit
+	bool sparse_storage; // store voxel grids as 8^3 bricks with uniform-value tiles rather than dense arrays
 	unsigned remove_unconnected; // 0=never, 1=init only, 2=always, 3=always, including interior holes
 	unsigned atten_at_edges; // 0=no atten, 1=top only, 2=all 5 edges (excludes the bottom), 3=sphere (outer), 4=sphere (inner and outer), 5=sphere (inner and outer, excludes the bottom)
 	unsigned keep_at_scene_edge; // 0=don't keep, 1=always keep, 2=only when scrolling
@@ -33,7 +36,7 @@ struct voxel_params_t {
 
 	voxel_params_t() : xsize(0), ysize(0), zsize(0), num_blocks(12), isolevel(0.0), elasticity(0.5), mag(1.0), freq(1.0), atten_thresh(1.0), tex_scale(1.0), noise_scale(0.1),
 		noise_freq(1.0), tex_mix_saturate(5.0), z_gradient(0.0), height_eval_freq(1.0), radius_val(0.5), ao_radius(1.0), ao_weight_scale(2.0), ao_atten_power(1.0),
-		spec_mag(0.0), spec_exp(1.0), make_closed_surface(1), invert(0), remove_under_mesh(0), add_cobjs(1), normalize_to_1(1), top_tex_used(0), detail_normal_map(1),
+		spec_mag(0.0), spec_exp(1.0), make_closed_surface(1), invert(0), remove_under_mesh(0), add_cobjs(1), normalize_to_1(1), top_tex_used(0), detail_normal_map(1), remesh_budget_ms(4.0), sparse_storage(0),
 		remove_unconnected(1), atten_at_edges(0), keep_at_scene_edge(0), atten_top_mode(0), enable_falling(1), geom_rseed(123), texture_rseed(321), base_color(WHITE)
 	{
 			tids[0] = tids[1] = tids[2] = 0; colors[0] = colors[1] = WHITE;
@@ -113,25 +116,159 @@ public:
 };
 
 
-// stored internally in yxz order
+unsigned const VOXEL_BRICK_BITS   = 3; // 8x8x8 voxels per brick
+unsigned const VOXEL_BRICK_SZ     = (1 << VOXEL_BRICK_BITS);
+unsigned const VOXEL_BRICK_MASK   = (VOXEL_BRICK_SZ - 1);
+unsigned const VOXEL_BRICK_VOXELS = (VOXEL_BRICK_SZ*VOXEL_BRICK_SZ*VOXEL_BRICK_SZ);
+
+inline unsigned get_num_voxel_bricks(unsigned num_voxels) {return ((num_voxels + VOXEL_BRICK_MASK) >> VOXEL_BRICK_BITS);} // ceil
+
+
+// sparse voxel storage: bricks in yxz order, each of which is either a single uniform value or an allocated tile of voxels;
+// tiles are allocated on the first write of a non-uniform value, which is thread safe, while compress() must not run concurrently with writes
+template<typename V> class voxel_brick_map_t {
+
+	struct brick_t {
+		std::atomic<V*> data; // nullptr for uniform bricks
+		V val; // value of every voxel in a uniform brick
+
+		brick_t(V const &val_=V()) : data(nullptr), val(val_) {}
+		brick_t(brick_t const &b) : data(nullptr), val(b.val) {copy_data(b);}
+		~brick_t() {free_data();}
+		brick_t &operator=(brick_t const &b) {if (&b != this) {free_data(); val = b.val; copy_data(b);} return *this;}
+		void free_data() {delete [] data.exchange(nullptr);}
+
+		void copy_data(brick_t const &b) {
+			V const *const d(b.data.load());
+			if (d == nullptr) return;
+			V *const d2(new V[VOXEL_BRICK_VOXELS]);
+			std::copy(d, d+VOXEL_BRICK_VOXELS, d2);
+			data = d2;
+		}
+	};
+	unsigned nx, ny, nz, nbx, nby, nbz;
+	vector<brick_t> bricks;
+
+	static unsigned get_local_ix(unsigned x, unsigned y, unsigned z) {
+		return ((z & VOXEL_BRICK_MASK) + (((x & VOXEL_BRICK_MASK) + ((y & VOXEL_BRICK_MASK) << VOXEL_BRICK_BITS)) << VOXEL_BRICK_BITS));
+	}
+public:
+	voxel_brick_map_t() : nx(0), ny(0), nz(0), nbx(0), nby(0), nbz(0) {}
+	bool empty() const {return bricks.empty();}
+	size_t get_num_voxels() const {return size_t(nx)*ny*nz;}
+	unsigned get_num_bricks() const {return bricks.size();}
+	void clear() {bricks.clear(); nx = ny = nz = nbx = nby = nbz = 0;}
+
+	void init(unsigned nx_, unsigned ny_, unsigned nz_, V const &default_val) {
+		nx  = nx_; ny = ny_; nz = nz_;
+		nbx = get_num_voxel_bricks(nx);
+		nby = get_num_voxel_bricks(ny);
+		nbz = get_num_voxel_bricks(nz);
+		bricks.clear();
+		bricks.resize(nbx*nby*nbz, brick_t(default_val));
+	}
+	unsigned get_brick_ix(unsigned x, unsigned y, unsigned z) const {
+		return ((z >> VOXEL_BRICK_BITS) + ((x >> VOXEL_BRICK_BITS) + (y >> VOXEL_BRICK_BITS)*nbx)*nbz);
+	}
+	V const &get(unsigned x, unsigned y, unsigned z) const {
+		brick_t const &b(bricks[get_brick_ix(x, y, z)]);
+		V const *const d(b.data.load(std::memory_order_acquire));
+		return (d ? d[get_local_ix(x, y, z)] : b.val);
+	}
+	V &get_ref(unsigned x, unsigned y, unsigned z) {return get_brick_data(get_brick_ix(x, y, z))[get_local_ix(x, y, z)];}
+
+	void set(unsigned x, unsigned y, unsigned z, V const &val) {
+		unsigned const bix(get_brick_ix(x, y, z));
+		brick_t const &b(bricks[bix]);
+		V *d(b.data.load(std::memory_order_acquire));
+
+		if (d == nullptr) {
+			if (val == b.val) return; // same as the uniform value, no need to allocate
+			d = get_brick_data(bix);
+		}
+		d[get_local_ix(x, y, z)] = val;
+	}
+	V *get_brick_data(unsigned bix) { // allocates the tile if needed
+		brick_t &b(bricks[bix]);
+		V *d(b.data.load(std::memory_order_acquire));
+		if (d != nullptr) return d;
+		V *const d2(new V[VOXEL_BRICK_VOXELS]);
+		std::fill(d2, d2+VOXEL_BRICK_VOXELS, b.val);
+		if (b.data.compare_exchange_strong(d, d2, std::memory_order_acq_rel)) return d2;
+		delete [] d2; // another thread allocated this tile first
+		return d;
+	}
+	void set_uniform(unsigned bx, unsigned by, unsigned bz, V const &val) {
+		brick_t &b(bricks[bz + (bx + by*nbx)*nbz]);
+		b.free_data();
+		b.val = val;
+	}
+	bool is_uniform(unsigned x, unsigned y, unsigned z, V &val) const { // returns the uniform value of the brick containing {x,y,z}
+		brick_t const &b(bricks[get_brick_ix(x, y, z)]);
+		if (b.data.load(std::memory_order_acquire) != nullptr) return 0;
+		val = b.val;
+		return 1;
+	}
+	bool compress_brick(unsigned bx, unsigned by, unsigned bz) { // returns true if the brick is uniform
+		brick_t &b(bricks[bz + (bx + by*nbx)*nbz]);
+		V const *const d(b.data.load(std::memory_order_acquire));
+		if (d == nullptr) return 1; // already uniform
+		// only test voxels inside the grid; voxels past the end of partial edge bricks are never written
+		unsigned const xe(min(VOXEL_BRICK_SZ, nx - (bx << VOXEL_BRICK_BITS))), ye(min(VOXEL_BRICK_SZ, ny - (by << VOXEL_BRICK_BITS)));
+		unsigned const ze(min(VOXEL_BRICK_SZ, nz - (bz << VOXEL_BRICK_BITS)));
+		V const val(d[0]);
+
+		for (unsigned y = 0; y < ye; ++y) {
+			for (unsigned x = 0; x < xe; ++x) {
+				V const *const zd(d + get_local_ix(x, y, 0));
+				for (unsigned z = 0; z < ze; ++z) {if (!(zd[z] == val)) return 0;}
+			}
+		}
+		b.free_data();
+		b.val = val;
+		return 1;
+	}
+	void compress_range(unsigned x1, unsigned y1, unsigned x2, unsigned y2) { // voxel range {x1,y1} to {x2,y2} exclusive, all z
+		if (x2 <= x1 || y2 <= y1) return;
+		unsigned const by_end(min(nby, ((y2 - 1) >> VOXEL_BRICK_BITS) + 1)), bx_end(min(nbx, ((x2 - 1) >> VOXEL_BRICK_BITS) + 1));
+
+		for (unsigned by = (y1 >> VOXEL_BRICK_BITS); by < by_end; ++by) {
+			for (unsigned bx = (x1 >> VOXEL_BRICK_BITS); bx < bx_end; ++bx) {
+				for (unsigned bz = 0; bz < nbz; ++bz) {compress_brick(bx, by, bz);}
+			}
+		}
+	}
+	unsigned get_num_allocated() const {
+		unsigned num(0);
+		for (auto i = bricks.begin(); i != bricks.end(); ++i) {num += (i->data.load() != nullptr);}
+		return num;
+	}
+	size_t get_mem_usage() const {return (bricks.capacity()*sizeof(brick_t) + size_t(get_num_allocated())*VOXEL_BRICK_VOXELS*sizeof(V));}
+};
+
+
+// stored internally in yxz order; either a dense vector or sparse bricks (begin()/end()/front()/resize() only apply to dense grids)
 template<typename V> class voxel_grid : public vector<V> {
+	bool sparse;
+	voxel_brick_map_t<V> bricks; // used in place of the vector when sparse
+
 	void init_grid(unsigned nx_, unsigned ny_, unsigned nz_, V default_val, unsigned num_blocks);
 public:
 	unsigned nx, ny, nz, xblocks, yblocks;
 	vector3d vsz; // size of a voxel in x,y,z
 	point center, lo_pos;
 
-	using vector<V>::clear;
-	using vector<V>::empty;
-	using vector<V>::size;
-	using vector<V>::at;
-	using vector<V>::operator[];
 	using vector<V>::resize;
 	using vector<V>::begin;
 	using vector<V>::end;
 	using vector<V>::front;
 
-	voxel_grid() : nx(0), ny(0), nz(0), xblocks(0), yblocks(0), vsz(zero_vector) {}
+	voxel_grid() : sparse(0), nx(0), ny(0), nz(0), xblocks(0), yblocks(0), vsz(zero_vector) {}
+	void set_sparse(bool sparse_) {if (sparse_ != sparse) {clear(); sparse = sparse_;}} // must be followed by init()
+	bool is_sparse() const {return sparse;}
+	void clear() {vector<V>::clear(); bricks.clear();}
+	bool empty() const {return (sparse ? bricks.empty() : vector<V>::empty());}
+	size_t size() const {return (sparse ? bricks.get_num_voxels() : vector<V>::size());}
 	void init(unsigned nx_, unsigned ny_, unsigned nz_, vector3d const &vsz_, point const &center_, V const &default_val, unsigned num_blocks=1);
 	void init(unsigned nx_, unsigned ny_, unsigned nz_, cube_t const &bcube, V const &default_val, unsigned num_blocks=1);
 	void init_from_heightmap(float **height, unsigned mesh_nx, unsigned mesh_ny, unsigned zsteps, float mesh_xsize, float mesh_ysize, unsigned num_blocks=1, bool invert=0);
@@ -155,11 +292,41 @@ public:
 		//assert(x < nx && y < ny && z < nz);
 		return (z + (x + y*nx)*nz);
 	}
+	void get_xyz_from_ix(unsigned ix, unsigned &x, unsigned &y, unsigned &z) const {z = ix%nz; ix /= nz; x = ix%nx; y = ix/nx;}
 	void get_bcube_ix_bounds(cube_t const &bcube, int llc[3], int urc[3]) const;
 	point get_pt_at(unsigned x, unsigned y, unsigned z) const  {return (point(x, y, z)*vsz + lo_pos);}
-	V const &get   (unsigned x, unsigned y, unsigned z) const  {return operator[](get_ix(x, y, z));}
-	V &get_ref     (unsigned x, unsigned y, unsigned z)        {return operator[](get_ix(x, y, z));}
-	void set       (unsigned x, unsigned y, unsigned z, V const &val) {operator[](get_ix(x, y, z)) = val;}
+	V const &get   (unsigned x, unsigned y, unsigned z) const  {return (sparse ? bricks.get(x, y, z) : vector<V>::operator[](get_ix(x, y, z)));}
+	V &get_ref     (unsigned x, unsigned y, unsigned z)        {return (sparse ? bricks.get_ref(x, y, z) : vector<V>::operator[](get_ix(x, y, z)));}
+	void set       (unsigned x, unsigned y, unsigned z, V const &val) {if (sparse) {bricks.set(x, y, z, val);} else {vector<V>::operator[](get_ix(x, y, z)) = val;}}
+	// index versions; get() and set() don't allocate sparse bricks unless the value changes, while operator[] on a non-const grid always does
+	V const &get(unsigned ix) const {
+		if (!sparse) return vector<V>::operator[](ix);
+		unsigned x, y, z;
+		get_xyz_from_ix(ix, x, y, z);
+		return bricks.get(x, y, z);
+	}
+	void set(unsigned ix, V const &val) {
+		if (!sparse) {vector<V>::operator[](ix) = val; return;}
+		unsigned x, y, z;
+		get_xyz_from_ix(ix, x, y, z);
+		bricks.set(x, y, z, val);
+	}
+	V const &operator[](unsigned ix) const {return get(ix);}
+
+	V &operator[](unsigned ix) {
+		if (!sparse) return vector<V>::operator[](ix);
+		unsigned x, y, z;
+		get_xyz_from_ix(ix, x, y, z);
+		return bricks.get_ref(x, y, z);
+	}
+	bool is_uniform_range(unsigned x1, unsigned y1, unsigned z1, unsigned x2, unsigned y2, unsigned z2) const; // inclusive; always false for dense grids
+	void compress_range(unsigned x1, unsigned y1, unsigned x2, unsigned y2) {if (sparse) {bricks.compress_range(x1, y1, x2, y2);}} // exclusive
+	void compress() {compress_range(0, 0, nx, ny);}
+	void set_brick_uniform(unsigned bx, unsigned by, unsigned bz, V const &val) {assert(sparse); bricks.set_uniform(bx, by, bz, val);}
+	vector<V> const &get_dense_vals(vector<V> &temp) const; // returns either this or temp
+	void set_from_dense(vector<V> const &vals);
+	size_t get_mem_usage() const {return (sparse ? bricks.get_mem_usage() : vector<V>::capacity()*sizeof(V));}
+	void print_mem_stats(char const *const name) const;
 	cube_t get_raw_bbox() const {return cube_t(lo_pos, center + (center - lo_pos));}
 	bool read(FILE *fp);
 	bool write(FILE *fp) const;
@@ -205,7 +372,7 @@ protected:
 
 public:
 	voxel_manager(bool use_mesh_=0) : use_mesh(use_mesh_) {}
-	void set_params(voxel_params_t const &p) {params = p;}
+	void set_params(voxel_params_t const &p) {params = p; set_sparse(p.sparse_storage);}
 	void clear();
 	void create_procedural(float mag, float freq, vector3d const &offset, bool normalize_to_1, int rseed1, int rseed2, int gen_mode);
 	void create_from_cobjs(coll_obj_group &cobjs, float filled_val=1.0);
@@ -241,6 +408,19 @@ public:
 };
 
 
+// counters for the incremental remesh queue, reset each time the queue drains; times are in ms
+struct voxel_remesh_stats_t {
+
+	unsigned num_queued, num_merged, num_remeshed, num_frames, max_queue_depth; // num_remeshed counts {block, LOD} pairs; queue depth is in blocks, at the start of a frame
+	double tot_latency, max_latency, tot_remesh_time, max_remesh_time; // latency is from the first edit until all LODs of the block are rebuilt
+
+	voxel_remesh_stats_t() : num_queued(0), num_merged(0), num_remeshed(0), num_frames(0), max_queue_depth(0), tot_latency(0.0), max_latency(0.0), tot_remesh_time(0.0), max_remesh_time(0.0) {}
+	float get_avg_latency    () const {return ((num_queued   > 0) ? tot_latency/num_queued       : 0.0);}
+	float get_avg_remesh_time() const {return ((num_remeshed > 0) ? tot_remesh_time/num_remeshed : 0.0);}
+	void print() const;
+};
+
+
 class voxel_model : public voxel_manager {
 
 protected:
@@ -250,6 +430,16 @@ protected:
 	std::set<unsigned> modified_blocks, next_frame_modified_blocks;
 	voxel_grid<unsigned char> ao_lighting;
 
+	struct remesh_entry_t {
+		unsigned lod_mask; // LODs that still need to be regenerated
+		bool volume_added; // used to select the AO lighting update mode
+		double queue_time; // when the block was first modified, in ms
+		remesh_entry_t(unsigned lod_mask_=0, bool volume_added_=0, double queue_time_=0.0) : lod_mask(lod_mask_), volume_added(volume_added_), queue_time(queue_time_) {}
+	};
+	std::map<unsigned, remesh_entry_t> remesh_queue; // block_ix => pending work; repeated edits to the same block are merged
+	unsigned last_render_lod;
+	voxel_remesh_stats_t remesh_stats;
+
 	struct step_dir_t {
 		unsigned nsteps;
 		float nsteps_inv;
@@ -283,6 +473,10 @@ protected:
 	void remove_unconnected_outside_modified_blocks(bool postproc_brushes_mode);
 	unsigned get_block_ix(unsigned voxel_ix) const;
 	virtual bool clear_block(unsigned block_ix);
+	bool clear_block_lod(unsigned block_ix, unsigned lod);
+	virtual void clear_block_cobjs(unsigned block_ix) {}
+	void queue_modified_blocks();
+	void proc_remesh_queue(bool no_time_limit, point const *priority_pos);
 	unsigned create_block(voxel_ix_cache &vix_cache, unsigned block_ix, bool first_create, bool count_only, unsigned lod_level);
 	unsigned create_block_all_lods(unsigned block_ix, bool first_create, bool count_only);
 	void update_boundary_normals_for_block(unsigned block_ix, bool calc_average);
@@ -304,7 +498,7 @@ public:
 	bool update_voxel_sphere_region(point const &center, float radius, float val_at_center, bool spherical, int falloff_exp,
 		point *damage_pos=NULL, int shooter=-1, unsigned num_fragments=0);
 	unsigned get_texture_at(point const &pos) const;
-	void proc_pending_updates(bool postproc_brushes_mode=0);
+	void proc_pending_updates(bool postproc_brushes_mode=0, point const *priority_pos=nullptr);
 	void build(bool verbose, bool do_ao_lighting=1);
 	virtual void setup_tex_gen_for_rendering(shader_t &s);
 	void core_render(shader_t &s, unsigned lod_level, bool is_shadow_pass, bool no_vfc=0);
@@ -318,7 +512,9 @@ public:
 	bool has_filled_at_edges() const;
 	bool from_file(string const &fn);
 	bool to_file(string const &fn) const;
-	bool has_modified_blocks() const {return !modified_blocks.empty();}
+	bool has_modified_blocks() const {return (!modified_blocks.empty() || !remesh_queue.empty());}
+	unsigned get_remesh_queue_depth() const {return remesh_queue.size();}
+	voxel_remesh_stats_t const &get_remesh_stats() const {return remesh_stats;}
 };
 
 
@@ -336,6 +532,7 @@ class voxel_model_ground : public voxel_model {
 	vector<data_block_t> data_blocks;
 
 	virtual bool clear_block(unsigned block_ix);
+	virtual void clear_block_cobjs(unsigned block_ix);
 	virtual void maybe_create_fragments(point const &center, float radius, int shooter, unsigned num_fragments, bool directly_from_update) const;
 	virtual void create_block_hook(unsigned block_ix);
 	virtual void update_blocks_hook(vector<unsigned> const &blocks_to_update, unsigned num_added);